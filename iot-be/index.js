@@ -58,11 +58,15 @@ mqttClient.on('message', (topic, message) => {
       io.emit('esp32-response', { topic, payload });
     }
   } else if (topic === 'mytopic/rfid') {
-    // NFC card detected
-    io.emit('nfc-detected', { nfcId: payload, timestamp: Date.now() });
+    // NFC cards detected; the door batches taps one per line
+    payload.split('\n').filter(Boolean).forEach((nfcId) => {
+      io.emit('nfc-detected', { nfcId, timestamp: Date.now() });
+    });
   } else if (topic === 'mytopic/pin') {
-    // PIN entered on ESP32
-    io.emit('pin-entered', { pin: payload, timestamp: Date.now() });
+    // PINs entered on ESP32, one per line
+    payload.split('\n').filter(Boolean).forEach((pin) => {
+      io.emit('pin-entered', { pin, timestamp: Date.now() });
+    });
   }
 });
 
@@ -122,6 +126,25 @@ const initDB = () => {
       )
     `);
 
+    // Delta sync: a global revision counter, bumped by triggers on every
+    // change to esp32_users, and tombstones for removed credentials
+    db.run(`
+      CREATE TABLE IF NOT EXISTS esp32_sync (
+        id INTEGER PRIMARY KEY,
+        revision INTEGER NOT NULL DEFAULT 0
+      )
+    `);
+    db.run(`INSERT OR IGNORE INTO esp32_sync (id, revision) VALUES (1, 0)`);
+
+    db.run(`
+      CREATE TABLE IF NOT EXISTS esp32_user_tombstones (
+        id INTEGER PRIMARY KEY AUTOINCREMENT,
+        pin TEXT,
+        nfc_id TEXT,
+        revision INTEGER NOT NULL
+      )
+    `);
+
     // ESP32 system status tracking
     db.run(`
       CREATE TABLE IF NOT EXISTS esp32_status (
@@ -134,6 +157,24 @@ const initDB = () => {
       )
     `);
 
+    // Access log uploaded by the ESP32 (iot-esp/src/audit_log_format.h);
+    // a batch sent again after a lost acknowledgement changes nothing
+    db.run(`
+      CREATE TABLE IF NOT EXISTS esp32_audit (
+        log_id INTEGER NOT NULL,
+        seq INTEGER NOT NULL,
+        time INTEGER,
+        boot INTEGER,
+        user_id INTEGER,
+        method TEXT,
+        granted INTEGER,
+        source TEXT,
+        latency_ms INTEGER,
+        received_at INTEGER,
+        PRIMARY KEY (log_id, seq)
+      )
+    `);
+
     // Admin users table
     db.run(`
       CREATE TABLE IF NOT EXISTS admin_users (
@@ -306,10 +347,59 @@ const initDB = () => {
           else console.log('✅ username column added successfully');
         });
       }
+
+      // Check and add revision column (delta sync); the triggers need it
+      if (!columnNames.includes('revision')) {
+        console.log('Adding revision column to esp32_users...');
+        db.run(`ALTER TABLE esp32_users ADD COLUMN revision INTEGER DEFAULT 0`, (err) => {
+          if (err) console.error('Error adding revision column:', err);
+          else {
+            console.log('✅ revision column added successfully');
+            createSyncTriggers();
+          }
+        });
+      } else {
+        createSyncTriggers();
+      }
     });
   });
 };
 
+// Keep esp32_users revisions and tombstones up to date for /api/users/changes,
+// whichever endpoint touches the table
+const createSyncTriggers = () => {
+  db.run(`
+    CREATE TRIGGER IF NOT EXISTS esp32_users_sync_insert AFTER INSERT ON esp32_users
+    BEGIN
+      UPDATE esp32_sync SET revision = revision + 1 WHERE id = 1;
+      UPDATE esp32_users SET revision = (SELECT revision FROM esp32_sync WHERE id = 1) WHERE id = NEW.id;
+    END
+  `);
+
+  // A changed PIN (or card, for card-only users) also retires the old one
+  db.run(`
+    CREATE TRIGGER IF NOT EXISTS esp32_users_sync_update
+    AFTER UPDATE OF name, pin, nfc_id, auth_type, is_active ON esp32_users
+    BEGIN
+      UPDATE esp32_sync SET revision = revision + 1 WHERE id = 1;
+      INSERT INTO esp32_user_tombstones (pin, nfc_id, revision)
+        SELECT OLD.pin, OLD.nfc_id, (SELECT revision FROM esp32_sync WHERE id = 1)
+        WHERE IFNULL(OLD.pin, '') <> IFNULL(NEW.pin, '')
+           OR (IFNULL(OLD.pin, '') = '' AND IFNULL(OLD.nfc_id, '') <> IFNULL(NEW.nfc_id, ''));
+      UPDATE esp32_users SET revision = (SELECT revision FROM esp32_sync WHERE id = 1) WHERE id = NEW.id;
+    END
+  `);
+
+  db.run(`
+    CREATE TRIGGER IF NOT EXISTS esp32_users_sync_delete AFTER DELETE ON esp32_users
+    BEGIN
+      UPDATE esp32_sync SET revision = revision + 1 WHERE id = 1;
+      INSERT INTO esp32_user_tombstones (pin, nfc_id, revision)
+        VALUES (OLD.pin, OLD.nfc_id, (SELECT revision FROM esp32_sync WHERE id = 1));
+    END
+  `);
+};
+
 // Seed default admin user
 const seedDefaultAdmin = async () => {
   // Check if admin user already exists
@@ -475,9 +565,20 @@ app.post('/api/open', adminAuth, (req, res) => {
   });
 });
 
+// How long (seconds) the door may reuse a grant from /api/unlock without
+// asking again. One-off codes get 0 and timed codes never outlive their
+// expiry.
+const UNLOCK_CACHE_TTL = 600;
+
 app.post('/api/unlock', (req, res) => {
   const { code } = req.body;
   if (!code) return res.status(400).json({ error: 'Code or NFC ID required' });
+  // verify: the door already opened on its own and only wants the verdict
+  // for its audit trail; nothing is opened and no one-off code is used up
+  const verify = req.body.verify === true;
+  const open = () => {
+    if (!verify) mqttClient.publish('mytopic/open', 'unlock');
+  };
 
   const now = Date.now();
 
@@ -490,10 +591,10 @@ app.post('/api/unlock', (req, res) => {
     
     if (esp32User) {
       // Found ESP32 user by PIN
-      mqttClient.publish('mytopic/open', 'unlock');
+      open();
       const formattedName = formatUserName(esp32User.name, esp32User.username);
       logAttempt('esp32_pin', code, true, formattedName, esp32User.id);
-      res.json({ success: true, method: 'esp32_pin', user: formattedName });
+      res.json({ success: true, method: 'esp32_pin', user: formattedName, cacheTtl: UNLOCK_CACHE_TTL });
       return;
     }
 
@@ -506,10 +607,10 @@ app.post('/api/unlock', (req, res) => {
       
       if (esp32NfcUser) {
         // Found ESP32 user by NFC
-        mqttClient.publish('mytopic/open', 'unlock');
+        open();
         const formattedName = formatUserName(esp32NfcUser.name, esp32NfcUser.username);
         logAttempt('esp32_nfc', code, true, formattedName, esp32NfcUser.id);
-        res.json({ success: true, method: 'esp32_nfc', user: formattedName });
+        res.json({ success: true, method: 'esp32_nfc', user: formattedName, cacheTtl: UNLOCK_CACHE_TTL });
         return;
       }
 
@@ -525,14 +626,16 @@ app.post('/api/unlock', (req, res) => {
             return res.status(401).json({ error: 'Invalid or expired code' });
           }
 
-          if (row.type === 'otp') {
+          if (row.type === 'otp' && !verify) {
             db.run(`DELETE FROM passwords WHERE code = ?`, [code]);
           }
 
-          mqttClient.publish('mytopic/open', 'unlock');
+          open();
           logAttempt('password', code, true, 'Quản Trị Viên(admin)', null);
-          io.emit('password-update');
-          res.json({ success: true, method: 'password', type: row.type });
+          if (!verify) io.emit('password-update');
+          const cacheTtl = row.type === 'otp' ? 0 :
+            Math.min(UNLOCK_CACHE_TTL, Math.floor((row.expires_at - now) / 1000));
+          res.json({ success: true, method: 'password', type: row.type, cacheTtl });
         });
       } else {
         // Check if it's a valid NFC ID
@@ -546,9 +649,9 @@ app.post('/api/unlock', (req, res) => {
             return res.status(401).json({ error: 'Code not recognized' });
           }
 
-          mqttClient.publish('mytopic/open', 'unlock');
+          open();
           logAttempt('nfc', code, true, 'Quản Trị Viên NFC(admin)', null);
-          res.json({ success: true, method: 'nfc', id: code });
+          res.json({ success: true, method: 'nfc', id: code, cacheTtl: UNLOCK_CACHE_TTL });
         });
       }
     });
@@ -1008,6 +1111,195 @@ app.get('/api/users', (req, res) => {
   });
 });
 
+// ESP32 delta sync: users added or changed and credentials removed since
+// the revision the ESP32 last applied
+app.get('/api/users/changes', (req, res) => {
+  const authHeader = req.headers.authorization;
+  if (authHeader !== 'meichan-auth') {
+    return res.status(401).json({ error: 'Unauthorized' });
+  }
+
+  const since = parseInt(req.query.since, 10) || 0;
+
+  db.get(`SELECT revision FROM esp32_sync WHERE id = 1`, [], (err, row) => {
+    if (err) {
+      return res.status(500).json({ error: 'Database error' });
+    }
+
+    const revision = row ? row.revision : 0;
+    // First sync, or a cursor from before a server database reset: send everything
+    const full = since <= 0 || since > revision;
+    const from = full ? -1 : since;
+
+    db.all(`
+      SELECT name, pin, nfc_id, auth_type
+      FROM esp32_users
+      WHERE is_active = 1 AND revision > ?
+      ORDER BY revision ASC
+    `, [from], (err, rows) => {
+      if (err) {
+        return res.status(500).json({ error: 'Database error' });
+      }
+
+      const users = rows.map(user => ({
+        name: user.name,
+        pin: user.pin,
+        nfc: user.nfc_id || '',
+        authType: user.auth_type
+      }));
+
+      if (full) {
+        return res.json({ revision, full, removed: [], users });
+      }
+
+      // Deleted or deactivated since the cursor, unless the credential is
+      // in use again by an active user. Removals are listed first, so a
+      // PIN moved to a new user is retired before it is added back.
+      db.all(`
+        SELECT pin, nfc_id FROM (
+          SELECT pin, nfc_id, revision FROM esp32_user_tombstones WHERE revision > ?
+          UNION ALL
+          SELECT pin, nfc_id, revision FROM esp32_users WHERE is_active = 0 AND revision > ?
+        ) AS gone
+        WHERE NOT EXISTS (
+          SELECT 1 FROM esp32_users u
+          WHERE u.is_active = 1 AND (
+            (IFNULL(gone.pin, '') <> '' AND u.pin = gone.pin) OR
+            (IFNULL(gone.pin, '') = '' AND IFNULL(u.pin, '') = '' AND u.nfc_id = gone.nfc_id)
+          )
+        )
+        ORDER BY revision ASC
+      `, [from, from], (err, gone) => {
+        if (err) {
+          return res.status(500).json({ error: 'Database error' });
+        }
+
+        const removed = gone.map(entry => ({
+          pin: entry.pin || '',
+          nfc: entry.nfc_id || ''
+        }));
+
+        res.json({ revision, full, removed, users });
+      });
+    });
+  });
+});
+
+// Signed credential image for the ESP32 (built with
+// iot-esp/tools/credential_image_tool from /api/users/changes?since=0)
+app.get('/api/credential-image', (req, res) => {
+  const authHeader = req.headers.authorization;
+  if (authHeader !== 'meichan-auth') {
+    return res.status(401).json({ error: 'Unauthorized' });
+  }
+
+  res.sendFile(path.join(__dirname, 'credential.img'), {
+    headers: { 'Content-Type': 'application/octet-stream' }
+  }, (err) => {
+    if (err && !res.headersSent) {
+      res.status(404).json({ error: 'No credential image' });
+    }
+  });
+});
+
+const AUDIT_BATCH_MAGIC = 0x42445541; // "AUDB"
+const AUDIT_HEADER_SIZE = 24;
+const AUDIT_METHODS = { 1: 'pin', 2: 'nfc', 3: 'remote' };
+const AUDIT_SOURCES = ['local', 'online', 'cached', 'deadline'];
+
+// Decodes an audit batch: a 24-byte header, then per record the seq and
+// zigzag time differences, user ID, method, flags and latency (varints
+// except method and flags)
+const decodeAuditBatch = (body) => {
+  if (body.length < AUDIT_HEADER_SIZE || body.readUInt32LE(0) !== AUDIT_BATCH_MAGIC || body[4] !== 1) {
+    return null;
+  }
+  const header = {
+    boot: body[5],
+    count: body.readUInt16LE(6),
+    logId: body.readUInt32LE(8),
+    firstSeq: body.readUInt32LE(12),
+    lastSeq: body.readUInt32LE(16),
+    uptime: body.readUInt32LE(20)
+  };
+
+  let at = AUDIT_HEADER_SIZE;
+  const varint = () => {
+    let value = 0;
+    let scale = 1;
+    while (at < body.length) {
+      const byte = body[at++];
+      value += (byte & 0x7f) * scale;
+      if (!(byte & 0x80)) return value;
+      scale *= 128;
+    }
+    throw new Error('truncated');
+  };
+
+  const records = [];
+  let seq = header.firstSeq - 1;
+  let time = 0;
+  try {
+    for (let i = 0; i < header.count; i++) {
+      seq += varint();
+      const timeDelta = varint();
+      time += timeDelta % 2 ? -(timeDelta + 1) / 2 : timeDelta / 2;
+      const userId = varint();
+      if (at + 2 > body.length) throw new Error('truncated');
+      const method = body[at++];
+      const flags = body[at++];
+      const latencyMs = varint();
+      records.push({ seq, time, userId, method, flags, latencyMs });
+    }
+  } catch (err) {
+    return null;
+  }
+  return { header, records };
+};
+
+// Batched access log from the ESP32; answers with the last seq stored and
+// the server clock, which the door stamps later records with
+app.post('/api/esp32/audit', express.raw({ type: 'application/octet-stream', limit: '64kb' }), (req, res) => {
+  if (req.headers.authorization !== 'meichan-auth') {
+    return res.status(401).json({ error: 'Unauthorized' });
+  }
+
+  const batch = Buffer.isBuffer(req.body) ? decodeAuditBatch(req.body) : null;
+  if (!batch) {
+    return res.status(400).json({ error: 'Bad audit batch' });
+  }
+
+  const { header, records } = batch;
+  const now = Math.floor(Date.now() / 1000);
+  const stmt = db.prepare(`
+    INSERT OR IGNORE INTO esp32_audit
+      (log_id, seq, time, boot, user_id, method, granted, source, latency_ms, received_at)
+    VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?)
+  `);
+  for (const record of records) {
+    const boot = (record.flags >> 4) & 0x0f;
+    // Before the door had the server's clock: seconds since its boot,
+    // placeable only if it has not restarted since
+    let time = null;
+    if (record.flags & 0x02) {
+      time = record.time;
+    } else if (boot === header.boot) {
+      time = now - (header.uptime - record.time);
+    }
+    stmt.run([
+      header.logId, record.seq, time, boot, record.userId || null,
+      AUDIT_METHODS[record.method] || 'unknown', record.flags & 0x01,
+      AUDIT_SOURCES[(record.flags >> 2) & 0x03], record.latencyMs, now
+    ]);
+  }
+  stmt.finalize((err) => {
+    if (err) {
+      return res.status(500).json({ error: 'Database error' });
+    }
+    res.json({ success: true, acked: header.lastSeq, time: now, stored: records.length });
+  });
+});
+
 // Trigger ESP32 to scan for NFC card (for guest access approval)
 app.post('/api/admin/scan-nfc', adminAuth, (req, res) => {
   const { requestId } = req.body;
@@ -1,7 +1,7 @@
 #include "admin_interface.h"
-#include <LiquidCrystal_I2C.h>
+#include "lcd_frame.h"
 
-extern LiquidCrystal_I2C lcd;
+extern LcdFrame lcd;
 
 AdminInterface adminInterface;
 
@@ -9,6 +9,8 @@ AdminInterface::AdminInterface() {
   adminMode = false;
   currentCommand = "";
   lastActivity = 0;
+  listPosition = 0;
+  scrollPosition = 0;
 }
 
 bool AdminInterface::enterAdminMode(const String& adminPin) {
@@ -22,12 +24,21 @@ bool AdminInterface::enterAdminMode(const String& adminPin) {
 }
 
 void AdminInterface::exitAdminMode() {
+  cancelPending();
   adminMode = false;
   currentCommand = "";
   lcd.clear();
   lcd.setCursor(0, 0);
   lcd.print("Admin mode OFF");
-  delay(1000);
+}
+
+void AdminInterface::cancelPending() {
+  scheduler.cancel(showMenuPage2);
+  scheduler.cancel(showNextUser);
+  scheduler.cancel(showStatsPage2);
+  scheduler.cancel(showStatsDone);
+  scheduler.cancel(scrollStep);
+  listedUsers.clear();
 }
 
 bool AdminInterface::isInAdminMode() {
@@ -38,6 +49,7 @@ void AdminInterface::processCommand(char key) {
   if (!adminMode) return;
   
   lastActivity = millis();
+  cancelPending(); // A new command replaces whatever is still paging
   
   switch (key) {
     case 'A': // Show users
@@ -79,7 +91,10 @@ void AdminInterface::showAdminMenu() {
   lcd.print("ADMIN MENU");
   lcd.setCursor(0, 1);
   lcd.print("A:Users B:Stats");
-  delay(1500);
+  scheduler.after(1500, showMenuPage2);
+}
+
+void AdminInterface::showMenuPage2() {
   lcd.clear();
   lcd.setCursor(0, 0);
   lcd.print("C:AddUser D:Exit");
@@ -89,31 +104,45 @@ void AdminInterface::showAdminMenu() {
 
 void AdminInterface::showUserList() {
   currentCommand = "users";
-  std::vector<OfflineUser> users = offlineAuth.getUsers();
+  // The LCD can only page through a handful; the full list is on MQTT
+  listedUsers = offlineAuth.getUsers(1, MAX_LISTED_USERS);
+  listPosition = 0;
   
-  if (users.empty()) {
+  if (listedUsers.empty()) {
     displayMessage("No users found", "A:Menu #:Refresh");
     return;
   }
-  
-  for (size_t i = 0; i < users.size(); i++) {
-    const auto& user = users[i];
+  showNextUser();
+}
+
+void AdminInterface::showNextUser() {
+  AdminInterface& admin = adminInterface;
+  if (admin.listPosition < admin.listedUsers.size()) {
+    const auto& user = admin.listedUsers[admin.listPosition++];
     String line1 = String(user.id) + ":" + String(user.name);
     String line2 = "Type:" + String(user.authType) + " " + (user.isActive ? "ON" : "OFF");
     
     lcd.clear();
     lcd.setCursor(0, 0);
     if (line1.length() > 16) {
-      displayScrollingText(line1);
+      admin.displayScrollingText(line1);
     } else {
       lcd.print(line1);
     }
     lcd.setCursor(0, 1);
     lcd.print(line2);
-    delay(2000);
+    scheduler.after(2000, showNextUser);
+    return;
   }
   
-  displayMessage("End of users", "A:Menu #:Refresh");
+  size_t shown = admin.listedUsers.size();
+  admin.listedUsers.clear();
+  scheduler.cancel(scrollStep);
+  if (offlineAuth.getUserCount() > shown) {
+    admin.displayMessage("+" + String(offlineAuth.getUserCount() - shown) + " more users", "A:Menu #:Refresh");
+    return;
+  }
+  admin.displayMessage("End of users", "A:Menu #:Refresh");
 }
 
 void AdminInterface::showSystemStats() {
@@ -125,8 +154,10 @@ void AdminInterface::showSystemStats() {
   lcd.print("Users: " + String(offlineAuth.getUserCount()));
   lcd.setCursor(0, 1);
   lcd.print("Fails: " + String(offlineAuth.getFailedAttempts()));
-  delay(2000);
-  
+  scheduler.after(2000, showStatsPage2);
+}
+
+void AdminInterface::showStatsPage2() {
   // Page 2: Lockout info
   uint32_t lockoutTime = offlineAuth.getRemainingLockoutTime();
   lcd.clear();
@@ -138,9 +169,11 @@ void AdminInterface::showSystemStats() {
   }
   lcd.setCursor(0, 1);
   lcd.print("LastAuth: " + String(offlineAuth.getLastAuthTime() / 1000));
-  delay(2000);
-  
-  displayMessage("Stats complete", "A:Menu #:Refresh");
+  scheduler.after(2000, showStatsDone);
+}
+
+void AdminInterface::showStatsDone() {
+  adminInterface.displayMessage("Stats complete", "A:Menu #:Refresh");
 }
 
 bool AdminInterface::quickAddUser(const String& name, const String& pin) {
@@ -153,7 +186,7 @@ bool AdminInterface::quickAddUser(const String& name, const String& pin) {
   }
 }
 
-bool AdminInterface::quickEnrollNfc(uint8_t userId) {
+bool AdminInterface::quickEnrollNfc(uint16_t userId) {
   OfflineUser user = offlineAuth.getUser(userId);
   if (user.id == 0) {
     displayMessage("User not found", "ID: " + String(userId));
@@ -164,7 +197,7 @@ bool AdminInterface::quickEnrollNfc(uint8_t userId) {
   return true;
 }
 
-void AdminInterface::displayMessage(const String& line1, const String& line2, int delayMs) {
+void AdminInterface::displayMessage(const String& line1, const String& line2) {
   lcd.clear();
   lcd.setCursor(0, 0);
   if (line1.length() > 16) {
@@ -181,8 +214,6 @@ void AdminInterface::displayMessage(const String& line1, const String& line2, in
       lcd.print(line2);
     }
   }
-  
-  delay(delayMs);
 }
 
 void AdminInterface::displayScrollingText(const String& text) {
@@ -191,11 +222,23 @@ void AdminInterface::displayScrollingText(const String& text) {
     return;
   }
   
-  for (int i = 0; i <= text.length() - 16; i++) {
-    lcd.setCursor(0, 0);
-    lcd.print(text.substring(i, i + 16));
-    delay(300);
+  // Scrolls the top line one character every 300ms
+  scrollText = text;
+  scrollPosition = 0;
+  lcd.setCursor(0, 0);
+  lcd.print(scrollText.substring(0, 16));
+  scheduler.every(300, scrollStep);
+}
+
+void AdminInterface::scrollStep() {
+  AdminInterface& admin = adminInterface;
+  admin.scrollPosition++;
+  if (admin.scrollPosition > (int)admin.scrollText.length() - 16) {
+    scheduler.cancel(scrollStep);
+    return;
   }
+  lcd.setCursor(0, 0);
+  lcd.print(admin.scrollText.substring(admin.scrollPosition, admin.scrollPosition + 16));
 }
 
 void AdminInterface::update() {
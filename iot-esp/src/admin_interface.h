@@ -2,6 +2,7 @@
 
 #include <Arduino.h>
 #include "offline_auth.h"
+#include "scheduler.h"
 
 class AdminInterface {
 private:
@@ -9,6 +10,20 @@ private:
   String currentCommand;
   unsigned long lastActivity;
   static const unsigned long ADMIN_TIMEOUT = 60000; // 1 minute timeout
+  static const uint16_t MAX_LISTED_USERS = 10;
+  
+  // Multi-page screens advance from scheduler tasks instead of delay()
+  std::vector<OfflineUser> listedUsers;
+  size_t listPosition;
+  String scrollText;
+  int scrollPosition;
+  
+  static void showMenuPage2();
+  static void showNextUser();
+  static void showStatsPage2();
+  static void showStatsDone();
+  static void scrollStep();
+  void cancelPending();
   
 public:
   AdminInterface();
@@ -26,10 +41,10 @@ public:
   
   // Quick actions
   bool quickAddUser(const String& name, const String& pin);
-  bool quickEnrollNfc(uint8_t userId);
+  bool quickEnrollNfc(uint16_t userId);
   
   // Display helpers
-  void displayMessage(const String& line1, const String& line2 = "", int delayMs = 2000);
+  void displayMessage(const String& line1, const String& line2 = "");
   void displayScrollingText(const String& text);
   
   // Update loop
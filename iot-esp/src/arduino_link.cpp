@@ -0,0 +1,292 @@
+#include "arduino_link.h"
+
+ArduinoLink arduinoLink;
+
+ArduinoLink::ArduinoLink() {
+  handler = nullptr;
+  mode = MODE_TEXT;
+  modeSince = 0;
+  renegotiateAt = 0;
+  queueHead = 0;
+  queueCount = 0;
+  txSeq = 0;
+  awaitingAck = false;
+  sentAt = 0;
+  lastSentAt = 0;
+  retries = 0;
+  rxSeq = 0;
+  hasRxSeq = false;
+  partialSince = 0;
+  partialPending = false;
+  memset(&counters, 0, sizeof(counters));
+}
+
+void ArduinoLink::begin(MessageHandler messageHandler) {
+  handler = messageHandler;
+  hello(MODE_NEGOTIATING);
+}
+
+// Asks the Arduino for frames at ARDUINO_LINK_BAUD, at whatever rate the
+// UART is on; text lines keep working until it answers
+void ArduinoLink::hello(Mode waiting) {
+  uint32_t rate = ARDUINO_LINK_BAUD;
+  uint8_t payload[4] = {(uint8_t)rate, (uint8_t)(rate >> 8), (uint8_t)(rate >> 16), (uint8_t)(rate >> 24)};
+  uint8_t frame[LINK_OVERHEAD + 4];
+  size_t length = encodeLinkFrame(frame, LINK_HELLO, 0, payload, 4);
+  Serial2.write(frame, length);
+  if (waiting == MODE_PROBING) counters.probes++;
+  mode = waiting;
+  modeSince = millis();
+  lastSentAt = modeSince;
+}
+
+bool ArduinoLink::isIdle() {
+  return mode != MODE_NEGOTIATING && mode != MODE_PROBING && queueCount == 0 && !awaitingAck &&
+         !partialPending && Serial2.available() == 0;
+}
+
+uint32_t ArduinoLink::msUntilNext() {
+  uint32_t now = millis();
+  if (mode == MODE_FRAMED && queueCount == 0) {
+    uint32_t quiet = now - lastSentAt;
+    return quiet < LINK_KEEPALIVE_MS ? LINK_KEEPALIVE_MS - quiet : 0;
+  }
+  if (mode == MODE_TEXT && renegotiateAt != 0) {
+    int32_t left = (int32_t)(renegotiateAt - now);
+    return left > 0 ? left : 0;
+  }
+  return UINT32_MAX;
+}
+
+void ArduinoLink::poll() {
+  // Take what the UART interrupt has buffered, as far as the ring has room
+  int available = Serial2.available();
+  uint16_t room = receiver.space();
+  bool took = false;
+  while (available-- > 0 && room-- > 0) {
+    receiver.push(Serial2.read());
+    took = true;
+  }
+  
+  uint32_t receivedUs = micros();
+  LinkFrame frame;
+  while (receiver.next(frame)) {
+    handleFrame(frame, receivedUs);
+  }
+  
+  // A frame or line cut short stays at the front; don't wait forever
+  uint32_t now = millis();
+  if (receiver.empty()) {
+    partialPending = false;
+  } else if (took || !partialPending) {
+    partialPending = true;
+    partialSince = now;
+  } else if (now - partialSince >= PARTIAL_TIMEOUT_MS) {
+    receiver.skipPartial();
+    partialPending = false;
+  }
+  
+  if (mode == MODE_NEGOTIATING && now - modeSince >= HELLO_TIMEOUT_MS) {
+    mode = MODE_TEXT;
+    modeSince = now;
+    Serial.println("[LINK] No framed reply, using text lines at " + String(LINK_BOOT_BAUD));
+  }
+  if (mode == MODE_TEXT && renegotiateAt != 0 && (int32_t)(now - renegotiateAt) >= 0) {
+    renegotiateAt = 0;
+    hello(MODE_NEGOTIATING);
+  }
+  
+  if (mode == MODE_FRAMED && awaitingAck && now - sentAt >= ARDUINO_LINK_ACK_TIMEOUT_MS) {
+    if (retries < ARDUINO_LINK_RETRIES) {
+      retries++;
+      counters.retransmits++;
+      transmitHead();
+    } else {
+      // An Arduino that was only busy still hears the framed rate; one that
+      // restarted is at the boot rate and never answers
+      Serial.println("[LINK] Arduino did not acknowledge, asking for frames again");
+      awaitingAck = false;
+      retries = 0;
+      hello(MODE_PROBING);
+    }
+  }
+  if (mode == MODE_PROBING && now - modeSince >= ARDUINO_LINK_ACK_TIMEOUT_MS) {
+    if (retries < ARDUINO_LINK_RETRIES) {
+      retries++;
+      hello(MODE_PROBING);
+    } else {
+      counters.failures++;
+      Serial.println("[LINK] No answer at " + String(ARDUINO_LINK_BAUD) + ", back to text lines");
+      fallBack();
+    }
+  }
+  
+  // Keeps the Arduino from timing out and finds out if it restarted
+  if (mode == MODE_FRAMED && queueCount == 0 && now - lastSentAt >= LINK_KEEPALIVE_MS) {
+    send(LINK_PING, nullptr, 0);
+  }
+}
+
+void ArduinoLink::handleFrame(const LinkFrame& frame, uint32_t receivedUs) {
+  switch (frame.type) {
+    case LINK_TEXT: {
+      size_t offset;
+      LinkFrameType type = linkTextType(frame.payload, frame.length, offset);
+      deliver(type, frame.payload + offset, frame.length - offset, receivedUs);
+      return;
+    }
+    
+    case LINK_ACK:
+      if (awaitingAck && frame.seq == txSeq) {
+        awaitingAck = false;
+        queueHead = (queueHead + 1) % TX_QUEUE_SIZE;
+        queueCount--;
+        txSeq++;
+        if (queueCount > 0) {
+          retries = 0;
+          transmitHead();
+        }
+      }
+      return;
+    
+    case LINK_HELLO_OK:
+      if (mode == MODE_NEGOTIATING) {
+        // Let the UART finish at the old rate before changing it
+        Serial2.flush();
+        Serial2.updateBaudRate(ARDUINO_LINK_BAUD);
+        mode = MODE_FRAMED;
+        modeSince = millis();
+        hasRxSeq = false;
+        Serial.println("[LINK] Framed at " + String(ARDUINO_LINK_BAUD));
+      } else if (mode == MODE_PROBING) {
+        // Both ends start the seq bookkeeping over; the command goes again
+        mode = MODE_FRAMED;
+        modeSince = millis();
+        hasRxSeq = false;
+        retries = 0;
+        Serial.println("[LINK] Arduino answered, staying framed");
+        if (queueCount > 0) transmitHead();
+      }
+      return;
+    
+    default:
+      counters.framesIn++;
+      sendAck(frame.seq);
+      if (hasRxSeq && frame.seq == rxSeq) {
+        // Our ack got lost; the Arduino sent it again
+        counters.duplicates++;
+        return;
+      }
+      rxSeq = frame.seq;
+      hasRxSeq = true;
+      deliver(frame.type, frame.payload, frame.length, receivedUs);
+      return;
+  }
+}
+
+void ArduinoLink::deliver(uint8_t type, const char* payload, uint8_t length, uint32_t receivedUs) {
+  if (!handler) return;
+  ArduinoMessage message = {(LinkFrameType)type, payload, length, receivedUs};
+  handler(message);
+}
+
+bool ArduinoLink::servo(uint8_t angle) {
+  return send(LINK_SERVO, &angle, 1);
+}
+
+bool ArduinoLink::writeNfc(const char* data) {
+  size_t length = strlen(data);
+  if (length > LINK_MAX_PAYLOAD) return false;
+  return send(LINK_WRITE_NFC, (const uint8_t*)data, length);
+}
+
+bool ArduinoLink::send(uint8_t type, const uint8_t* payload, uint8_t length) {
+  Outgoing command;
+  command.type = type;
+  command.length = length;
+  if (length > 0) memcpy(command.payload, payload, length);
+  
+  if (mode == MODE_NEGOTIATING || mode == MODE_TEXT) {
+    sendText(command);
+    return true;
+  }
+  
+  if (queueCount == TX_QUEUE_SIZE) {
+    Serial.println("[LINK] Send queue full, command dropped");
+    return false;
+  }
+  queue[(queueHead + queueCount) % TX_QUEUE_SIZE] = command;
+  queueCount++;
+  if (mode == MODE_FRAMED && !awaitingAck) {
+    retries = 0;
+    transmitHead();
+  }
+  return true;
+}
+
+void ArduinoLink::transmitHead() {
+  const Outgoing& command = queue[queueHead];
+  uint8_t frame[LINK_OVERHEAD + LINK_MAX_PAYLOAD];
+  size_t length = encodeLinkFrame(frame, command.type, txSeq, command.payload, command.length);
+  Serial2.write(frame, length);
+  counters.framesOut++;
+  awaitingAck = true;
+  sentAt = millis();
+  lastSentAt = sentAt;
+}
+
+void ArduinoLink::sendAck(uint8_t seq) {
+  uint8_t frame[LINK_OVERHEAD];
+  size_t length = encodeLinkFrame(frame, LINK_ACK, seq, nullptr, 0);
+  Serial2.write(frame, length);
+  lastSentAt = millis();
+}
+
+// The old line for a command: SERVO:90, WRITE_NFC:data
+void ArduinoLink::sendText(const Outgoing& command) {
+  char line[LINK_MAX_PAYLOAD + 16];
+  size_t length = strlen(linkTextPrefix(command.type));
+  memcpy(line, linkTextPrefix(command.type), length);
+  if (command.type == LINK_SERVO) {
+    length += snprintf(line + length, sizeof(line) - length, "%u", command.payload[0]);
+  } else {
+    memcpy(line + length, command.payload, command.length);
+    length += command.length;
+  }
+  line[length++] = '\n';
+  Serial2.write((const uint8_t*)line, length);
+}
+
+// The Arduino answered neither frames nor a hello at the framed rate, most
+// likely because it restarted at the boot rate. Whatever is still queued
+// goes out as text lines; pings have no line.
+void ArduinoLink::fallBack() {
+  counters.fallbacks++;
+  Serial2.flush();
+  Serial2.updateBaudRate(LINK_BOOT_BAUD);
+  mode = MODE_TEXT;
+  modeSince = millis();
+  awaitingAck = false;
+  while (queueCount > 0) {
+    if (queue[queueHead].type != LINK_PING) sendText(queue[queueHead]);
+    queueHead = (queueHead + 1) % TX_QUEUE_SIZE;
+    queueCount--;
+  }
+  txSeq++;
+  renegotiateAt = millis() + RENEGOTIATE_MS;
+  if (renegotiateAt == 0) renegotiateAt = 1;
+}
+
+ArduinoLinkStats ArduinoLink::stats() const {
+  ArduinoLinkStats result = counters;
+  result.badFrames = receiver.badFrames;
+  return result;
+}
+
+size_t ArduinoLink::toLine(const ArduinoMessage& message, char* out, size_t size) {
+  if (size == 0) return 0;
+  const char* prefix = message.type == LINK_TEXT ? "" : linkTextPrefix(message.type);
+  int length = snprintf(out, size, "%s%.*s", prefix, (int)message.length, message.payload);
+  if (length < 0) length = 0;
+  return (size_t)length < size ? length : size - 1;
+}
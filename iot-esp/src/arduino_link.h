@@ -0,0 +1,134 @@
+#pragma once
+
+#include <Arduino.h>
+#include "arduino_link_format.h"
+
+// Baud rate asked for in LINK_HELLO
+#ifndef ARDUINO_LINK_BAUD
+#define ARDUINO_LINK_BAUD 115200
+#endif
+
+// UART driver receive buffer, filled from the UART interrupt
+#ifndef ARDUINO_LINK_UART_BUFFER
+#define ARDUINO_LINK_UART_BUFFER 1024
+#endif
+
+// A frame not acknowledged within this is sent again, up to the retry limit
+#ifndef ARDUINO_LINK_ACK_TIMEOUT_MS
+#define ARDUINO_LINK_ACK_TIMEOUT_MS 60
+#endif
+#ifndef ARDUINO_LINK_RETRIES
+#define ARDUINO_LINK_RETRIES 4
+#endif
+
+// A message from the Arduino, framed or a text line
+struct ArduinoMessage {
+  LinkFrameType type;    // LINK_NFC_UID, LINK_SERVO_OK, ... or LINK_TEXT
+  const char* payload;   // NUL-terminated; valid during the handler only
+  uint8_t length;
+  uint32_t receivedUs;   // micros() when it was taken off the ring
+};
+
+struct ArduinoLinkStats {
+  uint32_t framesIn;
+  uint32_t framesOut;
+  uint32_t retransmits;
+  uint32_t failures;     // commands that ran out of retries
+  uint32_t duplicates;   // repeated frames from the Arduino, acked again
+  uint32_t badFrames;
+  uint32_t probes;       // hellos at the framed rate after missing acks
+  uint32_t fallbacks;    // drops back to text lines at the boot rate
+};
+
+// The door task's end of Serial2. The UART driver's interrupt fills its
+// buffer; poll() moves what has arrived into a fixed ring and hands out
+// each complete frame or line without waiting for the rest of a partial
+// one. Once the Arduino has agreed to frames, servo() and writeNfc() are
+// sent as frames and retransmitted until acknowledged (format in
+// arduino_link_format.h). A quiet link is kept up with pings. With an
+// Arduino that only knows text lines, and after a command runs out of
+// retries and the Arduino does not answer a hello either, they go out as
+// the old text lines.
+class ArduinoLink {
+public:
+  typedef void (*MessageHandler)(const ArduinoMessage& message);
+  
+  ArduinoLink();
+  
+  // Serial2 must already be running at LINK_BOOT_BAUD
+  void begin(MessageHandler handler);
+  // Call from loop(): reads, acknowledges, delivers and retransmits
+  void poll();
+  
+  // Return false if the command could not be queued
+  bool servo(uint8_t angle);
+  bool writeNfc(const char* data);
+  
+  bool isFramed() const { return mode == MODE_FRAMED; }
+  // Nothing to send, retransmit or finish reading, so poll() can wait for
+  // the next byte
+  bool isIdle();
+  // How long an idle poll() can be put off: the next ping or hello
+  uint32_t msUntilNext();
+  uint32_t baud() const { return mode == MODE_FRAMED || mode == MODE_PROBING ? ARDUINO_LINK_BAUD : LINK_BOOT_BAUD; }
+  ArduinoLinkStats stats() const;
+  
+  // The text line form of a message, for logs and the input trace
+  static size_t toLine(const ArduinoMessage& message, char* out, size_t size);
+
+private:
+  enum Mode : uint8_t {
+    MODE_NEGOTIATING,  // hello sent at the boot rate
+    MODE_TEXT,
+    MODE_FRAMED,
+    MODE_PROBING       // framed, acks missing; hello sent at the framed rate
+  };
+  
+  static const uint8_t TX_QUEUE_SIZE = 4;
+  static const uint16_t HELLO_TIMEOUT_MS = 250;
+  // After a fallback the Arduino may have restarted; ask for frames again
+  // once one still on frames has timed out too
+  static const uint32_t RENEGOTIATE_MS = 35000;
+  static_assert(RENEGOTIATE_MS > LINK_SILENCE_MS, "renegotiate after the Arduino's silence timeout");
+  // A partial frame or line older than this lost its remaining bytes
+  static const uint16_t PARTIAL_TIMEOUT_MS = 50;
+  
+  struct Outgoing {
+    uint8_t type;
+    uint8_t length;
+    uint8_t payload[LINK_MAX_PAYLOAD];
+  };
+  
+  MessageHandler handler;
+  LinkReceiver<256> receiver;
+  Mode mode;
+  uint32_t modeSince;
+  uint32_t renegotiateAt;  // 0 = not planned
+  
+  Outgoing queue[TX_QUEUE_SIZE];
+  uint8_t queueHead;
+  uint8_t queueCount;
+  uint8_t txSeq;
+  bool awaitingAck;
+  uint32_t sentAt;
+  uint32_t lastSentAt;  // any frame, for the keepalive
+  uint8_t retries;
+  
+  uint8_t rxSeq;
+  bool hasRxSeq;
+  uint32_t partialSince;
+  bool partialPending;
+  
+  ArduinoLinkStats counters;
+  
+  void hello(Mode waiting);
+  void handleFrame(const LinkFrame& frame, uint32_t receivedUs);
+  void deliver(uint8_t type, const char* payload, uint8_t length, uint32_t receivedUs);
+  bool send(uint8_t type, const uint8_t* payload, uint8_t length);
+  void transmitHead();
+  void sendAck(uint8_t seq);
+  void sendText(const Outgoing& command);
+  void fallBack();
+};
+
+extern ArduinoLink arduinoLink;
@@ -0,0 +1,246 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+// Frames on the Serial2 link between the ESP32 and the Arduino. Plain C++
+// with no Arduino dependency, so the host simulator plays the Arduino with
+// the same definitions the firmware uses.
+//
+//   0x7E | type | seq | length | payload (0-64 bytes) | CRC-16 (high, low)
+//
+// The CRC is CRC-16/CCITT-FALSE over type, seq, length and payload. A
+// receiver that sees a bad CRC or an impossible length drops the 0x7E and
+// hunts for the next one, so a lost or corrupted byte costs one frame.
+//
+// Both ends start at LINK_BOOT_BAUD speaking the old newline-terminated
+// text lines (NFC_UID:..., SERVO:90, ...). The ESP32 sends LINK_HELLO with
+// the baud rate it wants; an Arduino that understands frames answers
+// LINK_HELLO_OK at the boot rate and both switch. An Arduino that does not
+// never answers, and the link stays on text lines.
+//
+// Every frame except LINK_ACK, LINK_HELLO and LINK_HELLO_OK is acknowledged
+// with a LINK_ACK carrying its seq. The sender keeps one frame in flight and
+// retransmits it with the same seq until it is acknowledged; the receiver
+// acknowledges a repeat of the last seq again but acts on it only once.
+// LINK_HELLO starts the seq bookkeeping over on both ends.
+// Text lines never contain 0x7E, so the two can share the receive stream.
+//
+// When its retransmits run out the ESP32 sends LINK_HELLO again at the
+// framed rate. An Arduino already on frames answers LINK_HELLO_OK at the
+// rate the hello came in on and both carry on; only without an answer does
+// the ESP32 drop back to text lines at LINK_BOOT_BAUD. An Arduino on frames
+// that has had no valid frame for LINK_SILENCE_MS does the same, so the
+// two meet again at the boot rate. The ESP32 sends LINK_PING whenever it
+// has sent nothing for LINK_KEEPALIVE_MS, so a quiet door never trips it.
+
+static const uint8_t LINK_SOF = 0x7E;
+static const uint8_t LINK_MAX_PAYLOAD = 64;
+static const uint8_t LINK_OVERHEAD = 6;
+static const uint32_t LINK_BOOT_BAUD = 9600;
+static const uint32_t LINK_KEEPALIVE_MS = 10000;
+static const uint32_t LINK_SILENCE_MS = 30000;
+
+enum LinkFrameType : uint8_t {
+  LINK_ACK = 0x01,             // seq = the frame acknowledged
+  
+  // ESP32 -> Arduino
+  LINK_HELLO = 0x10,           // payload: baud rate (uint32, little-endian)
+  LINK_SERVO = 0x11,           // payload: angle (1 byte)
+  LINK_WRITE_NFC = 0x12,       // payload: data for the card
+  LINK_PING = 0x13,            // no payload; only acknowledged
+  
+  // Arduino -> ESP32
+  LINK_HELLO_OK = 0x20,        // payload: the baud rate both now use
+  LINK_NFC_UID = 0x21,         // payload: UID as hex text
+  LINK_NFC_WRITE_OK = 0x22,
+  LINK_NFC_WRITE_FAIL = 0x23,
+  LINK_SERVO_OK = 0x24,
+  
+  LINK_TEXT = 0x7F             // not a frame: a text line, payload = the line
+};
+
+// Text line equivalents of the Arduino's frames; the payload follows the
+// prefix. Traces and logs show frames in this form.
+struct LinkTextForm {
+  LinkFrameType type;
+  const char* prefix;
+  bool hasPayload;
+};
+
+static const LinkTextForm LINK_TEXT_FORMS[] = {
+  {LINK_NFC_UID, "NFC_UID:", true},
+  {LINK_NFC_WRITE_OK, "NFC_WRITE_OK", false},
+  {LINK_NFC_WRITE_FAIL, "NFC_WRITE_FAIL", false},
+  {LINK_SERVO_OK, "SERVO_OK", false},
+  {LINK_SERVO, "SERVO:", true},
+  {LINK_WRITE_NFC, "WRITE_NFC:", true}
+};
+static const uint8_t LINK_TEXT_FORM_COUNT = sizeof(LINK_TEXT_FORMS) / sizeof(LINK_TEXT_FORMS[0]);
+
+// The frame type a text line stands for and where its payload starts;
+// LINK_TEXT with offset 0 for anything else
+inline LinkFrameType linkTextType(const char* line, size_t length, size_t& payloadOffset) {
+  for (uint8_t i = 0; i < LINK_TEXT_FORM_COUNT; i++) {
+    const LinkTextForm& form = LINK_TEXT_FORMS[i];
+    size_t prefixLength = strlen(form.prefix);
+    bool match = form.hasPayload ? length >= prefixLength : length == prefixLength;
+    if (match && memcmp(line, form.prefix, prefixLength) == 0) {
+      payloadOffset = prefixLength;
+      return form.type;
+    }
+  }
+  payloadOffset = 0;
+  return LINK_TEXT;
+}
+
+inline const char* linkTextPrefix(uint8_t type) {
+  for (uint8_t i = 0; i < LINK_TEXT_FORM_COUNT; i++) {
+    if (LINK_TEXT_FORMS[i].type == type) return LINK_TEXT_FORMS[i].prefix;
+  }
+  return "";
+}
+
+inline uint16_t linkCrc(const uint8_t* data, size_t length, uint16_t crc = 0xFFFF) {
+  for (size_t i = 0; i < length; i++) {
+    crc ^= (uint16_t)data[i] << 8;
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+// Writes a frame at out (LINK_OVERHEAD + length bytes) and returns its size
+inline size_t encodeLinkFrame(uint8_t* out, uint8_t type, uint8_t seq, const uint8_t* payload, uint8_t length) {
+  if (length > LINK_MAX_PAYLOAD) length = LINK_MAX_PAYLOAD;
+  out[0] = LINK_SOF;
+  out[1] = type;
+  out[2] = seq;
+  out[3] = length;
+  if (length > 0) memcpy(out + 4, payload, length);
+  uint16_t crc = linkCrc(out + 1, 3 + length);
+  out[4 + length] = crc >> 8;
+  out[5 + length] = crc & 0xFF;
+  return LINK_OVERHEAD + length;
+}
+
+struct LinkFrame {
+  uint8_t type;
+  uint8_t seq;
+  uint8_t length;
+  char payload[LINK_MAX_PAYLOAD + 1];  // always NUL-terminated
+};
+
+// Receive ring and parser. Bytes go in as they come off the UART; next()
+// takes complete frames and text lines off the front and never waits for
+// more. SIZE must hold the longest frame.
+template <uint16_t SIZE>
+class LinkReceiver {
+public:
+  uint32_t badFrames = 0;  // CRC or length errors
+  uint32_t noiseBytes = 0; // bytes that were neither a frame nor a line
+  
+  uint16_t space() const { return SIZE - count; }
+  bool empty() const { return count == 0; }
+  
+  bool push(uint8_t byte) {
+    if (count == SIZE) return false;
+    ring[(head + count) % SIZE] = byte;
+    count++;
+    return true;
+  }
+  
+  bool next(LinkFrame& frame) {
+    while (count > 0) {
+      if (at(0) == LINK_SOF) {
+        if (count < 4) return false;
+        uint8_t length = at(3);
+        if (length > LINK_MAX_PAYLOAD) {
+          badFrame();
+          continue;
+        }
+        if (count < LINK_OVERHEAD + length) return false;
+        
+        uint8_t header[3] = {at(1), at(2), at(3)};
+        uint16_t crc = linkCrc(header, 3);
+        for (uint8_t i = 0; i < length; i++) {
+          uint8_t byte = at(4 + i);
+          crc = linkCrc(&byte, 1, crc);
+          frame.payload[i] = byte;
+        }
+        if (crc != ((uint16_t)at(4 + length) << 8 | at(5 + length))) {
+          badFrame();
+          continue;
+        }
+        frame.type = header[0];
+        frame.seq = header[1];
+        frame.length = length;
+        frame.payload[length] = '\0';
+        drop(LINK_OVERHEAD + length);
+        return true;
+      }
+      
+      // A text line, up to '\n'; a 0x7E before that starts a frame
+      uint16_t end = 0;
+      while (end < count && at(end) != '\n' && at(end) != LINK_SOF) end++;
+      if (end < count && at(end) == LINK_SOF) {
+        noiseBytes += end;
+        drop(end);
+        continue;
+      }
+      if (end == count) {
+        // Nothing ends this line before the ring fills: throw it away
+        if (count == SIZE) {
+          noiseBytes += count;
+          drop(count);
+        }
+        return false;
+      }
+      
+      uint16_t length = end;
+      if (length > 0 && at(length - 1) == '\r') length--;
+      if (length > LINK_MAX_PAYLOAD) length = LINK_MAX_PAYLOAD;
+      for (uint16_t i = 0; i < length; i++) {
+        frame.payload[i] = at(i);
+      }
+      frame.payload[length] = '\0';
+      frame.type = LINK_TEXT;
+      frame.seq = 0;
+      frame.length = length;
+      drop(end + 1);
+      return true;
+    }
+    return false;
+  }
+  
+  // Gives up on whatever is left: a frame whose remaining bytes never came
+  // or a line whose '\n' never did
+  void skipPartial() {
+    if (count == 0) return;
+    if (at(0) == LINK_SOF) {
+      badFrames++;
+    } else {
+      noiseBytes += count;
+    }
+    drop(count);
+  }
+
+private:
+  uint8_t ring[SIZE];
+  uint16_t head = 0;
+  uint16_t count = 0;
+  
+  uint8_t at(uint16_t offset) const { return ring[(head + offset) % SIZE]; }
+  
+  void drop(uint16_t bytes) {
+    head = (head + bytes) % SIZE;
+    count -= bytes;
+  }
+  
+  void badFrame() {
+    badFrames++;
+    drop(1);
+  }
+};
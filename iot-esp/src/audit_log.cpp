@@ -0,0 +1,237 @@
+#include "audit_log.h"
+
+AuditLog auditLog;
+
+const char* AuditLog::PARTITION = "auditlog";
+
+static_assert(AUDIT_HOLD_SIZE < SPI_FLASH_SEC_SIZE / AUDIT_RECORD_SIZE, "held records must fit one sector");
+
+AuditLog::AuditLog() {
+  partition = nullptr;
+  slots = 0;
+  logId = 0;
+  boot = 0;
+  nextSeq = 1;
+  erasedLimit = 0;
+  acked = 0;
+  lastAppend = 0;
+  wallTime = 0;
+  wallSetAt = 0;
+  holdCount = 0;
+  memset(&counters, 0, sizeof(counters));
+}
+
+bool AuditLog::begin() {
+  partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, PARTITION);
+  if (!partition) {
+    Serial.println("[AUDIT] No auditlog partition");
+    return false;
+  }
+  uint32_t sectors = partition->size / SPI_FLASH_SEC_SIZE;
+  slots = sectors * SLOTS_PER_SECTOR;
+  
+  // Sectors fill in order, so the one whose first record is newest holds
+  // the head. A sector whose first record was cut short by a reset is
+  // passed over and erased again before it is written.
+  uint32_t newestFirst = 0;
+  uint32_t newestSector = 0;
+  for (uint32_t sector = 0; sector < sectors; sector++) {
+    AuditRecord record;
+    if (esp_partition_read(partition, sector * SPI_FLASH_SEC_SIZE, &record, sizeof(record)) != ESP_OK) continue;
+    if (record.seq == AUDIT_UNWRITTEN || record.crc != auditCrc(record)) continue;
+    if (offsetOf(record.seq) == sector * SPI_FLASH_SEC_SIZE && record.seq > newestFirst) {
+      newestFirst = record.seq;
+      newestSector = sector;
+    }
+  }
+  
+  if (newestFirst == 0) {
+    nextSeq = 1;
+    erasedLimit = 0;
+  } else {
+    // The first blank slot is next; a half-written one before it keeps its seq
+    nextSeq = newestFirst + SLOTS_PER_SECTOR;
+    for (uint16_t i = 1; i < SLOTS_PER_SECTOR; i++) {
+      if (isBlank(newestSector * SLOTS_PER_SECTOR + i)) {
+        nextSeq = newestFirst + i;
+        break;
+      }
+    }
+    erasedLimit = newestFirst + SLOTS_PER_SECTOR - 1;
+  }
+  
+  preferences.begin("audit_log", false);
+  logId = preferences.getUInt("log_id", 0);
+  acked = preferences.getUInt("acked", 0);
+  if (logId == 0 || acked >= nextSeq) {
+    // A new log, or the partition was wiped: its seqs start over, so the
+    // backend must not take them for the old log's
+    logId = esp_random() | 1;
+    acked = 0;
+    preferences.putUInt("log_id", logId);
+    preferences.putUInt("acked", acked);
+  }
+  boot = preferences.getUChar("boot", 0) + 1;
+  preferences.putUChar("boot", boot);
+  
+  // Nothing is waiting on the door yet, so the first erase can happen now
+  if (erasedLimit < nextSeq) {
+    eraseAhead();
+  }
+  
+  Serial.printf("[AUDIT] %u records, %u unsent, log %08x\n",
+                nextSeq - oldestSeq(), unsent(), logId);
+  return true;
+}
+
+bool AuditLog::append(AuditMethod method, bool granted, uint8_t source, uint16_t userId, uint32_t latencyMs) {
+  if (!partition) return false;
+  if (holdCount == AUDIT_HOLD_SIZE) {
+    counters.dropped++;
+    return false;
+  }
+  
+  uint32_t now = millis();
+  AuditRecord record;
+  record.seq = nextSeq;
+  record.time = wallTime != 0 ? wallTime + (now - wallSetAt) / 1000 : now / 1000;
+  record.userId = userId;
+  record.method = method;
+  record.flags = (granted ? AUDIT_GRANTED : 0) | (wallTime != 0 ? AUDIT_WALL_TIME : 0) |
+                 (source & 0x03) << AUDIT_SOURCE_SHIFT | (boot & 0x0F) << AUDIT_BOOT_SHIFT;
+  record.latencyMs = latencyMs > 0xFFFF ? 0xFFFF : latencyMs;
+  record.crc = auditCrc(record);
+  nextSeq++;
+  lastAppend = now;
+  counters.appended++;
+  
+  if (holdCount == 0 && record.seq <= erasedLimit) {
+    write(record);
+  } else {
+    // Its slot has not been erased yet; loop() writes it after the erase
+    hold[holdCount++] = record;
+    counters.held++;
+  }
+  return true;
+}
+
+void AuditLog::loop() {
+  if (!partition) return;
+  
+  // Keep a whole erased sector ahead of the writer, erasing once the door
+  // has been idle for a while; held records cannot wait for that
+  uint32_t nextSlotSeq = nextSeq - holdCount;
+  bool runwayShort = erasedLimit + 1 - nextSlotSeq < SLOTS_PER_SECTOR;
+  if (holdCount > 0 || (runwayShort && millis() - lastAppend >= AUDIT_ERASE_IDLE_MS)) {
+    eraseAhead();
+    for (uint8_t i = 0; i < holdCount; i++) {
+      write(hold[i]);
+    }
+    holdCount = 0;
+  }
+}
+
+void AuditLog::eraseAhead() {
+  uint32_t first = erasedLimit + 1;
+  // Unacknowledged records from the last lap that the erase takes with it
+  if (first > slots) {
+    uint32_t goneFrom = first - slots;
+    uint32_t goneTo = goneFrom + SLOTS_PER_SECTOR - 1;
+    if (goneFrom <= acked) goneFrom = acked + 1;
+    if (goneTo >= goneFrom) counters.overwritten += goneTo - goneFrom + 1;
+  }
+  esp_err_t err = esp_partition_erase_range(partition, offsetOf(first), SPI_FLASH_SEC_SIZE);
+  if (err != ESP_OK) {
+    Serial.printf("[AUDIT] Erase failed: %d\n", err);
+    return;
+  }
+  erasedLimit += SLOTS_PER_SECTOR;
+  counters.erases++;
+}
+
+void AuditLog::write(const AuditRecord& record) {
+  esp_err_t err = esp_partition_write(partition, offsetOf(record.seq), &record, sizeof(record));
+  if (err != ESP_OK) {
+    Serial.printf("[AUDIT] Write of %u failed: %d\n", record.seq, err);
+  }
+}
+
+bool AuditLog::isBlank(uint32_t slot) const {
+  uint32_t words[AUDIT_RECORD_SIZE / 4];
+  if (esp_partition_read(partition, slot * AUDIT_RECORD_SIZE, words, sizeof(words)) != ESP_OK) return false;
+  for (uint32_t word : words) {
+    if (word != AUDIT_UNWRITTEN) return false;
+  }
+  return true;
+}
+
+bool AuditLog::readRecord(uint32_t seq, AuditRecord& record) const {
+  return esp_partition_read(partition, offsetOf(seq), &record, sizeof(record)) == ESP_OK &&
+         record.seq == seq && record.crc == auditCrc(record);
+}
+
+// The erased sector ahead replaced the oldest records of the last lap
+uint32_t AuditLog::oldestSeq() const {
+  return erasedLimit >= slots ? erasedLimit - slots + 1 : 1;
+}
+
+uint32_t AuditLog::firstUnsent() const {
+  uint32_t oldest = oldestSeq();
+  return acked + 1 > oldest ? acked + 1 : oldest;
+}
+
+uint32_t AuditLog::unsent() const {
+  uint32_t from = firstUnsent();
+  return nextSeq > from ? nextSeq - from : 0;
+}
+
+bool AuditLog::pendingRange(uint32_t& from, uint32_t& to) const {
+  if (!partition) return false;
+  from = firstUnsent();
+  to = nextSeq - 1 - holdCount;
+  if (to < from) return false;
+  if (to - from >= AUDIT_BATCH_RECORDS) to = from + AUDIT_BATCH_RECORDS - 1;
+  return true;
+}
+
+size_t AuditLog::encodeBatch(uint32_t from, uint32_t to, uint8_t* out, size_t size) const {
+  if (!partition || size < sizeof(AuditBatchHeader)) return 0;
+  
+  AuditBatchHeader header;
+  header.magic = AUDIT_BATCH_MAGIC;
+  header.version = AUDIT_BATCH_VERSION;
+  header.boot = boot & 0x0F;
+  header.count = 0;
+  header.logId = logId;
+  header.firstSeq = from;
+  header.lastSeq = from - 1;
+  header.uptime = millis() / 1000;
+  
+  size_t length = sizeof(header);
+  uint32_t previousSeq = from - 1;
+  uint32_t previousTime = 0;
+  for (uint32_t seq = from; seq <= to && length + AUDIT_BATCH_RECORD_MAX <= size; seq++) {
+    header.lastSeq = seq;
+    // A record overwritten since the range was taken, or cut short by a
+    // reset, is left out and shows as a gap
+    AuditRecord record;
+    if (!readRecord(seq, record)) continue;
+    length += putAuditRecord(out + length, record, previousSeq, previousTime);
+    previousSeq = seq;
+    previousTime = record.time;
+    header.count++;
+  }
+  memcpy(out, &header, sizeof(header));
+  return length;
+}
+
+void AuditLog::acknowledge(uint32_t seq) {
+  if (seq <= acked || seq >= nextSeq) return;
+  acked = seq;
+  preferences.putUInt("acked", acked);
+}
+
+void AuditLog::setTime(uint32_t unixTime) {
+  wallTime = unixTime;
+  wallSetAt = millis();
+}
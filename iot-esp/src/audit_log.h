@@ -0,0 +1,110 @@
+#pragma once
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include <esp_partition.h>
+#include "audit_log_format.h"
+
+// The log starts erasing the sector ahead once no record has been appended
+// for this long, so the 40-50 ms erase lands between visitors
+#ifndef AUDIT_ERASE_IDLE_MS
+#define AUDIT_ERASE_IDLE_MS 2000
+#endif
+
+// Records that wait in RAM when a burst has used up the erased slots
+#ifndef AUDIT_HOLD_SIZE
+#define AUDIT_HOLD_SIZE 16
+#endif
+
+// Most records in one upload batch
+#ifndef AUDIT_BATCH_RECORDS
+#define AUDIT_BATCH_RECORDS 128
+#endif
+
+// How often unacknowledged records are uploaded while online
+#ifndef AUDIT_UPLOAD_PERIOD_MS
+#define AUDIT_UPLOAD_PERIOD_MS 30000
+#endif
+
+static const size_t AUDIT_BATCH_SIZE = sizeof(AuditBatchHeader) + AUDIT_BATCH_RECORDS * AUDIT_BATCH_RECORD_MAX;
+
+struct AuditLogStats {
+  uint32_t appended;     // since boot
+  uint32_t held;         // waited in RAM for an erase
+  uint32_t dropped;      // no erased slot and no room to hold them
+  uint32_t overwritten;  // never acknowledged before the ring came round
+  uint32_t erases;
+};
+
+// Append-only access log in the "auditlog" data partition (format in
+// audit_log_format.h). append() writes one 16-byte record into a slot that
+// was erased earlier, so the grant path costs a single flash write and
+// never an erase; loop() erases the sector ahead while the door is idle,
+// and a burst that outruns it waits in a small RAM queue. Each sector is
+// erased once per lap of the ring, which spreads wear evenly.
+//
+// Records stay until the ring comes round again. The backend acknowledges
+// uploads by seq and the cursor is kept in NVS; only records after it are
+// uploaded. append(), loop() and acknowledge() belong to the door task;
+// encodeBatch() only reads flash and runs on the network task.
+class AuditLog {
+public:
+  static const char* PARTITION;
+  
+  AuditLog();
+  
+  // Finds the newest record; false when there is no partition
+  bool begin();
+  
+  // O(1); false if the record was dropped
+  bool append(AuditMethod method, bool granted, uint8_t source, uint16_t userId, uint32_t latencyMs);
+  // Erases ahead of the writer and writes held records; call from loop()
+  void loop();
+  
+  // The next records to upload, at most AUDIT_BATCH_RECORDS; false if none
+  bool pendingRange(uint32_t& from, uint32_t& to) const;
+  // Builds the batch for [from, to] in out; returns its size
+  size_t encodeBatch(uint32_t from, uint32_t to, uint8_t* out, size_t size) const;
+  // The backend has everything up to and including seq
+  void acknowledge(uint32_t seq);
+  // Unix time from the backend; later records carry wall-clock time
+  void setTime(uint32_t unixTime);
+  
+  bool isReady() const { return partition != nullptr; }
+  uint32_t lastSeq() const { return nextSeq - 1; }
+  uint32_t acknowledged() const { return acked; }
+  uint32_t unsent() const;
+  uint32_t capacity() const { return slots; }
+  const AuditLogStats& stats() const { return counters; }
+
+private:
+  static const uint16_t SLOTS_PER_SECTOR = SPI_FLASH_SEC_SIZE / AUDIT_RECORD_SIZE;
+  
+  const esp_partition_t* partition;
+  Preferences preferences;
+  uint32_t slots;
+  uint32_t logId;
+  uint8_t boot;
+  
+  uint32_t nextSeq;      // seq the next record gets
+  uint32_t erasedLimit;  // last seq whose slot is erased and waiting
+  uint32_t acked;
+  uint32_t lastAppend;
+  uint32_t wallTime;     // Unix time at wallSetAt, 0 = unknown
+  uint32_t wallSetAt;
+  
+  AuditRecord hold[AUDIT_HOLD_SIZE];
+  uint8_t holdCount;
+  
+  AuditLogStats counters;
+  
+  size_t offsetOf(uint32_t seq) const { return ((seq - 1) % slots) * AUDIT_RECORD_SIZE; }
+  uint32_t oldestSeq() const;
+  uint32_t firstUnsent() const;
+  bool readRecord(uint32_t seq, AuditRecord& record) const;
+  bool isBlank(uint32_t slot) const;
+  void write(const AuditRecord& record);
+  void eraseAhead();
+};
+
+extern AuditLog auditLog;
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "input_trace_format.h"
+
+// Audit records in the "auditlog" partition and the batches they are
+// uploaded in. Plain C++ with no Arduino dependency, so the host simulator's
+// backend decodes batches with the same definitions.
+//
+// The partition is a ring of 16-byte records: record n (numbered from 1)
+// lives in slot (n - 1) % slots, so the ring is written front to back and
+// every sector is erased once per lap. A slot reads all 0xFF until it is
+// written; a record whose CRC does not match was cut short by a reset.
+
+static const uint16_t AUDIT_RECORD_SIZE = 16;
+static const uint32_t AUDIT_UNWRITTEN = 0xFFFFFFFF;
+
+enum AuditMethod : uint8_t {
+  AUDIT_PIN = 1,
+  AUDIT_NFC = 2,
+  AUDIT_REMOTE = 3   // mytopic/open
+};
+
+// flags
+static const uint8_t AUDIT_GRANTED = 0x01;
+static const uint8_t AUDIT_WALL_TIME = 0x02;   // time is Unix seconds, else seconds since boot
+static const uint8_t AUDIT_SOURCE_SHIFT = 2;   // 2 bits of VerdictSource
+static const uint8_t AUDIT_BOOT_SHIFT = 4;     // low 4 bits of the boot count
+
+struct __attribute__((packed)) AuditRecord {
+  uint32_t seq;
+  uint32_t time;
+  uint16_t userId;     // 0 unless a local user was matched
+  uint8_t method;
+  uint8_t flags;
+  uint16_t latencyMs;  // last input until the verdict
+  uint16_t crc;        // CRC-16/CCITT-FALSE over the bytes before it
+};
+
+static_assert(sizeof(AuditRecord) == AUDIT_RECORD_SIZE, "audit record layout");
+
+inline uint16_t auditCrc(const AuditRecord& record) {
+  const uint8_t* bytes = (const uint8_t*)&record;
+  uint16_t crc = 0xFFFF;
+  for (size_t i = 0; i < offsetof(AuditRecord, crc); i++) {
+    crc ^= (uint16_t)bytes[i] << 8;
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+// An upload batch (POST /api/esp32/audit, application/octet-stream):
+//
+//   header | record | record | ...
+//
+// Each record is the seq difference to the previous one (the first to
+// header.firstSeq - 1), the time as a zigzag difference to the previous
+// record's (the first to 0), the user ID, method, flags and latency; all
+// varints (see input_trace_format.h) but method and flags, which are one
+// byte each. A run of records from one door takes 5-7 bytes each instead
+// of 16.
+static const uint32_t AUDIT_BATCH_MAGIC = 0x42445541;  // "AUDB"
+static const uint8_t AUDIT_BATCH_VERSION = 1;
+
+struct __attribute__((packed)) AuditBatchHeader {
+  uint32_t magic;
+  uint8_t version;
+  uint8_t boot;        // low 4 bits of the door's boot count now
+  uint16_t count;
+  uint32_t logId;      // changes when the log is wiped, so seqs can repeat
+  uint32_t firstSeq;
+  uint32_t lastSeq;    // the batch covers firstSeq..lastSeq; seqs missing are gone
+  uint32_t uptime;     // the door's seconds since boot when it was built
+};
+
+static_assert(sizeof(AuditBatchHeader) == 24, "audit batch header layout");
+
+// Most a record can take in a batch
+static const uint8_t AUDIT_BATCH_RECORD_MAX = 5 + 5 + 3 + 1 + 1 + 3;
+
+inline size_t putAuditRecord(uint8_t* out, const AuditRecord& record, uint32_t previousSeq, uint32_t previousTime) {
+  size_t length = putTraceVarint(out, record.seq - previousSeq);
+  int64_t timeDelta = (int64_t)record.time - previousTime;
+  length += putTraceVarint(out + length, timeDelta >= 0 ? (uint64_t)timeDelta << 1 : ((uint64_t)-timeDelta << 1) - 1);
+  length += putTraceVarint(out + length, record.userId);
+  out[length++] = record.method;
+  out[length++] = record.flags;
+  length += putTraceVarint(out + length, record.latencyMs);
+  return length;
+}
+
+// Reads one record from [at, end); false if it runs past end
+inline bool getAuditRecord(const uint8_t*& at, const uint8_t* end, AuditRecord& record,
+                           uint32_t previousSeq, uint32_t previousTime) {
+  uint64_t seqDelta, timeDelta, userId, latency;
+  if (!getTraceVarint(at, end, seqDelta) || !getTraceVarint(at, end, timeDelta) ||
+      !getTraceVarint(at, end, userId) || end - at < 2) {
+    return false;
+  }
+  record.method = *at++;
+  record.flags = *at++;
+  if (!getTraceVarint(at, end, latency)) return false;
+  record.seq = previousSeq + (uint32_t)seqDelta;
+  int64_t time = timeDelta & 1 ? -(int64_t)((timeDelta + 1) >> 1) : (int64_t)(timeDelta >> 1);
+  record.time = (uint32_t)(previousTime + time);
+  record.userId = userId;
+  record.latencyMs = latency;
+  return true;
+}
@@ -0,0 +1,184 @@
+#include "auth_pipeline.h"
+#include "network.h"
+#include "scheduler.h"
+#include "latency_trace.h"
+#include "memory_telemetry.h"
+
+AuthPipeline authPipeline;
+
+AuthPipeline::AuthPipeline() {
+  handler = nullptr;
+  isOnline = false;
+  onlineDeadline = AUTH_ONLINE_DEADLINE_MS;
+  raceActive = false;
+  raceRequestId = 0;
+  raceKind = CREDENTIAL_PIN;
+  raceMessage = AUTH_MSG_NONE;
+  lateRequestId = 0;
+  lateKind = CREDENTIAL_PIN;
+  for (uint8_t i = 0; i < MAX_CONFIRMATIONS; i++) {
+    confirmations[i] = 0;
+  }
+  nextConfirmation = 0;
+  memset(&stats, 0, sizeof(stats));
+}
+
+void AuthPipeline::begin(VerdictHandler verdictHandler) {
+  handler = verdictHandler;
+}
+
+bool AuthPipeline::submitPin(const String& pin, const uint8_t* pinDigest) {
+  MemoryScope scope(MEM_AUTH);
+  uint32_t lookupUs = LatencyTrace::now();
+  AuthResult local = offlineAuth.authenticatePinDigest(pinDigest);
+  latencyTrace.record(STAGE_LOOKUP, lookupUs);
+  return decide(local, CREDENTIAL_PIN, pin, pinDigest);
+}
+
+bool AuthPipeline::submitCard(const String& uid) {
+  MemoryScope scope(MEM_AUTH);
+  uint8_t uidDigest[VerdictCache::DIGEST_LEN];
+  uint32_t hashUs = LatencyTrace::now();
+  OfflineAuth::sha256((const uint8_t*)uid.c_str(), uid.length(), uidDigest);
+  latencyTrace.record(STAGE_HASH, hashUs);
+  
+  uint8_t uidBytes[UserHotRecord::MAX_UID_LEN];
+  uint8_t uidLen = UserStore::parseUid(uid.c_str(), uidBytes);
+  uint32_t lookupUs = LatencyTrace::now();
+  AuthResult local = offlineAuth.authenticateNfc(uidBytes, uidLen);
+  latencyTrace.record(STAGE_LOOKUP, lookupUs);
+  return decide(local, CREDENTIAL_NFC, uid, uidDigest);
+}
+
+bool AuthPipeline::decide(const AuthResult& local, CredentialKind kind, const String& credential, const uint8_t* digest) {
+  // A new credential supersedes whatever was still racing
+  if (raceActive) {
+    retireRace();
+    scheduler.cancel(deadlineExpired);
+  }
+  
+  if (local.success) {
+    deliver(true, kind, VERDICT_LOCAL, local.userId, local.message);
+    
+    // Ask the server anyway, for the audit trail only
+    if (isOnline) {
+      uint16_t requestId = sendCredentialCommand(NET_VERIFY, credential.c_str(), credential.length());
+      if (requestId != 0) {
+        confirmations[nextConfirmation] = requestId;
+        nextConfirmation = (nextConfirmation + 1) % MAX_CONFIRMATIONS;
+      }
+    }
+    return true;
+  }
+  
+  // The server ruled on this credential recently: no round trip, works offline
+  bool cachedGrant;
+  if (verdictCache.lookup(kind, digest, cachedGrant)) {
+    if (cachedGrant) {
+      offlineAuth.resetFailedAttempts();
+      deliver(true, kind, VERDICT_CACHED, 0, AUTH_MSG_ONLINE_OK);
+    } else {
+      deliver(false, kind, VERDICT_CACHED, 0, local.message);
+    }
+    return true;
+  }
+  
+  uint16_t requestId = isOnline ? sendCredentialCommand(NET_UNLOCK, credential.c_str(), credential.length()) : 0;
+  if (requestId == 0) {
+    deliver(false, kind, VERDICT_LOCAL, 0, local.message);
+    return true;
+  }
+  
+  // Unknown locally: give the server until the deadline
+  raceActive = true;
+  raceRequestId = requestId;
+  raceKind = kind;
+  raceMessage = local.message;
+  memcpy(raceDigest, digest, VerdictCache::DIGEST_LEN);
+  scheduler.after(onlineDeadline, deadlineExpired);
+  return false;
+}
+
+void AuthPipeline::onOnlineVerdict(const DoorEvent& event) {
+  if (event.reached) {
+    latencyTrace.add(STAGE_HTTP, event.elapsedUs);
+  }
+  
+  if (raceActive && event.requestId == raceRequestId) {
+    raceActive = false;
+    scheduler.cancel(deadlineExpired);
+    if (!event.reached) {
+      stats.unreachable++;
+    } else if (event.cacheMs > 0) {
+      verdictCache.store(raceKind, raceDigest, event.success, event.cacheMs);
+    }
+    
+    if (event.success) {
+      stats.onlineGrants++;
+      // The local miss counted as a failure; the server says it was fine
+      offlineAuth.resetFailedAttempts();
+      deliver(true, raceKind, VERDICT_ONLINE, 0, AUTH_MSG_ONLINE_OK);
+    } else {
+      deliver(false, raceKind, event.reached ? VERDICT_ONLINE : VERDICT_DEADLINE, 0, raceMessage);
+    }
+    return;
+  }
+  
+  if (event.requestId != 0 && event.requestId == lateRequestId) {
+    lateRequestId = 0;
+    stats.lateVerdicts++;
+    // Too late for this attempt, but the next one can use it
+    if (event.reached && event.cacheMs > 0) {
+      verdictCache.store(lateKind, lateDigest, event.success, event.cacheMs);
+    }
+    Serial.printf("[AUTH] Late online verdict: %s\n", event.success ? "granted" : "denied");
+    return;
+  }
+  
+  if (takeConfirmation(event.requestId)) {
+    if (!event.reached) {
+      stats.unreachable++;
+    } else if (event.success) {
+      stats.confirmed++;
+    } else {
+      stats.disputed++;
+      Serial.println("[AUTH] Server rejected a credential granted offline");
+    }
+  }
+}
+
+void AuthPipeline::deadlineExpired() {
+  AuthPipeline& pipeline = authPipeline;
+  if (!pipeline.raceActive) return;
+  
+  Serial.println("[AUTH] Online check missed the deadline");
+  pipeline.retireRace();
+  pipeline.deliver(false, pipeline.raceKind, VERDICT_DEADLINE, 0, pipeline.raceMessage);
+}
+
+// Keeps the race's request around so a verdict arriving after it can still
+// be cached
+void AuthPipeline::retireRace() {
+  raceActive = false;
+  lateRequestId = raceRequestId;
+  lateKind = raceKind;
+  memcpy(lateDigest, raceDigest, VerdictCache::DIGEST_LEN);
+}
+
+bool AuthPipeline::takeConfirmation(uint16_t requestId) {
+  if (requestId == 0) return false;
+  for (uint8_t i = 0; i < MAX_CONFIRMATIONS; i++) {
+    if (confirmations[i] == requestId) {
+      confirmations[i] = 0;
+      return true;
+    }
+  }
+  return false;
+}
+
+void AuthPipeline::deliver(bool granted, CredentialKind kind, VerdictSource source, uint16_t userId, AuthMessage message) {
+  AuthVerdict verdict = {granted, kind, source, userId, message};
+  if (handler) {
+    handler(verdict);
+  }
+}
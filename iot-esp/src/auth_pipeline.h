@@ -0,0 +1,100 @@
+#pragma once
+
+#include <Arduino.h>
+#include "offline_auth.h"
+#include "events.h"
+#include "verdict_cache.h"
+
+// How long a credential the local store does not know may wait for the
+// server before it is denied
+#ifndef AUTH_ONLINE_DEADLINE_MS
+#define AUTH_ONLINE_DEADLINE_MS 1500
+#endif
+
+enum CredentialKind : uint8_t {
+  CREDENTIAL_PIN,
+  CREDENTIAL_NFC
+};
+
+enum VerdictSource : uint8_t {
+  VERDICT_LOCAL,    // decided by the offline store
+  VERDICT_ONLINE,   // unknown locally, accepted or rejected by the server
+  VERDICT_CACHED,   // unknown locally, recent server verdict from verdictCache
+  VERDICT_DEADLINE  // unknown locally, server too slow or unreachable
+};
+
+struct AuthVerdict {
+  bool granted;
+  CredentialKind kind;
+  VerdictSource source;
+  uint16_t userId;  // 0 unless granted locally
+  AuthMessage message;  // authMessageText() for the LCD
+};
+
+// Online confirmations, for the admin status report
+struct OnlineAuditStats {
+  uint32_t confirmed;     // server agreed with a local grant
+  uint32_t disputed;      // server rejected a local grant
+  uint32_t onlineGrants;  // unknown locally, granted by the server in time
+  uint32_t lateVerdicts;  // answered after the deadline had already denied
+  uint32_t unreachable;   // no answer from the server at all
+};
+
+// Offline-first authentication. Every PIN and card is decided from the
+// local store on the spot. Credentials the store rejects are answered from
+// verdictCache when the server has ruled on them recently, otherwise raced
+// against the server up to the deadline; local grants are still sent to
+// the server afterwards so its answer can be audited, but the door never
+// waits for it.
+class AuthPipeline {
+public:
+  typedef void (*VerdictHandler)(const AuthVerdict& verdict);
+  
+  AuthPipeline();
+  
+  void begin(VerdictHandler handler);
+  void setOnline(bool online) { isOnline = online; }
+  void setOnlineDeadline(uint32_t ms) { onlineDeadline = ms; }
+  
+  // Return true if the verdict was delivered immediately, false while an
+  // online check is racing the deadline
+  bool submitPin(const String& pin, const uint8_t* pinDigest);
+  bool submitCard(const String& uid);
+  bool isChecking() const { return raceActive; }
+  
+  // DOOR_ONLINE_VERDICT events from the network task
+  void onOnlineVerdict(const DoorEvent& event);
+  
+  const OnlineAuditStats& auditStats() const { return stats; }
+
+private:
+  static const uint8_t MAX_CONFIRMATIONS = 4;
+  
+  VerdictHandler handler;
+  bool isOnline;
+  uint32_t onlineDeadline;
+  
+  // The one credential currently racing the server
+  bool raceActive;
+  uint16_t raceRequestId;
+  CredentialKind raceKind;
+  AuthMessage raceMessage;
+  uint8_t raceDigest[VerdictCache::DIGEST_LEN];
+  uint16_t lateRequestId;
+  CredentialKind lateKind;
+  uint8_t lateDigest[VerdictCache::DIGEST_LEN];
+  
+  // Local grants waiting for the server's opinion
+  uint16_t confirmations[MAX_CONFIRMATIONS];
+  uint8_t nextConfirmation;
+  
+  OnlineAuditStats stats;
+  
+  bool decide(const AuthResult& local, CredentialKind kind, const String& credential, const uint8_t* digest);
+  void retireRace();
+  void deliver(bool granted, CredentialKind kind, VerdictSource source, uint16_t userId, AuthMessage message);
+  bool takeConfirmation(uint16_t requestId);
+  static void deadlineExpired();
+};
+
+extern AuthPipeline authPipeline;
@@ -0,0 +1,85 @@
+#include "backend_client.h"
+
+BackendClient::BackendClient(const char* host, uint16_t port, const char* authToken)
+  : host(host), port(port), authToken(authToken), reused(0), reopened(0) {
+  connectTimeout = 1000;
+  responseTimeout = 3000;
+  preconnected = false;
+}
+
+void BackendClient::setTimeouts(uint16_t connectMs, uint16_t responseMs) {
+  connectTimeout = connectMs;
+  responseTimeout = responseMs;
+}
+
+bool BackendClient::preconnect() {
+  if (tcp.connected()) return true;
+  
+  // Counted against the request that uses it, in begin()
+  preconnected = tcp.connect(host, port, connectTimeout);
+  return preconnected;
+}
+
+void BackendClient::close() {
+  http.end();
+  tcp.stop();
+}
+
+void BackendClient::begin(const char* path) {
+  // HTTPClient keeps the socket open across end() when reuse is on, and
+  // begin() on a still-connected client skips the handshake. Each request
+  // is counted once; one on a socket preconnect() just opened had to reopen.
+  if (tcp.connected() && !preconnected) {
+    reused.fetch_add(1, std::memory_order_relaxed);
+  } else {
+    reopened.fetch_add(1, std::memory_order_relaxed);
+  }
+  preconnected = false;
+  
+  http.setReuse(true);
+  http.setConnectTimeout(connectTimeout);
+  http.setTimeout(responseTimeout);
+  http.begin(tcp, host, port, path);
+  http.addHeader("Authorization", authToken);
+}
+
+int BackendClient::finish(int code, String* response) {
+  if (code > 0 && response) {
+    *response = http.getString();
+  }
+  // Always end, so the connection goes back for reuse (or is dropped on error)
+  http.end();
+  if (code <= 0) {
+    tcp.stop();
+  }
+  return code;
+}
+
+int BackendClient::post(const char* path, const String& body, String* response) {
+  begin(path);
+  http.addHeader("Content-Type", "application/json");
+  return finish(http.POST(body), response);
+}
+
+int BackendClient::post(const char* path, const uint8_t* body, size_t length, String* response) {
+  begin(path);
+  http.addHeader("Content-Type", "application/octet-stream");
+  return finish(http.POST((uint8_t*)body, length), response);
+}
+
+int BackendClient::get(const char* path, String* response) {
+  begin(path);
+  return finish(http.GET(), response);
+}
+
+int BackendClient::get(const char* path, Stream& sink) {
+  begin(path);
+  int code = http.GET();
+  if (code == HTTP_CODE_OK) {
+    int written = http.writeToStream(&sink);
+    if (written < 0) {
+      code = written;
+    }
+  }
+  return finish(code, nullptr);
+}
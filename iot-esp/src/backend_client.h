@@ -0,0 +1,51 @@
+#pragma once
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <HTTPClient.h>
+#include <atomic>
+
+// Long-lived HTTP client for the backend API. One TCP connection is kept
+// open with HTTP keep-alive and reused by every request, so an unlock check
+// costs one round trip instead of a handshake plus a round trip. Only used
+// from the network task; the counters may be read from anywhere.
+class BackendClient {
+public:
+  BackendClient(const char* host, uint16_t port, const char* authToken);
+  
+  // Connect and response timeouts bound how long one request can hold up
+  // the network task
+  void setTimeouts(uint16_t connectMs, uint16_t responseMs);
+  
+  // Opens the connection ahead of a request (e.g. on the first keypad digit)
+  bool preconnect();
+  void close();
+  
+  // Return the HTTP status code, or a negative HTTPClient error
+  int post(const char* path, const String& body, String* response = nullptr);
+  // Binary body, sent as application/octet-stream
+  int post(const char* path, const uint8_t* body, size_t length, String* response = nullptr);
+  int get(const char* path, String* response = nullptr);
+  // Streams a 200 response body into sink through a small fixed buffer
+  int get(const char* path, Stream& sink);
+  
+  uint32_t reusedCount() const { return reused.load(std::memory_order_relaxed); }
+  uint32_t reopenedCount() const { return reopened.load(std::memory_order_relaxed); }
+
+private:
+  const char* host;
+  uint16_t port;
+  const char* authToken;
+  uint16_t connectTimeout;
+  uint16_t responseTimeout;
+  bool preconnected;  // opened by preconnect(), no request on it yet
+  
+  WiFiClient tcp;
+  HTTPClient http;
+  
+  std::atomic<uint32_t> reused;
+  std::atomic<uint32_t> reopened;
+  
+  void begin(const char* path);
+  int finish(int code, String* response);
+};
@@ -0,0 +1,327 @@
+#include "credential_image.h"
+#include <mbedtls/md.h>
+#include <atomic>
+
+const char* CredentialImage::PARTITION = "authimg";
+
+// Slot the door task has mapped, -1 for none; the writer never erases it
+static std::atomic<int8_t> mountedSlot(-1);
+// Revision of that image; the writer refuses anything older
+static std::atomic<uint32_t> mountedRevision(0);
+
+static const esp_partition_t* findImagePartition() {
+  return esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY,
+                                  CredentialImage::PARTITION);
+}
+
+// HMAC-SHA256 as the tool signs it: the header with generation and
+// signature zeroed, then everything after the header
+class ImageMac {
+public:
+  ImageMac(const CredentialImageHeader& header) {
+    mbedtls_md_init(&ctx);
+    mbedtls_md_setup(&ctx, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 1);
+    mbedtls_md_hmac_starts(&ctx, (const unsigned char*)CREDENTIAL_IMAGE_KEY, strlen(CREDENTIAL_IMAGE_KEY));
+    
+    CredentialImageHeader signedHeader = header;
+    signedHeader.generation = 0;
+    memset(signedHeader.signature, 0, sizeof(signedHeader.signature));
+    mbedtls_md_hmac_update(&ctx, (const unsigned char*)&signedHeader, sizeof(signedHeader));
+  }
+  
+  ~ImageMac() {
+    mbedtls_md_free(&ctx);
+  }
+  
+  void update(const uint8_t* data, size_t length) {
+    mbedtls_md_hmac_update(&ctx, data, length);
+  }
+  
+  bool matches(const uint8_t* signature) {
+    uint8_t mac[32];
+    mbedtls_md_hmac_finish(&ctx, mac);
+    // Constant time, so a forged image learns nothing from the timing
+    uint8_t diff = 0;
+    for (uint8_t i = 0; i < sizeof(mac); i++) {
+      diff |= mac[i] ^ signature[i];
+    }
+    return diff == 0;
+  }
+
+private:
+  mbedtls_md_context_t ctx;
+};
+
+CredentialImage::CredentialImage() {
+  partition = nullptr;
+  mapped = nullptr;
+  mapHandle = 0;
+  header = nullptr;
+  users = nullptr;
+  pins = nullptr;
+  nfcs = nullptr;
+  slot = 0;
+}
+
+CredentialImage::~CredentialImage() {
+  end();
+}
+
+uint32_t CredentialImage::slotSize(const esp_partition_t* partition) {
+  return (partition->size / 2) & ~(uint32_t)(SPI_FLASH_SEC_SIZE - 1);
+}
+
+bool CredentialImage::verify(const CredentialImageHeader& header, const uint8_t* image) {
+  ImageMac mac(header);
+  mac.update(image + header.headerSize, header.imageSize - header.headerSize);
+  return mac.matches(header.signature);
+}
+
+bool CredentialImage::begin() {
+  end();
+  
+  partition = findImagePartition();
+  if (!partition) {
+    Serial.println("[IMAGE] No authimg partition");
+    return false;
+  }
+  
+  const void* pointer = nullptr;
+#if ESP_IDF_VERSION_MAJOR >= 5
+  esp_err_t err = esp_partition_mmap(partition, 0, partition->size, ESP_PARTITION_MMAP_DATA, &pointer, &mapHandle);
+#else
+  esp_err_t err = esp_partition_mmap(partition, 0, partition->size, SPI_FLASH_MMAP_DATA, &pointer, &mapHandle);
+#endif
+  if (err != ESP_OK) {
+    Serial.printf("[IMAGE] Failed to map partition: %d\n", err);
+    return false;
+  }
+  mapped = (const uint8_t*)pointer;
+  
+  // Newest slot with a valid signature wins; a slot whose header was never
+  // written (interrupted install) is still erased and fails the magic check
+  uint32_t size = slotSize(partition);
+  int8_t best = -1;
+  for (uint8_t candidate = 0; candidate < 2; candidate++) {
+    const uint8_t* base = mapped + candidate * size;
+    const CredentialImageHeader* slotHeader = (const CredentialImageHeader*)base;
+    if (!isImageLayoutValid(*slotHeader, size) || !verify(*slotHeader, base)) {
+      continue;
+    }
+    if (best < 0 || slotHeader->generation > ((const CredentialImageHeader*)(mapped + best * size))->generation) {
+      best = candidate;
+    }
+  }
+  
+  if (best < 0) {
+    Serial.println("[IMAGE] No valid credential image");
+    end();
+    return false;
+  }
+  
+  slot = best;
+  const uint8_t* base = mapped + slot * size;
+  header = (const CredentialImageHeader*)base;
+  users = (const CredentialImageUser*)(base + header->userOffset);
+  pins = (const CredentialImagePin*)(base + header->pinOffset);
+  nfcs = (const CredentialImageNfc*)(base + header->nfcOffset);
+  mountedRevision.store(header->revision);
+  mountedSlot.store(slot);
+  
+  Serial.printf("[IMAGE] Mounted slot %u: generation %u, revision %u, %u users\n",
+                slot, header->generation, header->revision, header->userCount);
+  return true;
+}
+
+void CredentialImage::end() {
+  if (mapped) {
+#if ESP_IDF_VERSION_MAJOR >= 5
+    esp_partition_munmap(mapHandle);
+#else
+    spi_flash_munmap(mapHandle);
+#endif
+  }
+  mapped = nullptr;
+  mapHandle = 0;
+  header = nullptr;
+  users = nullptr;
+  pins = nullptr;
+  nfcs = nullptr;
+  mountedSlot.store(-1);
+}
+
+bool CredentialImage::invalidate() {
+  end();
+  partition = findImagePartition();
+  if (!partition) {
+    return true;
+  }
+  
+  // Erasing the first sector of each slot removes both headers
+  uint32_t size = slotSize(partition);
+  return esp_partition_erase_range(partition, 0, SPI_FLASH_SEC_SIZE) == ESP_OK &&
+         esp_partition_erase_range(partition, size, SPI_FLASH_SEC_SIZE) == ESP_OK;
+}
+
+uint16_t CredentialImage::findPin(const uint8_t* digest) const {
+  if (!header) return NO_USER;
+  
+  uint32_t low = 0;
+  uint32_t high = header->pinCount;
+  while (low < high) {
+    uint32_t mid = (low + high) / 2;
+    int order = memcmp(pins[mid].digest, digest, CREDENTIAL_IMAGE_DIGEST_LEN);
+    if (order == 0) return pins[mid].user;
+    if (order < 0) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return NO_USER;
+}
+
+uint16_t CredentialImage::findNfc(const uint8_t* uid, uint8_t uidLen) const {
+  if (!header) return NO_USER;
+  
+  uint32_t low = 0;
+  uint32_t high = header->nfcCount;
+  while (low < high) {
+    uint32_t mid = (low + high) / 2;
+    int order = compareImageUid(nfcs[mid].uid, nfcs[mid].uidLen, uid, uidLen);
+    if (order == 0) return nfcs[mid].user;
+    if (order < 0) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return NO_USER;
+}
+
+const CredentialImageUser* CredentialImage::user(uint16_t index) const {
+  if (!header || index >= header->userCount) return nullptr;
+  return &users[index];
+}
+
+CredentialImageWriter::CredentialImageWriter() {
+  partition = nullptr;
+  slotBase = 0;
+  slotLimit = 0;
+  generation = 0;
+  received = 0;
+  failed = true;
+}
+
+bool CredentialImageWriter::begin() {
+  received = 0;
+  failed = true;
+  memset(&header, 0, sizeof(header));
+  
+  partition = findImagePartition();
+  if (!partition) {
+    Serial.println("[IMAGE] No authimg partition");
+    return false;
+  }
+  
+  // Only the headers are read; a slot with a broken body simply loses
+  uint32_t size = CredentialImage::slotSize(partition);
+  uint32_t generations[2] = {0, 0};
+  for (uint8_t candidate = 0; candidate < 2; candidate++) {
+    CredentialImageHeader slotHeader;
+    if (esp_partition_read(partition, candidate * size, &slotHeader, sizeof(slotHeader)) == ESP_OK &&
+        isImageLayoutValid(slotHeader, size)) {
+      generations[candidate] = slotHeader.generation;
+    }
+  }
+  
+  // Never overwrite the slot the door is reading; otherwise the older one
+  int8_t inUse = mountedSlot.load();
+  uint8_t target;
+  if (inUse >= 0) {
+    target = inUse == 0 ? 1 : 0;
+  } else {
+    target = generations[0] <= generations[1] ? 0 : 1;
+  }
+  
+  slotBase = target * size;
+  slotLimit = size;
+  generation = (generations[0] > generations[1] ? generations[0] : generations[1]) + 1;
+  if (esp_partition_erase_range(partition, slotBase, size) != ESP_OK) {
+    Serial.println("[IMAGE] Failed to erase slot");
+    return false;
+  }
+  
+  failed = false;
+  return true;
+}
+
+size_t CredentialImageWriter::write(uint8_t c) {
+  return write(&c, 1);
+}
+
+size_t CredentialImageWriter::write(const uint8_t* buffer, size_t size) {
+  if (failed) return 0;
+  
+  size_t consumed = 0;
+  // The header stays in RAM until commit()
+  if (received < sizeof(header)) {
+    consumed = sizeof(header) - received;
+    if (consumed > size) consumed = size;
+    memcpy((uint8_t*)&header + received, buffer, consumed);
+    received += consumed;
+  }
+  
+  size_t remaining = size - consumed;
+  if (remaining == 0) return size;
+  
+  if (received + remaining > slotLimit ||
+      esp_partition_write(partition, slotBase + received, buffer + consumed, remaining) != ESP_OK) {
+    failed = true;
+    return 0;
+  }
+  received += remaining;
+  return size;
+}
+
+bool CredentialImageWriter::commit() {
+  if (failed || received != header.imageSize || !isImageLayoutValid(header, slotLimit)) {
+    Serial.printf("[IMAGE] Incomplete image: %u bytes\n", received);
+    return false;
+  }
+  
+  // Check the body as it landed in flash, not as it came off the wire
+  ImageMac mac(header);
+  uint8_t chunk[256];
+  for (uint32_t offset = header.headerSize; offset < header.imageSize; offset += sizeof(chunk)) {
+    uint32_t length = header.imageSize - offset;
+    if (length > sizeof(chunk)) length = sizeof(chunk);
+    if (esp_partition_read(partition, slotBase + offset, chunk, length) != ESP_OK) {
+      return false;
+    }
+    mac.update(chunk, length);
+  }
+  if (!mac.matches(header.signature)) {
+    Serial.println("[IMAGE] Signature mismatch, image rejected");
+    return false;
+  }
+  
+  // A signed but older image would bring back users removed since
+  if (mountedSlot.load() >= 0 && header.revision < mountedRevision.load()) {
+    Serial.printf("[IMAGE] Revision %u is older than mounted %u, image rejected\n",
+                  header.revision, mountedRevision.load());
+    return false;
+  }
+  
+  // The one write that makes the new roster live
+  header.generation = generation;
+  if (esp_partition_write(partition, slotBase, &header, sizeof(header)) != ESP_OK) {
+    Serial.println("[IMAGE] Failed to write header");
+    return false;
+  }
+  
+  Serial.printf("[IMAGE] Installed generation %u (%u users, %u bytes)\n",
+                generation, header.userCount, header.imageSize);
+  failed = true;
+  return true;
+}
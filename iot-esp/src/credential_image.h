@@ -0,0 +1,105 @@
+#pragma once
+
+#include <Arduino.h>
+#include <esp_partition.h>
+#include <esp_idf_version.h>
+#include "credential_image_format.h"
+
+// HMAC key images are signed with; must match the key given to
+// tools/credential_image_tool. There is no default: a key anyone can read
+// in the source signs images anyone can forge. Set it with a build flag,
+// e.g. -DCREDENTIAL_IMAGE_KEY=\"...\"
+#ifndef CREDENTIAL_IMAGE_KEY
+#error "CREDENTIAL_IMAGE_KEY is not set; add it to the build flags"
+#endif
+
+#if ESP_IDF_VERSION_MAJOR >= 5
+typedef esp_partition_mmap_handle_t CredentialImageMapHandle;
+#else
+typedef spi_flash_mmap_handle_t CredentialImageMapHandle;
+#endif
+
+// Read-only credential image in the "authimg" data partition, built on a
+// host by tools/credential_image_tool from a user export. The partition is
+// split into two slots; the newest slot whose signature checks out is
+// memory-mapped and searched in place, so mounting costs one signature
+// check and no RAM per user however large the roster is.
+class CredentialImage {
+public:
+  static const uint16_t NO_USER = 0xFFFF;
+  static const char* PARTITION;
+  
+  CredentialImage();
+  ~CredentialImage();
+  
+  // Maps the partition and mounts the newest valid slot; false when there
+  // is no partition or no valid image
+  bool begin();
+  void end();
+  // Erases both slots (factory reset)
+  bool invalidate();
+  
+  bool isMounted() const { return header != nullptr; }
+  uint8_t activeSlot() const { return slot; }
+  uint32_t generation() const { return header ? header->generation : 0; }
+  uint32_t revision() const { return header ? header->revision : 0; }
+  uint16_t userCount() const { return header ? header->userCount : 0; }
+  
+  // Binary searches over the mapped tables; return a user index or NO_USER
+  uint16_t findPin(const uint8_t* digest) const;
+  uint16_t findNfc(const uint8_t* uid, uint8_t uidLen) const;
+  const CredentialImageUser* user(uint16_t index) const;
+  
+  static uint32_t slotSize(const esp_partition_t* partition);
+  // Checks the HMAC of an image whose tables follow header in memory
+  static bool verify(const CredentialImageHeader& header, const uint8_t* image);
+
+private:
+  const esp_partition_t* partition;
+  const uint8_t* mapped;
+  CredentialImageMapHandle mapHandle;
+  
+  const CredentialImageHeader* header;
+  const CredentialImageUser* users;
+  const CredentialImagePin* pins;
+  const CredentialImageNfc* nfcs;
+  uint8_t slot;
+};
+
+// Installs a downloaded image into the slot the door is not using. The
+// body is written as it arrives but the header is held back until the
+// whole image has been read back and its signature checked; the header
+// then goes in with the next generation number. Until that single write
+// lands the old image remains the newest valid slot, so a power cut or a
+// bad download never leaves the door without a roster. Used from the
+// network task as the sink of BackendClient::get().
+class CredentialImageWriter : public Stream {
+public:
+  CredentialImageWriter();
+  
+  // Picks and erases the target slot
+  bool begin();
+  // Verifies what was written and activates it; an image older than the
+  // mounted one's revision is refused
+  bool commit();
+  
+  uint32_t bytesWritten() const { return received; }
+  uint32_t installedGeneration() const { return generation; }
+  
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t* buffer, size_t size) override;
+  
+  // Write-only
+  int available() override { return 0; }
+  int read() override { return -1; }
+  int peek() override { return -1; }
+
+private:
+  const esp_partition_t* partition;
+  uint32_t slotBase;
+  uint32_t slotLimit;
+  uint32_t generation;
+  CredentialImageHeader header;
+  uint32_t received;
+  bool failed;
+};
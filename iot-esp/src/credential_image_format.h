@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+// On-flash layout of the credential image. Plain C++ with no Arduino
+// dependency, so tools/credential_image_tool.cpp builds images from the
+// same definitions the firmware reads them with.
+//
+//   header | users[userCount] | pins[pinCount] | nfcs[nfcCount]
+//
+// Every table has a fixed stride. pins are sorted by digest and nfcs by
+// (uidLen, uid) so lookups are binary searches straight over the mapped
+// flash. The signature is HMAC-SHA256 over the header (with generation and
+// signature zeroed) followed by the tables.
+
+static const uint32_t CREDENTIAL_IMAGE_MAGIC = 0x474D4943;  // "CIMG"
+static const uint16_t CREDENTIAL_IMAGE_VERSION = 1;
+static const uint8_t CREDENTIAL_IMAGE_DIGEST_LEN = 32;
+static const uint8_t CREDENTIAL_IMAGE_UID_LEN = 10;  // UserHotRecord::MAX_UID_LEN
+
+struct __attribute__((packed)) CredentialImageHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t headerSize;
+  uint32_t generation;  // set by the device when the image is installed
+  uint32_t revision;    // server user revision the image was built from
+  uint32_t imageSize;   // header plus tables
+  uint32_t userCount;
+  uint32_t pinCount;
+  uint32_t nfcCount;
+  uint32_t userOffset;
+  uint32_t pinOffset;
+  uint32_t nfcOffset;
+  uint8_t reserved[52];
+  uint8_t signature[32];
+};
+
+// Display data, indexed by the user field of the credential tables
+struct __attribute__((packed)) CredentialImageUser {
+  char name[32];
+  uint8_t nfcUid[CREDENTIAL_IMAGE_UID_LEN];
+  uint8_t nfcUidLen;
+  uint8_t authType;  // AuthType
+};
+
+struct __attribute__((packed)) CredentialImagePin {
+  uint8_t digest[CREDENTIAL_IMAGE_DIGEST_LEN];  // raw SHA-256 of the PIN
+  uint16_t user;
+  uint16_t reserved;
+};
+
+struct __attribute__((packed)) CredentialImageNfc {
+  uint8_t uid[CREDENTIAL_IMAGE_UID_LEN];
+  uint8_t uidLen;
+  uint8_t reserved;
+  uint16_t user;
+  uint16_t reserved2;
+};
+
+static_assert(sizeof(CredentialImageHeader) == 128, "image header layout");
+static_assert(sizeof(CredentialImageUser) == 44, "image user layout");
+static_assert(sizeof(CredentialImagePin) == 36, "image PIN entry layout");
+static_assert(sizeof(CredentialImageNfc) == 16, "image card entry layout");
+
+// Sort order of the card table: shorter UIDs first, then bytewise
+inline int compareImageUid(const uint8_t* a, uint8_t aLen, const uint8_t* b, uint8_t bLen) {
+  if (aLen != bLen) return aLen < bLen ? -1 : 1;
+  return memcmp(a, b, aLen);
+}
+
+// Checks that the tables the header describes fit inside imageSize
+inline bool isImageLayoutValid(const CredentialImageHeader& header, uint32_t maxSize) {
+  if (header.magic != CREDENTIAL_IMAGE_MAGIC ||
+      header.version != CREDENTIAL_IMAGE_VERSION ||
+      header.headerSize != sizeof(CredentialImageHeader) ||
+      header.imageSize < sizeof(CredentialImageHeader) ||
+      header.imageSize > maxSize ||
+      header.userCount > 0x7FFF) {
+    return false;
+  }
+  uint64_t userEnd = (uint64_t)header.userOffset + (uint64_t)header.userCount * sizeof(CredentialImageUser);
+  uint64_t pinEnd = (uint64_t)header.pinOffset + (uint64_t)header.pinCount * sizeof(CredentialImagePin);
+  uint64_t nfcEnd = (uint64_t)header.nfcOffset + (uint64_t)header.nfcCount * sizeof(CredentialImageNfc);
+  return header.userOffset >= header.headerSize && userEnd <= header.imageSize &&
+         header.pinOffset >= header.headerSize && pinEnd <= header.imageSize &&
+         header.nfcOffset >= header.headerSize && nfcEnd <= header.imageSize;
+}
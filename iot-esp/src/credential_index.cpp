@@ -0,0 +1,112 @@
+#include "credential_index.h"
+
+CredentialIndex::CredentialIndex() {
+  buckets = nullptr;
+  mask = 0;
+  used = 0;
+  tombstones = 0;
+}
+
+CredentialIndex::~CredentialIndex() {
+  delete[] buckets;
+}
+
+bool CredentialIndex::begin(uint16_t capacity) {
+  uint32_t size = 8;
+  while (size < capacity) size <<= 1;
+  if (size > 0x8000) return false; // slot numbers must stay below TOMBSTONE
+  
+  delete[] buckets;
+  buckets = new Bucket[size];
+  mask = size - 1;
+  clear();
+  return true;
+}
+
+void CredentialIndex::clear() {
+  if (!buckets) return;
+  for (uint32_t i = 0; i <= mask; i++) {
+    buckets[i].tag = 0;
+    buckets[i].slot = EMPTY;
+  }
+  used = 0;
+  tombstones = 0;
+}
+
+bool CredentialIndex::insert(uint32_t hash, uint16_t slot) {
+  if (!buckets || slot >= TOMBSTONE) return false;
+  
+  // Keep the load factor under 3/4 so probe chains stay short; tombstones
+  // count too until a compaction frees them
+  if ((uint32_t)(used + tombstones + 1) * 4 > (uint32_t)(mask + 1) * 3) {
+    if (tombstones > 0) compact();
+    if ((uint32_t)(used + 1) * 4 > (uint32_t)(mask + 1) * 3) return false;
+  }
+  
+  uint16_t pos = (hash >> 16) & mask;
+  while (buckets[pos].slot != EMPTY && buckets[pos].slot != TOMBSTONE) {
+    pos = (pos + 1) & mask;
+  }
+  if (buckets[pos].slot == TOMBSTONE) tombstones--;
+  buckets[pos].tag = hash >> 16;
+  buckets[pos].slot = slot;
+  used++;
+  return true;
+}
+
+bool CredentialIndex::remove(uint32_t hash, uint16_t slot) {
+  if (!buckets) return false;
+  
+  uint16_t tag = hash >> 16;
+  for (uint16_t i = 0, pos = tag & mask; i <= mask; i++, pos = (pos + 1) & mask) {
+    Bucket& b = buckets[pos];
+    if (b.slot == EMPTY) return false;
+    if (b.slot == slot && b.tag == tag) {
+      b.slot = TOMBSTONE;
+      used--;
+      tombstones++;
+      // Long runs of tombstones make every miss probe further
+      if (tombstones > (mask + 1) / 4) compact();
+      return true;
+    }
+  }
+  return false;
+}
+
+// Drops the tombstones in place, without a second bucket array. Starting
+// just after a bucket that was empty before, each live bucket is taken out
+// and put back at the first free bucket from its home. Its home lies
+// between that empty bucket and where it was, and everything before it has
+// been placed already, so it lands at or before its old position and no
+// probe chain is cut.
+void CredentialIndex::compact() {
+  uint32_t size = (uint32_t)mask + 1;
+  uint32_t start = 0;
+  while (buckets[start].slot != EMPTY) start++;  // the load limit leaves one
+  
+  for (uint32_t i = 0; i < size; i++) {
+    if (buckets[i].slot == TOMBSTONE) buckets[i].slot = EMPTY;
+  }
+  tombstones = 0;
+  
+  for (uint32_t i = 1; i < size; i++) {
+    uint16_t pos = (start + i) & mask;
+    if (buckets[pos].slot == EMPTY) continue;
+    Bucket moving = buckets[pos];
+    buckets[pos].slot = EMPTY;
+    uint16_t to = moving.tag & mask;
+    while (buckets[to].slot != EMPTY) {
+      to = (to + 1) & mask;
+    }
+    buckets[to] = moving;
+  }
+}
+
+uint32_t CredentialIndex::hashBytes(const uint8_t* data, size_t length) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < length; i++) {
+    hash ^= data[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
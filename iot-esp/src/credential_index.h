@@ -0,0 +1,59 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Open-addressing hash index from a credential key (PIN digest or NFC UID)
+// to a user slot. Buckets only hold the top 16 bits of the key hash as a tag
+// plus the slot number (4 bytes each), and the low bits of the tag pick the
+// bucket, so a bucket's home can be worked out again without the key.
+// Callers confirm every candidate against the full key in their user table,
+// so tag collisions cost an extra compare, never a wrong match.
+class CredentialIndex {
+public:
+  static const uint16_t NO_SLOT = 0xFFFF;
+  
+  CredentialIndex();
+  ~CredentialIndex();
+  
+  // Allocates the bucket array once; capacity is rounded up to a power of two
+  bool begin(uint16_t capacity);
+  void clear();
+  
+  bool insert(uint32_t hash, uint16_t slot);
+  bool remove(uint32_t hash, uint16_t slot);
+  
+  // Returns the first slot with a matching hash for which match(slot) is
+  // true, or NO_SLOT. Never allocates.
+  template <typename Match>
+  uint16_t find(uint32_t hash, Match match) const {
+    if (!buckets) return NO_SLOT;
+    uint16_t tag = hash >> 16;
+    for (uint16_t i = 0, pos = tag & mask; i <= mask; i++, pos = (pos + 1) & mask) {
+      const Bucket& b = buckets[pos];
+      if (b.slot == EMPTY) return NO_SLOT;
+      if (b.slot != TOMBSTONE && b.tag == tag && match(b.slot)) return b.slot;
+    }
+    return NO_SLOT;
+  }
+  
+  uint16_t size() const { return used; }
+  
+  // FNV-1a, used for keys that are not already uniformly distributed
+  static uint32_t hashBytes(const uint8_t* data, size_t length);
+
+private:
+  static const uint16_t EMPTY = 0xFFFF;
+  static const uint16_t TOMBSTONE = 0xFFFE;
+  
+  struct Bucket {
+    uint16_t tag;
+    uint16_t slot;
+  };
+  
+  Bucket* buckets;
+  uint16_t mask;
+  uint16_t used;
+  uint16_t tombstones;
+  
+  void compact();
+};
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <Arduino.h>
+#include "spsc_queue.h"
+#include "user_sync.h"
+
+// Messages between the door task (core 1: keypad, Serial2, LCD, offline
+// auth, servo) and the network task (core 0: WiFi, MQTT, HTTP). Each
+// direction is its own SPSC queue, so neither side ever waits on the other.
+
+// Door task -> network task
+enum NetCommandType : uint8_t {
+  NET_PUBLISH,    // topic + payload
+  NET_UNLOCK,     // credential = PIN or card UID for /api/unlock
+  NET_ENROLL,     // credential = card UID for /api/enroll
+  NET_SYNC,       // download users from the backend
+  NET_PRECONNECT, // warm up the backend connection (first keypad digit)
+  NET_IMAGE,      // download and install a credential image
+  NET_TRACE_DUMP, // publish the stopped input trace on admin/trace-data
+  NET_AUDIT,      // payload = "from:to", audit records to upload
+  NET_VERIFY      // credential = PIN or card UID, checked by /api/unlock with no side effects
+};
+
+struct NetCommand {
+  NetCommandType type;
+  uint16_t requestId;  // echoed back in the matching DoorEvent
+  char topic[32];
+  String payload;
+};
+
+// Unlock and enroll requests travel in their own queue, so a burst of
+// publishes or audit uploads can never crowd out a credential, and in a
+// fixed buffer, so queueing one never touches the heap
+static const uint8_t CREDENTIAL_MAX_LEN = 20;  // 8-digit PIN or 10-byte UID in hex
+
+struct CredentialCommand {
+  NetCommandType type;  // NET_UNLOCK, NET_VERIFY or NET_ENROLL
+  uint16_t requestId;
+  char credential[CREDENTIAL_MAX_LEN + 1];
+};
+
+// Network task -> door task
+enum DoorEventType : uint8_t {
+  DOOR_ONLINE_VERDICT,  // answer to NET_UNLOCK and NET_VERIFY
+  DOOR_ENROLL_RESULT,   // answer to NET_ENROLL
+  DOOR_SYNC_RESULT,     // answer to NET_SYNC
+  DOOR_IMAGE_RESULT,    // answer to NET_IMAGE
+  DOOR_CONNECTIVITY,    // state = NetState
+  DOOR_MQTT_COMMAND,    // command = MqttCommand, payload = message
+  DOOR_AUDIT_RESULT     // answer to NET_AUDIT, payload = "acked:unixTime"
+};
+
+enum NetState : uint8_t {
+  NET_ONLINE,
+  NET_RECONNECTING,
+  NET_OFFLINE,
+  NET_RESTORED
+};
+
+enum MqttCommand : uint8_t {
+  MQTT_TEST_MESSAGE,
+  MQTT_OPEN,
+  MQTT_NFC_REGISTER,
+  MQTT_ACTIVATE,
+  MQTT_ADD_USER,
+  MQTT_REMOVE_USER,
+  MQTT_LIST_USERS,
+  MQTT_SYSTEM_STATUS,
+  MQTT_RESET_SYSTEM,
+  MQTT_CLEAR_CACHE,
+  MQTT_LOAD_IMAGE,
+  MQTT_TRACE
+};
+
+struct DoorEvent {
+  DoorEventType type;
+  uint16_t requestId;
+  bool reached;   // the server answered (verdict/enroll/sync)
+  bool success;   // the server accepted the request
+  uint8_t state;  // NetState or MqttCommand
+  uint32_t elapsedUs;  // time the network task spent on the request
+  uint32_t cacheMs;    // DOOR_ONLINE_VERDICT: how long it may be cached, 0 = not at all
+  String payload;
+};
+
+static const uint16_t EVENT_QUEUE_SIZE = 16;
+extern SpscQueue<NetCommand, EVENT_QUEUE_SIZE> netCommands;
+static const uint16_t CREDENTIAL_QUEUE_SIZE = 8;
+extern SpscQueue<CredentialCommand, CREDENTIAL_QUEUE_SIZE> credentialCommands;
+extern SpscQueue<DoorEvent, EVENT_QUEUE_SIZE> doorEvents;
+
+// Users parsed from a sync, in document order. The network task waits when
+// this is full, so the door task applies the roster at its own pace.
+static const uint16_t SYNC_QUEUE_SIZE = 16;
+extern SpscQueue<SyncUser, SYNC_QUEUE_SIZE> syncUsers;
@@ -0,0 +1,150 @@
+#include "input_trace.h"
+
+InputTrace inputTrace;
+
+// Held only to copy a record in, never across a wait
+static portMUX_TYPE traceLock = portMUX_INITIALIZER_UNLOCKED;
+
+// Gaps longer than this are timed with millis(), which does not wrap
+// within the ~71 minutes micros() does
+static const uint32_t LONG_GAP_MS = 1000000;
+
+InputTrace::InputTrace() {
+  buffer = nullptr;
+  memset(&traceHeader, 0, sizeof(traceHeader));
+  lastUs = 0;
+  lastMs = 0;
+  recording = false;
+}
+
+bool InputTrace::start(uint32_t syncRevision, uint16_t userCount, bool offline) {
+  stop();
+  if (!buffer) {
+    uint8_t* allocated = (uint8_t*)malloc(INPUT_TRACE_SIZE);
+    if (!allocated) return false;
+    buffer = allocated;
+  }
+  
+  portENTER_CRITICAL(&traceLock);
+  memset(&traceHeader, 0, sizeof(traceHeader));
+  traceHeader.magic = INPUT_TRACE_MAGIC;
+  traceHeader.version = INPUT_TRACE_VERSION;
+  traceHeader.headerSize = sizeof(InputTraceHeader);
+  traceHeader.startedMs = millis();
+  traceHeader.syncRevision = syncRevision;
+  traceHeader.userCount = userCount;
+  traceHeader.offline = offline ? 1 : 0;
+  lastUs = micros();
+  lastMs = traceHeader.startedMs;
+  recording = true;
+  portEXIT_CRITICAL(&traceLock);
+  return true;
+}
+
+void InputTrace::stop() {
+  portENTER_CRITICAL(&traceLock);
+  recording = false;
+  portEXIT_CRITICAL(&traceLock);
+}
+
+void InputTrace::clear() {
+  portENTER_CRITICAL(&traceLock);
+  recording = false;
+  uint8_t* released = buffer;
+  buffer = nullptr;
+  memset(&traceHeader, 0, sizeof(traceHeader));
+  portEXIT_CRITICAL(&traceLock);
+  free(released);
+}
+
+void InputTrace::key(char key) {
+  if (!recording) return;
+  uint8_t body = key;
+  append(TRACE_KEY, &body, 1, nullptr, 0);
+}
+
+void InputTrace::arduinoLine(const char* line) {
+  if (!recording) return;
+  size_t lineLength = strlen(line);
+  uint8_t length = lineLength < 255 ? lineLength : 255;
+  append(TRACE_ARDUINO, &length, 1, line, length);
+}
+
+void InputTrace::mqtt(const char* topic, const String& payload) {
+  if (!recording) return;
+  
+  // Topic (index or inline), then the payload length
+  uint8_t prefix[2 + 255 + 10];
+  size_t length = 0;
+  uint8_t index = traceTopicIndex(topic);
+  prefix[length++] = index;
+  if (index == TRACE_TOPIC_INLINE) {
+    size_t topicLength = strlen(topic);
+    if (topicLength > 255) topicLength = 255;
+    prefix[length++] = topicLength;
+    memcpy(prefix + length, topic, topicLength);
+    length += topicLength;
+  }
+  length += putTraceVarint(prefix + length, payload.length());
+  append(TRACE_MQTT, prefix, length, payload.c_str(), payload.length());
+}
+
+void InputTrace::wifi(uint8_t status) {
+  if (!recording) return;
+  append(TRACE_WIFI, &status, 1, nullptr, 0);
+}
+
+void InputTrace::append(uint8_t type, const uint8_t* prefix, size_t prefixLength, const char* data, size_t dataLength) {
+  portENTER_CRITICAL(&traceLock);
+  if (recording && buffer) {
+    uint32_t nowUs = micros();
+    uint32_t nowMs = millis();
+    uint64_t delta = nowMs - lastMs > LONG_GAP_MS ? (uint64_t)(nowMs - lastMs) * 1000 : nowUs - lastUs;
+    
+    uint8_t stamp[11];
+    stamp[0] = type;
+    size_t stampLength = 1 + putTraceVarint(stamp + 1, delta);
+    
+    uint32_t used = traceHeader.recordBytes;
+    uint32_t need = stampLength + prefixLength + dataLength;
+    if (need > INPUT_TRACE_SIZE - used) {
+      traceHeader.dropped++;
+    } else {
+      memcpy(buffer + used, stamp, stampLength);
+      memcpy(buffer + used + stampLength, prefix, prefixLength);
+      if (dataLength > 0) memcpy(buffer + used + stampLength + prefixLength, data, dataLength);
+      traceHeader.recordBytes = used + need;
+      traceHeader.records++;
+      lastUs = nowUs;
+      lastMs = nowMs;
+    }
+  }
+  portEXIT_CRITICAL(&traceLock);
+}
+
+uint32_t InputTrace::size() const {
+  return traceHeader.magic ? sizeof(InputTraceHeader) + traceHeader.recordBytes : 0;
+}
+
+uint32_t InputTrace::read(uint32_t offset, uint8_t* out, uint32_t length) const {
+  portENTER_CRITICAL(&traceLock);
+  uint32_t total = size();
+  uint32_t copied = 0;
+  if (buffer && offset < total) {
+    if (length > total - offset) length = total - offset;
+    while (copied < length) {
+      uint32_t at = offset + copied;
+      if (at < sizeof(InputTraceHeader)) {
+        uint32_t part = sizeof(InputTraceHeader) - at;
+        if (part > length - copied) part = length - copied;
+        memcpy(out + copied, (const uint8_t*)&traceHeader + at, part);
+        copied += part;
+      } else {
+        memcpy(out + copied, buffer + at - sizeof(InputTraceHeader), length - copied);
+        copied = length;
+      }
+    }
+  }
+  portEXIT_CRITICAL(&traceLock);
+  return copied;
+}
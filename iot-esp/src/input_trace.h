@@ -0,0 +1,51 @@
+#pragma once
+
+#include <Arduino.h>
+#include "input_trace_format.h"
+
+// RAM a recording may fill; allocated when it starts, freed by clear()
+#ifndef INPUT_TRACE_SIZE
+#define INPUT_TRACE_SIZE 16384
+#endif
+
+// Recorder for everything the firmware takes in from outside: keypad keys,
+// Serial2 lines from the Arduino, MQTT commands and WiFi status changes,
+// each with the time it was seen (format in input_trace_format.h). Both
+// tasks record into the same buffer under a short critical section, so the
+// trace is in the order the inputs happened. A recording runs until it is
+// stopped or the buffer is full; inputs after that are only counted. The
+// host replay tool (test/host/door_replay) feeds a trace back into the
+// firmware under the simulator's virtual clock.
+class InputTrace {
+public:
+  InputTrace();
+  
+  // Starts a new recording, discarding the previous one. The arguments are
+  // the door's state at the start, kept in the header for the replay.
+  bool start(uint32_t syncRevision, uint16_t userCount, bool offline);
+  // Ends the recording; it stays readable until the next start() or clear()
+  void stop();
+  void clear();
+  bool isRecording() const { return recording; }
+  
+  void key(char key);
+  void arduinoLine(const char* line);
+  void mqtt(const char* topic, const String& payload);
+  void wifi(uint8_t status);
+  
+  // The trace as a file: header, then records
+  uint32_t size() const;
+  uint32_t read(uint32_t offset, uint8_t* out, uint32_t length) const;
+  const InputTraceHeader& header() const { return traceHeader; }
+
+private:
+  uint8_t* buffer;
+  InputTraceHeader traceHeader;
+  uint32_t lastUs;
+  uint32_t lastMs;
+  volatile bool recording;
+  
+  void append(uint8_t type, const uint8_t* prefix, size_t prefixLength, const char* data, size_t dataLength);
+};
+
+extern InputTrace inputTrace;
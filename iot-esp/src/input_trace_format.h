@@ -0,0 +1,97 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+// Layout of an input trace. Plain C++ with no Arduino dependency, so the
+// host replay tool reads traces with the same definitions the firmware
+// writes them with.
+//
+//   header | record | record | ...
+//
+// A record is its type, the time since the previous record in microseconds
+// (the first one counts from the start of the recording) as a varint, and
+// a type-specific body:
+//
+//   TRACE_KEY      key character
+//   TRACE_ARDUINO  length (1 byte), the Serial2 line without its line ending
+//                  (frames in their text form, see arduino_link_format.h)
+//   TRACE_MQTT     topic index (1 byte) or TRACE_TOPIC_INLINE, length and
+//                  topic; then payload length (varint) and payload
+//   TRACE_WIFI     wl_status_t (1 byte)
+//
+// Varints are little-endian base 128, 7 bits a byte, high bit set on every
+// byte but the last.
+
+static const uint32_t INPUT_TRACE_MAGIC = 0x43525449;  // "ITRC"
+static const uint16_t INPUT_TRACE_VERSION = 1;
+
+enum InputTraceRecord : uint8_t {
+  TRACE_KEY = 1,
+  TRACE_ARDUINO = 2,
+  TRACE_MQTT = 3,
+  TRACE_WIFI = 4
+};
+
+struct __attribute__((packed)) InputTraceHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t headerSize;
+  uint32_t startedMs;     // uptime when the recording started
+  uint32_t recordBytes;   // bytes of records after the header
+  uint32_t records;
+  uint32_t dropped;       // inputs not recorded because the buffer was full
+  uint32_t syncRevision;  // the door's user revision at the start
+  uint16_t userCount;
+  uint8_t offline;        // the door was in offline mode at the start
+  uint8_t reserved[5];
+};
+
+static_assert(sizeof(InputTraceHeader) == 36, "trace header layout");
+
+// Topics stored as one byte; anything else is written out in the record
+static const uint8_t TRACE_TOPIC_INLINE = 0xFF;
+static const char* const INPUT_TRACE_TOPICS[] = {
+  "mytopic/test",
+  "mytopic/open",
+  "auth/nfc-register",
+  "mytopic/activate",
+  "admin/add-user",
+  "admin/remove-user",
+  "admin/list-users",
+  "admin/system-status",
+  "admin/reset-system",
+  "admin/clear-cache",
+  "admin/load-image"
+};
+static const uint8_t INPUT_TRACE_TOPIC_COUNT = sizeof(INPUT_TRACE_TOPICS) / sizeof(INPUT_TRACE_TOPICS[0]);
+
+inline uint8_t traceTopicIndex(const char* topic) {
+  for (uint8_t i = 0; i < INPUT_TRACE_TOPIC_COUNT; i++) {
+    if (strcmp(INPUT_TRACE_TOPICS[i], topic) == 0) return i;
+  }
+  return TRACE_TOPIC_INLINE;
+}
+
+// Writes value at out and returns the number of bytes used (at most 10)
+inline size_t putTraceVarint(uint8_t* out, uint64_t value) {
+  size_t length = 0;
+  while (value >= 0x80) {
+    out[length++] = (uint8_t)value | 0x80;
+    value >>= 7;
+  }
+  out[length++] = (uint8_t)value;
+  return length;
+}
+
+// Reads a varint from [at, end); returns false if it runs past end
+inline bool getTraceVarint(const uint8_t*& at, const uint8_t* end, uint64_t& value) {
+  value = 0;
+  for (uint8_t shift = 0; at < end && shift < 64; shift += 7) {
+    uint8_t byte = *at++;
+    value |= (uint64_t)(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) return true;
+  }
+  return false;
+}
@@ -0,0 +1,229 @@
+#include "json_stream.h"
+
+JsonStreamParser::JsonStreamParser(Handler handler, void* context)
+  : handler(handler), context(context) {
+  reset();
+}
+
+void JsonStreamParser::reset() {
+  state = STATE_VALUE;
+  stringIsKey = false;
+  level = 0;
+  objectLevels = 0;
+  bytes = 0;
+  tokenLength = 0;
+  token[0] = '\0';
+}
+
+bool JsonStreamParser::feed(const uint8_t* data, size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    if (!feed((char)data[i])) return false;
+  }
+  return true;
+}
+
+bool JsonStreamParser::feed(char c) {
+  if (state == STATE_ERROR) return false;
+  bytes++;
+  
+  switch (state) {
+    case STATE_STRING:
+      if (c == '"') {
+        return endToken(stringIsKey ? JSON_KEY : JSON_STRING);
+      }
+      if (c == '\\') {
+        state = STATE_ESCAPE;
+      } else if ((uint8_t)c < 0x20) {
+        return fail();
+      } else {
+        append(c);
+      }
+      return true;
+    
+    case STATE_ESCAPE:
+      state = STATE_STRING;
+      switch (c) {
+        case '"': case '\\': case '/': append(c); break;
+        case 'b': append('\b'); break;
+        case 'f': append('\f'); break;
+        case 'n': append('\n'); break;
+        case 'r': append('\r'); break;
+        case 't': append('\t'); break;
+        case 'u':
+          state = STATE_UNICODE;
+          codepoint = 0;
+          hexDigits = 0;
+          break;
+        default:
+          return fail();
+      }
+      return true;
+    
+    case STATE_UNICODE: {
+      uint8_t nibble;
+      if (c >= '0' && c <= '9') nibble = c - '0';
+      else if (c >= 'a' && c <= 'f') nibble = c - 'a' + 10;
+      else if (c >= 'A' && c <= 'F') nibble = c - 'A' + 10;
+      else return fail();
+      
+      codepoint = (codepoint << 4) | nibble;
+      if (++hexDigits == 4) {
+        appendCodepoint(codepoint);
+        state = STATE_STRING;
+      }
+      return true;
+    }
+    
+    case STATE_NUMBER:
+      if ((c >= '0' && c <= '9') || c == '.' || c == 'e' || c == 'E' || c == '+' || c == '-') {
+        append(c);
+        return true;
+      }
+      // The number ends at the first other character, which is then
+      // handled as structure
+      if (!endToken(JSON_NUMBER)) return false;
+      return structural(c);
+    
+    case STATE_LITERAL:
+      if (c >= 'a' && c <= 'z') {
+        append(c);
+        return true;
+      }
+      if (!endToken(JSON_LITERAL)) return false;
+      return structural(c);
+    
+    default:
+      return structural(c);
+  }
+}
+
+bool JsonStreamParser::structural(char c) {
+  if (c == ' ' || c == '\t' || c == '\n' || c == '\r') return true;
+  
+  switch (state) {
+    case STATE_VALUE:
+      return startValue(c);
+    
+    case STATE_VALUE_OR_END:
+      if (c == ']') return close(false);
+      return startValue(c);
+    
+    case STATE_KEY_OR_END:
+      if (c == '}') return close(true);
+      // fall through
+    case STATE_KEY:
+      if (c != '"') return fail();
+      stringIsKey = true;
+      tokenLength = 0;
+      state = STATE_STRING;
+      return true;
+    
+    case STATE_COLON:
+      if (c != ':') return fail();
+      state = STATE_VALUE;
+      return true;
+    
+    case STATE_AFTER_VALUE:
+      if (c == ',') {
+        state = inObject() ? STATE_KEY : STATE_VALUE;
+        return true;
+      }
+      if (c == '}' && inObject()) return close(true);
+      if (c == ']' && !inObject()) return close(false);
+      return fail();
+    
+    default:
+      // Nothing but whitespace may follow the top-level value
+      return fail();
+  }
+}
+
+bool JsonStreamParser::startValue(char c) {
+  tokenLength = 0;
+  
+  if (c == '{') return open(true);
+  if (c == '[') return open(false);
+  if (c == '"') {
+    stringIsKey = false;
+    state = STATE_STRING;
+    return true;
+  }
+  if (c == '-' || (c >= '0' && c <= '9')) {
+    append(c);
+    state = STATE_NUMBER;
+    return true;
+  }
+  if (c == 't' || c == 'f' || c == 'n') {
+    append(c);
+    state = STATE_LITERAL;
+    return true;
+  }
+  return fail();
+}
+
+bool JsonStreamParser::open(bool isObject) {
+  if (level == MAX_DEPTH) return fail();
+  
+  if (isObject) {
+    objectLevels |= 1UL << level;
+  } else {
+    objectLevels &= ~(1UL << level);
+  }
+  level++;
+  emit(isObject ? JSON_OBJECT_START : JSON_ARRAY_START, "");
+  state = isObject ? STATE_KEY_OR_END : STATE_VALUE_OR_END;
+  return true;
+}
+
+bool JsonStreamParser::close(bool isObject) {
+  emit(isObject ? JSON_OBJECT_END : JSON_ARRAY_END, "");
+  level--;
+  afterValue();
+  return true;
+}
+
+bool JsonStreamParser::endToken(Event event) {
+  token[tokenLength] = '\0';
+  
+  if (event == JSON_LITERAL &&
+      strcmp(token, "true") != 0 && strcmp(token, "false") != 0 && strcmp(token, "null") != 0) {
+    return fail();
+  }
+  
+  emit(event, token);
+  if (event == JSON_KEY) {
+    state = STATE_COLON;
+  } else {
+    afterValue();
+  }
+  return true;
+}
+
+void JsonStreamParser::afterValue() {
+  state = level == 0 ? STATE_DONE : STATE_AFTER_VALUE;
+}
+
+void JsonStreamParser::append(char c) {
+  if (tokenLength < MAX_TOKEN - 1) {
+    token[tokenLength++] = c;
+  }
+}
+
+void JsonStreamParser::appendCodepoint(uint16_t cp) {
+  // UTF-8; surrogate pairs are not combined
+  if (cp < 0x80) {
+    append((char)cp);
+  } else if (cp < 0x800) {
+    append((char)(0xC0 | (cp >> 6)));
+    append((char)(0x80 | (cp & 0x3F)));
+  } else {
+    append((char)(0xE0 | (cp >> 12)));
+    append((char)(0x80 | ((cp >> 6) & 0x3F)));
+    append((char)(0x80 | (cp & 0x3F)));
+  }
+}
+
+bool JsonStreamParser::fail() {
+  state = STATE_ERROR;
+  return false;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+// Incremental SAX-style JSON tokenizer. Bytes are fed in whatever chunks
+// the transport delivers and every token is reported to the handler as
+// soon as it is complete, so memory use is fixed (one token buffer and a
+// nesting bitmap) no matter how large the document is. Strings longer than
+// MAX_TOKEN - 1 bytes are truncated.
+class JsonStreamParser {
+public:
+  enum Event : uint8_t {
+    JSON_OBJECT_START,
+    JSON_OBJECT_END,
+    JSON_ARRAY_START,
+    JSON_ARRAY_END,
+    JSON_KEY,
+    JSON_STRING,
+    JSON_NUMBER,
+    JSON_LITERAL  // true, false or null
+  };
+  
+  // depth is the nesting level the token sits in; a container's start and
+  // end events report the level inside it (the outermost object is 1)
+  typedef void (*Handler)(void* context, Event event, const char* text, uint8_t depth);
+  
+  static const uint8_t MAX_TOKEN = 64;
+  static const uint8_t MAX_DEPTH = 32;
+  
+  JsonStreamParser(Handler handler, void* context);
+  
+  void reset();
+  
+  // Return false once the input is malformed; later input is ignored
+  bool feed(const uint8_t* data, size_t length);
+  bool feed(char c);
+  
+  bool failed() const { return state == STATE_ERROR; }
+  bool complete() const { return state == STATE_DONE; }
+  uint8_t depth() const { return level; }
+  uint32_t bytesParsed() const { return bytes; }
+
+private:
+  enum State : uint8_t {
+    STATE_VALUE,           // a value must follow
+    STATE_VALUE_OR_END,    // right after '['
+    STATE_KEY,             // after ',' in an object
+    STATE_KEY_OR_END,      // right after '{'
+    STATE_COLON,
+    STATE_AFTER_VALUE,     // ',' or the closing bracket
+    STATE_STRING,
+    STATE_ESCAPE,
+    STATE_UNICODE,
+    STATE_NUMBER,
+    STATE_LITERAL,
+    STATE_DONE,
+    STATE_ERROR
+  };
+  
+  Handler handler;
+  void* context;
+  
+  State state;
+  bool stringIsKey;
+  uint8_t level;
+  uint32_t objectLevels;  // bit n set: level n + 1 is an object
+  uint32_t bytes;
+  
+  char token[MAX_TOKEN];
+  uint8_t tokenLength;
+  uint16_t codepoint;
+  uint8_t hexDigits;
+  
+  bool structural(char c);
+  bool startValue(char c);
+  bool open(bool isObject);
+  bool close(bool isObject);
+  bool endToken(Event event);
+  void afterValue();
+  void append(char c);
+  void appendCodepoint(uint16_t cp);
+  bool fail();
+  bool inObject() const { return level > 0 && (objectLevels & (1UL << (level - 1))); }
+  void emit(Event event, const char* text) { handler(context, event, text, level); }
+};
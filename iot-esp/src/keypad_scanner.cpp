@@ -0,0 +1,151 @@
+#include "keypad_scanner.h"
+#include <esp_timer.h>
+#include "power_manager.h"
+#include "memory_telemetry.h"
+
+KeypadScanner keypadScanner;
+
+static const uint32_t SCAN_STACK_SIZE = 2048;
+// Above loop(), so a scan is never held up by the door task
+static const UBaseType_t SCAN_PRIORITY = 2;
+
+KeypadScanner::KeypadScanner() {
+  keypad = nullptr;
+  rowPins = nullptr;
+  colPins = nullptr;
+  rows = 0;
+  cols = 0;
+  task = nullptr;
+  edgeUs = 0;
+  wakes = 0;
+  scans = 0;
+  keys = 0;
+  dropped = 0;
+}
+
+bool KeypadScanner::begin(Keypad& keypad, const byte* rowPins, const byte* colPins, uint8_t rows, uint8_t cols) {
+  this->keypad = &keypad;
+  this->rowPins = rowPins;
+  this->colPins = colPins;
+  this->rows = rows;
+  this->cols = cols;
+  // The task paces and debounces; the library's own throttle would only
+  // skip scans
+  keypad.setDebounceTime(1);
+  if (xTaskCreatePinnedToCore(scanTask, "keypad", SCAN_STACK_SIZE, this, SCAN_PRIORITY, &task, 1) != pdPASS) {
+    Serial.println("[KEYPAD] Scan task not started");
+    return false;
+  }
+  memoryTelemetry.watchTask("keypad", task);
+  return true;
+}
+
+KeypadScannerStats KeypadScanner::stats() const {
+  KeypadScannerStats result;
+  result.wakes = wakes;
+  result.scans = scans;
+  result.keys = keys;
+  result.dropped = dropped;
+  return result;
+}
+
+void IRAM_ATTR KeypadScanner::onRowEdge() {
+  keypadScanner.edgeUs = (uint32_t)esp_timer_get_time();
+  BaseType_t woken = pdFALSE;
+  vTaskNotifyGiveFromISR(keypadScanner.task, &woken);
+  // The door task gets its clock back while the contacts settle
+  powerManager.wakeFromISR(keypadScanner.edgeUs, &woken);
+  portYIELD_FROM_ISR(woken);
+}
+
+void KeypadScanner::scanTask(void* parameter) {
+  KeypadScanner* scanner = static_cast<KeypadScanner*>(parameter);
+  for (;;) {
+    scanner->arm();
+    // A key already down when the rows were armed makes no edge
+    if (scanner->rowDown()) {
+      scanner->edgeUs = (uint32_t)esp_timer_get_time();
+    } else {
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+    scanner->disarm();
+    // Bounce after the first edge
+    ulTaskNotifyTake(pdTRUE, 0);
+    scanner->wakes++;
+    scanner->scanUntilReleased();
+  }
+}
+
+// Every column LOW, every row pulled up and waiting for a key to pull it down
+void KeypadScanner::arm() {
+  for (uint8_t c = 0; c < cols; c++) {
+    pinMode(colPins[c], OUTPUT);
+    digitalWrite(colPins[c], LOW);
+  }
+  for (uint8_t r = 0; r < rows; r++) {
+    pinMode(rowPins[r], INPUT_PULLUP);
+    attachInterrupt(digitalPinToInterrupt(rowPins[r]), onRowEdge, FALLING);
+  }
+}
+
+// Scanning drives the columns one by one, which would fire the rows too.
+// Leaves the columns floating, as the library expects before a scan
+void KeypadScanner::disarm() {
+  for (uint8_t r = 0; r < rows; r++) {
+    detachInterrupt(digitalPinToInterrupt(rowPins[r]));
+  }
+  for (uint8_t c = 0; c < cols; c++) {
+    pinMode(colPins[c], INPUT);
+  }
+}
+
+// With every column driven LOW
+bool KeypadScanner::rowDown() {
+  for (uint8_t r = 0; r < rows; r++) {
+    if (digitalRead(rowPins[r]) == LOW) return true;
+  }
+  return false;
+}
+
+bool KeypadScanner::anyKeyDown() {
+  for (uint8_t c = 0; c < cols; c++) {
+    pinMode(colPins[c], OUTPUT);
+    digitalWrite(colPins[c], LOW);
+  }
+  for (uint8_t r = 0; r < rows; r++) {
+    pinMode(rowPins[r], INPUT_PULLUP);
+  }
+  bool down = rowDown();
+  for (uint8_t c = 0; c < cols; c++) {
+    pinMode(colPins[c], INPUT);
+  }
+  return down;
+}
+
+// Scans until two scans in a row find nothing down, so the bounce of a
+// release does not re-arm early
+void KeypadScanner::scanUntilReleased() {
+  uint32_t atUs = edgeUs;
+  vTaskDelay(pdMS_TO_TICKS(KEYPAD_DEBOUNCE_MS));
+  uint8_t quiet = 0;
+  while (quiet < 2) {
+    char key = keypad->getKey();
+    scans++;
+    if (key != NO_KEY) {
+      KeyEvent event = {key, atUs};
+      if (events.push(event)) {
+        keys++;
+        powerManager.wake();
+      } else {
+        dropped++;
+      }
+    }
+    quiet = anyKeyDown() ? 0 : quiet + 1;
+    if (quiet < 2) {
+      vTaskDelay(pdMS_TO_TICKS(KEYPAD_DEBOUNCE_MS));
+    }
+    // A key pressed while another is held makes no edge; it dates from
+    // the scan that finds it
+    atUs = (uint32_t)esp_timer_get_time();
+  }
+}
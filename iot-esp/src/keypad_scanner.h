@@ -0,0 +1,74 @@
+#pragma once
+
+#include <Arduino.h>
+#include <Keypad.h>
+#include <atomic>
+#include "spsc_queue.h"
+
+// After a row edge the scan task waits this long for the contacts to
+// settle, then scans this often until every key is let go
+#ifndef KEYPAD_DEBOUNCE_MS
+#define KEYPAD_DEBOUNCE_MS 10
+#endif
+
+// Key events waiting for the door task
+#ifndef KEY_QUEUE_SIZE
+#define KEY_QUEUE_SIZE 16
+#endif
+
+struct KeyEvent {
+  char key;
+  uint32_t atUs;  // esp_timer time of the edge that woke the scan
+};
+
+struct KeypadScannerStats {
+  uint32_t wakes;    // row edges that woke the scan task
+  uint32_t scans;
+  uint32_t keys;
+  uint32_t dropped;  // door task not draining
+};
+
+// Scans the 4x4 matrix from its own task instead of from loop(). While no
+// key is down every column is driven LOW and every row waits on a FALLING
+// edge with its pull-up, so an idle keypad costs nothing. A press pulls its
+// row LOW; the interrupt wakes the task, which detaches the row interrupts,
+// lets the contacts settle and scans with the Keypad library every
+// KEYPAD_DEBOUNCE_MS until all keys are released. Each key goes into a
+// queue with the time of the edge, so a key pressed while loop() is busy is
+// kept rather than missed, and the latency from the press is measured.
+class KeypadScanner {
+public:
+  KeypadScanner();
+  
+  // Starts the scan task; rowPins and colPins must outlive it
+  bool begin(Keypad& keypad, const byte* rowPins, const byte* colPins, uint8_t rows, uint8_t cols);
+  // Door task
+  bool pop(KeyEvent& event) { return events.pop(event); }
+  
+  KeypadScannerStats stats() const;
+
+private:
+  Keypad* keypad;
+  const byte* rowPins;
+  const byte* colPins;
+  uint8_t rows;
+  uint8_t cols;
+  TaskHandle_t task;
+  volatile uint32_t edgeUs;
+  SpscQueue<KeyEvent, KEY_QUEUE_SIZE> events;
+  
+  std::atomic<uint32_t> wakes;
+  std::atomic<uint32_t> scans;
+  std::atomic<uint32_t> keys;
+  std::atomic<uint32_t> dropped;
+  
+  static void IRAM_ATTR onRowEdge();
+  static void scanTask(void* parameter);
+  void arm();
+  void disarm();
+  bool rowDown();
+  bool anyKeyDown();
+  void scanUntilReleased();
+};
+
+extern KeypadScanner keypadScanner;
@@ -0,0 +1,131 @@
+#include "latency_trace.h"
+
+LatencyTrace latencyTrace;
+
+static const char* STAGE_NAMES[STAGE_COUNT] = {
+  "input", "hash", "lookup", "nvs", "http", "display", "servo_cmd", "servo_ack", "unlock"
+};
+
+LatencyTrace::LatencyTrace() {
+  ringHead = 0;
+  ringCount = 0;
+  inputAt = 0;
+  servoAt = 0;
+  inputPending = false;
+  servoPending = false;
+  reset();
+}
+
+void LatencyTrace::add(LatencyStage stage, uint32_t durationUs) {
+  if (ringCount == LATENCY_TRACE_RING_SIZE) {
+    // loop() has not caught up; the oldest span goes
+    ringHead = (ringHead + 1) % LATENCY_TRACE_RING_SIZE;
+    ringCount--;
+    dropped++;
+  }
+  LatencySpan& span = ring[(ringHead + ringCount) % LATENCY_TRACE_RING_SIZE];
+  span.stage = stage;
+  span.durationUs = durationUs;
+  ringCount++;
+}
+
+void LatencyTrace::inputStarted(uint32_t startUs) {
+  inputAt = startUs;
+  inputPending = true;
+}
+
+void LatencyTrace::inputSubmitted() {
+  if (inputPending) record(STAGE_INPUT, inputAt);
+}
+
+void LatencyTrace::servoSent(uint32_t sentUs, bool unlock) {
+  if (unlock && inputPending) {
+    add(STAGE_UNLOCK, sentUs - inputAt);
+    inputPending = false;
+  }
+  servoAt = sentUs;
+  servoPending = true;
+}
+
+void LatencyTrace::servoAcked() {
+  if (servoPending) {
+    record(STAGE_SERVO_ACK, servoAt);
+    servoPending = false;
+  }
+}
+
+// Values below 4 get a bucket each; above, each power of two is split in 4
+uint8_t LatencyTrace::bucketOf(uint32_t us) {
+  if (us < 4) return us;
+  uint8_t msb = 31 - __builtin_clz(us);
+  return 4 * (msb - 1) + ((us >> (msb - 2)) & 3);
+}
+
+// Middle of the bucket
+uint32_t LatencyTrace::bucketValue(uint8_t bucket) {
+  if (bucket < 4) return bucket;
+  uint8_t msb = bucket / 4 + 1;
+  uint32_t low = (uint32_t)(4 + bucket % 4) << (msb - 2);
+  return low + ((1u << (msb - 2)) >> 1);
+}
+
+void LatencyTrace::loop() {
+  while (ringCount > 0) {
+    const LatencySpan& span = ring[ringHead];
+    StageHistogram& histogram = stages[span.stage];
+    uint16_t& count = histogram.counts[bucketOf(span.durationUs)];
+    if (count < 0xFFFF) count++;
+    if (histogram.count == 0 || span.durationUs < histogram.min) histogram.min = span.durationUs;
+    if (span.durationUs > histogram.max) histogram.max = span.durationUs;
+    histogram.count++;
+    
+    ringHead = (ringHead + 1) % LATENCY_TRACE_RING_SIZE;
+    ringCount--;
+  }
+}
+
+uint32_t LatencyTrace::percentile(const StageHistogram& histogram, uint8_t p) const {
+  if (histogram.count == 0) return 0;
+  uint32_t total = 0;
+  for (uint8_t i = 0; i < BUCKETS; i++) {
+    total += histogram.counts[i];
+  }
+  // The sample with rank ceil(p% of total)
+  uint32_t rank = ((uint64_t)total * p + 99) / 100;
+  if (rank == 0) rank = 1;
+  uint32_t seen = 0;
+  for (uint8_t i = 0; i < BUCKETS; i++) {
+    seen += histogram.counts[i];
+    if (seen >= rank) {
+      uint32_t value = bucketValue(i);
+      // The bucket middle can lie outside what was actually seen
+      if (value < histogram.min) value = histogram.min;
+      if (value > histogram.max) value = histogram.max;
+      return value;
+    }
+  }
+  return histogram.max;
+}
+
+String LatencyTrace::metricsJson() {
+  loop();
+  String json = "{\"windowMs\":" + String(millis() - windowStart) +
+                ",\"dropped\":" + String(dropped) + ",\"stages\":{";
+  for (uint8_t i = 0; i < STAGE_COUNT; i++) {
+    const StageHistogram& histogram = stages[i];
+    if (i > 0) json += ",";
+    json += "\"" + String(STAGE_NAMES[i]) + "\":{\"count\":" + String(histogram.count) +
+            ",\"min\":" + String(histogram.min) +
+            ",\"p50\":" + String(percentile(histogram, 50)) +
+            ",\"p99\":" + String(percentile(histogram, 99)) +
+            ",\"max\":" + String(histogram.max) + "}";
+  }
+  json += "}}";
+  return json;
+}
+
+void LatencyTrace::reset() {
+  memset(stages, 0, sizeof(stages));
+  dropped = 0;
+  windowStart = millis();
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <Arduino.h>
+#include <esp_timer.h>
+
+// Spans recorded since the last fold into the histograms
+#ifndef LATENCY_TRACE_RING_SIZE
+#define LATENCY_TRACE_RING_SIZE 64
+#endif
+
+// How often the histograms go out on admin/metrics (and start over)
+#ifndef LATENCY_METRICS_PERIOD_MS
+#define LATENCY_METRICS_PERIOD_MS 60000
+#endif
+
+// Stages of the path from the last input to the door opening
+enum LatencyStage : uint8_t {
+  STAGE_INPUT,      // '#' or an NFC_UID line until it reaches the pipeline
+  STAGE_HASH,       // finishing the PIN digest, hashing a card UID
+  STAGE_LOOKUP,     // store and image lookup
+  STAGE_NVS,        // flushing batched bookkeeping to NVS
+  STAGE_HTTP,       // /api/unlock round trip, timed by the network task
+  STAGE_DISPLAY,    // verdict screen sent to the LCD, after the servo command
+  STAGE_SERVO_CMD,  // sending SERVO:90 to the Arduino
+  STAGE_SERVO_ACK,  // SERVO:90 sent until SERVO_OK came back
+  STAGE_UNLOCK,     // last input until SERVO:90 sent, end to end
+  STAGE_COUNT
+};
+
+struct LatencySpan {
+  LatencyStage stage;
+  uint32_t durationUs;
+};
+
+// Lightweight spans on the unlock path. record() costs an esp_timer read
+// and an 8-byte store into a fixed ring; loop() folds the ring into one
+// log-scale histogram per stage (4 buckets per power of two, so a
+// percentile is within ~12%) and metricsJson() reports count, min, p50,
+// p99 and max per stage. Door task only; the network task's HTTP time
+// comes back in the verdict event.
+class LatencyTrace {
+public:
+  LatencyTrace();
+  
+  static uint32_t now() { return (uint32_t)esp_timer_get_time(); }
+  
+  void record(LatencyStage stage, uint32_t startUs) { add(stage, now() - startUs); }
+  void add(LatencyStage stage, uint32_t durationUs);
+  
+  // Where an unlock starts and where it ends. unlock is false when the
+  // door opens for something other than the last input (mytopic/open).
+  void inputStarted(uint32_t startUs);
+  void inputSubmitted();
+  void servoSent(uint32_t sentUs, bool unlock);
+  void servoAcked();
+  // Time since the input that is still waiting to open the door, 0 if none
+  uint32_t sinceInput() const { return inputPending ? now() - inputAt : 0; }
+  
+  // Folds recorded spans into the histograms; call from loop()
+  void loop();
+  // {"windowMs":..,"dropped":..,"stages":{"input":{"count":..,"min":..,
+  // "p50":..,"p99":..,"max":..},...}} in microseconds
+  String metricsJson();
+  // Starts a new window
+  void reset();
+
+private:
+  static const uint8_t BUCKETS = 124;
+  
+  struct StageHistogram {
+    uint16_t counts[BUCKETS];
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+  };
+  
+  LatencySpan ring[LATENCY_TRACE_RING_SIZE];
+  uint8_t ringHead;
+  uint8_t ringCount;
+  uint32_t dropped;
+  StageHistogram stages[STAGE_COUNT];
+  uint32_t windowStart;
+  uint32_t inputAt;
+  uint32_t servoAt;
+  bool inputPending;  // an input has not yet opened the door
+  bool servoPending;  // SERVO_OK is expected
+  
+  static uint8_t bucketOf(uint32_t us);
+  static uint32_t bucketValue(uint8_t bucket);
+  uint32_t percentile(const StageHistogram& histogram, uint8_t p) const;
+};
+
+extern LatencyTrace latencyTrace;
@@ -0,0 +1,90 @@
+#include "lcd_frame.h"
+
+LcdFrame::LcdFrame(LiquidCrystal_I2C& panel) : panel(panel) {
+  memset(frame, ' ', sizeof(frame));
+  memset(shown, ' ', sizeof(shown));
+  cursorColumn = 0;
+  cursorRow = 0;
+  panelColumn = 0;
+  panelRow = 0;
+  dirty = false;
+  memset(&counters, 0, sizeof(counters));
+}
+
+void LcdFrame::init() {
+  panel.init();  // clears the panel too
+  memset(frame, ' ', sizeof(frame));
+  memset(shown, ' ', sizeof(shown));
+  cursorColumn = 0;
+  cursorRow = 0;
+  panelColumn = 0;
+  panelRow = 0;
+  dirty = false;
+}
+
+void LcdFrame::clear() {
+  memset(frame, ' ', sizeof(frame));
+  cursorColumn = 0;
+  cursorRow = 0;
+  dirty = true;
+}
+
+void LcdFrame::setCursor(uint8_t column, uint8_t row) {
+  cursorColumn = column;
+  cursorRow = row < ROWS ? row : ROWS - 1;
+}
+
+// Text past the last column is off screen on the panel too
+size_t LcdFrame::write(uint8_t c) {
+  if (cursorColumn < COLUMNS) {
+    frame[cursorRow][cursorColumn] = c;
+    dirty = true;
+  }
+  if (cursorColumn < 0xFF) cursorColumn++;
+  return 1;
+}
+
+size_t LcdFrame::write(const uint8_t* buffer, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    write(buffer[i]);
+  }
+  return size;
+}
+
+uint16_t LcdFrame::refresh() {
+  if (!dirty) return 0;
+  dirty = false;
+  
+  uint32_t startUs = micros();
+  uint16_t sent = 0;
+  for (uint8_t row = 0; row < ROWS; row++) {
+    uint8_t column = 0;
+    while (column < COLUMNS) {
+      if (frame[row][column] == shown[row][column]) {
+        column++;
+        continue;
+      }
+      uint8_t end = column + 1;
+      while (end < COLUMNS && frame[row][end] != shown[row][end]) end++;
+      
+      if (panelRow != row || panelColumn != column) {
+        panel.setCursor(column, row);
+        sent++;
+      }
+      panel.write((const uint8_t*)&frame[row][column], end - column);
+      memcpy(&shown[row][column], &frame[row][column], end - column);
+      sent += end - column;
+      panelRow = row;
+      panelColumn = end;
+      column = end;
+    }
+  }
+  if (sent == 0) return 0;
+  
+  uint32_t elapsedUs = micros() - startUs;
+  counters.frames++;
+  counters.lcdBytes += sent;
+  counters.busyUs += elapsedUs;
+  if (elapsedUs > counters.maxFrameUs) counters.maxFrameUs = elapsedUs;
+  return sent;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <Arduino.h>
+#include <LiquidCrystal_I2C.h>
+
+// Bytes on the I2C bus per byte sent to the controller: two 4-bit nibbles,
+// each written to the PCF8574 three times (data, enable high, enable low)
+// as address + data
+static const uint8_t LCD_I2C_BYTES_PER_BYTE = 2 * 3 * 2;
+
+struct LcdFrameStats {
+  uint32_t frames;      // refreshes that sent anything
+  uint32_t lcdBytes;    // commands and characters sent to the controller
+  uint32_t busyUs;      // spent in refresh()
+  uint32_t maxFrameUs;
+};
+
+// 16x2 shadow of the LCD. Callers draw with the LiquidCrystal_I2C calls
+// they already use, but into RAM: clear() only blanks the shadow, so the
+// controller's 2 ms clear is never paid. refresh() compares the shadow
+// with what the panel shows and sends only the cells that differ, with one
+// setCursor per run of changes and none when the controller's cursor is
+// already there. loop() refreshes once per pass, so a screen redrawn several
+// times in a pass costs one update; setup() refreshes before anything that
+// blocks. Door task only.
+class LcdFrame : public Print {
+public:
+  static const uint8_t COLUMNS = 16;
+  static const uint8_t ROWS = 2;
+  
+  explicit LcdFrame(LiquidCrystal_I2C& panel);
+  
+  // Initialises and clears the panel; both start blank
+  void init();
+  void backlight() { panel.backlight(); }
+  
+  void clear();
+  void setCursor(uint8_t column, uint8_t row);
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t* buffer, size_t size) override;
+  using Print::write;
+  
+  // Sends what changed since the last refresh; returns the bytes sent to
+  // the controller
+  uint16_t refresh();
+  
+  const LcdFrameStats& stats() const { return counters; }
+
+private:
+  LiquidCrystal_I2C& panel;
+  char frame[ROWS][COLUMNS];
+  char shown[ROWS][COLUMNS];
+  uint8_t cursorColumn;  // where the next write lands in frame
+  uint8_t cursorRow;
+  uint8_t panelColumn;   // the controller's cursor
+  uint8_t panelRow;
+  bool dirty;
+  LcdFrameStats counters;
+};
@@ -2,12 +2,24 @@
 #include <LiquidCrystal_I2C.h>
 #include <Keypad.h>
 #include <WiFi.h>
-#include <HTTPClient.h>
-#include "EspMQTTClient.h"
 #include "offline_auth.h"
+#include "scheduler.h"
+#include "network.h"
+#include "auth_pipeline.h"
+#include "input_trace.h"
+#include "latency_trace.h"
+#include "arduino_link.h"
+#include "audit_log.h"
+#include "mqtt_outbox.h"
+#include "lcd_frame.h"
+#include "keypad_scanner.h"
+#include "power_manager.h"
+#include "memory_telemetry.h"
 
 // LCD setup
-LiquidCrystal_I2C lcd(0x27, 16, 2);
+LiquidCrystal_I2C lcdPanel(0x27, 16, 2);
+// Screens are drawn here and reach the panel at the next refresh
+LcdFrame lcd(lcdPanel);
 
 // Keypad setup
 const byte ROWS = 4;
@@ -24,27 +36,25 @@ byte colPins[COLS] = {26, 25, 33, 32};
 Keypad keypad = Keypad(makeKeymap(keys), rowPins, colPins, ROWS, COLS);
 
 String pinInput = "";
+PinHasher pinHasher; // Hashes pinInput digit by digit as it is typed
 String pendingNfcId = ""; // Store NFC ID for combined authentication
 bool waitingForNfc = false; // Flag for combined auth
 bool offlineMode = false; // Track if we're in offline mode
 
-// Hardcoded WiFi credentials
-const char* wifi_ssid = "HONG SY 4G";
-const char* wifi_pass = "22226666";
-
 // Enrollment state
 bool enrollment = false;
-uint8_t enrollmentUserId = 0;
-
-// MQTT setup
-EspMQTTClient client(
-  wifi_ssid,
-  wifi_pass,
-  "165.232.169.151",  // MQTT Broker server ip
-  "caxtiq",           // MQTT username
-  "anthithhn1N_",     // MQTT password
-  "TestClient"        // Client name
-);
+uint16_t enrollmentUserId = 0;
+
+// Users applied from the sync in progress, and the last sync's report
+uint16_t syncAdded = 0;
+uint16_t syncUpdated = 0;
+uint16_t syncUnchanged = 0;
+uint16_t syncRemoved = 0;
+uint16_t syncFailed = 0;
+String lastSyncReport = "{}";
+
+// An audit batch is with the network task
+bool auditUploading = false;
 
 void showEnterPin() {
   lcd.clear();
@@ -55,7 +65,7 @@ void showEnterPin() {
     lcd.print("Enter PIN:");
   }
   lcd.setCursor(0, 1);
-  for (int i = 0; i < pinInput.length(); i++) lcd.print("*");
+  for (size_t i = 0; i < pinInput.length(); i++) lcd.print("*");
 }
 
 void showSystemStatus() {
@@ -74,6 +84,21 @@ void showSystemStatus() {
   lcd.print("Fails: " + String(offlineAuth.getFailedAttempts()));
 }
 
+// Keeps the current screen up for holdMs, then goes back to the PIN prompt
+void returnToIdle(uint32_t holdMs) {
+  scheduler.after(holdMs, showEnterPin);
+}
+
+// Denied screen, then the lockout countdown, then the PIN prompt
+void showDeniedThenIdle() {
+  if (offlineAuth.getRemainingLockoutTime() > 0) {
+    showSystemStatus();
+    returnToIdle(3000);
+  } else {
+    showEnterPin();
+  }
+}
+
 void showWiFiStatus() {
   lcd.clear();
   lcd.setCursor(0, 0);
@@ -104,260 +129,308 @@ void showWiFiStatus() {
   Serial.println("Offline Mode: " + String(offlineMode ? "YES" : "NO"));
 }
 
-bool handleOfflineAuthentication(const String& credential, AuthType authType) {
-  AuthResult result;
-  
-  if (authType == AUTH_PIN) {
-    result = offlineAuth.authenticatePin(credential);
-  } else if (authType == AUTH_NFC) {
-    result = offlineAuth.authenticateNfc(credential);
-  }
-  
+// Tells the Arduino to move the servo; unlock marks the end of an
+// input-to-unlock span
+void openDoor(bool unlock) {
+  uint32_t sentUs = LatencyTrace::now();
+  arduinoLink.servo(90);
+  latencyTrace.record(STAGE_SERVO_CMD, sentUs);
+  latencyTrace.servoSent(sentUs, unlock);
+}
+
+// One audit record per verdict, a single flash write
+void auditVerdict(const AuthVerdict& verdict, uint32_t latencyMs) {
+  AuditMethod method = verdict.kind == CREDENTIAL_NFC ? AUDIT_NFC : AUDIT_PIN;
+  auditLog.append(method, verdict.granted, verdict.source, verdict.userId, latencyMs);
+}
+
+// Verdict handler for the auth pipeline: LCD message and servo
+void showVerdict(const AuthVerdict& verdict) {
   lcd.clear();
   lcd.setCursor(0, 0);
   
-  if (result.success) {
-    lcd.print("Access Granted!");
-    lcd.setCursor(0, 1);
-    OfflineUser user = offlineAuth.getUser(result.userId);
-    lcd.print("Welcome " + String(user.name));
-    
-    // Trigger door unlock
-    Serial2.println("SERVO:90");
-    delay(3000);
-    return true;
-  } else {
-    lcd.print("Access Denied!");
-    lcd.setCursor(0, 1);
-    lcd.print(result.message);
-    
-    if (offlineAuth.getRemainingLockoutTime() > 0) {
-      delay(2000);
-      showSystemStatus();
-      delay(3000);
+  if (verdict.granted) {
+    if (verdict.source != VERDICT_LOCAL) {
+      lcd.print(verdict.kind == CREDENTIAL_NFC ? "NFC Access!" : "Online Access!");
+      lcd.setCursor(0, 1);
+      lcd.print("Door Opening...");
     } else {
-      delay(2000);
+      lcd.print("Access Granted!");
+      lcd.setCursor(0, 1);
+      OfflineUser user;
+      offlineAuth.getUser(verdict.userId, user);
+      lcd.print("Welcome ");
+      lcd.print(user.name);
     }
-    return false;
+    
+    // Trigger door unlock, then show why; the audit record goes last
+    uint32_t latencyMs = latencyTrace.sinceInput() / 1000;
+    openDoor(true);
+    uint32_t displayUs = LatencyTrace::now();
+    lcd.refresh();
+    latencyTrace.record(STAGE_DISPLAY, displayUs);
+    auditVerdict(verdict, latencyMs);
+    scheduler.cancel(showDeniedThenIdle);
+    returnToIdle(3000);
+    return;
   }
+  
+  lcd.print("Access Denied!");
+  lcd.setCursor(0, 1);
+  lcd.print(authMessageText(verdict.message));
+  auditVerdict(verdict, latencyTrace.sinceInput() / 1000);
+  
+  scheduler.cancel(showEnterPin);
+  scheduler.after(2000, showDeniedThenIdle);
 }
 
-void sendUnlockRequest(const String& code) {
-  // Try online authentication first if WiFi is available
-  if (WiFi.status() == WL_CONNECTED && !offlineMode) {
-    HTTPClient http;
-    http.begin("http://165.232.169.151:3000/api/unlock");
-    http.addHeader("Authorization", "meichan-auth");
-    http.addHeader("Content-Type", "application/json");
+// Offline, the network task's outbox keeps it until the broker is back
+void publish(const char* topic, const String& payload) {
+  sendNetCommand(NET_PUBLISH, payload, topic);
+}
 
-    String payload = "{\"code\":\"" + code + "\"}";
-    int httpResponseCode = http.POST(payload);
+// Latency histograms for the last window, then a fresh window
+void publishMetrics() {
+  if (!offlineMode) {
+    publish("admin/metrics", latencyTrace.metricsJson());
+    latencyTrace.reset();
+  }
+}
 
-    if (httpResponseCode > 0) {
-      String response = http.getString();
-      Serial.println("Unlock Response: " + response);
-      lcd.clear();
-      lcd.setCursor(0, 0);
-      if (response.indexOf("\"success\":true") != -1) {
-        lcd.print("Online Access!");
-        lcd.setCursor(0, 1);
-        lcd.print("Door Opening...");
-        Serial2.println("SERVO:90");
-        
-        // Reset failed attempts on successful online auth
-        offlineAuth.resetFailedAttempts();
-        
-        delay(3000);
-        showEnterPin();
-        return;
-      } else {
-        lcd.print("Online Failed!");
-        delay(1000);
-      }
-    } else {
-      Serial.println("Unlock POST failed");
-      lcd.clear();
-      lcd.setCursor(0, 0);
-      lcd.print("HTTP Error!");
-      delay(1000);
+// The last memory sample, for admin/system-status and alerts
+String memoryJson() {
+  const MemorySample& memory = memoryTelemetry.last();
+  String json = "{\"free\":" + String(memory.freeHeap) +
+                ",\"minFree\":" + String(memory.minFreeHeap) +
+                ",\"largestBlock\":" + String(memory.largestBlock) +
+                ",\"fragmentation\":" + String(memory.fragmentation) +
+                ",\"nvsFreeEntries\":" + String(memory.nvsFreeEntries) +
+                ",\"alerts\":" + String(memoryTelemetry.alertCount()) +
+                ",\"stackFree\":{";
+  for (uint8_t i = 0; i < memoryTelemetry.taskCount(); i++) {
+    const MemoryTask& task = memoryTelemetry.task(i);
+    json += String(i > 0 ? "," : "") + "\"" + task.name + "\":" + String(task.stackFree);
+  }
+  json += "}";
+  if (MemoryTelemetry::allocationsCounted()) {
+    String counts = ",\"allocs\":{";
+    String bytes = ",\"allocBytes\":{";
+    for (uint8_t i = 0; i < MEM_SUBSYSTEMS; i++) {
+      MemorySubsystem subsystem = (MemorySubsystem)i;
+      String key = String(i > 0 ? "," : "") + "\"" + MemoryTelemetry::subsystemName(subsystem) + "\":";
+      counts += key + String(memoryTelemetry.allocations(subsystem));
+      bytes += key + String(memoryTelemetry.allocatedBytes(subsystem));
     }
-    http.end();
+    json += counts + "}" + bytes + "}";
   }
+  return json + "}";
+}
+
+// Every MEMORY_SAMPLE_MS; a newly crossed threshold goes out on admin/alert
+void sampleMemory() {
+  uint8_t raised = memoryTelemetry.sample(offlineAuth.getNvsFreeEntries());
+  if (raised == 0) return;
   
-  // If online fails or not available, try offline authentication
-  // But don't count failures if we already tried online (server might be slow)
-  AuthResult result = offlineAuth.authenticatePin(code);
-  if (result.success) {
-    lcd.clear();
-    lcd.setCursor(0, 0);
-    lcd.print("Offline Access!");
-    lcd.setCursor(0, 1);
-    OfflineUser user = offlineAuth.getUser(result.userId);
-    lcd.print("Welcome " + String(user.name));
-    
-    // Trigger door unlock
-    Serial2.println("SERVO:90");
-    delay(3000);
-    showEnterPin();
-    return;
+  const MemorySample& memory = memoryTelemetry.last();
+  Serial.printf("[MEM] Alert: %u bytes free, largest block %u (%u%% fragmented)\n",
+                memory.freeHeap, memory.largestBlock, memory.fragmentation);
+  String alerts;
+  for (uint8_t bit = MEM_ALERT_FRAGMENTED; bit <= MEM_ALERT_STACK; bit <<= 1) {
+    if (raised & bit) {
+      alerts += String(alerts.length() > 0 ? "," : "") + "\"" + MemoryTelemetry::alertName((MemoryAlert)bit) + "\"";
+    }
+  }
+  publish("admin/alert", "{\"memory\":[" + alerts + "],\"sample\":" + memoryJson() + "}");
+}
+
+// Sends the next batch of unacknowledged audit records to the backend.
+// Re-arms itself every AUDIT_UPLOAD_PERIOD_MS; scheduling it sooner (on
+// reconnect) just moves the next run up.
+void uploadAudit() {
+  scheduler.after(AUDIT_UPLOAD_PERIOD_MS, uploadAudit);
+  uint32_t from, to;
+  if (offlineMode || auditUploading || !auditLog.pendingRange(from, to)) return;
+  if (sendNetCommand(NET_AUDIT, String(from) + ":" + String(to)) != 0) {
+    auditUploading = true;
   }
+}
+
+// Payload "acked:unixTime"
+void handleAuditResult(const DoorEvent& event) {
+  auditUploading = false;
+  if (!event.success) return;
   
-  // Both online and offline failed
-  lcd.clear();
-  lcd.setCursor(0, 0);
-  lcd.print("Access Denied!");
-  lcd.setCursor(0, 1);
-  lcd.print(result.message);
+  uint32_t before = auditLog.acknowledged();
+  int colon = event.payload.indexOf(':');
+  auditLog.acknowledge(strtoul(event.payload.c_str(), nullptr, 10));
+  uint32_t unixTime = colon > 0 ? strtoul(event.payload.c_str() + colon + 1, nullptr, 10) : 0;
+  if (unixTime > 0) {
+    auditLog.setTime(unixTime);
+  }
   
-  if (offlineAuth.getRemainingLockoutTime() > 0) {
-    delay(2000);
-    showSystemStatus();
-    delay(3000);
-  } else {
-    delay(2000);
+  // Work through a backlog left by an outage batch after batch
+  if (auditLog.acknowledged() > before) {
+    uploadAudit();
   }
 }
 
-void sendNfcUnlockRequest(const String& nfcId) {
-  // Try online authentication first if WiFi is available
-  if (WiFi.status() == WL_CONNECTED && !offlineMode) {
-    HTTPClient http;
-    http.begin("http://165.232.169.151:3000/api/unlock");
-    http.addHeader("Authorization", "meichan-auth");
-    http.addHeader("Content-Type", "application/json");
+// Asks for the changes since the last completed sync
+void requestSync() {
+  sendNetCommand(NET_SYNC, String(offlineAuth.getSyncRevision()));
+}
 
-    String payload = "{\"code\":\"" + nfcId + "\"}";
-    int httpResponseCode = http.POST(payload);
+void handleEnrollResult(const DoorEvent& event) {
+  lcd.clear();
+  lcd.setCursor(0, 0);
+  if (!event.reached) {
+    lcd.print(offlineMode ? "No WiFi!" : "Enroll Error!");
+  } else if (event.success) {
+    lcd.print("Enroll success!");
+  } else {
+    lcd.print("Enroll failed!");
+  }
+  returnToIdle(2000);
+}
 
-    if (httpResponseCode > 0) {
-      String response = http.getString();
-      Serial.println("NFC Unlock Response: " + response);
-      lcd.clear();
-      lcd.setCursor(0, 0);
-      if (response.indexOf("\"success\":true") != -1) {
-        lcd.print("NFC Access!");
-        lcd.setCursor(0, 1);
-        lcd.print("Door Opening...");
-        Serial2.println("SERVO:90");
-        
-        // Reset failed attempts on successful online auth
-        offlineAuth.resetFailedAttempts();
-        
-        delay(3000);
-        showEnterPin();
-        return;
-      } else {
-        lcd.print("Online NFC Failed!");
-        delay(1000);
-      }
-    } else {
-      Serial.println("NFC POST failed");
-      lcd.clear();
-      lcd.setCursor(0, 0);
-      lcd.print("HTTP Error!");
-      delay(1000);
+// Writes changes parsed by the network task into the store as one batch.
+// Called every loop with a small budget, so the keypad stays live during a
+// large sync.
+void applySyncedUsers(uint16_t maxUsers) {
+  MemoryScope scope(MEM_SYNC);
+  SyncUser user;
+  for (uint16_t i = 0; i < maxUsers && syncUsers.pop(user); i++) {
+    if (!offlineAuth.isSyncing()) {
+      offlineAuth.beginSync();
+    }
+    
+    if (user.op == SYNC_COMMIT) {
+      // A full roster carries no removals; whatever it left out is gone
+      if (user.full) syncRemoved += offlineAuth.pruneUnseenUsers();
+      offlineAuth.commitSync(user.revision);
+      continue;
+    }
+    if (user.op == SYNC_REMOVE) {
+      if (offlineAuth.removeSyncedUser(user.pin, user.nfc)) syncRemoved++;
+      continue;
+    }
+    
+    AuthType authType = (AuthType)user.authType;
+    if (authType < AUTH_PIN || authType > AUTH_COMBINED) {
+      authType = user.pin[0] ? AUTH_PIN : AUTH_NFC;
+    }
+    
+    switch (offlineAuth.upsertUser(user.name, user.pin, user.nfc, authType)) {
+      case UPSERT_ADDED: syncAdded++; break;
+      case UPSERT_UPDATED: syncUpdated++; break;
+      case UPSERT_UNCHANGED: syncUnchanged++; break;
+      default: syncFailed++; break;
     }
-    http.end();
   }
+}
+
+void handleSyncResult(const DoorEvent& event) {
+  // Changes still queued belong to this sync; without a commit marker
+  // (failed download) they are kept but the cursor stays put
+  applySyncedUsers(0xFFFF);
+  offlineAuth.endSync();
+  
+  // Network-side parse stats plus what the store did with them
+  lastSyncReport = event.payload.length() > 0 ? event.payload.substring(0, event.payload.length() - 1) : "{";
+  lastSyncReport += String(event.payload.length() > 0 ? "," : "") +
+                    "\"ok\":" + (event.success ? "true" : "false") +
+                    ",\"added\":" + String(syncAdded) +
+                    ",\"updated\":" + String(syncUpdated) +
+                    ",\"unchanged\":" + String(syncUnchanged) +
+                    ",\"removed\":" + String(syncRemoved) +
+                    ",\"failed\":" + String(syncFailed) + "}";
+  Serial.printf("[SYNC] Applied: %u added, %u updated, %u unchanged, %u removed, %u failed\n",
+                syncAdded, syncUpdated, syncUnchanged, syncRemoved, syncFailed);
+  syncAdded = 0;
+  syncUpdated = 0;
+  syncUnchanged = 0;
+  syncRemoved = 0;
+  syncFailed = 0;
   
-  // If online fails or not available, try offline NFC authentication
-  AuthResult result = offlineAuth.authenticateNfc(nfcId);
-  if (result.success) {
+  if (event.success) {
     lcd.clear();
     lcd.setCursor(0, 0);
-    lcd.print("Offline NFC!");
+    lcd.print("Syncing users...");
     lcd.setCursor(0, 1);
-    OfflineUser user = offlineAuth.getUser(result.userId);
-    lcd.print("Welcome " + String(user.name));
-    
-    // Trigger door unlock
-    Serial2.println("SERVO:90");
-    delay(3000);
-    showEnterPin();
-    return;
+    lcd.print("Downloaded!");
+    returnToIdle(2000);
   }
-  
-  // Both online and offline failed
-  lcd.clear();
-  lcd.setCursor(0, 0);
-  lcd.print("Access Denied!");
-  lcd.setCursor(0, 1);
-  lcd.print("Unknown NFC Card");
-  delay(2000);
 }
 
-void syncUsersFromServer() {
-  if (WiFi.status() != WL_CONNECTED || offlineMode) {
-    Serial.println("[SYNC] No internet connection for sync");
-    return;
+void handleImageResult(const DoorEvent& event) {
+  // The old image stays mounted unless the new one was installed
+  bool mounted = event.success && offlineAuth.reloadImage();
+  if (mounted) {
+    verdictCache.clear();
   }
   
-  HTTPClient http;
-  http.begin("http://165.232.169.151:3000/api/users");
-  http.addHeader("Authorization", "meichan-auth");
-  
-  int httpResponseCode = http.GET();
-  
-  if (httpResponseCode == 200) {
-    String response = http.getString();
-    Serial.println("[SYNC] Users downloaded: " + response);
-    
-    // Parse JSON and add users to offline storage
-    // Format expected: {"users":[{"name":"John","pin":"1234","nfc":"abc123","authType":1},...]}
-    
-    // Simple parsing (you might want to use ArduinoJson library)
-    if (response.indexOf("\"users\":[") > 0) {
+  const CredentialImage& image = offlineAuth.getImage();
+  String response = "{\"loaded\":" + String(mounted ? "true" : "false") +
+                    ",\"reached\":" + (event.reached ? "true" : "false") +
+                    ",\"users\":" + String(image.userCount()) +
+                    ",\"revision\":" + String(image.revision()) +
+                    ",\"download\":" + (event.payload.length() > 0 ? event.payload : "{}") + "}";
+  publish("admin/response", response);
+}
+
+void handleConnectivity(uint8_t state) {
+  switch (state) {
+    case NET_ONLINE:
+      offlineMode = false;
+      authPipeline.setOnline(true);
+      // Catch up with the server once the connection has settled
+      scheduler.after(1000, requestSync);
+      scheduler.after(2000, uploadAudit);
+      break;
+      
+    case NET_RECONNECTING:
       lcd.clear();
       lcd.setCursor(0, 0);
-      lcd.print("Syncing users...");
+      lcd.print("WiFi Reconnecting");
+      lcd.setCursor(0, 1);
+      lcd.print("Please wait...");
+      break;
       
-      // TODO: Parse JSON properly and add each user
-      // For now, just show sync attempt
+    case NET_OFFLINE:
+      offlineMode = true;
+      authPipeline.setOnline(false);
+      lcd.clear();
+      lcd.setCursor(0, 0);
+      lcd.print("WiFi Lost!");
       lcd.setCursor(0, 1);
-      lcd.print("Downloaded!");
-      delay(2000);
-    }
-  } else {
-    Serial.println("[SYNC] Failed to download users: " + String(httpResponseCode));
+      lcd.print("Offline Mode");
+      returnToIdle(2000);
+      break;
+      
+    case NET_RESTORED:
+      offlineMode = false;
+      authPipeline.setOnline(true);
+      lcd.clear();
+      lcd.setCursor(0, 0);
+      lcd.print("WiFi Restored!");
+      lcd.setCursor(0, 1);
+      lcd.print("Online Mode");
+      returnToIdle(2000);
+      // Whatever was logged while offline goes up now
+      scheduler.after(2000, uploadAudit);
+      break;
   }
-  
-  http.end();
 }
 
-void sendEnrollRequest(const String& nfcId) {
-  if (WiFi.status() == WL_CONNECTED) {
-    HTTPClient http;
-    http.begin("http://165.232.169.151:3000/api/enroll");
-    http.addHeader("Authorization", "meichan-auth");
-    http.addHeader("Content-Type", "application/json");
+void handleArduinoMessage(const ArduinoMessage& message);
 
-    String payload = "{\"id\":\"" + nfcId + "\"}";
-    int httpResponseCode = http.POST(payload);
+// Bytes from the Arduino, from the UART driver's event task
+static void wakeOnSerial2() {
+  powerManager.wake();
+}
 
-    if (httpResponseCode > 0) {
-      String response = http.getString();
-      Serial.println("Enroll Response: " + response);
-      lcd.clear();
-      lcd.setCursor(0, 0);
-      if (response.indexOf("\"success\":true") != -1) {
-        lcd.print("Enroll success!");
-      } else {
-        lcd.print("Enroll failed!");
-      }
-    } else {
-      Serial.println("Enroll POST failed");
-      lcd.clear();
-      lcd.setCursor(0, 0);
-      lcd.print("Enroll Error!");
-    }
-    delay(2000);
-    http.end();
-  } else {
-    lcd.clear();
-    lcd.setCursor(0, 0);
-    lcd.print("No WiFi!");
-    delay(2000);
-  }
+// Nothing to do until a key, a byte on Serial2, a network event or a timer
+static bool doorIdle() {
+  return !offlineAuth.isSyncing() && arduinoLink.isIdle() && offlineAuth.getRemainingLockoutTime() == 0;
 }
 
 void setup() {
@@ -366,34 +439,41 @@ void setup() {
   lcd.backlight();
 
   Serial.begin(115200); // Debug
-  Serial2.begin(9600, SERIAL_8N1, 16, 17); // RX2=GPIO16, TX2=GPIO17
+  Serial2.setRxBufferSize(ARDUINO_LINK_UART_BUFFER);
+  Serial2.begin(LINK_BOOT_BAUD, SERIAL_8N1, 16, 17); // RX2=GPIO16, TX2=GPIO17
 
   // Initialize offline authentication system
   lcd.clear();
   lcd.setCursor(0, 0);
   lcd.print("Initializing...");
+  lcd.refresh();
   
   if (!offlineAuth.begin()) {
     lcd.clear();
     lcd.setCursor(0, 0);
     lcd.print("Auth Init Failed!");
+    lcd.refresh();
     delay(3000);
   } else {
     lcd.setCursor(0, 1);
     lcd.print("Auth Ready");
+    lcd.refresh();
     delay(1000);
   }
+  auditLog.begin();
 
   lcd.clear();
   lcd.setCursor(0, 0);
   lcd.print("Connecting...");
   lcd.setCursor(0, 1);
   lcd.print(wifi_ssid);
+  lcd.refresh();
   
   // Configure WiFi for better stability
   WiFi.mode(WIFI_STA);
   WiFi.setAutoReconnect(true);
   WiFi.persistent(true);
+  WiFi.setSleep(true); // modem sleep: the radio wakes for DTIM beacons only
   WiFi.begin(wifi_ssid, wifi_pass);
 
   unsigned long startAttemptTime = millis();
@@ -414,7 +494,6 @@ void setup() {
     Serial.print("Signal strength: ");
     Serial.println(WiFi.RSSI());
     offlineMode = false;
-    delay(2000);
   } else {
     lcd.clear();
     lcd.setCursor(0, 0);
@@ -424,232 +503,522 @@ void setup() {
     Serial.println();
     Serial.println("WiFi connection failed!");
     offlineMode = true;
-    delay(2000);
   }
   
-  showEnterPin();
+  returnToIdle(2000);
+  authPipeline.begin(showVerdict);
+  authPipeline.setOnline(!offlineMode);
+  powerManager.begin();
+  memoryTelemetry.begin();
+  startNetworkTask(offlineMode);
+  arduinoLink.begin(handleArduinoMessage);
+  Serial2.onReceive(wakeOnSerial2);
+  keypadScanner.begin(keypad, rowPins, colPins, ROWS, COLS);
+  latencyTrace.reset();
+  scheduler.every(LATENCY_METRICS_PERIOD_MS, publishMetrics);
+  scheduler.after(AUDIT_UPLOAD_PERIOD_MS, uploadAudit);
+  sampleMemory();
+  scheduler.every(MEMORY_SAMPLE_MS, sampleMemory);
+  
+#ifdef INPUT_TRACE_AT_BOOT
+  inputTrace.start(offlineAuth.getSyncRevision(), offlineAuth.getUserCount(), offlineMode);
+#endif
 }
 
-void onConnectionEstablished() {
-  offlineMode = false; // We have MQTT connection, so we're online
+// MQTT messages forwarded by the network task; runs on the door task, which
+// owns the LCD, Serial2 and the user store
+void handleMqttCommand(const DoorEvent& event) {
+  MemoryScope scope(MEM_MQTT);
+  const String& payload = event.payload;
   
-  client.subscribe("mytopic/test", [] (const String &payload)  {
-    Serial.println(payload);
-    lcd.clear();
-    lcd.setCursor(0, 0);
-    lcd.print("MQTT msg:");
-    lcd.setCursor(0, 1);
-    lcd.print(payload.substring(0, 16));
-    delay(2000);
-    showEnterPin();
-  });
-
-  client.subscribe("mytopic/open", [] (const String &payload) {
-    lcd.clear();
-    lcd.setCursor(0, 0);
-    lcd.print("Opening...");
-    Serial2.println("SERVO:90"); // Command Arduino to move servo
-    showEnterPin();
-  });
-
-  client.subscribe("auth/nfc-register", [] (const String &payload) {
-    // For Arduino NFC writing - payload should be enrollment data
-    Serial2.print("WRITE_NFC:");
-    Serial2.println(payload);
-  });
-
-  client.subscribe("mytopic/activate", [] (const String &payload) {
-    Serial.print("Activate payload: ");
-    Serial.println(payload);
-    if (payload == "enroll") {
-      enrollment = true;
-      enrollmentUserId = 1; // Default to user 1, can be changed via admin commands
+  switch (event.state) {
+    case MQTT_TEST_MESSAGE: { // mytopic/test
+      Serial.println(payload);
       lcd.clear();
       lcd.setCursor(0, 0);
-      lcd.print("Enroll mode ON");
+      lcd.print("MQTT msg:");
       lcd.setCursor(0, 1);
-      lcd.print("User ID: " + String(enrollmentUserId));
-      delay(2000);
-    } else if (payload.startsWith("enroll:")) {
-      // Format: "enroll:userId"
-      enrollmentUserId = payload.substring(7).toInt();
-      enrollment = true;
+      lcd.print(payload.substring(0, 16));
+      returnToIdle(2000);
+      break;
+    }
+    
+    case MQTT_OPEN: { // mytopic/open
       lcd.clear();
       lcd.setCursor(0, 0);
-      lcd.print("Enroll mode ON");
-      lcd.setCursor(0, 1);
-      lcd.print("User ID: " + String(enrollmentUserId));
-      delay(2000);
+      lcd.print("Opening...");
+      openDoor(false); // Command Arduino to move servo
+      auditLog.append(AUDIT_REMOTE, true, VERDICT_ONLINE, 0, 0);
+      returnToIdle(2000);
+      break;
+    }
+    
+    case MQTT_NFC_REGISTER: { // auth/nfc-register
+      // For Arduino NFC writing - payload should be enrollment data
+      if (!arduinoLink.writeNfc(payload.c_str())) {
+        publish("admin/response", "NFC data too long");
+      }
+      break;
+    }
+    
+    case MQTT_ACTIVATE: { // mytopic/activate
+      Serial.print("Activate payload: ");
+      Serial.println(payload);
+      if (payload == "enroll") {
+        enrollment = true;
+        enrollmentUserId = 1; // Default to user 1, can be changed via admin commands
+        lcd.clear();
+        lcd.setCursor(0, 0);
+        lcd.print("Enroll mode ON");
+        lcd.setCursor(0, 1);
+        lcd.print("User ID: " + String(enrollmentUserId));
+        returnToIdle(2000);
+      } else if (payload.startsWith("enroll:")) {
+        // Format: "enroll:userId"
+        enrollmentUserId = payload.substring(7).toInt();
+        enrollment = true;
+        lcd.clear();
+        lcd.setCursor(0, 0);
+        lcd.print("Enroll mode ON");
+        lcd.setCursor(0, 1);
+        lcd.print("User ID: " + String(enrollmentUserId));
+        returnToIdle(2000);
+      }
+      break;
     }
-  });
-
-  // Admin commands for user management (controlled by backend/frontend)
-  client.subscribe("admin/add-user", [] (const String &payload) {
-    // Format: "name:pin:nfcId:authType" where authType is 1=PIN, 2=NFC, 3=COMBINED
-    int firstColon = payload.indexOf(':');
-    int secondColon = payload.indexOf(':', firstColon + 1);
-    int thirdColon = payload.indexOf(':', secondColon + 1);
     
-    if (firstColon > 0 && secondColon > 0 && thirdColon > 0) {
-      String name = payload.substring(0, firstColon);
-      String pin = payload.substring(firstColon + 1, secondColon);
-      String nfcId = payload.substring(secondColon + 1, thirdColon);
-      AuthType authType = (AuthType)payload.substring(thirdColon + 1).toInt();
+    case MQTT_ADD_USER: { // admin/add-user
+      // Format: "name:pin:nfcId:authType" where authType is 1=PIN, 2=NFC, 3=COMBINED
+      int firstColon = payload.indexOf(':');
+      int secondColon = payload.indexOf(':', firstColon + 1);
+      int thirdColon = payload.indexOf(':', secondColon + 1);
       
-      if (offlineAuth.addUser(name, pin, nfcId, authType)) {
+      if (firstColon > 0 && secondColon > 0 && thirdColon > 0) {
+        String name = payload.substring(0, firstColon);
+        String pin = payload.substring(firstColon + 1, secondColon);
+        String nfcId = payload.substring(secondColon + 1, thirdColon);
+        AuthType authType = (AuthType)payload.substring(thirdColon + 1).toInt();
+        
+        if (offlineAuth.addUser(name, pin, nfcId, authType)) {
+          verdictCache.clear();
+          lcd.clear();
+          lcd.setCursor(0, 0);
+          lcd.print("User Added:");
+          lcd.setCursor(0, 1);
+          lcd.print(name);
+          publish("admin/response", "User " + name + " added successfully");
+          returnToIdle(2000);
+          
+          // Sync with server after adding user, once the message has been shown
+          scheduler.after(2000, requestSync);
+        } else {
+          lcd.clear();
+          lcd.setCursor(0, 0);
+          lcd.print("Add User Failed");
+          publish("admin/response", "Failed to add user " + name);
+          returnToIdle(2000);
+        }
+      }
+      break;
+    }
+    
+    case MQTT_REMOVE_USER: { // admin/remove-user
+      uint16_t userId = payload.toInt();
+      if (offlineAuth.removeUser(userId)) {
+        verdictCache.clear();
         lcd.clear();
         lcd.setCursor(0, 0);
-        lcd.print("User Added:");
+        lcd.print("User Removed");
         lcd.setCursor(0, 1);
-        lcd.print(name);
-        client.publish("admin/response", "User " + name + " added successfully");
-        delay(2000);
+        lcd.print("ID: " + String(userId));
+        publish("admin/response", "User " + String(userId) + " removed");
+        returnToIdle(2000);
         
-        // Sync with server after adding user
-        syncUsersFromServer();
-        showEnterPin();
+        // Sync with server after removing user, once the message has been shown
+        scheduler.after(2000, requestSync);
       } else {
+        publish("admin/response", "Failed to remove user " + String(userId));
+      }
+      break;
+    }
+    
+    case MQTT_LIST_USERS: { // admin/list-users
+      // Paged: payload is the first user ID to list (empty = from the start),
+      // and "next" in the response is where the following page begins
+      const uint16_t PAGE_SIZE = 20;
+      uint16_t firstId = payload.length() > 0 ? payload.toInt() : 1;
+      std::vector<OfflineUser> users = offlineAuth.getUsers(firstId, PAGE_SIZE);
+      String userList = "{\"users\":[";
+      for (size_t i = 0; i < users.size(); i++) {
+        const auto& user = users[i];
+        if (i > 0) userList += ",";
+        userList += "{\"id\":" + String(user.id) + 
+                    ",\"name\":\"" + String(user.name) + "\"" +
+                    ",\"authType\":" + String(user.authType) +
+                    ",\"isActive\":" + (user.isActive ? "true" : "false") +
+                    ",\"lastUsed\":" + String(user.lastUsed) +
+                    ",\"failedAttempts\":" + String(user.failedAttempts) + "}";
+      }
+      userList += "]";
+      if (users.size() == PAGE_SIZE) {
+        userList += ",\"next\":" + String(users.back().id + 1);
+      }
+      userList += "}";
+      publish("admin/response", userList);
+      break;
+    }
+    
+    case MQTT_SYSTEM_STATUS: { // admin/system-status
+      String status = "{\"userCount\":" + String(offlineAuth.getUserCount()) + 
+                     ",\"failedAttempts\":" + String(offlineAuth.getFailedAttempts()) +
+                     ",\"lockoutTime\":" + String(offlineAuth.getRemainingLockoutTime()) +
+                     ",\"lastAuth\":" + String(offlineAuth.getLastAuthTime());
+      const OnlineAuditStats& audit = authPipeline.auditStats();
+      status += ",\"online\":{\"confirmed\":" + String(audit.confirmed) +
+                ",\"disputed\":" + String(audit.disputed) +
+                ",\"grants\":" + String(audit.onlineGrants) +
+                ",\"late\":" + String(audit.lateVerdicts) +
+                ",\"unreachable\":" + String(audit.unreachable) + "}" +
+                ",\"http\":{\"reused\":" + String(backend.reusedCount()) +
+                ",\"reopened\":" + String(backend.reopenedCount()) + "}";
+      const VerdictCacheStats& cache = verdictCache.stats();
+      status += ",\"cache\":{\"size\":" + String(verdictCache.size()) +
+                ",\"hits\":" + String(cache.hits) +
+                ",\"misses\":" + String(cache.misses) +
+                ",\"expired\":" + String(cache.expired) +
+                ",\"evictions\":" + String(cache.evictions) + "}" +
+                ",\"sync\":" + lastSyncReport;
+      const CredentialImage& image = offlineAuth.getImage();
+      status += ",\"image\":{\"mounted\":" + String(image.isMounted() ? "true" : "false") +
+                ",\"users\":" + String(image.userCount()) +
+                ",\"revision\":" + String(image.revision()) +
+                ",\"generation\":" + String(image.generation()) +
+                ",\"revoked\":" + String(offlineAuth.getRevokedCount()) + "}";
+      ArduinoLinkStats link = arduinoLink.stats();
+      status += ",\"link\":{\"framed\":" + String(arduinoLink.isFramed() ? "true" : "false") +
+                ",\"baud\":" + String(arduinoLink.baud()) +
+                ",\"retransmits\":" + String(link.retransmits) +
+                ",\"probes\":" + String(link.probes) +
+                ",\"failures\":" + String(link.failures) +
+                ",\"badFrames\":" + String(link.badFrames) +
+                ",\"duplicates\":" + String(link.duplicates) + "}";
+      const AuditLogStats& log = auditLog.stats();
+      status += ",\"auditLog\":{\"last\":" + String(auditLog.lastSeq()) +
+                ",\"acked\":" + String(auditLog.acknowledged()) +
+                ",\"unsent\":" + String(auditLog.unsent()) +
+                ",\"held\":" + String(log.held) +
+                ",\"dropped\":" + String(log.dropped) +
+                ",\"overwritten\":" + String(log.overwritten) +
+                ",\"erases\":" + String(log.erases) + "}";
+      OutboxStats outbox = mqttOutbox.stats();
+      status += ",\"outbox\":{\"depth\":" + String(outbox.depth) +
+                ",\"publishes\":" + String(outbox.publishes) +
+                ",\"delivered\":" + String(outbox.delivered) +
+                ",\"coalesced\":" + String(outbox.coalesced) +
+                ",\"dropped\":" + String(outbox.dropped) +
+                ",\"restored\":" + String(outbox.restored) + "}";
+      const LcdFrameStats& frames = lcd.stats();
+      status += ",\"lcd\":{\"frames\":" + String(frames.frames) +
+                ",\"i2cBytes\":" + String(frames.lcdBytes * LCD_I2C_BYTES_PER_BYTE) +
+                ",\"busyUs\":" + String(frames.busyUs) +
+                ",\"maxFrameUs\":" + String(frames.maxFrameUs) + "}";
+      KeypadScannerStats scanner = keypadScanner.stats();
+      status += ",\"keypad\":{\"wakes\":" + String(scanner.wakes) +
+                ",\"scans\":" + String(scanner.scans) +
+                ",\"keys\":" + String(scanner.keys) +
+                ",\"dropped\":" + String(scanner.dropped) + "}";
+      PowerStats power = powerManager.stats();
+      status += ",\"power\":{\"wakes\":" + String(power.wakes) +
+                ",\"waitMs\":" + String(power.waitMs) +
+                ",\"lowMs\":" + String(power.lowMs) +
+                ",\"lowWakes\":" + String(power.lowWakes) +
+                ",\"maxWakeUs\":" + String(power.maxWakeUs) +
+                ",\"cpuMhz\":" + String(getCpuFrequencyMhz()) + "}";
+      sampleMemory();
+      status += ",\"memory\":" + memoryJson() + "}";
+      publish("admin/response", status);
+      break;
+    }
+    
+    case MQTT_CLEAR_CACHE: { // admin/clear-cache
+      verdictCache.clear();
+      publish("admin/response", "Verdict cache cleared");
+      break;
+    }
+    
+    case MQTT_LOAD_IMAGE: { // admin/load-image
+      sendNetCommand(NET_IMAGE, "");
+      break;
+    }
+    
+    case MQTT_TRACE: { // admin/trace
+      // start, stop, or dump (stop, then publish it on admin/trace-data)
+      if (payload == "start") {
+        if (inputTrace.start(offlineAuth.getSyncRevision(), offlineAuth.getUserCount(), offlineMode)) {
+          publish("admin/response", "{\"trace\":\"recording\",\"capacity\":" + String(INPUT_TRACE_SIZE) + "}");
+        } else {
+          publish("admin/response", "Trace failed: out of memory");
+        }
+      } else if (payload == "stop" || payload == "dump") {
+        inputTrace.stop();
+        const InputTraceHeader& trace = inputTrace.header();
+        publish("admin/response", "{\"trace\":\"stopped\",\"records\":" + String(trace.records) +
+                                  ",\"bytes\":" + String(inputTrace.size()) +
+                                  ",\"dropped\":" + String(trace.dropped) + "}");
+        if (payload == "dump") {
+          sendNetCommand(NET_TRACE_DUMP, "");
+        }
+      }
+      break;
+    }
+    
+    case MQTT_RESET_SYSTEM: { // admin/reset-system
+      if (payload == "CONFIRM_RESET") {
+        offlineAuth.reset();
+        verdictCache.clear();
         lcd.clear();
         lcd.setCursor(0, 0);
-        lcd.print("Add User Failed");
-        client.publish("admin/response", "Failed to add user " + name);
-        delay(2000);
-        showEnterPin();
+        lcd.print("System Reset!");
+        lcd.setCursor(0, 1);
+        lcd.print("By Remote Admin");
+        returnToIdle(3000);
+        publish("admin/response", "System reset complete");
+        
+        // Sync with server after system reset, once the message has been shown
+        scheduler.after(3000, requestSync);
       }
+      break;
     }
-  });
+  }
+}
 
-  client.subscribe("admin/remove-user", [] (const String &payload) {
-    uint8_t userId = payload.toInt();
-    if (offlineAuth.removeUser(userId)) {
+void handleKey(char key) {
+  // A key press cuts a timed message short
+  if (scheduler.cancel(showEnterPin)) {
+    showEnterPin();
+  }
+  
+  if (key == '#') { // Submit PIN
+    if (pinInput.length() > 0) {
+      uint8_t pinDigest[PinHasher::DIGEST_LEN];
+      uint32_t hashUs = LatencyTrace::now();
+      pinHasher.finish(pinDigest);
+      latencyTrace.record(STAGE_HASH, hashUs);
+      
       lcd.clear();
       lcd.setCursor(0, 0);
-      lcd.print("User Removed");
-      lcd.setCursor(0, 1);
-      lcd.print("ID: " + String(userId));
-      client.publish("admin/response", "User " + String(userId) + " removed");
-      delay(2000);
+      lcd.print("Authenticating...");
       
-      // Sync with server after removing user
-      syncUsersFromServer();
-      showEnterPin();
-    } else {
-      client.publish("admin/response", "Failed to remove user " + String(userId));
+      publish("mytopic/pin", pinInput); // Publish PIN to MQTT
+      
+      latencyTrace.inputSubmitted();
+      if (!authPipeline.submitPin(pinInput, pinDigest)) {
+        lcd.setCursor(0, 1);
+        lcd.print("Checking online");
+      }
+      pinInput = "";
+      pinHasher.clear();
     }
-  });
-
-  client.subscribe("admin/list-users", [] (const String &payload) {
-    std::vector<OfflineUser> users = offlineAuth.getUsers();
-    String userList = "{\"users\":[";
-    for (size_t i = 0; i < users.size(); i++) {
-      const auto& user = users[i];
-      if (i > 0) userList += ",";
-      userList += "{\"id\":" + String(user.id) + 
-                  ",\"name\":\"" + String(user.name) + "\"" +
-                  ",\"authType\":" + String(user.authType) +
-                  ",\"isActive\":" + (user.isActive ? "true" : "false") +
-                  ",\"lastUsed\":" + String(user.lastUsed) +
-                  ",\"failedAttempts\":" + String(user.failedAttempts) + "}";
+  } else if (key == '*') { // Clear input or show system status
+    if (pinInput.length() == 0) {
+      // Show system status when PIN is empty and * is pressed
+      showSystemStatus();
+      returnToIdle(3000);
+    } else {
+      // Clear PIN input
+      pinInput = "";
+      pinHasher.clear();
+      lcd.setCursor(0, 1);
+      lcd.print("                "); // Clear line
+      lcd.setCursor(0, 1);
     }
-    userList += "]}";
-    client.publish("admin/response", userList);
-  });
-
-  client.subscribe("admin/system-status", [] (const String &payload) {
-    String status = "{\"userCount\":" + String(offlineAuth.getUserCount()) + 
-                   ",\"failedAttempts\":" + String(offlineAuth.getFailedAttempts()) +
-                   ",\"lockoutTime\":" + String(offlineAuth.getRemainingLockoutTime()) +
-                   ",\"lastAuth\":" + String(offlineAuth.getLastAuthTime()) + "}";
-    client.publish("admin/response", status);
-  });
-
-  client.subscribe("admin/reset-system", [] (const String &payload) {
-    if (payload == "CONFIRM_RESET") {
-      offlineAuth.reset();
+  } else if (key == 'D' && pinInput.length() == 0) {
+    // Show WiFi status when PIN is empty and D is pressed
+    showWiFiStatus();
+    returnToIdle(3000);
+  } else if (key == 'C' && pinInput.length() == 0) {
+    // Add test user when PIN is empty and C is pressed
+    if (offlineAuth.addUser("TestUser", "1234", "", AUTH_PIN)) {
       lcd.clear();
       lcd.setCursor(0, 0);
-      lcd.print("System Reset!");
+      lcd.print("Test User Added!");
       lcd.setCursor(0, 1);
-      lcd.print("By Remote Admin");
-      delay(3000);
-      
-      // Sync with server after system reset
-      syncUsersFromServer();
-      showEnterPin();
-      client.publish("admin/response", "System reset complete");
+      lcd.print("PIN: 1234");
+      Serial.println("Test user added: PIN 1234");
+    } else {
+      lcd.clear();
+      lcd.setCursor(0, 0);
+      lcd.print("Add User Failed!");
     }
-  });
-
-  client.publish("mytopic/test", "Offline Auth System Ready");
-  
-  // Auto-sync users from server on connection
-  delay(1000); // Wait a moment for connection to stabilize
-  syncUsersFromServer();
+    returnToIdle(3000);
+  } else if (key == 'B' && pinInput.length() == 0) {
+    // Sync users from server when PIN is empty and B is pressed
+    lcd.clear();
+    lcd.setCursor(0, 0);
+    lcd.print("Syncing...");
+    requestSync();
+    returnToIdle(2000);
+  } else if (pinInput.length() < 8) { // Max 8 digits
+    if (pinInput.length() == 0 && !offlineMode) {
+      // Open the backend connection while the rest of the PIN is typed
+      sendNetCommand(NET_PRECONNECT, "");
+    }
+    pinInput += key;
+    pinHasher.push(key);
+    lcd.setCursor(0, 1);
+    lcd.print("                "); // Clear line
+    lcd.setCursor(0, 1);
+    for (size_t i = 0; i < pinInput.length(); i++) {
+      lcd.print("*");
+    }
+  }
 }
 
-void loop() {
-  static unsigned long lastWiFiCheck = 0;
-  static unsigned long wifiLostTime = 0;
-  static bool reconnecting = false;
-  
-  // Check WiFi status every 5 seconds instead of every loop
-  if (millis() - lastWiFiCheck > 5000) {
-    lastWiFiCheck = millis();
+void handleArduinoMessage(const ArduinoMessage& message) {
+  char line[LINK_MAX_PAYLOAD + 16];
+  ArduinoLink::toLine(message, line, sizeof(line));
+  inputTrace.arduinoLine(line);
+  Serial.print("From Arduino: ");
+  Serial.println(line);
+
+  if (message.type == LINK_NFC_UID) {
+    latencyTrace.inputStarted(message.receivedUs);
+    String uid = message.payload;
     
-    if (!offlineMode && WiFi.status() == WL_CONNECTED) {
-      client.loop();
-      reconnecting = false;
-    } else if (!offlineMode && WiFi.status() != WL_CONNECTED) {
-      if (!reconnecting) {
-        // First time detecting WiFi loss
-        wifiLostTime = millis();
-        reconnecting = true;
+    publish("mytopic/rfid", uid);
+
+    if (enrollment) {
+      // Enroll NFC card to specified user
+      if (offlineAuth.enrollNfcCard(uid, enrollmentUserId)) {
         lcd.clear();
         lcd.setCursor(0, 0);
-        lcd.print("WiFi Reconnecting");
+        lcd.print("NFC Enrolled!");
         lcd.setCursor(0, 1);
-        lcd.print("Please wait...");
+        lcd.print("User " + String(enrollmentUserId));
         
-        // Try to reconnect
-        WiFi.disconnect();
-        delay(1000);
-        WiFi.begin(wifi_ssid, wifi_pass);
-      } else if (millis() - wifiLostTime > 30000) {
-        // After 30 seconds of failed reconnection, go offline
-        offlineMode = true;
-        reconnecting = false;
+        // Get enrollment data and write to card via Arduino
+        String enrollmentData = offlineAuth.getNfcEnrollmentData(enrollmentUserId);
+        if (enrollmentData.length() > 0) {
+          arduinoLink.writeNfc(enrollmentData.c_str());
+          lcd.clear();
+          lcd.setCursor(0, 0);
+          lcd.print("Writing to card");
+          lcd.setCursor(0, 1);
+          lcd.print("Please wait...");
+        }
+        
+        enrollment = false; // Reset enrollment after use
+      } else {
         lcd.clear();
         lcd.setCursor(0, 0);
-        lcd.print("WiFi Lost!");
-        lcd.setCursor(0, 1);
-        lcd.print("Offline Mode");
-        delay(2000);
-        showEnterPin();
+        lcd.print("Enroll Failed!");
       }
-    } else if (offlineMode && WiFi.status() == WL_CONNECTED) {
-      // WiFi reconnected, switch back to online mode
-      offlineMode = false;
-      reconnecting = false;
-      lcd.clear();
-      lcd.setCursor(0, 0);
-      lcd.print("WiFi Restored!");
-      lcd.setCursor(0, 1);
-      lcd.print("Online Mode");
-      delay(2000);
-      showEnterPin();
-    } else if (offlineMode && WiFi.status() != WL_CONNECTED) {
-      // In offline mode but periodically try to reconnect
-      if (!reconnecting) {
-        reconnecting = true;
-        WiFi.begin(wifi_ssid, wifi_pass);
+      returnToIdle(2000);
+      
+      // Also try online enrollment if available
+      if (!offlineMode) {
+        sendCredentialCommand(NET_ENROLL, uid.c_str(), uid.length());
+      }
+    } else {
+      // Decided locally; unknown cards get a short online check
+      latencyTrace.inputSubmitted();
+      if (!authPipeline.submitCard(uid)) {
+        lcd.clear();
+        lcd.setCursor(0, 0);
+        lcd.print("Checking card...");
+        lcd.setCursor(0, 1);
+        lcd.print("Checking online");
       }
     }
+  } else if (message.type == LINK_NFC_WRITE_OK) {
+    lcd.clear();
+    lcd.setCursor(0, 0);
+    lcd.print("Write  success!");
+    returnToIdle(2000);
+  } else if (message.type == LINK_NFC_WRITE_FAIL) {
+    lcd.clear();
+    lcd.setCursor(0, 0);
+    lcd.print("Write failed!");
+    returnToIdle(2000);
+  } else if (message.type == LINK_SERVO_OK) {
+    latencyTrace.servoAcked();
+    lcd.clear();
+    lcd.setCursor(0, 0);
+    lcd.print("Door Opened!");
+    returnToIdle(2000);
+  }
+}
+
+void handleDoorEvent(const DoorEvent& event) {
+  switch (event.type) {
+    case DOOR_ONLINE_VERDICT:
+      authPipeline.onOnlineVerdict(event);
+      break;
+    case DOOR_ENROLL_RESULT:
+      handleEnrollResult(event);
+      break;
+    case DOOR_SYNC_RESULT:
+      handleSyncResult(event);
+      break;
+    case DOOR_IMAGE_RESULT:
+      handleImageResult(event);
+      break;
+    case DOOR_CONNECTIVITY:
+      handleConnectivity(event.state);
+      break;
+    case DOOR_MQTT_COMMAND:
+      handleMqttCommand(event);
+      break;
+    case DOOR_AUDIT_RESULT:
+      handleAuditResult(event);
+      break;
+  }
+}
+
+// Runs on the Arduino loop task (core 1). WiFi, MQTT and HTTP live in the
+// network task on core 0, so nothing here waits on the network.
+void loop() {
+  // What the last pass drew goes to the panel, once
+  lcd.refresh();
+  
+  // Sleep rather than spin; whatever wakes the task is handled below
+  if (doorIdle()) {
+    uint32_t waitMs = offlineAuth.msUntilFlush();
+    uint32_t timerMs = scheduler.msUntilNext();
+    uint32_t linkMs = arduinoLink.msUntilNext();
+    if (timerMs < waitMs) waitMs = timerMs;
+    if (linkMs < waitMs) waitMs = linkMs;
+    powerManager.idle(waitMs);
   }
   
-  // If connected and not offline, run MQTT client
-  if (!offlineMode && WiFi.status() == WL_CONNECTED) {
-    client.loop();
+  // Run due screen timeouts and deferred actions
+  scheduler.run();
+  
+  // Verdicts, sync results and admin commands from the network task
+  DoorEvent event;
+  while (doorEvents.pop(event)) {
+    handleDoorEvent(event);
   }
+  
+  // Users streamed in by a running sync
+  applySyncedUsers(4);
+
+  // Commit batched auth bookkeeping once idle or at the loss window
+  bool nvsPending = offlineAuth.hasPendingWrites();
+  uint32_t nvsUs = LatencyTrace::now();
+  offlineAuth.loop();
+  if (nvsPending && !offlineAuth.hasPendingWrites()) {
+    latencyTrace.record(STAGE_NVS, nvsUs);
+  }
+  
+  // Erase ahead in the audit log and write records a burst left waiting;
+  // not while a PIN is half typed, as an erase holds the loop for ~45 ms
+  if (pinInput.length() == 0) {
+    auditLog.loop();
+  }
+  
+  // Fold this pass's spans into the latency histograms
+  latencyTrace.loop();
 
   // Check for system lockout
   if (offlineAuth.getRemainingLockoutTime() > 0) {
@@ -658,161 +1027,23 @@ void loop() {
       showSystemStatus();
       lastLockoutUpdate = millis();
     }
+    // Keys pressed during the lockout are not kept for after it
+    KeyEvent ignored;
+    while (keypadScanner.pop(ignored)) {
+    }
     return; // Don't process input when locked out
   }
 
   // --- Keypad logic with enhanced features ---
-  char key = keypad.getKey();
-  if (key) {
-    if (key == '#') { // Submit PIN
-      if (pinInput.length() > 0) {
-        lcd.clear();
-        lcd.setCursor(0, 0);
-        lcd.print("Authenticating...");
-        
-        if (!offlineMode) {
-          client.publish("mytopic/pin", pinInput); // Publish PIN to MQTT
-        }
-        
-        sendUnlockRequest(pinInput);
-        pinInput = "";
-        showEnterPin();
-      }
-    } else if (key == '*') { // Clear input or show system status
-      if (pinInput.length() == 0) {
-        // Show system status when PIN is empty and * is pressed
-        showSystemStatus();
-        delay(3000);
-        showEnterPin();
-      } else {
-        // Clear PIN input
-        pinInput = "";
-        lcd.setCursor(0, 1);
-        lcd.print("                "); // Clear line
-        lcd.setCursor(0, 1);
-      }
-    } else if (key == 'D' && pinInput.length() == 0) {
-      // Show WiFi status when PIN is empty and D is pressed
-      showWiFiStatus();
-      delay(3000);
-      showEnterPin();
-    } else if (key == 'C' && pinInput.length() == 0) {
-      // Add test user when PIN is empty and C is pressed
-      if (offlineAuth.addUser("TestUser", "1234", "", AUTH_PIN)) {
-        lcd.clear();
-        lcd.setCursor(0, 0);
-        lcd.print("Test User Added!");
-        lcd.setCursor(0, 1);
-        lcd.print("PIN: 1234");
-        Serial.println("Test user added: PIN 1234");
-      } else {
-        lcd.clear();
-        lcd.setCursor(0, 0);
-        lcd.print("Add User Failed!");
-      }
-      delay(3000);
-      showEnterPin();
-    } else if (key == 'B' && pinInput.length() == 0) {
-      // Sync users from server when PIN is empty and B is pressed
-      lcd.clear();
-      lcd.setCursor(0, 0);
-      lcd.print("Syncing...");
-      syncUsersFromServer();
-      showEnterPin();
-    } else if (pinInput.length() < 8) { // Max 8 digits
-      pinInput += key;
-      lcd.setCursor(0, 1);
-      lcd.print("                "); // Clear line
-      lcd.setCursor(0, 1);
-      for (int i = 0; i < pinInput.length(); i++) {
-        lcd.print("*");
-      }
-    }
+  // Keys scanned by the keypad task, timed from the press
+  KeyEvent keyEvent;
+  while (keypadScanner.pop(keyEvent)) {
+    latencyTrace.inputStarted(keyEvent.atUs);
+    inputTrace.key(keyEvent.key);
+    handleKey(keyEvent.key);
   }
 
-  // Handle responses from Arduino (NFC UID, write status, servo status)
-  if (Serial2.available()) {
-    String response = Serial2.readStringUntil('\n');
-    response.trim();
-    Serial.print("From Arduino: ");
-    Serial.println(response);
-
-    if (response.startsWith("NFC_UID:")) {
-      String uid = response.substring(8);
-      
-      if (!offlineMode) {
-        client.publish("mytopic/rfid", uid);
-      }
-
-      if (enrollment) {
-        // Enroll NFC card to specified user
-        if (offlineAuth.enrollNfcCard(uid, enrollmentUserId)) {
-          lcd.clear();
-          lcd.setCursor(0, 0);
-          lcd.print("NFC Enrolled!");
-          lcd.setCursor(0, 1);
-          lcd.print("User " + String(enrollmentUserId));
-          
-          // Get enrollment data and write to card via Arduino
-          String enrollmentData = offlineAuth.getNfcEnrollmentData(enrollmentUserId);
-          if (enrollmentData.length() > 0) {
-            Serial2.print("WRITE_NFC:");
-            Serial2.println(enrollmentData);
-            lcd.clear();
-            lcd.setCursor(0, 0);
-            lcd.print("Writing to card");
-            lcd.setCursor(0, 1);
-            lcd.print("Please wait...");
-          }
-          
-          enrollment = false; // Reset enrollment after use
-        } else {
-          lcd.clear();
-          lcd.setCursor(0, 0);
-          lcd.print("Enroll Failed!");
-        }
-        delay(2000);
-        
-        // Also try online enrollment if available
-        if (!offlineMode) {
-          sendEnrollRequest(uid);
-        }
-      } else {
-        // Try offline NFC authentication
-        if (handleOfflineAuthentication(uid, AUTH_NFC)) {
-          // Success handled in function
-        } else if (!offlineMode) {
-          // Fall back to online NFC authentication
-          sendNfcUnlockRequest(uid);
-        } else {
-          // In offline mode and NFC failed
-          lcd.clear();
-          lcd.setCursor(0, 0);
-          lcd.print("Access Denied!");
-          lcd.setCursor(0, 1);
-          lcd.print("Unknown NFC");
-          delay(2000);
-        }
-      }
-      showEnterPin();
-    } else if (response == "NFC_WRITE_OK") {
-      lcd.clear();
-      lcd.setCursor(0, 0);
-      lcd.print("Write  success!");
-      delay(2000);
-      showEnterPin();
-    } else if (response == "NFC_WRITE_FAIL") {
-      lcd.clear();
-      lcd.setCursor(0, 0);
-      lcd.print("Write failed!");
-      delay(2000);
-      showEnterPin();
-    } else if (response == "SERVO_OK") {
-      lcd.clear();
-      lcd.setCursor(0, 0);
-      lcd.print("Door Opened!");
-      delay(2000);
-      showEnterPin();
-    }
-  }
-}
\ No newline at end of file
+  // Messages from the Arduino (NFC UID, write status, servo status), acks
+  // and retransmits; never waits on a partial frame or line
+  arduinoLink.poll();
+}
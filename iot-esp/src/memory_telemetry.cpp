@@ -0,0 +1,120 @@
+#include "memory_telemetry.h"
+
+MemoryTelemetry memoryTelemetry;
+
+// Per task, so the network task's scopes never tag the door task's
+// allocations; __thread lives in the task's TLS area on ESP-IDF
+static thread_local MemorySubsystem currentSubsystem = MEM_OTHER;
+
+MemoryScope::MemoryScope(MemorySubsystem subsystem) {
+  outer = currentSubsystem;
+  currentSubsystem = subsystem;
+}
+
+MemoryScope::~MemoryScope() {
+  currentSubsystem = outer;
+}
+
+#ifdef CONFIG_HEAP_USE_HOOKS
+// Called by the heap for every successful allocation, with its lock held:
+// two relaxed adds and nothing that could allocate
+extern "C" void IRAM_ATTR esp_heap_trace_alloc_hook(void*, size_t size, uint32_t) {
+  memoryTelemetry.countAllocation(size);
+}
+#endif
+
+MemoryTelemetry::MemoryTelemetry() {
+  tasks = 0;
+  memset(&latest, 0, sizeof(latest));
+  raisedTotal = 0;
+  for (uint8_t i = 0; i < MEM_SUBSYSTEMS; i++) {
+    counts[i] = 0;
+    bytes[i] = 0;
+  }
+}
+
+void MemoryTelemetry::begin() {
+  watchTask("door", xTaskGetCurrentTaskHandle());
+}
+
+bool MemoryTelemetry::watchTask(const char* name, TaskHandle_t task) {
+  if (!task || tasks >= MEMORY_MAX_TASKS) return false;
+  watched[tasks].name = name;
+  watched[tasks].handle = task;
+  watched[tasks].stackFree = 0;
+  tasks++;
+  return true;
+}
+
+uint8_t MemoryTelemetry::sample(uint32_t nvsFreeEntries) {
+  MemorySample next;
+  next.freeHeap = ESP.getFreeHeap();
+  next.minFreeHeap = ESP.getMinFreeHeap();
+  next.largestBlock = ESP.getMaxAllocHeap();
+  if (next.largestBlock > next.freeHeap) next.largestBlock = next.freeHeap;
+  next.fragmentation = next.freeHeap > 0 ? 100 - (uint64_t)next.largestBlock * 100 / next.freeHeap : 100;
+  next.nvsFreeEntries = nvsFreeEntries;
+  
+  uint32_t leastStack = UINT32_MAX;
+  for (uint8_t i = 0; i < tasks; i++) {
+    watched[i].stackFree = uxTaskGetStackHighWaterMark(watched[i].handle);
+    if (watched[i].stackFree < leastStack) leastStack = watched[i].stackFree;
+  }
+  
+  // Fragmentation clears 10 points under its limit so a heap hovering at
+  // the limit does not alert on every sample
+  uint8_t up = latest.alerts;
+  if (next.fragmentation > MEMORY_FRAGMENTATION_ALERT_PCT) {
+    up |= MEM_ALERT_FRAGMENTED;
+  } else if (next.fragmentation + 10 <= MEMORY_FRAGMENTATION_ALERT_PCT) {
+    up &= ~MEM_ALERT_FRAGMENTED;
+  }
+  if (next.largestBlock < MEMORY_LARGEST_BLOCK_ALERT_BYTES) {
+    up |= MEM_ALERT_LARGEST_BLOCK;
+  } else {
+    up &= ~MEM_ALERT_LARGEST_BLOCK;
+  }
+  // A high-water mark never recovers, so a stack alert stays up
+  if (leastStack < MEMORY_STACK_ALERT_BYTES) {
+    up |= MEM_ALERT_STACK;
+  }
+  
+  uint8_t raised = up & ~latest.alerts;
+  next.alerts = up;
+  latest = next;
+  raisedTotal += __builtin_popcount(raised);
+  return raised;
+}
+
+void IRAM_ATTR MemoryTelemetry::countAllocation(size_t size) {
+  MemorySubsystem subsystem = currentSubsystem;
+  counts[subsystem].fetch_add(1, std::memory_order_relaxed);
+  bytes[subsystem].fetch_add(size, std::memory_order_relaxed);
+}
+
+bool MemoryTelemetry::allocationsCounted() {
+#ifdef CONFIG_HEAP_USE_HOOKS
+  return true;
+#else
+  return false;
+#endif
+}
+
+const char* MemoryTelemetry::subsystemName(MemorySubsystem subsystem) {
+  switch (subsystem) {
+    case MEM_AUTH: return "auth";
+    case MEM_SYNC: return "sync";
+    case MEM_MQTT: return "mqtt";
+    case MEM_HTTP: return "http";
+    default: return "other";
+  }
+}
+
+const char* MemoryTelemetry::alertName(MemoryAlert alert) {
+  switch (alert) {
+    case MEM_ALERT_FRAGMENTED: return "fragmented";
+    case MEM_ALERT_LARGEST_BLOCK: return "largestBlock";
+    case MEM_ALERT_STACK: return "stack";
+    default: return "";
+  }
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <Arduino.h>
+#include <esp_heap_caps.h>
+#include <atomic>
+
+// How often the door task samples the heap and the watched stacks
+#ifndef MEMORY_SAMPLE_MS
+#define MEMORY_SAMPLE_MS 10000
+#endif
+
+// Alert when more than this share (percent) of the free heap lies outside
+// the largest free block
+#ifndef MEMORY_FRAGMENTATION_ALERT_PCT
+#define MEMORY_FRAGMENTATION_ALERT_PCT 60
+#endif
+
+// Alert when no free block this large is left; an HTTPS request needs
+// about 16 KB in one piece for its TLS buffers
+#ifndef MEMORY_LARGEST_BLOCK_ALERT_BYTES
+#define MEMORY_LARGEST_BLOCK_ALERT_BYTES 16384
+#endif
+
+// Alert when a watched task has come within this many bytes of its stack end
+#ifndef MEMORY_STACK_ALERT_BYTES
+#define MEMORY_STACK_ALERT_BYTES 512
+#endif
+
+#ifndef MEMORY_MAX_TASKS
+#define MEMORY_MAX_TASKS 4
+#endif
+
+// Who made an allocation, set per task by MemoryScope
+enum MemorySubsystem : uint8_t {
+  MEM_OTHER,  // outside any scope, including the WiFi and lwIP tasks
+  MEM_AUTH,   // a PIN or card, from the lookup to the verdict screen
+  MEM_SYNC,   // user sync and credential image download, with their HTTP
+  MEM_MQTT,   // client loop, outbox and admin commands
+  MEM_HTTP,   // unlock, enroll and audit requests
+  MEM_SUBSYSTEMS
+};
+
+enum MemoryAlert : uint8_t {
+  MEM_ALERT_FRAGMENTED = 1,
+  MEM_ALERT_LARGEST_BLOCK = 2,
+  MEM_ALERT_STACK = 4
+};
+
+struct MemorySample {
+  uint32_t freeHeap;
+  uint32_t minFreeHeap;     // lowest since boot
+  uint32_t largestBlock;
+  uint8_t fragmentation;    // percent of the free heap outside largestBlock
+  uint32_t nvsFreeEntries;  // user store partition
+  uint8_t alerts;           // MemoryAlert bits currently raised
+};
+
+struct MemoryTask {
+  const char* name;
+  TaskHandle_t handle;
+  uint32_t stackFree;  // least stack ever left, in bytes
+};
+
+// Tags the calling task's allocations with a subsystem until it goes out
+// of scope. Scopes nest; the innermost wins.
+class MemoryScope {
+public:
+  explicit MemoryScope(MemorySubsystem subsystem);
+  ~MemoryScope();
+
+private:
+  MemorySubsystem outer;
+};
+
+// Heap health for admin/system-status. The door task calls sample() every
+// MEMORY_SAMPLE_MS: free heap, largest free block, the low-water mark, the
+// stack high-water mark of each watched task and the free NVS entries. A
+// threshold crossed for the first time is returned as a newly raised alert;
+// fragmentation has to drop 10 points below its limit before it can fire
+// again. Allocations are counted per subsystem through the ESP-IDF heap
+// hooks, so the counts need CONFIG_HEAP_USE_HOOKS in the sdkconfig; without
+// it they read 0 and allocationsCounted() is false.
+class MemoryTelemetry {
+public:
+  MemoryTelemetry();
+  
+  // Door task, from setup(); watches the calling task as "door"
+  void begin();
+  // Door task; name must outlive the telemetry
+  bool watchTask(const char* name, TaskHandle_t task);
+  
+  // Door task. Returns the alerts this sample raised that were not
+  // already up.
+  uint8_t sample(uint32_t nvsFreeEntries);
+  const MemorySample& last() const { return latest; }
+  uint8_t taskCount() const { return tasks; }
+  const MemoryTask& task(uint8_t index) const { return watched[index]; }
+  uint32_t alertCount() const { return raisedTotal; }
+  
+  // From the allocation hook, any task
+  void countAllocation(size_t size);
+  uint32_t allocations(MemorySubsystem subsystem) const { return counts[subsystem]; }
+  uint32_t allocatedBytes(MemorySubsystem subsystem) const { return bytes[subsystem]; }
+  static bool allocationsCounted();
+  
+  static const char* subsystemName(MemorySubsystem subsystem);
+  static const char* alertName(MemoryAlert alert);
+
+private:
+  MemoryTask watched[MEMORY_MAX_TASKS];
+  uint8_t tasks;
+  MemorySample latest;
+  uint32_t raisedTotal;
+  
+  std::atomic<uint32_t> counts[MEM_SUBSYSTEMS];
+  std::atomic<uint32_t> bytes[MEM_SUBSYSTEMS];
+};
+
+extern MemoryTelemetry memoryTelemetry;
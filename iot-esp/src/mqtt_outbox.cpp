@@ -0,0 +1,282 @@
+#include "mqtt_outbox.h"
+
+MqttOutbox mqttOutbox;
+
+struct OutboxTopic {
+  const char* topic;
+  OutboxPriority priority;
+  uint8_t flags;
+};
+
+// PINs are batched like taps but never written to flash
+static const OutboxTopic OUTBOX_TOPICS[] = {
+  {"admin/response", OUTBOX_RESPONSE, 0},
+  {"mytopic/rfid", OUTBOX_EVENT, OUTBOX_BATCH | OUTBOX_PERSIST},
+  {"mytopic/pin", OUTBOX_EVENT, OUTBOX_BATCH},
+  {"admin/metrics", OUTBOX_STATUS, OUTBOX_COALESCE},
+  {"mytopic/test", OUTBOX_STATUS, OUTBOX_COALESCE},
+  {"admin/trace-data", OUTBOX_BULK, 0}
+};
+static const OutboxTopic OUTBOX_DEFAULT = {"", OUTBOX_EVENT, 0};
+
+static const OutboxTopic& outboxTopic(const char* topic) {
+  for (const OutboxTopic& route : OUTBOX_TOPICS) {
+    if (strcmp(route.topic, topic) == 0) return route;
+  }
+  return OUTBOX_DEFAULT;
+}
+
+// Saved messages: topic, NUL, payload, NUL, ... in one NVS blob
+static const uint16_t SAVE_BYTES = 2048;
+static uint8_t saveBuffer[SAVE_BYTES];
+
+MqttOutbox::MqttOutbox() {
+  for (Entry& entry : entries) {
+    entry.used = false;
+  }
+  nextSeq = 1;
+  bytes = 0;
+  dirty = false;
+  saved = false;
+  lastSave = 0;
+  count = 0;
+  queued = 0;
+  publishes = 0;
+  delivered = 0;
+  coalesced = 0;
+  dropped = 0;
+  restored = 0;
+}
+
+void MqttOutbox::begin() {
+  preferences.begin("mqtt_outbox", false);
+  size_t length = preferences.getBytes("queue", saveBuffer, SAVE_BYTES);
+  size_t at = 0;
+  while (at < length) {
+    const char* topic = (const char*)saveBuffer + at;
+    size_t topicLength = strnlen(topic, length - at);
+    if (at + topicLength + 1 >= length) break;
+    const char* payload = topic + topicLength + 1;
+    size_t payloadLength = strnlen(payload, length - at - topicLength - 1);
+    if (at + topicLength + payloadLength + 2 > length) break;
+    if (push(topic, payload)) {
+      restored++;
+      for (const char* at = payload; *at; at++) {
+        if (*at == '\n') restored++;
+      }
+    }
+    at += topicLength + payloadLength + 2;
+  }
+  saved = length > 0;
+  if (restored > 0) {
+    Serial.printf("[OUTBOX] %u messages restored\n", restored.load());
+  }
+}
+
+bool MqttOutbox::push(const char* topic, const String& payload) {
+  const OutboxTopic& route = outboxTopic(topic);
+  for (uint8_t i = 0; i < MQTT_OUTBOX_SIZE; i++) {
+    Entry& entry = entries[i];
+    if (!entry.used || strcmp(entry.topic, topic) != 0) continue;
+    if (route.flags & OUTBOX_COALESCE) {
+      // Only the newest report matters; it goes to the back of the line
+      remove(i);
+      coalesced++;
+      break;
+    }
+    if (!(route.flags & OUTBOX_BATCH) && entry.payload == payload) {
+      coalesced++;
+      return true;
+    }
+  }
+  
+  // An event joins the newest message of its priority if that is one of
+  // the same topic with room, so order within the priority holds
+  if (route.flags & OUTBOX_BATCH) {
+    int8_t last = newest(route.priority);
+    if (last >= 0) {
+      Entry& entry = entries[last];
+      size_t joined = entry.payload.length() + 1 + payload.length();
+      if (strcmp(entry.topic, topic) == 0 && joined <= MQTT_OUTBOX_BATCH_BYTES &&
+          bytes + payload.length() + 1 <= MQTT_OUTBOX_BYTES) {
+        entry.payload += '\n';
+        entry.payload += payload;
+        entry.messages++;
+        bytes += payload.length() + 1;
+        queued++;
+        if (entry.flags & OUTBOX_PERSIST) dirty = true;
+        return true;
+      }
+    }
+  }
+  
+  if (strlen(topic) >= sizeof(entries[0].topic) || !makeRoom(route.priority, payload.length())) {
+    dropped++;
+    return false;
+  }
+  Entry& entry = entries[freeSlot()];
+  entry.used = true;
+  strcpy(entry.topic, topic);
+  entry.priority = route.priority;
+  entry.flags = route.flags;
+  entry.seq = nextSeq++;
+  entry.queuedAt = millis();
+  entry.payload = payload;
+  entry.messages = 1;
+  bytes += payload.length();
+  count++;
+  queued++;
+  if (entry.flags & OUTBOX_PERSIST) dirty = true;
+  return true;
+}
+
+bool MqttOutbox::hasRoom(size_t length) const {
+  return freeSlot() >= 0 && bytes + length <= MQTT_OUTBOX_BYTES;
+}
+
+uint8_t MqttOutbox::flush(Publisher publisher) {
+  uint32_t now = millis();
+  uint8_t made = 0;
+  while (made < MQTT_OUTBOX_BURST) {
+    int8_t head = next();
+    if (head < 0) break;
+    Entry& entry = entries[head];
+    // A batch still open gets a moment for later events to join; anything
+    // queued behind it waits too, so the order holds
+    bool open = entry.seq == nextSeq - 1;
+    if ((entry.flags & OUTBOX_BATCH) && open && now - entry.queuedAt < MQTT_OUTBOX_LINGER_MS) break;
+    
+    if (!publisher(entry.topic, entry.payload)) break;
+    made++;
+    publishes++;
+    delivered += entry.messages;
+    remove(head);
+  }
+  return made;
+}
+
+void MqttOutbox::loop() {
+  uint32_t now = millis();
+  if (!dirty || now - lastSave < MQTT_OUTBOX_SAVE_MS) return;
+  
+  // Only messages the broker has not taken for a while are worth a flash
+  // write; while online they are gone long before that
+  bool any = false;
+  bool waiting = false;
+  for (const Entry& entry : entries) {
+    if (!entry.used || !(entry.flags & OUTBOX_PERSIST)) continue;
+    any = true;
+    if (now - entry.queuedAt >= MQTT_OUTBOX_SAVE_MS) waiting = true;
+  }
+  if (waiting || saved) {
+    save();
+  } else if (!any) {
+    dirty = false;
+  }
+}
+
+OutboxStats MqttOutbox::stats() const {
+  OutboxStats result;
+  result.depth = count;
+  result.queued = queued;
+  result.publishes = publishes;
+  result.delivered = delivered;
+  result.coalesced = coalesced;
+  result.dropped = dropped;
+  result.restored = restored;
+  return result;
+}
+
+// Highest priority, then oldest
+int8_t MqttOutbox::next() const {
+  int8_t best = -1;
+  for (uint8_t i = 0; i < MQTT_OUTBOX_SIZE; i++) {
+    const Entry& entry = entries[i];
+    if (!entry.used) continue;
+    if (best < 0 || entry.priority < entries[best].priority ||
+        (entry.priority == entries[best].priority && entry.seq < entries[best].seq)) {
+      best = i;
+    }
+  }
+  return best;
+}
+
+int8_t MqttOutbox::newest(uint8_t priority) const {
+  int8_t found = -1;
+  for (uint8_t i = 0; i < MQTT_OUTBOX_SIZE; i++) {
+    const Entry& entry = entries[i];
+    if (entry.used && entry.priority == priority && (found < 0 || entry.seq > entries[found].seq)) {
+      found = i;
+    }
+  }
+  return found;
+}
+
+int8_t MqttOutbox::freeSlot() const {
+  for (uint8_t i = 0; i < MQTT_OUTBOX_SIZE; i++) {
+    if (!entries[i].used) return i;
+  }
+  return -1;
+}
+
+// Drops the oldest messages of the lowest priority below this one until a
+// message of length fits
+bool MqttOutbox::makeRoom(uint8_t priority, size_t length) {
+  if (length > MQTT_OUTBOX_BYTES) return false;
+  while (!hasRoom(length)) {
+    int8_t victim = -1;
+    for (uint8_t i = 0; i < MQTT_OUTBOX_SIZE; i++) {
+      const Entry& entry = entries[i];
+      if (!entry.used || entry.priority <= priority) continue;
+      if (victim < 0 || entry.priority > entries[victim].priority ||
+          (entry.priority == entries[victim].priority && entry.seq < entries[victim].seq)) {
+        victim = i;
+      }
+    }
+    if (victim < 0) return false;
+    remove(victim);
+    dropped++;
+  }
+  return true;
+}
+
+void MqttOutbox::remove(int8_t index) {
+  Entry& entry = entries[index];
+  if (entry.flags & OUTBOX_PERSIST) dirty = true;
+  bytes -= entry.payload.length();
+  entry.payload = String();
+  entry.used = false;
+  count--;
+}
+
+// Persistent messages in the order they were queued, as many as fit
+void MqttOutbox::save() {
+  size_t length = 0;
+  uint32_t lastSeq = 0;
+  for (;;) {
+    int8_t found = -1;
+    for (uint8_t i = 0; i < MQTT_OUTBOX_SIZE; i++) {
+      const Entry& entry = entries[i];
+      if (!entry.used || !(entry.flags & OUTBOX_PERSIST) || entry.seq <= lastSeq) continue;
+      if (found < 0 || entry.seq < entries[found].seq) found = i;
+    }
+    if (found < 0) break;
+    const Entry& entry = entries[found];
+    lastSeq = entry.seq;
+    size_t topicLength = strlen(entry.topic) + 1;
+    size_t payloadLength = entry.payload.length() + 1;
+    if (length + topicLength + payloadLength > SAVE_BYTES) break;
+    memcpy(saveBuffer + length, entry.topic, topicLength);
+    memcpy(saveBuffer + length + topicLength, entry.payload.c_str(), payloadLength);
+    length += topicLength + payloadLength;
+  }
+  
+  if (length > 0) {
+    preferences.putBytes("queue", saveBuffer, length);
+  } else {
+    preferences.remove("queue");
+  }
+  saved = length > 0;
+  dirty = false;
+  lastSave = millis();
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include <atomic>
+
+// Messages and payload bytes waiting for the broker
+#ifndef MQTT_OUTBOX_SIZE
+#define MQTT_OUTBOX_SIZE 32
+#endif
+#ifndef MQTT_OUTBOX_BYTES
+#define MQTT_OUTBOX_BYTES 8192
+#endif
+
+// Most publishes per flush(), i.e. per pass of the network task
+#ifndef MQTT_OUTBOX_BURST
+#define MQTT_OUTBOX_BURST 4
+#endif
+
+// How long an event waits for others to share its publish, and the
+// largest payload a batch may grow to
+#ifndef MQTT_OUTBOX_LINGER_MS
+#define MQTT_OUTBOX_LINGER_MS 50
+#endif
+#ifndef MQTT_OUTBOX_BATCH_BYTES
+#define MQTT_OUTBOX_BATCH_BYTES 256
+#endif
+
+// Persistent messages are written to NVS at most this often
+#ifndef MQTT_OUTBOX_SAVE_MS
+#define MQTT_OUTBOX_SAVE_MS 5000
+#endif
+
+// Highest first
+enum OutboxPriority : uint8_t {
+  OUTBOX_RESPONSE,  // answers to admin commands; someone is waiting
+  OUTBOX_EVENT,     // taps and PINs as they happen
+  OUTBOX_STATUS,    // periodic reports; only the newest matters
+  OUTBOX_BULK       // trace dumps
+};
+
+// How a topic is queued
+static const uint8_t OUTBOX_COALESCE = 0x01;  // a newer message replaces the queued one
+static const uint8_t OUTBOX_BATCH = 0x02;     // queued messages share a publish, one per line
+static const uint8_t OUTBOX_PERSIST = 0x04;   // kept in NVS until published
+
+struct OutboxStats {
+  uint16_t depth;      // messages queued now
+  uint32_t queued;
+  uint32_t publishes;  // MQTT publishes made
+  uint32_t delivered;  // messages they carried
+  uint32_t coalesced;  // replaced by a newer one, or a repeat of one queued
+  uint32_t dropped;    // no room
+  uint32_t restored;   // loaded from NVS at boot
+};
+
+// Everything the door publishes goes through this queue on the network
+// task. While the broker is unreachable messages wait, bounded by count
+// and bytes; when room runs out the lowest priority goes first. A status
+// report replaces the one still queued, and a message identical to one
+// already queued is not queued twice. Events on batch topics share a
+// newline-separated publish of up to MQTT_OUTBOX_BATCH_BYTES, which waits
+// MQTT_OUTBOX_LINGER_MS for more to join. flush() sends highest priority first, oldest first within a
+// priority, at most MQTT_OUTBOX_BURST per pass, and stops as soon as the
+// client refuses one, so a reconnect replays the backlog in order without
+// a burst of writes. Card taps are also kept in NVS and survive a restart.
+// Network task only; stats() may be read from anywhere.
+class MqttOutbox {
+public:
+  typedef bool (*Publisher)(const String& topic, const String& payload);
+  
+  MqttOutbox();
+  
+  // Loads messages saved before a restart
+  void begin();
+  // False if the message was dropped for lack of room
+  bool push(const char* topic, const String& payload);
+  // Whether a message of this size would be queued without dropping one
+  bool hasRoom(size_t length) const;
+  // Publishes what is due; returns how many publishes were made
+  uint8_t flush(Publisher publisher);
+  // Saves persistent messages that changed; call every pass
+  void loop();
+  
+  uint16_t depth() const { return count.load(std::memory_order_relaxed); }
+  OutboxStats stats() const;
+
+private:
+  struct Entry {
+    bool used;
+    char topic[32];
+    uint8_t priority;
+    uint8_t flags;
+    uint32_t seq;
+    uint32_t queuedAt;
+    uint8_t messages;  // batched into payload, one per line
+    String payload;
+  };
+  
+  Entry entries[MQTT_OUTBOX_SIZE];
+  uint32_t nextSeq;
+  size_t bytes;
+  bool dirty;    // persistent messages changed since the last save
+  bool saved;    // NVS holds some
+  uint32_t lastSave;
+  Preferences preferences;
+  
+  std::atomic<uint16_t> count;
+  std::atomic<uint32_t> queued;
+  std::atomic<uint32_t> publishes;
+  std::atomic<uint32_t> delivered;
+  std::atomic<uint32_t> coalesced;
+  std::atomic<uint32_t> dropped;
+  std::atomic<uint32_t> restored;
+  
+  int8_t next() const;
+  int8_t newest(uint8_t priority) const;
+  int8_t freeSlot() const;
+  bool makeRoom(uint8_t priority, size_t length);
+  void remove(int8_t index);
+  void save();
+};
+
+extern MqttOutbox mqttOutbox;
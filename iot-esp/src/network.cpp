@@ -0,0 +1,522 @@
+#include "network.h"
+#include <WiFi.h>
+#include "EspMQTTClient.h"
+#include "credential_image.h"
+#include "input_trace.h"
+#include "latency_trace.h"
+#include "audit_log.h"
+#include "mqtt_outbox.h"
+#include "power_manager.h"
+#include "verdict_cache.h"
+#include "memory_telemetry.h"
+
+SpscQueue<NetCommand, EVENT_QUEUE_SIZE> netCommands;
+SpscQueue<CredentialCommand, CREDENTIAL_QUEUE_SIZE> credentialCommands;
+SpscQueue<DoorEvent, EVENT_QUEUE_SIZE> doorEvents;
+SpscQueue<SyncUser, SYNC_QUEUE_SIZE> syncUsers;
+
+const char* wifi_ssid = "HONG SY 4G";
+const char* wifi_pass = "22226666";
+
+// MQTT setup
+EspMQTTClient client(
+  wifi_ssid,
+  wifi_pass,
+  "165.232.169.151",  // MQTT Broker server ip
+  "caxtiq",           // MQTT username
+  "anthithhn1N_",     // MQTT password
+  "TestClient"        // Client name
+);
+
+// Backend API, one kept-alive connection for every request
+BackendClient backend("165.232.169.151", 3000, "meichan-auth");
+
+static const uint32_t NETWORK_STACK_SIZE = 8192;
+static const uint32_t WIFI_CHECK_INTERVAL = 5000;
+static const uint32_t WIFI_OFFLINE_AFTER = 30000;
+
+// Network-side connection state; the door task gets a copy via events
+static bool netOffline = false;
+static bool reconnecting = false;
+static unsigned long wifiLostTime = 0;
+static unsigned long reconnectAt = 0;
+
+static void postDoorEvent(DoorEventType type, uint16_t requestId, bool reached, bool success,
+                          uint8_t state = 0, const String& payload = "", uint32_t elapsedUs = 0,
+                          uint32_t cacheMs = 0) {
+  DoorEvent event;
+  event.type = type;
+  event.requestId = requestId;
+  event.reached = reached;
+  event.success = success;
+  event.state = state;
+  event.elapsedUs = elapsedUs;
+  event.cacheMs = cacheMs;
+  event.payload = payload;
+  if (!doorEvents.push(event)) {
+    Serial.println("[NET] Door event queue full, event dropped");
+  }
+  powerManager.wake();
+}
+
+static void forwardCommand(MqttCommand command, const String& payload) {
+  postDoorEvent(DOOR_MQTT_COMMAND, 0, true, true, command, payload);
+}
+
+struct CommandTopic {
+  const char* topic;
+  MqttCommand command;
+};
+
+static const CommandTopic COMMAND_TOPICS[] = {
+  {"mytopic/test", MQTT_TEST_MESSAGE},
+  {"mytopic/open", MQTT_OPEN},
+  {"auth/nfc-register", MQTT_NFC_REGISTER},
+  {"mytopic/activate", MQTT_ACTIVATE},
+  // Admin commands for user management (controlled by backend/frontend)
+  {"admin/add-user", MQTT_ADD_USER},
+  {"admin/remove-user", MQTT_REMOVE_USER},
+  {"admin/list-users", MQTT_LIST_USERS},
+  {"admin/system-status", MQTT_SYSTEM_STATUS},
+  {"admin/reset-system", MQTT_RESET_SYSTEM},
+  {"admin/clear-cache", MQTT_CLEAR_CACHE},
+  {"admin/load-image", MQTT_LOAD_IMAGE},
+  {"admin/trace", MQTT_TRACE}
+};
+
+void onConnectionEstablished() {
+  netOffline = false; // We have MQTT connection, so we're online
+  postDoorEvent(DOOR_CONNECTIVITY, 0, true, true, NET_ONLINE);
+  
+  // Handlers only forward; the door task owns the LCD, Serial2 and users
+  for (const CommandTopic& route : COMMAND_TOPICS) {
+    MqttCommand command = route.command;
+    const char* topic = route.topic;
+    client.subscribe(topic, [topic, command] (const String &payload) {
+      if (command != MQTT_TRACE) inputTrace.mqtt(topic, payload);
+      forwardCommand(command, payload);
+    });
+  }
+  
+  mqttOutbox.push("mytopic/test", "Offline Auth System Ready");
+}
+
+static bool isOnline() {
+  return !netOffline && WiFi.status() == WL_CONNECTED;
+}
+
+// Value of "field":<number> in a flat JSON response, 0 if absent
+static uint32_t responseNumber(const String& response, const char* field) {
+  String key = String("\"") + field + "\":";
+  int at = response.indexOf(key);
+  return at < 0 ? 0 : strtoul(response.c_str() + at + key.length(), nullptr, 10);
+}
+
+// POSTs {"<field>":"<value>"} and reports whether the server answered and
+// whether it said "success":true
+// extra is appended to the body's members, e.g. ",\"verify\":true".
+// Returns the HTTP status code, or a negative HTTPClient error.
+static int postJson(const char* path, const char* field, const char* value, bool& reached, bool& success,
+                    const char* extra = "", String* reply = nullptr) {
+  MemoryScope scope(MEM_HTTP);
+  String payload = String("{\"") + field + "\":\"" + value + "\"" + extra + "}";
+  String response;
+  int httpResponseCode = backend.post(path, payload, &response);
+  
+  reached = httpResponseCode > 0;
+  success = reached && response.indexOf("\"success\":true") != -1;
+  if (reached) {
+    Serial.println("[NET] " + String(path) + " -> " + response);
+  } else {
+    Serial.println("[NET] POST failed: " + String(path));
+  }
+  if (reply) *reply = response;
+  return httpResponseCode;
+}
+
+// Longest the sync waits for the door task to take a parsed user
+static const uint32_t SYNC_QUEUE_TIMEOUT_MS = 2000;
+static uint32_t syncDropped = 0;
+
+static void queueSyncedUser(const SyncUser& user) {
+  uint32_t start = millis();
+  while (!syncUsers.push(user)) {
+    if (millis() - start >= SYNC_QUEUE_TIMEOUT_MS) {
+      syncDropped++;
+      return;
+    }
+    vTaskDelay(1);
+  }
+  powerManager.wake();
+}
+
+static UserSyncStream syncStream(queueSyncedUser);
+
+// since is the door's revision cursor; only changes after it are sent
+static void syncUsersFromServer(uint16_t requestId, uint32_t since) {
+  MemoryScope scope(MEM_SYNC);
+  if (!isOnline()) {
+    Serial.println("[SYNC] No internet connection for sync");
+    postDoorEvent(DOOR_SYNC_RESULT, requestId, false, false);
+    return;
+  }
+  
+  // The body is parsed as it arrives and users go to the door task one by
+  // one, so memory use does not depend on the size of the roster
+  syncDropped = 0;
+  syncStream.begin();
+  char path[48];
+  snprintf(path, sizeof(path), "/api/users/changes?since=%lu", (unsigned long)since);
+  int httpResponseCode = backend.get(path, syncStream);
+  SyncReport report = syncStream.finish();
+  
+  bool downloaded = httpResponseCode == 200 && report.parsed && syncDropped == 0;
+  if (downloaded) {
+    // Only a complete download may move the cursor
+    SyncUser commit;
+    memset(&commit, 0, sizeof(commit));
+    commit.op = SYNC_COMMIT;
+    commit.revision = report.revision;
+    commit.full = report.full;
+    queueSyncedUser(commit);
+  }
+  if (httpResponseCode == 200) {
+    uint32_t bytesPerSec = report.elapsedMs > 0 ? (uint64_t)report.bytes * 1000 / report.elapsedMs : report.bytes;
+    Serial.printf("[SYNC] %s %lu -> %lu: %u changes, %u bytes in %u ms (%u B/s), peak heap %u bytes%s\n",
+                  report.full ? "Full" : "Delta", (unsigned long)since, (unsigned long)report.revision,
+                  report.users, report.bytes, report.elapsedMs, bytesPerSec, report.peakHeapUse,
+                  report.parsed ? "" : ", malformed JSON");
+    if (syncDropped > 0) {
+      Serial.printf("[SYNC] %u users dropped, door task not draining\n", syncDropped);
+    }
+  } else {
+    Serial.println("[SYNC] Failed to download users: " + String(httpResponseCode));
+  }
+  
+  String summary = "{\"revision\":" + String(report.revision) +
+                   ",\"full\":" + (report.full ? "true" : "false") +
+                   ",\"changes\":" + String(report.users) +
+                   ",\"bytes\":" + String(report.bytes) +
+                   ",\"ms\":" + String(report.elapsedMs) +
+                   ",\"peakHeap\":" + String(report.peakHeapUse) +
+                   ",\"dropped\":" + String(syncDropped) + "}";
+  postDoorEvent(DOOR_SYNC_RESULT, requestId, httpResponseCode > 0, downloaded, 0, summary);
+}
+
+static CredentialImageWriter imageWriter;
+
+// Streams the image into the spare slot; the door remounts on success
+static void downloadCredentialImage(uint16_t requestId) {
+  MemoryScope scope(MEM_SYNC);
+  if (!isOnline()) {
+    Serial.println("[IMAGE] No internet connection for image download");
+    postDoorEvent(DOOR_IMAGE_RESULT, requestId, false, false);
+    return;
+  }
+  
+  if (!imageWriter.begin()) {
+    postDoorEvent(DOOR_IMAGE_RESULT, requestId, true, false);
+    return;
+  }
+  
+  uint32_t startedAt = millis();
+  int httpResponseCode = backend.get("/api/credential-image", imageWriter);
+  bool installed = httpResponseCode == 200 && imageWriter.commit();
+  if (httpResponseCode != 200) {
+    Serial.println("[IMAGE] Failed to download image: " + String(httpResponseCode));
+  }
+  
+  String summary = "{\"generation\":" + String(installed ? imageWriter.installedGeneration() : 0) +
+                   ",\"bytes\":" + String(imageWriter.bytesWritten()) +
+                   ",\"ms\":" + String(millis() - startedAt) + "}";
+  postDoorEvent(DOOR_IMAGE_RESULT, requestId, httpResponseCode > 0, installed, 0, summary);
+}
+
+// The outbox's publisher; a refused publish is tried again later
+static bool publishNow(const String& topic, const String& payload) {
+  return client.publish(topic, payload);
+}
+
+// Queues a trace chunk, waiting for the broker to take earlier ones rather
+// than pushing events out of the outbox; false once the connection is gone
+static bool queueTraceChunk(const String& message) {
+  while (!mqttOutbox.hasRoom(message.length())) {
+    if (!isOnline() || !client.isConnected()) return false;
+    client.loop();
+    if (mqttOutbox.flush(publishNow) == 0) {
+      vTaskDelay(1);
+    }
+  }
+  return mqttOutbox.push("admin/trace-data", message);
+}
+
+// Trace bytes per admin/trace-data message; hex doubles them
+static const uint32_t TRACE_CHUNK = 96;
+
+// Publishes the stopped trace as "<offset>:<hex>" messages, then "end:<size>"
+static void publishTrace() {
+  if (!isOnline()) {
+    Serial.println("[TRACE] No connection for the dump");
+    return;
+  }
+  
+  uint32_t size = inputTrace.size();
+  uint8_t chunk[TRACE_CHUNK];
+  char message[12 + TRACE_CHUNK * 2];
+  for (uint32_t offset = 0; offset < size; offset += TRACE_CHUNK) {
+    uint32_t length = inputTrace.read(offset, chunk, TRACE_CHUNK);
+    int at = snprintf(message, sizeof(message), "%lu:", (unsigned long)offset);
+    for (uint32_t i = 0; i < length; i++) {
+      at += snprintf(message + at, sizeof(message) - at, "%02x", chunk[i]);
+    }
+    if (!queueTraceChunk(message)) {
+      Serial.printf("[TRACE] Connection lost at %u of %u bytes\n", offset, size);
+      return;
+    }
+  }
+  queueTraceChunk("end:" + String(size));
+  Serial.printf("[TRACE] Queued %u bytes\n", size);
+}
+
+static uint8_t auditBatch[AUDIT_BATCH_SIZE];
+
+// Uploads audit records from..to as one binary batch; the backend answers
+// with the last seq it has stored and its clock
+static void uploadAuditBatch(uint16_t requestId, const String& range) {
+  MemoryScope scope(MEM_HTTP);
+  if (!isOnline()) {
+    postDoorEvent(DOOR_AUDIT_RESULT, requestId, false, false);
+    return;
+  }
+  
+  char* end;
+  uint32_t from = strtoul(range.c_str(), &end, 10);
+  uint32_t to = *end == ':' ? strtoul(end + 1, nullptr, 10) : from;
+  size_t length = auditLog.encodeBatch(from, to, auditBatch, sizeof(auditBatch));
+  
+  String response;
+  int httpResponseCode = backend.post("/api/esp32/audit", auditBatch, length, &response);
+  bool success = httpResponseCode == 200 && response.indexOf("\"success\":true") != -1;
+  String result;
+  if (success) {
+    const AuditBatchHeader* header = (const AuditBatchHeader*)auditBatch;
+    Serial.printf("[AUDIT] Uploaded %u records (%u bytes), seq %lu-%lu\n", header->count, (unsigned)length,
+                  (unsigned long)header->firstSeq, (unsigned long)header->lastSeq);
+    result = String(responseNumber(response, "acked")) + ":" + String(responseNumber(response, "time"));
+  } else {
+    Serial.println("[AUDIT] Upload failed: " + String(httpResponseCode));
+  }
+  postDoorEvent(DOOR_AUDIT_RESULT, requestId, httpResponseCode > 0, success, 0, result);
+}
+
+static void handleCredentialCommand(const CredentialCommand& command) {
+  bool reached = false;
+  bool success = false;
+  
+  switch (command.type) {
+    case NET_UNLOCK:
+    case NET_VERIFY: {
+      // An unlock follows a verdict cache miss and races the door task's
+      // deadline; whether it wins or arrives late, the door caches it for
+      // cacheMs: the backend's cacheTtl for a grant (0 for one-off codes),
+      // and for a denial only on a real 401. A verification must not make
+      // the backend publish mytopic/open: the door has opened already.
+      uint32_t startUs = LatencyTrace::now();
+      uint32_t cacheMs = 0;
+      if (isOnline()) {
+        String response;
+        int status = postJson("/api/unlock", "code", command.credential, reached, success,
+                              command.type == NET_VERIFY ? ",\"verify\":true" : "", &response);
+        if (success) {
+          cacheMs = responseNumber(response, "cacheTtl") * 1000;
+        } else if (status == 401) {
+          cacheMs = VERDICT_CACHE_DENY_TTL_MS;
+        }
+      }
+      postDoorEvent(DOOR_ONLINE_VERDICT, command.requestId, reached, success, 0, "",
+                    LatencyTrace::now() - startUs, cacheMs);
+      break;
+    }
+    
+    case NET_ENROLL:
+      if (isOnline()) {
+        postJson("/api/enroll", "id", command.credential, reached, success);
+      }
+      postDoorEvent(DOOR_ENROLL_RESULT, command.requestId, reached, success);
+      break;
+    
+    default:
+      break;
+  }
+}
+
+static void handleNetCommand(const NetCommand& command) {
+  switch (command.type) {
+    case NET_PUBLISH: {
+      // Queued while offline and sent on reconnect
+      MemoryScope scope(MEM_MQTT);
+      mqttOutbox.push(command.topic, command.payload);
+      break;
+    }
+    
+    case NET_SYNC:
+      syncUsersFromServer(command.requestId, strtoul(command.payload.c_str(), nullptr, 10));
+      break;
+      
+    case NET_PRECONNECT:
+      if (isOnline()) {
+        backend.preconnect();
+      }
+      break;
+    
+    case NET_IMAGE:
+      downloadCredentialImage(command.requestId);
+      break;
+    
+    case NET_TRACE_DUMP: {
+      MemoryScope scope(MEM_MQTT);
+      publishTrace();
+      break;
+    }
+    
+    case NET_AUDIT:
+      uploadAuditBatch(command.requestId, command.payload);
+      break;
+    
+    default:
+      break;
+  }
+}
+
+static void checkWiFi() {
+  if (!netOffline && WiFi.status() == WL_CONNECTED) {
+    reconnecting = false;
+  } else if (!netOffline && WiFi.status() != WL_CONNECTED) {
+    if (!reconnecting) {
+      // First time detecting WiFi loss; reconnect once the disconnect settles
+      wifiLostTime = millis();
+      reconnecting = true;
+      WiFi.disconnect();
+      reconnectAt = millis() + 1000;
+      postDoorEvent(DOOR_CONNECTIVITY, 0, true, true, NET_RECONNECTING);
+    } else if (millis() - wifiLostTime > WIFI_OFFLINE_AFTER) {
+      // After 30 seconds of failed reconnection, go offline
+      netOffline = true;
+      reconnecting = false;
+      postDoorEvent(DOOR_CONNECTIVITY, 0, true, true, NET_OFFLINE);
+    }
+  } else if (netOffline && WiFi.status() == WL_CONNECTED) {
+    // WiFi reconnected, switch back to online mode
+    netOffline = false;
+    reconnecting = false;
+    postDoorEvent(DOOR_CONNECTIVITY, 0, true, true, NET_RESTORED);
+  } else if (netOffline && WiFi.status() != WL_CONNECTED) {
+    // In offline mode but periodically try to reconnect
+    if (!reconnecting) {
+      reconnecting = true;
+      WiFi.begin(wifi_ssid, wifi_pass);
+    }
+  }
+}
+
+static void networkTask(void*) {
+  unsigned long lastWiFiCheck = millis();
+  wl_status_t tracedWiFi = WiFi.status();
+  
+  for (;;) {
+    // Every status change goes into the input trace, not just the ones
+    // checkWiFi() acts on
+    wl_status_t wifiStatus = WiFi.status();
+    if (wifiStatus != tracedWiFi) {
+      tracedWiFi = wifiStatus;
+      inputTrace.wifi(wifiStatus);
+    }
+    
+    if (isOnline()) {
+      MemoryScope scope(MEM_MQTT);
+      client.loop();
+    }
+    
+    if (millis() - lastWiFiCheck >= WIFI_CHECK_INTERVAL) {
+      lastWiFiCheck = millis();
+      checkWiFi();
+    }
+    if (reconnectAt != 0 && (int32_t)(millis() - reconnectAt) >= 0) {
+      reconnectAt = 0;
+      WiFi.begin(wifi_ssid, wifi_pass);
+    }
+    
+    // Blocking HTTP only ever stalls this task, never the door. A waiting
+    // credential goes ahead of the next queued command.
+    CredentialCommand credential;
+    NetCommand command;
+    for (;;) {
+      if (credentialCommands.pop(credential)) {
+        handleCredentialCommand(credential);
+      } else if (netCommands.pop(command)) {
+        handleNetCommand(command);
+      } else {
+        break;
+      }
+    }
+    
+    {
+      MemoryScope scope(MEM_MQTT);
+      if (isOnline() && client.isConnected()) {
+        mqttOutbox.flush(publishNow);
+      }
+      mqttOutbox.loop();
+    }
+    
+    vTaskDelay(pdMS_TO_TICKS(5));
+  }
+}
+
+static uint16_t nextRequestId() {
+  static uint16_t next = 1;
+  uint16_t id = next++;
+  if (next == 0) next = 1; // 0 marks unsolicited events
+  return id;
+}
+
+uint16_t sendNetCommand(NetCommandType type, const String& payload, const char* topic) {
+  NetCommand command;
+  command.type = type;
+  command.requestId = nextRequestId();
+  strncpy(command.topic, topic, sizeof(command.topic) - 1);
+  command.topic[sizeof(command.topic) - 1] = '\0';
+  command.payload = payload;
+  
+  if (!netCommands.push(command)) {
+    Serial.println("[NET] Network queue full, request dropped");
+    return 0;
+  }
+  return command.requestId;
+}
+
+uint16_t sendCredentialCommand(NetCommandType type, const char* credential, size_t length) {
+  if (length > CREDENTIAL_MAX_LEN) {
+    Serial.println("[NET] Credential too long, request dropped");
+    return 0;
+  }
+  
+  CredentialCommand command;
+  command.type = type;
+  command.requestId = nextRequestId();
+  memcpy(command.credential, credential, length);
+  command.credential[length] = '\0';
+  
+  if (!credentialCommands.push(command)) {
+    Serial.println("[NET] Credential queue full, request dropped");
+    return 0;
+  }
+  return command.requestId;
+}
+
+void startNetworkTask(bool startOffline) {
+  netOffline = startOffline;
+  mqttOutbox.begin();
+  TaskHandle_t task = NULL;
+  xTaskCreatePinnedToCore(networkTask, "network", NETWORK_STACK_SIZE, NULL, 1, &task, 0);
+  memoryTelemetry.watchTask("network", task);
+}
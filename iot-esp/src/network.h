@@ -0,0 +1,23 @@
+#pragma once
+
+#include <Arduino.h>
+#include "events.h"
+#include "backend_client.h"
+
+// Hardcoded WiFi credentials
+extern const char* wifi_ssid;
+extern const char* wifi_pass;
+
+// Starts the network task on core 0. It owns WiFi supervision, the MQTT
+// client and every HTTP request; the door task reaches it only through
+// netCommands/credentialCommands/doorEvents.
+void startNetworkTask(bool startOffline);
+
+extern BackendClient backend;
+
+// Door task side: queues a request for the network task and returns its
+// ID (echoed in the answering DoorEvent), or 0 if the queue is full
+uint16_t sendNetCommand(NetCommandType type, const String& payload, const char* topic = "");
+// Same for NET_UNLOCK, NET_VERIFY and NET_ENROLL; 0 also when the
+// credential is longer than CREDENTIAL_MAX_LEN
+uint16_t sendCredentialCommand(NetCommandType type, const char* credential, size_t length);
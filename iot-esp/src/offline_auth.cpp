@@ -1,4 +1,5 @@
 #include "offline_auth.h"
+#include <algorithm>
 
 const char* OfflineAuth::NAMESPACE = "offline_auth";
 
@@ -9,9 +10,23 @@ OfflineAuth::OfflineAuth() {
   lastFailedAttempt = 0;
   globalFailedAttempts = 0;
   isLockedOut = false;
+  lastAuthTime = 0;
+  journalCount = 0;
+  statsDirty = false;
+  firstDirtyAt = 0;
+  lastActivityAt = 0;
+  maxLossWindow = OFFLINE_AUTH_MAX_LOSS_MS;
+  syncRevision = 0;
+  syncing = false;
+  syncSeen = nullptr;
+  imageSeen = nullptr;
+  imageSeenCount = 0;
+  revokedCount = 0;
 }
 
 OfflineAuth::~OfflineAuth() {
+  flush();
+  releaseSeen();
   preferences.end();
 }
 
@@ -21,69 +36,474 @@ bool OfflineAuth::begin() {
     return false;
   }
   
+  if (!store.begin(MAX_USERS)) {
+    Serial.println("[AUTH] Failed to initialize user store");
+    return false;
+  }
+  
+  // Twice the user count keeps probe chains short in the credential indexes
+  if (!pinIndex.begin(MAX_USERS * 2) || !nfcIndex.begin(MAX_USERS * 2)) {
+    Serial.println("[AUTH] Failed to allocate credential index");
+    return false;
+  }
+  
+  migrateLegacyUsers();
+  loadUsers();
+  
+  // Optional; without an image only the store is used
+  image.begin();
+  
   // Initialize system if first run
   if (!preferences.isKey("initialized")) {
     Serial.println("[AUTH] First run - initializing system");
     preferences.putBool("initialized", true);
-    preferences.putUChar("user_count", 0);
-    preferences.putULong("last_auth", 0);
-    preferences.putUChar("failed_attempts", 0);
+    statsDirty = true;
     
     // Add default admin user (PIN: 1234)
     addUser("admin", "1234", "", AUTH_PIN);
   }
   
   // Load system state
-  globalFailedAttempts = preferences.getUChar("failed_attempts", 0);
-  lastFailedAttempt = preferences.getULong("last_failed", 0);
+  loadStats();
+  syncRevision = preferences.getUInt("sync_rev", 0);
+  loadRevocations();
+  flush();
   
-  Serial.println("[AUTH] Offline authentication system initialized");
+  Serial.printf("[AUTH] Offline authentication system initialized (%u/%u users)\n",
+                store.count(), MAX_USERS);
   return true;
 }
 
 void OfflineAuth::reset() {
   preferences.clear();
+  store.clear();
+  pinIndex.clear();
+  nfcIndex.clear();
+  journalCount = 0;
   globalFailedAttempts = 0;
   lastFailedAttempt = 0;
+  lastAuthTime = 0;
   isLockedOut = false;
+  syncRevision = 0; // the next sync downloads everything
+  image.invalidate();
+  revokedCount = 0;
   
   // Reinitialize
   preferences.putBool("initialized", true);
-  preferences.putUChar("user_count", 0);
-  preferences.putULong("last_auth", 0);
-  preferences.putUChar("failed_attempts", 0);
+  statsDirty = true;
+  flush();
   
   Serial.println("[AUTH] System reset complete");
 }
 
-String OfflineAuth::calculateSHA256(const String& input) {
-  mbedtls_sha256_context ctx;
-  unsigned char hash[32];
+void OfflineAuth::loadStats() {
+  StoredStats stats;
+  if (preferences.getBytes("auth_stats", &stats, sizeof(StoredStats)) == sizeof(StoredStats)) {
+    globalFailedAttempts = stats.failedAttempts;
+    lastFailedAttempt = stats.lastFailed;
+    lastAuthTime = stats.lastAuth;
+    return;
+  }
+  
+  // Older firmware kept one key per counter; fold them into the blob
+  globalFailedAttempts = preferences.getUChar("failed_attempts", 0);
+  lastFailedAttempt = preferences.getULong("last_failed", 0);
+  lastAuthTime = preferences.getULong("last_auth", 0);
+  const char* legacyKeys[] = {"failed_attempts", "last_failed", "last_auth"};
+  for (const char* key : legacyKeys) {
+    if (preferences.isKey(key)) preferences.remove(key);
+  }
+  statsDirty = true;
+}
+
+void OfflineAuth::markDirty() {
+  if (!hasPendingWrites()) {
+    firstDirtyAt = millis();
+  }
+  lastActivityAt = millis();
+}
+
+void OfflineAuth::journalUse(uint16_t slot, uint32_t lastUsed, uint8_t failedAttempts) {
+  markDirty();
+  
+  for (uint8_t i = 0; i < journalCount; i++) {
+    if (journal[i].slot == slot) {
+      journal[i].lastUsed = lastUsed;
+      journal[i].failedAttempts = failedAttempts;
+      return;
+    }
+  }
+  
+  // A full journal is flushed early rather than dropping an update
+  if (journalCount == JOURNAL_SIZE) {
+    flush();
+    markDirty();
+  }
+  journal[journalCount].slot = slot;
+  journal[journalCount].lastUsed = lastUsed;
+  journal[journalCount].failedAttempts = failedAttempts;
+  journalCount++;
+}
+
+void OfflineAuth::dropJournal(uint16_t slot) {
+  for (uint8_t i = 0; i < journalCount; i++) {
+    if (journal[i].slot == slot) {
+      journal[i] = journal[--journalCount];
+      return;
+    }
+  }
+}
+
+void OfflineAuth::flush() {
+  if (!hasPendingWrites()) return;
+  
+  // Apply in slot order so each cold page is rewritten once
+  std::sort(journal, journal + journalCount, [](const PendingUse& a, const PendingUse& b) {
+    return a.slot < b.slot;
+  });
+  for (uint8_t i = 0; i < journalCount; i++) {
+    UserColdRecord cold;
+    if (store.readCold(journal[i].slot, cold)) {
+      cold.lastUsed = journal[i].lastUsed;
+      cold.failedAttempts = journal[i].failedAttempts;
+      store.writeCold(journal[i].slot, cold, false);
+    }
+  }
+  store.commitCold();
+  
+  if (statsDirty) {
+    StoredStats stats = {globalFailedAttempts, lastFailedAttempt, lastAuthTime};
+    preferences.putBytes("auth_stats", &stats, sizeof(StoredStats));
+  }
+  
+  if (journalCount > 0) {
+    Serial.printf("[AUTH] Flushed %d user updates\n", journalCount);
+  }
+  journalCount = 0;
+  statsDirty = false;
+}
+
+void OfflineAuth::loop() {
+  if (!hasPendingWrites()) return;
+  
+  uint32_t now = millis();
+  if (now - firstDirtyAt >= maxLossWindow || now - lastActivityAt >= IDLE_FLUSH_MS) {
+    flush();
+  }
+}
+
+uint32_t OfflineAuth::msUntilFlush() {
+  if (!hasPendingWrites()) return UINT32_MAX;
+  
+  uint32_t now = millis();
+  uint32_t lossAge = now - firstDirtyAt;
+  uint32_t idleAge = now - lastActivityAt;
+  if (lossAge >= maxLossWindow || idleAge >= IDLE_FLUSH_MS) return 0;
+  uint32_t left = maxLossWindow - lossAge;
+  return IDLE_FLUSH_MS - idleAge < left ? IDLE_FLUSH_MS - idleAge : left;
+}
+
+void OfflineAuth::sha256(const uint8_t* data, size_t length, uint8_t* digest) {
+  // One-shot mbedtls call; on the ESP32 it runs on the hardware SHA engine
+  mbedtls_sha256(data, length, digest, 0); // 0 for SHA-256
+}
+
+void OfflineAuth::hexToBytes(const char* hex, uint8_t* bytes) {
+  for (size_t i = 0; hex[i] && hex[i + 1]; i += 2) {
+    char byteString[3] = {hex[i], hex[i + 1], '\0'};
+    bytes[i / 2] = (uint8_t)strtol(byteString, NULL, 16);
+  }
+}
+
+const char* authMessageText(AuthMessage message) {
+  switch (message) {
+    case AUTH_MSG_PIN_OK: return "PIN authenticated";
+    case AUTH_MSG_NFC_OK: return "NFC authenticated";
+    case AUTH_MSG_COMBINED_OK: return "Combined auth successful";
+    case AUTH_MSG_ONLINE_OK: return "Online authenticated";
+    case AUTH_MSG_INVALID_PIN: return "Invalid PIN";
+    case AUTH_MSG_INVALID_NFC: return "Invalid NFC card";
+    case AUTH_MSG_INVALID_CREDENTIALS: return "Invalid credentials";
+    default: return "";
+  }
+}
+
+uint32_t OfflineAuth::digestHash(const uint8_t* digest) {
+  // SHA-256 output is already uniform, so its first word is a fine hash
+  return (uint32_t)digest[0] | ((uint32_t)digest[1] << 8) |
+         ((uint32_t)digest[2] << 16) | ((uint32_t)digest[3] << 24);
+}
+
+void OfflineAuth::migrateLegacyUsers() {
+  // Firmware before the paged store kept one "user_<id>" key per user with
+  // an 8-bit ID. Copy each into the store under the same ID, then drop it,
+  // so an interrupted migration simply resumes on the next boot.
+  struct LegacyUser {
+    uint8_t id;
+    char name[32];
+    char pinHash[65];
+    char nfcId[33];
+    AuthType authType;
+    bool isActive;
+    uint32_t lastUsed;
+    uint8_t failedAttempts;
+  };
   
-  mbedtls_sha256_init(&ctx);
-  mbedtls_sha256_starts(&ctx, 0); // 0 for SHA-256
-  mbedtls_sha256_update(&ctx, (const unsigned char*)input.c_str(), input.length());
-  mbedtls_sha256_finish(&ctx, hash);
-  mbedtls_sha256_free(&ctx);
+  uint8_t migrated = 0;
+  for (uint8_t i = 1; i <= LEGACY_MAX_USERS; i++) {
+    char userKey[16];
+    snprintf(userKey, sizeof(userKey), "user_%u", i);
+    if (!preferences.isKey(userKey)) continue;
+    
+    LegacyUser legacy;
+    memset(&legacy, 0, sizeof(LegacyUser));
+    preferences.getBytes(userKey, &legacy, sizeof(LegacyUser));
+    
+    UserHotRecord hot;
+    UserColdRecord cold;
+    memset(&hot, 0, sizeof(UserHotRecord));
+    memset(&cold, 0, sizeof(UserColdRecord));
+    legacy.pinHash[sizeof(legacy.pinHash) - 1] = '\0';
+    legacy.nfcId[sizeof(legacy.nfcId) - 1] = '\0';
+    bool hasPin = strlen(legacy.pinHash) == DIGEST_LEN * 2;
+    if (hasPin) {
+      hexToBytes(legacy.pinHash, hot.pinDigest);
+    }
+    hot.nfcUidLen = UserStore::parseUid(legacy.nfcId, hot.nfcUid);
+    if (hot.nfcUidLen == 0 && legacy.nfcId[0] != '\0') {
+      Serial.printf("[AUTH] User %d: card ID %s is not a UID, dropped\n", i, legacy.nfcId);
+    }
+    hot.setFlags(legacy.authType, legacy.isActive, hasPin);
+    memcpy(cold.name, legacy.name, sizeof(cold.name));
+    cold.lastUsed = legacy.lastUsed;
+    cold.failedAttempts = legacy.failedAttempts;
+    
+    if (!store.add(i - 1, hot, cold)) {
+      Serial.printf("[AUTH] Failed to migrate user %d\n", i);
+      return;
+    }
+    preferences.remove(userKey);
+    migrated++;
+  }
   
-  return bytesToHex(hash, 32);
+  if (preferences.isKey("user_count")) {
+    preferences.remove("user_count");
+  }
+  if (migrated > 0) {
+    Serial.printf("[AUTH] Migrated %d users to paged store\n", migrated);
+  }
+}
+
+void OfflineAuth::loadUsers() {
+  pinIndex.clear();
+  nfcIndex.clear();
+  
+  for (uint16_t slot = 0; slot < MAX_USERS; slot++) {
+    if (store.isUsed(slot) && !indexUser(slot)) {
+      Serial.printf("[AUTH] User %d not indexed, index full\n", slot + 1);
+    }
+  }
+}
+
+// False if either index is full; then neither holds the slot, so a
+// caller can put the old record back
+bool OfflineAuth::indexUser(uint16_t slot) {
+  const UserHotRecord& hot = store.hot(slot);
+  uint32_t pinHash = digestHash(hot.pinDigest);
+  
+  if (hot.hasPin() && !pinIndex.insert(pinHash, slot)) {
+    return false;
+  }
+  if (hot.nfcUidLen > 0 && !nfcIndex.insert(CredentialIndex::hashBytes(hot.nfcUid, hot.nfcUidLen), slot)) {
+    if (hot.hasPin()) pinIndex.remove(pinHash, slot);
+    return false;
+  }
+  return true;
+}
+
+void OfflineAuth::unindexUser(uint16_t slot) {
+  const UserHotRecord& hot = store.hot(slot);
+  
+  if (hot.hasPin()) {
+    pinIndex.remove(digestHash(hot.pinDigest), slot);
+  }
+  if (hot.nfcUidLen > 0) {
+    nfcIndex.remove(CredentialIndex::hashBytes(hot.nfcUid, hot.nfcUidLen), slot);
+  }
+}
+
+// After a store write that replaced slot's credentials with hot. If the new
+// ones do not fit in the index, the old record goes back (old stays
+// findable) and the change is reported as failed.
+bool OfflineAuth::reindexUser(uint16_t slot, const UserHotRecord& old) {
+  if (indexUser(slot)) {
+    return true;
+  }
+  Serial.printf("[AUTH] User %d not indexed, index full\n", slot + 1);
+  store.writeHot(slot, old);
+  indexUser(slot);
+  return false;
+}
+
+bool OfflineAuth::isValidUser(uint16_t userId) {
+  return userId > 0 && userId <= MAX_USERS && store.isUsed(userId - 1);
+}
+
+bool OfflineAuth::fillRecords(UserHotRecord& hot, UserColdRecord& cold, const String& name, const String& pin, const String& nfcId, AuthType authType) {
+  strncpy(cold.name, name.c_str(), sizeof(cold.name) - 1);
+  cold.name[sizeof(cold.name) - 1] = '\0';
+  
+  // Hash the PIN
+  bool hasPin = pin.length() > 0;
+  if (hasPin) {
+    sha256((const uint8_t*)pin.c_str(), pin.length(), hot.pinDigest);
+  } else {
+    memset(hot.pinDigest, 0, sizeof(hot.pinDigest));
+  }
+  
+  // Store NFC UID as raw bytes
+  hot.nfcUidLen = UserStore::parseUid(nfcId.c_str(), hot.nfcUid);
+  
+  hot.setFlags(authType, hot.isActive(), hasPin);
+  return nfcId.length() == 0 || hot.nfcUidLen > 0;
+}
+
+void OfflineAuth::composeUser(uint16_t slot, const UserColdRecord& cold, OfflineUser& user) {
+  const UserHotRecord& hot = store.hot(slot);
+  
+  user.lastUsed = cold.lastUsed;
+  user.failedAttempts = cold.failedAttempts;
+  for (uint8_t i = 0; i < journalCount; i++) {
+    if (journal[i].slot == slot) {
+      user.lastUsed = journal[i].lastUsed;
+      user.failedAttempts = journal[i].failedAttempts;
+    }
+  }
+  
+  user.id = slot + 1;
+  memcpy(user.name, cold.name, sizeof(user.name));
+  user.name[sizeof(user.name) - 1] = '\0';
+  UserStore::formatUid(hot.nfcUid, hot.nfcUidLen, user.nfcId);
+  user.authType = hot.authType();
+  user.isActive = hot.isActive();
+}
+
+uint16_t OfflineAuth::findPinSlot(const uint8_t* digest) {
+  return pinIndex.find(digestHash(digest), [&](uint16_t slot) {
+    const UserHotRecord& hot = store.hot(slot);
+    return hot.isActive() &&
+           (hot.authType() == AUTH_PIN || hot.authType() == AUTH_COMBINED) &&
+           memcmp(hot.pinDigest, digest, DIGEST_LEN) == 0;
+  });
+}
+
+uint16_t OfflineAuth::findNfcSlot(const uint8_t* uid, uint8_t uidLen, bool forAuth) {
+  uint32_t hash = CredentialIndex::hashBytes(uid, uidLen);
+  return nfcIndex.find(hash, [&](uint16_t slot) {
+    const UserHotRecord& hot = store.hot(slot);
+    if (forAuth && (!hot.isActive() ||
+        (hot.authType() != AUTH_NFC && hot.authType() != AUTH_COMBINED))) {
+      return false;
+    }
+    return hot.nfcUidLen == uidLen && memcmp(hot.nfcUid, uid, uidLen) == 0;
+  });
+}
+
+void OfflineAuth::recordSuccess(uint16_t slot) {
+  // Update last used time and reset failed attempts (written behind)
+  lastAuthTime = millis();
+  journalUse(slot, lastAuthTime, 0);
+  resetFailedAttempts();
+  statsDirty = true;
+}
+
+void OfflineAuth::loadRevocations() {
+  // The list belongs to one image; a new image was built without those users
+  revokedCount = 0;
+  if (!image.isMounted() || preferences.getUInt("img_gen", 0) != image.generation()) {
+    if (preferences.isKey("img_revoked")) {
+      preferences.remove("img_revoked");
+    }
+    return;
+  }
+  size_t length = preferences.getBytes("img_revoked", revoked, sizeof(revoked));
+  revokedCount = length / sizeof(uint16_t);
+}
+
+bool OfflineAuth::isRevoked(uint16_t index) {
+  for (uint8_t i = 0; i < revokedCount; i++) {
+    if (revoked[i] == index) return true;
+  }
+  return false;
+}
+
+bool OfflineAuth::revokeImageUser(uint16_t index) {
+  if (isRevoked(index)) {
+    return true;
+  }
+  if (revokedCount == MAX_REVOKED) {
+    Serial.println("[AUTH] Image revocation list full, load a new credential image");
+    return false;
+  }
+  
+  revoked[revokedCount++] = index;
+  preferences.putUInt("img_gen", image.generation());
+  preferences.putBytes("img_revoked", revoked, revokedCount * sizeof(uint16_t));
+  Serial.printf("[AUTH] Image user %u revoked\n", index);
+  return true;
+}
+
+uint16_t OfflineAuth::findImagePin(const uint8_t* digest, bool forAuth) {
+  uint16_t index = image.findPin(digest);
+  if (index == CredentialImage::NO_USER || isRevoked(index)) {
+    return CredentialImage::NO_USER;
+  }
+  AuthType type = (AuthType)image.user(index)->authType;
+  if (forAuth && type != AUTH_PIN && type != AUTH_COMBINED) {
+    return CredentialImage::NO_USER;
+  }
+  return index;
 }
 
-String OfflineAuth::bytesToHex(const uint8_t* bytes, size_t length) {
-  String hex = "";
-  for (size_t i = 0; i < length; i++) {
-    if (bytes[i] < 16) hex += "0";
-    hex += String(bytes[i], HEX);
+uint16_t OfflineAuth::findImageNfc(const uint8_t* uid, uint8_t uidLen, bool forAuth) {
+  uint16_t index = image.findNfc(uid, uidLen);
+  if (index == CredentialImage::NO_USER || isRevoked(index)) {
+    return CredentialImage::NO_USER;
+  }
+  AuthType type = (AuthType)image.user(index)->authType;
+  if (forAuth && type != AUTH_NFC && type != AUTH_COMBINED) {
+    return CredentialImage::NO_USER;
   }
-  hex.toLowerCase();
-  return hex;
+  return index;
 }
 
-void OfflineAuth::hexToBytes(const String& hex, uint8_t* bytes) {
-  for (size_t i = 0; i < hex.length(); i += 2) {
-    String byteString = hex.substring(i, i + 2);
-    bytes[i / 2] = (uint8_t)strtol(byteString.c_str(), NULL, 16);
+// Index of the image user identical to hot/cold, or NO_USER
+uint16_t OfflineAuth::findInImage(const UserHotRecord& hot, const UserColdRecord& cold) {
+  uint16_t index = hot.hasPin() ? findImagePin(hot.pinDigest, false)
+                                : findImageNfc(hot.nfcUid, hot.nfcUidLen, false);
+  if (index == CredentialImage::NO_USER) {
+    return CredentialImage::NO_USER;
   }
+  const CredentialImageUser* user = image.user(index);
+  bool same = user->authType == hot.authType() &&
+              user->nfcUidLen == hot.nfcUidLen &&
+              memcmp(user->nfcUid, hot.nfcUid, hot.nfcUidLen) == 0 &&
+              strncmp(user->name, cold.name, sizeof(user->name)) == 0;
+  return same ? index : CredentialImage::NO_USER;
+}
+
+void OfflineAuth::recordImageSuccess() {
+  // Image users have no bookkeeping record; only the global stats change
+  lastAuthTime = millis();
+  resetFailedAttempts();
+  markDirty();
+  statsDirty = true;
+}
+
+bool OfflineAuth::reloadImage() {
+  bool mounted = image.begin();
+  loadRevocations();
+  return mounted;
 }
 
 bool OfflineAuth::isSystemLocked() {
@@ -93,103 +513,291 @@ bool OfflineAuth::isSystemLocked() {
 
 void OfflineAuth::incrementFailedAttempts() {
   // Still track failed attempts for statistics but don't use for lockout
+  markDirty();
   globalFailedAttempts++;
   lastFailedAttempt = millis();
-  preferences.putUChar("failed_attempts", globalFailedAttempts);
-  preferences.putULong("last_failed", lastFailedAttempt);
+  statsDirty = true;
 }
 
 void OfflineAuth::resetFailedAttempts() {
-  globalFailedAttempts = 0;
-  preferences.putUChar("failed_attempts", 0);
+  if (globalFailedAttempts != 0) {
+    markDirty();
+    globalFailedAttempts = 0;
+    statsDirty = true;
+  }
   isLockedOut = false;
 }
 
 bool OfflineAuth::addUser(const String& name, const String& pin, const String& nfcId, AuthType authType) {
-  uint8_t userCount = preferences.getUChar("user_count", 0);
-  
-  if (userCount >= MAX_USERS) {
+  // Find next available user ID
+  uint16_t slot = store.findFreeSlot();
+  if (slot == UserStore::NO_SLOT) {
     Serial.println("[AUTH] Maximum users reached");
     return false;
   }
   
-  // Find next available user ID
-  uint8_t userId = 1;
-  for (uint8_t i = 1; i <= MAX_USERS; i++) {
-    String userKey = "user_" + String(i);
-    if (!preferences.isKey(userKey.c_str())) {
-      userId = i;
-      break;
-    }
+  UserHotRecord hot;
+  UserColdRecord cold;
+  memset(&hot, 0, sizeof(UserHotRecord));
+  memset(&cold, 0, sizeof(UserColdRecord));
+  if (!fillRecords(hot, cold, name, pin, nfcId, authType)) {
+    Serial.printf("[AUTH] Card ID %s is not a UID\n", nfcId.c_str());
+    return false;
   }
+  hot.setFlags(authType, true, hot.hasPin());
   
-  OfflineUser user;
-  user.id = userId;
-  strncpy(user.name, name.c_str(), sizeof(user.name) - 1);
-  user.name[sizeof(user.name) - 1] = '\0';
+  // Save user to the store
+  if (!store.add(slot, hot, cold)) {
+    Serial.println("[AUTH] Failed to save user");
+    return false;
+  }
+  if (!indexUser(slot)) {
+    Serial.println("[AUTH] Credential index full");
+    store.erase(slot);
+    return false;
+  }
   
-  // Hash the PIN
-  String pinHash = calculateSHA256(pin);
-  strncpy(user.pinHash, pinHash.c_str(), sizeof(user.pinHash) - 1);
-  user.pinHash[sizeof(user.pinHash) - 1] = '\0';
+  Serial.printf("[AUTH] User %s added with ID %d\n", name.c_str(), slot + 1);
+  return true;
+}
+
+bool OfflineAuth::removeUser(uint16_t userId) {
+  // Image users cannot be erased, only revoked until the next image
+  if (userId >= IMAGE_USER_BASE) {
+    return image.user(userId - IMAGE_USER_BASE) && revokeImageUser(userId - IMAGE_USER_BASE);
+  }
   
-  // Store NFC ID
-  strncpy(user.nfcId, nfcId.c_str(), sizeof(user.nfcId) - 1);
-  user.nfcId[sizeof(user.nfcId) - 1] = '\0';
+  if (!isValidUser(userId)) {
+    return false;
+  }
   
-  user.authType = authType;
-  user.isActive = true;
-  user.lastUsed = 0;
-  user.failedAttempts = 0;
+  unindexUser(userId - 1);
+  dropJournal(userId - 1);
+  store.erase(userId - 1);
   
-  // Save user to preferences
-  String userKey = "user_" + String(userId);
-  preferences.putBytes(userKey.c_str(), &user, sizeof(OfflineUser));
+  Serial.printf("[AUTH] User %d removed\n", userId);
+  return true;
+}
+
+bool OfflineAuth::updateUser(uint16_t userId, const String& name, const String& pin, const String& nfcId, AuthType authType) {
+  UserColdRecord cold;
+  if (!isValidUser(userId) || !store.readCold(userId - 1, cold)) {
+    return false;
+  }
   
-  // Update user count
-  preferences.putUChar("user_count", userCount + 1);
+  UserHotRecord old = store.hot(userId - 1);
+  UserHotRecord hot = old;
+  if (!fillRecords(hot, cold, name, pin, nfcId, authType)) {
+    Serial.printf("[AUTH] Card ID %s is not a UID\n", nfcId.c_str());
+    return false;
+  }
+  unindexUser(userId - 1);
+  bool saved = store.writeCold(userId - 1, cold) && store.writeHot(userId - 1, hot);
+  if (!reindexUser(userId - 1, old) || !saved) {
+    return false;
+  }
   
-  Serial.printf("[AUTH] User %s added with ID %d\n", name.c_str(), userId);
+  Serial.printf("[AUTH] User %d updated\n", userId);
   return true;
 }
 
-bool OfflineAuth::removeUser(uint8_t userId) {
-  String userKey = "user_" + String(userId);
-  if (!preferences.isKey(userKey.c_str())) {
-    return false;
+UpsertResult OfflineAuth::upsertUser(const String& name, const String& pin, const String& nfcId, AuthType authType) {
+  UserHotRecord hot;
+  UserColdRecord cold;
+  memset(&hot, 0, sizeof(UserHotRecord));
+  memset(&cold, 0, sizeof(UserColdRecord));
+  if (!fillRecords(hot, cold, name, pin, nfcId, authType)) {
+    Serial.printf("[AUTH] Synced user %s: card ID %s is not a UID\n", name.c_str(), nfcId.c_str());
+    return UPSERT_FAILED;
+  }
+  hot.setFlags(authType, true, hot.hasPin());
+  hot.setSynced(true);
+  
+  // Server users carry no local ID, so match on the credentials (RAM only)
+  uint16_t slot = CredentialIndex::NO_SLOT;
+  if (hot.hasPin()) {
+    slot = findPinSlot(hot.pinDigest);
+  } else if (hot.nfcUidLen > 0) {
+    slot = findNfcSlot(hot.nfcUid, hot.nfcUidLen, false);
   }
   
-  preferences.remove(userKey.c_str());
+  if (slot == CredentialIndex::NO_SLOT) {
+    // Already in the credential image as is: nothing to store
+    uint16_t index = findInImage(hot, cold);
+    if (index != CredentialImage::NO_USER) {
+      if (index < imageSeenCount) markSeen(imageSeen, index);
+      return UPSERT_UNCHANGED;
+    }
+    slot = store.findFreeSlot();
+    if (slot == UserStore::NO_SLOT || !store.add(slot, hot, cold)) {
+      Serial.printf("[AUTH] Could not add synced user %s\n", name.c_str());
+      return UPSERT_FAILED;
+    }
+    if (!indexUser(slot)) {
+      Serial.printf("[AUTH] Credential index full, synced user %s not added\n", name.c_str());
+      store.erase(slot);
+      return UPSERT_FAILED;
+    }
+    markSeen(syncSeen, slot);
+    return UPSERT_ADDED;
+  }
   
-  uint8_t userCount = preferences.getUChar("user_count", 0);
-  if (userCount > 0) {
-    preferences.putUChar("user_count", userCount - 1);
+  markSeen(syncSeen, slot);
+  UserColdRecord current;
+  if (!store.readCold(slot, current)) {
+    return UPSERT_FAILED;
+  }
+  if (memcmp(&store.hot(slot), &hot, sizeof(UserHotRecord)) == 0 &&
+      strncmp(current.name, cold.name, sizeof(current.name)) == 0) {
+    return UPSERT_UNCHANGED;
   }
   
-  Serial.printf("[AUTH] User %d removed\n", userId);
+  // Keep the bookkeeping, replace name and credentials
+  memcpy(current.name, cold.name, sizeof(current.name));
+  UserHotRecord old = store.hot(slot);
+  unindexUser(slot);
+  bool saved = store.writeCold(slot, current) && store.writeHot(slot, hot);
+  return reindexUser(slot, old) && saved ? UPSERT_UPDATED : UPSERT_FAILED;
+}
+
+bool OfflineAuth::removeSyncedUser(const String& pin, const String& nfcId) {
+  uint16_t slot = CredentialIndex::NO_SLOT;
+  uint16_t index = CredentialImage::NO_USER;
+  if (pin.length() > 0) {
+    uint8_t pinDigest[DIGEST_LEN];
+    sha256((const uint8_t*)pin.c_str(), pin.length(), pinDigest);
+    slot = findPinSlot(pinDigest);
+    index = findImagePin(pinDigest, false);
+  } else {
+    uint8_t uid[MAX_UID_LEN];
+    uint8_t uidLen = UserStore::parseUid(nfcId.c_str(), uid);
+    if (uidLen > 0) {
+      slot = findNfcSlot(uid, uidLen, false);
+      index = findImageNfc(uid, uidLen, false);
+    }
+  }
+  
+  // The credential may be in both the store and the image
+  bool removed = index != CredentialImage::NO_USER && revokeImageUser(index);
+  if (slot != CredentialIndex::NO_SLOT) {
+    removed = removeUser(slot + 1) || removed;
+  }
+  // False when already gone, e.g. a tombstone replayed after an interrupted sync
+  return removed;
+}
+
+void OfflineAuth::beginSync() {
+  syncing = true;
+  store.beginBatch();
+  
+  // A failed allocation only means a full download cannot prune
+  releaseSeen();
+  syncSeen = (uint8_t*)calloc((MAX_USERS + 7) / 8, 1);
+  imageSeenCount = image.userCount();
+  imageSeen = (uint8_t*)calloc((imageSeenCount + 7) / 8 + 1, 1);
+  if (!syncSeen || !imageSeen) {
+    Serial.println("[AUTH] No memory to track the sync, removed users stay until the next one");
+    releaseSeen();
+  }
+}
+
+bool OfflineAuth::endSync() {
+  if (!syncing) return true;
+  syncing = false;
+  releaseSeen();
+  return store.commitBatch();
+}
+
+void OfflineAuth::markSeen(uint8_t* seen, uint16_t index) {
+  if (seen) seen[index / 8] |= 1 << (index % 8);
+}
+
+bool OfflineAuth::wasSeen(const uint8_t* seen, uint16_t index) {
+  return seen[index / 8] & (1 << (index % 8));
+}
+
+void OfflineAuth::releaseSeen() {
+  free(syncSeen);
+  free(imageSeen);
+  syncSeen = nullptr;
+  imageSeen = nullptr;
+  imageSeenCount = 0;
+}
+
+uint16_t OfflineAuth::pruneUnseenUsers() {
+  if (!syncing || !syncSeen) {
+    return 0;
+  }
+  
+  uint16_t pruned = 0;
+  for (uint16_t slot = 0; slot < MAX_USERS; slot++) {
+    if (store.isUsed(slot) && store.hot(slot).isSynced() && !wasSeen(syncSeen, slot)) {
+      if (removeUser(slot + 1)) pruned++;
+    }
+  }
+  for (uint16_t index = 0; index < imageSeenCount; index++) {
+    if (!wasSeen(imageSeen, index) && !isRevoked(index)) {
+      if (revokeImageUser(index)) pruned++;
+    }
+  }
+  if (pruned > 0) {
+    Serial.printf("[AUTH] Full sync removed %u users the server no longer has\n", pruned);
+  }
+  return pruned;
+}
+
+bool OfflineAuth::commitSync(uint32_t revision) {
+  if (!endSync()) {
+    Serial.println("[AUTH] Sync commit failed, cursor kept");
+    return false;
+  }
+  if (revision != syncRevision) {
+    preferences.putUInt("sync_rev", revision);
+    syncRevision = revision;
+  }
   return true;
 }
 
-OfflineUser OfflineAuth::getUser(uint8_t userId) {
+OfflineUser OfflineAuth::getUser(uint16_t userId) {
   OfflineUser user;
+  getUser(userId, user);
+  return user;
+}
+
+bool OfflineAuth::getUser(uint16_t userId, OfflineUser& user) {
   memset(&user, 0, sizeof(OfflineUser));
   
-  String userKey = "user_" + String(userId);
-  if (preferences.isKey(userKey.c_str())) {
-    preferences.getBytes(userKey.c_str(), &user, sizeof(OfflineUser));
+  if (userId >= IMAGE_USER_BASE) {
+    const CredentialImageUser* imageUser = image.user(userId - IMAGE_USER_BASE);
+    if (imageUser) {
+      user.id = userId;
+      memcpy(user.name, imageUser->name, sizeof(user.name));
+      user.name[sizeof(user.name) - 1] = '\0';
+      UserStore::formatUid(imageUser->nfcUid, imageUser->nfcUidLen <= MAX_UID_LEN ? imageUser->nfcUidLen : 0, user.nfcId);
+      user.authType = (AuthType)imageUser->authType;
+      user.isActive = !isRevoked(userId - IMAGE_USER_BASE);
+    }
+    return user.id != 0;
   }
   
-  return user;
+  // Names live in the cold table and are only loaded here
+  UserColdRecord cold;
+  if (!isValidUser(userId) || !store.readCold(userId - 1, cold)) {
+    return false;
+  }
+  composeUser(userId - 1, cold, user);
+  return true;
 }
 
-std::vector<OfflineUser> OfflineAuth::getUsers() {
+std::vector<OfflineUser> OfflineAuth::getUsers(uint16_t firstId, uint16_t maxCount) {
   std::vector<OfflineUser> users;
+  if (firstId == 0) firstId = 1;
   
-  for (uint8_t i = 1; i <= MAX_USERS; i++) {
-    String userKey = "user_" + String(i);
-    if (preferences.isKey(userKey.c_str())) {
+  for (uint16_t slot = firstId - 1; slot < MAX_USERS && users.size() < maxCount; slot++) {
+    UserColdRecord cold;
+    if (store.isUsed(slot) && store.readCold(slot, cold)) {
       OfflineUser user;
-      preferences.getBytes(userKey.c_str(), &user, sizeof(OfflineUser));
+      composeUser(slot, cold, user);
       users.push_back(user);
     }
   }
@@ -198,7 +806,17 @@ std::vector<OfflineUser> OfflineAuth::getUsers() {
 }
 
 AuthResult OfflineAuth::authenticatePin(const String& pin) {
-  AuthResult result = {false, 0, "", AUTH_PIN};
+  return authenticatePin(pin.c_str(), pin.length());
+}
+
+AuthResult OfflineAuth::authenticatePin(const char* pin, size_t length) {
+  uint8_t pinDigest[DIGEST_LEN];
+  sha256((const uint8_t*)pin, length, pinDigest);
+  return authenticatePinDigest(pinDigest);
+}
+
+AuthResult OfflineAuth::authenticatePinDigest(const uint8_t* pinDigest) {
+  AuthResult result = {false, 0, AUTH_MSG_NONE, AUTH_PIN};
   
   // Remove system lockout check
   // if (isSystemLocked()) {
@@ -206,49 +824,51 @@ AuthResult OfflineAuth::authenticatePin(const String& pin) {
   //   return result;
   // }
   
-  String pinHash = calculateSHA256(pin);
-  std::vector<OfflineUser> users = getUsers();
+  uint16_t slot = findPinSlot(pinDigest);
+  if (slot != CredentialIndex::NO_SLOT) {
+    
+    // Remove user lockout check
+    // if (user.failedAttempts >= MAX_FAILED_ATTEMPTS) {
+    //   result.message = "User locked";
+    //   return result;
+    // }
+    
+    result.success = true;
+    result.userId = slot + 1;
+    result.message = AUTH_MSG_PIN_OK;
+    result.usedMethod = AUTH_PIN;
+    
+    recordSuccess(slot);
+    
+    Serial.println("[AUTH] PIN authentication successful");
+    return result;
+  }
   
-  for (const auto& user : users) {
-    if (!user.isActive) continue;
+  uint16_t index = findImagePin(pinDigest, true);
+  if (index != CredentialImage::NO_USER) {
+    result.success = true;
+    result.userId = IMAGE_USER_BASE + index;
+    result.message = AUTH_MSG_PIN_OK;
+    recordImageSuccess();
     
-    if ((user.authType == AUTH_PIN || user.authType == AUTH_COMBINED) && 
-        String(user.pinHash) == pinHash) {
-      
-      // Remove user lockout check
-      // if (user.failedAttempts >= MAX_FAILED_ATTEMPTS) {
-      //   result.message = "User locked";
-      //   return result;
-      // }
-      
-      result.success = true;
-      result.userId = user.id;
-      result.message = "PIN authenticated";
-      result.usedMethod = AUTH_PIN;
-      
-      // Update last used time and reset failed attempts
-      OfflineUser updatedUser = user;
-      updatedUser.lastUsed = millis();
-      updatedUser.failedAttempts = 0;
-      String userKey = "user_" + String(user.id);
-      preferences.putBytes(userKey.c_str(), &updatedUser, sizeof(OfflineUser));
-      
-      resetFailedAttempts();
-      preferences.putULong("last_auth", millis());
-      
-      Serial.printf("[AUTH] PIN authentication successful for user %s\n", user.name);
-      return result;
-    }
+    Serial.println("[AUTH] PIN authentication successful (image)");
+    return result;
   }
   
   incrementFailedAttempts();
-  result.message = "Invalid PIN";
+  result.message = AUTH_MSG_INVALID_PIN;
   Serial.println("[AUTH] PIN authentication failed");
   return result;
 }
 
 AuthResult OfflineAuth::authenticateNfc(const String& nfcId) {
-  AuthResult result = {false, 0, "", AUTH_NFC};
+  uint8_t uid[MAX_UID_LEN];
+  uint8_t uidLen = UserStore::parseUid(nfcId.c_str(), uid);
+  return authenticateNfc(uid, uidLen);
+}
+
+AuthResult OfflineAuth::authenticateNfc(const uint8_t* uid, uint8_t uidLen) {
+  AuthResult result = {false, 0, AUTH_MSG_NONE, AUTH_NFC};
   
   // Remove system lockout check
   // if (isSystemLocked()) {
@@ -256,48 +876,52 @@ AuthResult OfflineAuth::authenticateNfc(const String& nfcId) {
   //   return result;
   // }
   
-  std::vector<OfflineUser> users = getUsers();
+  if (uidLen > MAX_UID_LEN) uidLen = 0;
+  uint16_t slot = uidLen > 0 ? findNfcSlot(uid, uidLen, true) : CredentialIndex::NO_SLOT;
+  if (slot != CredentialIndex::NO_SLOT) {
+    
+    // Remove user lockout check
+    // if (user.failedAttempts >= MAX_FAILED_ATTEMPTS) {
+    //   result.message = "User locked";
+    //   return result;
+    // }
+    
+    result.success = true;
+    result.userId = slot + 1;
+    result.message = AUTH_MSG_NFC_OK;
+    result.usedMethod = AUTH_NFC;
+    
+    recordSuccess(slot);
+    
+    Serial.println("[AUTH] NFC authentication successful");
+    return result;
+  }
   
-  for (const auto& user : users) {
-    if (!user.isActive) continue;
+  uint16_t index = uidLen > 0 ? findImageNfc(uid, uidLen, true) : CredentialImage::NO_USER;
+  if (index != CredentialImage::NO_USER) {
+    result.success = true;
+    result.userId = IMAGE_USER_BASE + index;
+    result.message = AUTH_MSG_NFC_OK;
+    recordImageSuccess();
     
-    if ((user.authType == AUTH_NFC || user.authType == AUTH_COMBINED) && 
-        String(user.nfcId) == nfcId) {
-      
-      // Remove user lockout check
-      // if (user.failedAttempts >= MAX_FAILED_ATTEMPTS) {
-      //   result.message = "User locked";
-      //   return result;
-      // }
-      
-      result.success = true;
-      result.userId = user.id;
-      result.message = "NFC authenticated";
-      result.usedMethod = AUTH_NFC;
-      
-      // Update last used time
-      OfflineUser updatedUser = user;
-      updatedUser.lastUsed = millis();
-      updatedUser.failedAttempts = 0;
-      String userKey = "user_" + String(user.id);
-      preferences.putBytes(userKey.c_str(), &updatedUser, sizeof(OfflineUser));
-      
-      resetFailedAttempts();
-      preferences.putULong("last_auth", millis());
-      
-      Serial.printf("[AUTH] NFC authentication successful for user %s\n", user.name);
-      return result;
-    }
+    Serial.println("[AUTH] NFC authentication successful (image)");
+    return result;
   }
   
   incrementFailedAttempts();
-  result.message = "Invalid NFC card";
+  result.message = AUTH_MSG_INVALID_NFC;
   Serial.println("[AUTH] NFC authentication failed");
   return result;
 }
 
 AuthResult OfflineAuth::authenticateCombined(const String& pin, const String& nfcId) {
-  AuthResult result = {false, 0, "", AUTH_COMBINED};
+  uint8_t uid[MAX_UID_LEN];
+  uint8_t uidLen = UserStore::parseUid(nfcId.c_str(), uid);
+  return authenticateCombined(pin.c_str(), pin.length(), uid, uidLen);
+}
+
+AuthResult OfflineAuth::authenticateCombined(const char* pin, size_t pinLength, const uint8_t* uid, uint8_t uidLen) {
+  AuthResult result = {false, 0, AUTH_MSG_NONE, AUTH_COMBINED};
   
   // Remove system lockout check
   // if (isSystemLocked()) {
@@ -305,75 +929,96 @@ AuthResult OfflineAuth::authenticateCombined(const String& pin, const String& nf
   //   return result;
   // }
   
-  String pinHash = calculateSHA256(pin);
-  std::vector<OfflineUser> users = getUsers();
+  uint8_t pinDigest[DIGEST_LEN];
+  sha256((const uint8_t*)pin, pinLength, pinDigest);
+  if (uidLen > MAX_UID_LEN) uidLen = 0;
   
-  for (const auto& user : users) {
-    if (!user.isActive || user.authType != AUTH_COMBINED) continue;
+  // The card narrows the candidates to one or two users; the PIN confirms
+  uint16_t slot = CredentialIndex::NO_SLOT;
+  if (uidLen > 0) {
+    slot = nfcIndex.find(CredentialIndex::hashBytes(uid, uidLen), [&](uint16_t candidate) {
+      const UserHotRecord& hot = store.hot(candidate);
+      return hot.isActive() && hot.authType() == AUTH_COMBINED &&
+             hot.nfcUidLen == uidLen &&
+             memcmp(hot.nfcUid, uid, uidLen) == 0 &&
+             memcmp(hot.pinDigest, pinDigest, DIGEST_LEN) == 0;
+    });
+  }
+  
+  if (slot != CredentialIndex::NO_SLOT) {
     
-    if (String(user.pinHash) == pinHash && String(user.nfcId) == nfcId) {
-      
-      // Remove user lockout check
-      // if (user.failedAttempts >= MAX_FAILED_ATTEMPTS) {
-      //   result.message = "User locked";
-      //   return result;
-      // }
-      
-      result.success = true;
-      result.userId = user.id;
-      result.message = "Combined auth successful";
-      result.usedMethod = AUTH_COMBINED;
-      
-      // Update last used time
-      OfflineUser updatedUser = user;
-      updatedUser.lastUsed = millis();
-      updatedUser.failedAttempts = 0;
-      String userKey = "user_" + String(user.id);
-      preferences.putBytes(userKey.c_str(), &updatedUser, sizeof(OfflineUser));
-      
-      resetFailedAttempts();
-      preferences.putULong("last_auth", millis());
-      
-      Serial.printf("[AUTH] Combined authentication successful for user %s\n", user.name);
-      return result;
-    }
+    // Remove user lockout check
+    // if (user.failedAttempts >= MAX_FAILED_ATTEMPTS) {
+    //   result.message = "User locked";
+    //   return result;
+    // }
+    
+    result.success = true;
+    result.userId = slot + 1;
+    result.message = AUTH_MSG_COMBINED_OK;
+    result.usedMethod = AUTH_COMBINED;
+    
+    recordSuccess(slot);
+    
+    Serial.println("[AUTH] Combined authentication successful");
+    return result;
+  }
+  
+  // In the image a card belongs to one user, whose PIN must match too
+  uint16_t index = uidLen > 0 ? findImageNfc(uid, uidLen, true) : CredentialImage::NO_USER;
+  if (index != CredentialImage::NO_USER &&
+      image.user(index)->authType == AUTH_COMBINED &&
+      image.findPin(pinDigest) == index) {
+    result.success = true;
+    result.userId = IMAGE_USER_BASE + index;
+    result.message = AUTH_MSG_COMBINED_OK;
+    recordImageSuccess();
+    
+    Serial.println("[AUTH] Combined authentication successful (image)");
+    return result;
   }
   
   incrementFailedAttempts();
-  result.message = "Invalid credentials";
+  result.message = AUTH_MSG_INVALID_CREDENTIALS;
   Serial.println("[AUTH] Combined authentication failed");
   return result;
 }
 
-bool OfflineAuth::enrollNfcCard(const String& nfcId, uint8_t userId) {
-  OfflineUser user = getUser(userId);
-  if (user.id == 0) {
+bool OfflineAuth::enrollNfcCard(const String& nfcId, uint16_t userId) {
+  if (!isValidUser(userId)) {
     return false;
   }
   
-  strncpy(user.nfcId, nfcId.c_str(), sizeof(user.nfcId) - 1);
-  user.nfcId[sizeof(user.nfcId) - 1] = '\0';
+  UserHotRecord old = store.hot(userId - 1);
+  UserHotRecord hot = old;
+  hot.nfcUidLen = UserStore::parseUid(nfcId.c_str(), hot.nfcUid);
+  if (hot.nfcUidLen == 0) {
+    Serial.printf("[AUTH] Card ID %s is not a UID\n", nfcId.c_str());
+    return false;
+  }
   
-  String userKey = "user_" + String(userId);
-  preferences.putBytes(userKey.c_str(), &user, sizeof(OfflineUser));
+  unindexUser(userId - 1);
+  bool saved = store.writeHot(userId - 1, hot);
+  if (!reindexUser(userId - 1, old) || !saved) {
+    return false;
+  }
   
   Serial.printf("[AUTH] NFC card enrolled for user %d\n", userId);
   return true;
 }
 
 bool OfflineAuth::isNfcCardEnrolled(const String& nfcId) {
-  std::vector<OfflineUser> users = getUsers();
-  
-  for (const auto& user : users) {
-    if (String(user.nfcId) == nfcId) {
-      return true;
-    }
+  uint8_t uid[MAX_UID_LEN];
+  uint8_t uidLen = UserStore::parseUid(nfcId.c_str(), uid);
+  if (uidLen == 0) {
+    return false;
   }
   
-  return false;
+  return findNfcSlot(uid, uidLen, false) != CredentialIndex::NO_SLOT ||
+         findImageNfc(uid, uidLen, false) != CredentialImage::NO_USER;
 }
 
-String OfflineAuth::getNfcEnrollmentData(uint8_t userId) {
+String OfflineAuth::getNfcEnrollmentData(uint16_t userId) {
   OfflineUser user = getUser(userId);
   if (user.id == 0) {
     return "";
@@ -402,12 +1047,12 @@ uint32_t OfflineAuth::getRemainingLockoutTime() {
   return LOCKOUT_TIME - timePassed;
 }
 
-uint8_t OfflineAuth::getUserCount() {
-  return preferences.getUChar("user_count", 0);
+uint16_t OfflineAuth::getUserCount() {
+  return store.count();
 }
 
 uint32_t OfflineAuth::getLastAuthTime() {
-  return preferences.getULong("last_auth", 0);
+  return lastAuthTime;
 }
 
 uint8_t OfflineAuth::getFailedAttempts() {
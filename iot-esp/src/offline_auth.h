@@ -4,55 +4,159 @@
 #include <Preferences.h>
 #include <mbedtls/sha256.h>
 #include <vector>
+#include "credential_image.h"
+#include "credential_index.h"
+#include "pin_hasher.h"
+#include "user_store.h"
 
-// Authentication types
-enum AuthType {
-  AUTH_PIN = 1,
-  AUTH_NFC = 2,
-  AUTH_COMBINED = 3  // PIN + NFC required
+// Maximum enrolled users. The hot table and indexes take ~60 bytes per
+// user, so boards without PSRAM get a smaller default; override with a
+// build flag.
+#ifndef OFFLINE_AUTH_MAX_USERS
+#ifdef BOARD_HAS_PSRAM
+#define OFFLINE_AUTH_MAX_USERS 4096
+#else
+#define OFFLINE_AUTH_MAX_USERS 1024
+#endif
+#endif
+
+// Longest time auth bookkeeping may sit unflushed in RAM, i.e. how much of
+// lastUsed/failedAttempts/lastAuth a power cut can lose
+#ifndef OFFLINE_AUTH_MAX_LOSS_MS
+#define OFFLINE_AUTH_MAX_LOSS_MS 60000
+#endif
+
+// What upsertUser() did with a synced user
+enum UpsertResult {
+  UPSERT_FAILED,
+  UPSERT_ADDED,
+  UPSERT_UPDATED,
+  UPSERT_UNCHANGED
 };
 
-// User structure for offline storage
-struct OfflineUser {
-  uint8_t id;
-  char name[32];
-  char pinHash[65];  // SHA256 hash as hex string
-  char nfcId[33];    // NFC UID as hex string
-  AuthType authType;
-  bool isActive;
-  uint32_t lastUsed;
-  uint8_t failedAttempts;
+// Outcome text for the LCD; an enum so a result never touches the heap
+enum AuthMessage : uint8_t {
+  AUTH_MSG_NONE,
+  AUTH_MSG_PIN_OK,
+  AUTH_MSG_NFC_OK,
+  AUTH_MSG_COMBINED_OK,
+  AUTH_MSG_ONLINE_OK,
+  AUTH_MSG_INVALID_PIN,
+  AUTH_MSG_INVALID_NFC,
+  AUTH_MSG_INVALID_CREDENTIALS
 };
 
+const char* authMessageText(AuthMessage message);
+
 // Authentication result
 struct AuthResult {
   bool success;
-  uint8_t userId;
-  String message;
+  uint16_t userId;
+  AuthMessage message;
   AuthType usedMethod;
 };
 
 class OfflineAuth {
 private:
   Preferences preferences;
-  static const uint8_t MAX_USERS = 10;
+  static const uint16_t MAX_USERS = OFFLINE_AUTH_MAX_USERS;
+  static const uint8_t LEGACY_MAX_USERS = 10;
   static const uint8_t MAX_FAILED_ATTEMPTS = 5;
   static const uint32_t LOCKOUT_TIME = 300000; // 5 minutes in milliseconds
+  static const uint8_t MAX_UID_LEN = UserHotRecord::MAX_UID_LEN;
+  static const uint8_t DIGEST_LEN = 32;
   static const char* NAMESPACE;
   
+  // Hot records live in RAM inside the store; cold records (names and
+  // bookkeeping) are only read after a match.
+  UserStore store;
+  CredentialIndex pinIndex;
+  CredentialIndex nfcIndex;
+  
   // Security settings
   uint32_t lastFailedAttempt;
   uint8_t globalFailedAttempts;
   bool isLockedOut;
+  uint32_t lastAuthTime;
+  
+  // Server revision the local users are synced up to
+  uint32_t syncRevision;
+  
+  // Read-only roster mapped from flash, consulted after the store misses.
+  // Its users get IDs from IMAGE_USER_BASE; users removed by a sync are
+  // revoked by index until the next image replaces the list.
+  static const uint8_t MAX_REVOKED = 64;
+  CredentialImage image;
+  uint16_t revoked[MAX_REVOKED];
+  uint8_t revokedCount;
+  
+  // Write-behind journal: per-user lastUsed/failedAttempts and the global
+  // counters above are kept dirty in RAM and committed together by flush(),
+  // so the unlock path never waits on a flash write.
+  static const uint8_t JOURNAL_SIZE = 32;
+  static const uint32_t IDLE_FLUSH_MS = 5000;
+  struct PendingUse {
+    uint16_t slot;
+    uint32_t lastUsed;
+    uint8_t failedAttempts;
+  };
+  struct __attribute__((packed)) StoredStats {
+    uint8_t failedAttempts;
+    uint32_t lastFailed;
+    uint32_t lastAuth;
+  };
+  PendingUse journal[JOURNAL_SIZE];
+  uint8_t journalCount;
+  bool statsDirty;
+  uint32_t firstDirtyAt;
+  uint32_t lastActivityAt;
+  uint32_t maxLossWindow;
+  bool syncing;
+  
+  // Store slots and image users the running sync has mentioned, so a full
+  // download can tell which synced users the server no longer has
+  uint8_t* syncSeen;
+  uint8_t* imageSeen;
+  uint16_t imageSeenCount;
   
   // Helper functions
-  String calculateSHA256(const String& input);
-  String bytesToHex(const uint8_t* bytes, size_t length);
-  void hexToBytes(const String& hex, uint8_t* bytes);
+  void hexToBytes(const char* hex, uint8_t* bytes);
   bool isSystemLocked();
   void incrementFailedAttempts();
+  void markDirty();
+  void journalUse(uint16_t slot, uint32_t lastUsed, uint8_t failedAttempts);
+  void dropJournal(uint16_t slot);
+  void loadStats();
   
+  // Store and index maintenance
+  void migrateLegacyUsers();
+  void loadUsers();
+  bool indexUser(uint16_t slot);
+  void unindexUser(uint16_t slot);
+  bool reindexUser(uint16_t slot, const UserHotRecord& old);
+  bool isValidUser(uint16_t userId);
+  bool fillRecords(UserHotRecord& hot, UserColdRecord& cold, const String& name, const String& pin, const String& nfcId, AuthType authType);
+  void composeUser(uint16_t slot, const UserColdRecord& cold, OfflineUser& user);
+  void recordSuccess(uint16_t slot);
+  static uint32_t digestHash(const uint8_t* digest);
+  uint16_t findPinSlot(const uint8_t* digest);
+  uint16_t findNfcSlot(const uint8_t* uid, uint8_t uidLen, bool forAuth);
+  
+  // Credential image
+  void loadRevocations();
+  bool isRevoked(uint16_t index);
+  bool revokeImageUser(uint16_t index);
+  uint16_t findImagePin(const uint8_t* digest, bool forAuth);
+  uint16_t findImageNfc(const uint8_t* uid, uint8_t uidLen, bool forAuth);
+  uint16_t findInImage(const UserHotRecord& hot, const UserColdRecord& cold);
+  static void markSeen(uint8_t* seen, uint16_t index);
+  static bool wasSeen(const uint8_t* seen, uint16_t index);
+  void releaseSeen();
+  void recordImageSuccess();
+
 public:
+  static const uint16_t IMAGE_USER_BASE = 0x8000;
+  
   OfflineAuth();
   ~OfflineAuth();
   
@@ -60,33 +164,81 @@ public:
   bool begin();
   void reset(); // Factory reset - clears all users
   
+  // Write-behind persistence. loop() flushes once the oldest dirty entry
+  // reaches the loss window or the door has been idle; call flush() before
+  // any controlled restart.
+  void loop();
+  void flush();
+  void setMaxLossWindow(uint32_t ms) { maxLossWindow = ms; }
+  bool hasPendingWrites() { return journalCount > 0 || statsDirty; }
+  // Time until loop() commits the pending writes; UINT32_MAX when none
+  uint32_t msUntilFlush();
+  
   // User management
   bool addUser(const String& name, const String& pin, const String& nfcId, AuthType authType);
-  bool removeUser(uint8_t userId);
-  bool updateUser(uint8_t userId, const String& name, const String& pin, const String& nfcId, AuthType authType);
-  bool activateUser(uint8_t userId, bool active);
-  std::vector<OfflineUser> getUsers();
-  OfflineUser getUser(uint8_t userId);
+  bool removeUser(uint16_t userId);
+  bool updateUser(uint16_t userId, const String& name, const String& pin, const String& nfcId, AuthType authType);
+  bool activateUser(uint16_t userId, bool active);
+  // Server sync: updates the user with the same PIN (the same card for
+  // card-only users) or adds a new one; an identical user is not rewritten.
+  // Either way the user is marked as synced.
+  UpsertResult upsertUser(const String& name, const String& pin, const String& nfcId, AuthType authType);
+  // Server tombstone: removes the user with that PIN (card for card-only)
+  bool removeSyncedUser(const String& pin, const String& nfcId);
   
-  // Authentication methods
+  // Delta sync. Changes between beginSync() and commitSync() are written
+  // once per touched page; the revision cursor is saved after them, so an
+  // interrupted sync is simply downloaded and applied again. endSync()
+  // writes the changes but keeps the old cursor.
+  void beginSync();
+  // A full download lists every server user: removes the synced users and
+  // revokes the image users it did not mention, then returns how many.
+  // Call before commitSync(); users added on the device are kept.
+  uint16_t pruneUnseenUsers();
+  bool commitSync(uint32_t revision);
+  bool endSync();
+  bool isSyncing() { return syncing; }
+  // With nothing synced yet, the changes since the image was built
+  uint32_t getSyncRevision() { return syncRevision > 0 ? syncRevision : image.revision(); }
+  
+  // Remounts the credential image, e.g. after a new one was installed
+  bool reloadImage();
+  const CredentialImage& getImage() { return image; }
+  uint8_t getRevokedCount() { return revokedCount; }
+  std::vector<OfflineUser> getUsers(uint16_t firstId = 1, uint16_t maxCount = MAX_USERS);
+  OfflineUser getUser(uint16_t userId);
+  // Copies into user, false if there is no such user
+  bool getUser(uint16_t userId, OfflineUser& user);
+  
+  // Authentication methods. The raw forms take the PIN as characters and
+  // the card as UID bytes and never allocate; the String forms wrap them.
+  AuthResult authenticatePin(const char* pin, size_t length);
+  AuthResult authenticatePinDigest(const uint8_t* pinDigest); // from PinHasher
+  AuthResult authenticateNfc(const uint8_t* uid, uint8_t uidLen);
+  AuthResult authenticateCombined(const char* pin, size_t pinLength, const uint8_t* uid, uint8_t uidLen);
   AuthResult authenticatePin(const String& pin);
   AuthResult authenticateNfc(const String& nfcId);
   AuthResult authenticateCombined(const String& pin, const String& nfcId);
   AuthResult authenticate(const String& credential, AuthType method);
   
   // NFC card management (works with Arduino NFC handler)
-  bool enrollNfcCard(const String& nfcId, uint8_t userId);
+  bool enrollNfcCard(const String& nfcId, uint16_t userId);
   bool isNfcCardEnrolled(const String& nfcId);
-  String getNfcEnrollmentData(uint8_t userId); // Get data to write to NFC card via Arduino
+  String getNfcEnrollmentData(uint16_t userId); // Get data to write to NFC card via Arduino
   
   // Security features
-  bool isUserLocked(uint8_t userId);
-  void unlockUser(uint8_t userId);
+  bool isUserLocked(uint16_t userId);
+  void unlockUser(uint16_t userId);
   uint32_t getRemainingLockoutTime();
   void resetFailedAttempts(); // Reset global failed attempt counter
   
+  // Raw SHA-256 into a caller-supplied 32-byte buffer, no heap use
+  static void sha256(const uint8_t* data, size_t length, uint8_t* digest);
+  
   // Statistics
-  uint8_t getUserCount();
+  uint16_t getUserCount();
+  uint16_t getMaxUsers() { return MAX_USERS; }
+  size_t getNvsFreeEntries() { return store.freeEntries(); }
   uint32_t getLastAuthTime();
   uint8_t getFailedAttempts();
 };
@@ -0,0 +1,41 @@
+#include "pin_hasher.h"
+
+PinHasher::PinHasher() {
+  for (uint8_t i = 0; i <= MAX_PIN_LEN; i++) {
+    mbedtls_sha256_init(&levels[i]);
+  }
+  depth = 0;
+  mbedtls_sha256_starts(&levels[0], 0); // 0 for SHA-256
+}
+
+PinHasher::~PinHasher() {
+  for (uint8_t i = 0; i <= MAX_PIN_LEN; i++) {
+    mbedtls_sha256_free(&levels[i]);
+  }
+}
+
+bool PinHasher::push(char digit) {
+  if (depth >= MAX_PIN_LEN) return false;
+  
+  mbedtls_sha256_clone(&levels[depth + 1], &levels[depth]);
+  mbedtls_sha256_update(&levels[depth + 1], (const uint8_t*)&digit, 1);
+  depth++;
+  return true;
+}
+
+void PinHasher::pop() {
+  if (depth > 0) depth--;
+}
+
+void PinHasher::clear() {
+  depth = 0;
+}
+
+void PinHasher::finish(uint8_t* digest) {
+  // Finalize a copy so the typed prefix can still be extended or trimmed
+  mbedtls_sha256_context ctx;
+  mbedtls_sha256_init(&ctx);
+  mbedtls_sha256_clone(&ctx, &levels[depth]);
+  mbedtls_sha256_finish(&ctx, digest);
+  mbedtls_sha256_free(&ctx);
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <Arduino.h>
+#include <mbedtls/sha256.h>
+
+// Incremental SHA-256 of a PIN as it is typed. One hashing context is kept
+// per prefix length: each digit clones the current context and feeds the
+// digit into the copy, so backspace just drops back a level and '#' only
+// has to finalize. On the ESP32 the mbedtls SHA-256 backend runs on the
+// hardware SHA engine. Fixed storage, never allocates.
+class PinHasher {
+public:
+  static const uint8_t MAX_PIN_LEN = 8;
+  static const uint8_t DIGEST_LEN = 32;
+  
+  PinHasher();
+  ~PinHasher();
+  
+  bool push(char digit);
+  void pop();
+  void clear();
+  uint8_t length() const { return depth; }
+  
+  // Writes the digest of the digits pushed so far; the entry stays intact
+  void finish(uint8_t* digest);
+
+private:
+  mbedtls_sha256_context levels[MAX_PIN_LEN + 1];
+  uint8_t depth;
+};
@@ -0,0 +1,131 @@
+#include "power_manager.h"
+#include <esp_timer.h>
+
+PowerManager powerManager;
+
+PowerManager::PowerManager() : wakeAt(0) {
+  task = nullptr;
+  cpuLock = nullptr;
+  scaling = POWER_SCALING_NONE;
+  low = false;
+  lastWakeMs = 0;
+  waitUs = 0;
+  lowUs = 0;
+  wakes = 0;
+  lowEntries = 0;
+  lowWakes = 0;
+  wakeUsTotal = 0;
+  maxWakeUs = 0;
+}
+
+void PowerManager::begin() {
+  task = xTaskGetCurrentTaskHandle();
+  lastWakeMs = millis();
+
+#if ESP_IDF_VERSION_MAJOR >= 5
+  esp_pm_config_t config = {};
+#else
+  esp_pm_config_esp32_t config = {};
+#endif
+  config.max_freq_mhz = POWER_ACTIVE_CPU_MHZ;
+  config.min_freq_mhz = POWER_IDLE_CPU_MHZ;
+  // Waking from light sleep on a row needs level-triggered GPIO wakeup,
+  // which would replace the edge interrupts the keypad scanner arms
+  config.light_sleep_enable = false;
+  if (esp_pm_configure(&config) == ESP_OK &&
+      esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "door", &cpuLock) == ESP_OK) {
+    esp_pm_lock_acquire(cpuLock);
+    scaling = POWER_SCALING_PM;
+    Serial.printf("[POWER] Frequency scaling %d-%d MHz\n", POWER_IDLE_CPU_MHZ, POWER_ACTIVE_CPU_MHZ);
+  } else {
+    // Built without CONFIG_PM_ENABLE
+    scaling = POWER_SCALING_MANUAL;
+    Serial.println("[POWER] No esp_pm; setting the CPU clock directly");
+  }
+}
+
+void PowerManager::stamp(uint32_t atUs) {
+  uint32_t none = 0;
+  wakeAt.compare_exchange_strong(none, atUs ? atUs : 1);
+}
+
+void PowerManager::wake() {
+  if (!task) return;
+  stamp((uint32_t)esp_timer_get_time());
+  xTaskNotifyGive(task);
+}
+
+void IRAM_ATTR PowerManager::wakeFromISR(uint32_t atUs, BaseType_t* woken) {
+  if (!task) return;
+  stamp(atUs);
+  vTaskNotifyGiveFromISR(task, woken);
+}
+
+void PowerManager::idle(uint32_t maxMs) {
+  if (!task) return;
+  if (maxMs > POWER_MAX_WAIT_MS) maxMs = POWER_MAX_WAIT_MS;
+  
+  if (!low && millis() - lastWakeMs >= POWER_LOW_AFTER_MS) {
+    // A wake from the pass that just ran is not a wake from the low clock
+    if (ulTaskNotifyTake(pdTRUE, 0) > 0) {
+      woke();
+      return;
+    }
+    enterLow();
+  }
+  
+  uint32_t startUs = (uint32_t)esp_timer_get_time();
+  uint32_t notified = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(maxMs));
+  uint32_t waited = (uint32_t)esp_timer_get_time() - startUs;
+  waitUs += waited;
+  if (low) lowUs += waited;
+  if (notified == 0) return;  // the timer; stays low
+  
+  if (low) {
+    leaveLow();
+    uint32_t at = wakeAt.load();
+    uint32_t latencyUs = at ? (uint32_t)esp_timer_get_time() - at : 0;
+    lowWakes++;
+    wakeUsTotal += latencyUs;
+    if (latencyUs > maxWakeUs) maxWakeUs = latencyUs;
+  }
+  woke();
+}
+
+void PowerManager::woke() {
+  wakeAt.store(0);
+  wakes++;
+  lastWakeMs = millis();
+}
+
+void PowerManager::enterLow() {
+  if (scaling == POWER_SCALING_PM) {
+    esp_pm_lock_release(cpuLock);
+  } else {
+    setCpuFrequencyMhz(POWER_IDLE_CPU_MHZ);
+  }
+  low = true;
+  lowEntries++;
+}
+
+void PowerManager::leaveLow() {
+  if (scaling == POWER_SCALING_PM) {
+    esp_pm_lock_acquire(cpuLock);
+  } else {
+    setCpuFrequencyMhz(POWER_ACTIVE_CPU_MHZ);
+  }
+  low = false;
+}
+
+PowerStats PowerManager::stats() const {
+  PowerStats result;
+  result.wakes = wakes;
+  result.lowEntries = lowEntries;
+  result.waitMs = (uint32_t)(waitUs / 1000);
+  result.lowMs = (uint32_t)(lowUs / 1000);
+  result.lowWakes = lowWakes;
+  result.wakeUsTotal = wakeUsTotal;
+  result.maxWakeUs = maxWakeUs;
+  result.scaling = scaling;
+  return result;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <Arduino.h>
+#include <esp_pm.h>
+#include <esp_idf_version.h>
+#include <atomic>
+
+// Quiet time after the last wake before the door task lets the clock drop
+#ifndef POWER_LOW_AFTER_MS
+#define POWER_LOW_AFTER_MS 2000
+#endif
+
+// CPU clock while the door is quiet; 80 MHz keeps the APB clock, so the
+// UARTs and I2C run at their usual rates
+#ifndef POWER_IDLE_CPU_MHZ
+#define POWER_IDLE_CPU_MHZ 80
+#endif
+#ifndef POWER_ACTIVE_CPU_MHZ
+#define POWER_ACTIVE_CPU_MHZ 240
+#endif
+
+// Longest wait with nothing to wake it, so housekeeping still runs
+#ifndef POWER_MAX_WAIT_MS
+#define POWER_MAX_WAIT_MS 1000
+#endif
+
+enum PowerScaling : uint8_t {
+  POWER_SCALING_NONE,  // begin() not called
+  POWER_SCALING_PM,    // esp_pm frequency scaling with a CPU lock
+  POWER_SCALING_MANUAL // setCpuFrequencyMhz(), for builds without esp_pm
+};
+
+struct PowerStats {
+  uint32_t wakes;       // wake() calls that ended a wait
+  uint32_t lowEntries;  // times the clock was let drop
+  uint32_t waitMs;      // loop() blocked in idle()
+  uint32_t lowMs;       // of which at the low clock
+  uint32_t lowWakes;    // wakes at the low clock
+  uint32_t wakeUsTotal; // wake() to the door task running at full clock
+  uint32_t maxWakeUs;
+  PowerScaling scaling;
+};
+
+// Lets the door task sleep instead of spinning loop(). When a pass has
+// nothing to do, idle() blocks on a task notification until a key edge, a
+// byte on Serial2, an event from the network task or the next scheduler
+// timer. Everything that hands the door task work calls wake() afterwards,
+// and a notification that comes before the wait makes it return at once,
+// so nothing is missed. After POWER_LOW_AFTER_MS without a wake the door
+// task gives up its esp_pm CPU lock and the clock drops to
+// POWER_IDLE_CPU_MHZ; the first wake takes it back before the pass runs.
+class PowerManager {
+public:
+  PowerManager();
+  
+  // Door task, from setup()
+  void begin();
+  
+  // Any task
+  void wake();
+  // Row interrupts; atUs is when the edge came
+  void IRAM_ATTR wakeFromISR(uint32_t atUs, BaseType_t* woken);
+  
+  // Door task: waits up to maxMs (capped at POWER_MAX_WAIT_MS) for wake()
+  void idle(uint32_t maxMs);
+  bool isLow() const { return low; }
+  // Time spent blocked so far
+  uint64_t waitedUs() const { return waitUs; }
+  
+  PowerStats stats() const;
+
+private:
+  TaskHandle_t task;
+  esp_pm_lock_handle_t cpuLock;
+  PowerScaling scaling;
+  bool low;
+  uint32_t lastWakeMs;
+  std::atomic<uint32_t> wakeAt;  // esp_timer time of the first wake(), 0 = none
+  
+  uint64_t waitUs;
+  uint64_t lowUs;
+  uint32_t wakes;
+  uint32_t lowEntries;
+  uint32_t lowWakes;
+  uint32_t wakeUsTotal;
+  uint32_t maxWakeUs;
+  
+  void stamp(uint32_t atUs);
+  void woke();
+  void enterLow();
+  void leaveLow();
+};
+
+extern PowerManager powerManager;
@@ -0,0 +1,84 @@
+#include "scheduler.h"
+
+Scheduler scheduler;
+
+Scheduler::Scheduler() {
+  for (uint8_t i = 0; i < MAX_TASKS; i++) {
+    entries[i].task = nullptr;
+  }
+}
+
+bool Scheduler::after(uint32_t delayMs, Task task) {
+  return schedule(delayMs, 0, task);
+}
+
+bool Scheduler::every(uint32_t periodMs, Task task) {
+  return schedule(periodMs, periodMs, task);
+}
+
+bool Scheduler::schedule(uint32_t delayMs, uint32_t periodMs, Task task) {
+  Entry* slot = nullptr;
+  for (uint8_t i = 0; i < MAX_TASKS; i++) {
+    if (entries[i].task == task) {
+      slot = &entries[i];
+      break;
+    }
+    if (!slot && !entries[i].task) slot = &entries[i];
+  }
+  if (!slot) {
+    Serial.println("[SCHED] Task table full");
+    return false;
+  }
+  
+  slot->task = task;
+  slot->due = millis() + delayMs;
+  slot->period = periodMs;
+  return true;
+}
+
+bool Scheduler::cancel(Task task) {
+  for (uint8_t i = 0; i < MAX_TASKS; i++) {
+    if (entries[i].task == task) {
+      entries[i].task = nullptr;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool Scheduler::isPending(Task task) const {
+  for (uint8_t i = 0; i < MAX_TASKS; i++) {
+    if (entries[i].task == task) return true;
+  }
+  return false;
+}
+
+uint32_t Scheduler::msUntilNext() const {
+  uint32_t next = UINT32_MAX;
+  uint32_t now = millis();
+  for (uint8_t i = 0; i < MAX_TASKS; i++) {
+    if (!entries[i].task) continue;
+    int32_t left = (int32_t)(entries[i].due - now);
+    if (left <= 0) return 0;
+    if ((uint32_t)left < next) next = left;
+  }
+  return next;
+}
+
+void Scheduler::run() {
+  for (uint8_t i = 0; i < MAX_TASKS; i++) {
+    Task task = entries[i].task;
+    if (!task || (int32_t)(millis() - entries[i].due) < 0) continue;
+    
+    // Update the entry before running: the task may re-arm or cancel itself
+    if (entries[i].period > 0) {
+      entries[i].due += entries[i].period;
+      if ((int32_t)(millis() - entries[i].due) >= 0) {
+        entries[i].due = millis() + entries[i].period; // skip missed periods
+      }
+    } else {
+      entries[i].task = nullptr;
+    }
+    task();
+  }
+}
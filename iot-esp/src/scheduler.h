@@ -0,0 +1,42 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Cooperative timer scheduler for the main loop. Screens that used to
+// delay() before going back to the PIN prompt schedule the next step
+// instead, so the keypad, Serial2 and MQTT keep being serviced. Tasks are
+// plain functions kept in a fixed table; run() calls the due ones.
+class Scheduler {
+public:
+  typedef void (*Task)();
+  static const uint8_t MAX_TASKS = 16;
+  
+  Scheduler();
+  
+  // One-shot task. A task that is already pending is re-armed rather than
+  // queued twice, so a newer screen simply pushes its timeout back.
+  bool after(uint32_t delayMs, Task task);
+  // Periodic task, first run one period from now
+  bool every(uint32_t periodMs, Task task);
+  // Returns true if the task was pending
+  bool cancel(Task task);
+  bool isPending(Task task) const;
+  
+  // Call from loop(); runs every task that is due
+  void run();
+  // Time until the next task is due, 0 if one is; UINT32_MAX when idle
+  uint32_t msUntilNext() const;
+
+private:
+  struct Entry {
+    Task task;
+    uint32_t due;
+    uint32_t period; // 0 = one-shot
+  };
+  
+  Entry entries[MAX_TASKS];
+  
+  bool schedule(uint32_t delayMs, uint32_t periodMs, Task task);
+};
+
+extern Scheduler scheduler;
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+
+// Bounded lock-free single-producer/single-consumer ring buffer. Exactly one
+// task may push and one other task may pop; neither ever blocks. Capacity
+// must be a power of two, and one slot is kept free to tell full from empty.
+template <typename T, uint16_t Capacity>
+class SpscQueue {
+  static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+  SpscQueue() : head(0), tail(0) {}
+  
+  // Producer side. Returns false (and drops the item) when full.
+  bool push(const T& item) {
+    uint16_t h = head.load(std::memory_order_relaxed);
+    uint16_t next = (h + 1) & (Capacity - 1);
+    if (next == tail.load(std::memory_order_acquire)) return false;
+    
+    items[h] = item;
+    head.store(next, std::memory_order_release);
+    return true;
+  }
+  
+  // Consumer side. Returns false when empty.
+  bool pop(T& item) {
+    uint16_t t = tail.load(std::memory_order_relaxed);
+    if (t == head.load(std::memory_order_acquire)) return false;
+    
+    item = std::move(items[t]);
+    tail.store((t + 1) & (Capacity - 1), std::memory_order_release);
+    return true;
+  }
+  
+  bool empty() const {
+    return tail.load(std::memory_order_acquire) == head.load(std::memory_order_acquire);
+  }
+
+private:
+  T items[Capacity];
+  std::atomic<uint16_t> head; // written by the producer only
+  std::atomic<uint16_t> tail; // written by the consumer only
+};
@@ -0,0 +1,357 @@
+#include "user_store.h"
+
+const char* UserStore::NAMESPACE = "auth_users";
+const char* UserStore::PARTITION = "authdb";
+
+// Users per "pg_<n>" blob in schema 2
+static const uint8_t V2_PER_PAGE = 16;
+
+UserStore::UserStore() {
+  slotMap = nullptr;
+  hotTable = nullptr;
+  slots = 0;
+  used = 0;
+  cachedColdPage = -1;
+  coldDirty = false;
+  batching = false;
+  dirtyHotPages = nullptr;
+  slotMapDirty = false;
+}
+
+UserStore::~UserStore() {
+  prefs.end();
+  free(slotMap);
+  free(hotTable);
+  free(dirtyHotPages);
+}
+
+bool UserStore::begin(uint16_t capacity) {
+  // Prefer the dedicated partition; small boards fall back to the default NVS
+  if (!prefs.begin(NAMESPACE, false, PARTITION)) {
+    Serial.println("[STORE] No authdb partition, using default NVS");
+    if (!prefs.begin(NAMESPACE, false)) {
+      Serial.println("[STORE] Failed to open user store");
+      return false;
+    }
+  }
+  
+  slots = capacity;
+  size_t tableSize = (size_t)pageCount() * RECORDS_PER_PAGE * sizeof(UserHotRecord);
+  free(slotMap);
+  free(hotTable);
+  free(dirtyHotPages);
+  slotMap = (uint32_t*)calloc(1, mapBytes());
+  dirtyHotPages = (uint32_t*)calloc((pageCount() + 31) / 32, sizeof(uint32_t));
+  hotTable = nullptr;
+#ifdef BOARD_HAS_PSRAM
+  if (psramFound()) hotTable = (UserHotRecord*)ps_calloc(1, tableSize);
+#endif
+  if (!hotTable) hotTable = (UserHotRecord*)calloc(1, tableSize);
+  if (!slotMap || !hotTable || !dirtyHotPages) {
+    Serial.println("[STORE] Failed to allocate user tables");
+    return false;
+  }
+  cachedColdPage = -1;
+  
+  uint8_t schema = prefs.getUChar("schema", 0);
+  if (schema == 0) {
+    clear();
+  } else if (schema == 2) {
+    prefs.getBytes("slot_map", slotMap, mapBytes());
+    if (!migrateFromV2()) {
+      return false;
+    }
+  } else if (schema == SCHEMA_VERSION) {
+    // Left behind when a migration lost power after bumping the schema
+    removeV2Pages();
+    prefs.getBytes("slot_map", slotMap, mapBytes());
+    char key[16];
+    for (uint16_t pageNo = 0; pageNo < pageCount(); pageNo++) {
+      snprintf(key, sizeof(key), "h_%u", pageNo);
+      if (prefs.isKey(key)) {
+        prefs.getBytes(key, &hotTable[pageNo * RECORDS_PER_PAGE],
+                       RECORDS_PER_PAGE * sizeof(UserHotRecord));
+      }
+    }
+  } else {
+    // Written by newer firmware; refuse rather than wipe the users
+    Serial.printf("[STORE] Unknown schema %d\n", schema);
+    return false;
+  }
+  
+  used = 0;
+  for (uint16_t slot = 0; slot < slots; slot++) {
+    if (isUsed(slot)) used++;
+  }
+  
+  Serial.printf("[STORE] %u/%u user slots in use\n", used, slots);
+  return true;
+}
+
+bool UserStore::migrateFromV2() {
+  // Schema 2 packed the whole user (hex PIN hash, hex UID, name) into one
+  // record, 16 per "pg_<n>" blob. Split each page into hot and cold records;
+  // the schema is bumped before any pg_ key goes, so a run interrupted
+  // before that restarts and one interrupted after only finishes the cleanup.
+  struct StoredUserV2 {
+    uint16_t id;
+    char name[32];
+    char pinHash[65];
+    char nfcId[33];
+    AuthType authType;
+    bool isActive;
+    uint32_t lastUsed;
+    uint8_t failedAttempts;
+  };
+  StoredUserV2* v2Page = (StoredUserV2*)malloc(V2_PER_PAGE * sizeof(StoredUserV2));
+  if (!v2Page) {
+    Serial.println("[STORE] Out of memory for migration");
+    return false;
+  }
+  
+  char key[16];
+  uint16_t migrated = 0;
+  for (uint16_t v2PageNo = 0; v2PageNo * V2_PER_PAGE < slots; v2PageNo++) {
+    snprintf(key, sizeof(key), "pg_%u", v2PageNo);
+    if (!prefs.isKey(key)) continue;
+    prefs.getBytes(key, v2Page, V2_PER_PAGE * sizeof(StoredUserV2));
+    
+    for (uint8_t i = 0; i < V2_PER_PAGE; i++) {
+      uint16_t slot = v2PageNo * V2_PER_PAGE + i;
+      if (!isUsed(slot)) continue;
+      const StoredUserV2& old = v2Page[i];
+      
+      UserHotRecord& hot = hotTable[slot];
+      memset(&hot, 0, sizeof(UserHotRecord));
+      bool hasPin = strlen(old.pinHash) == 64;
+      for (uint8_t b = 0; hasPin && b < 32; b++) {
+        char byteString[3] = {old.pinHash[b * 2], old.pinHash[b * 2 + 1], '\0'};
+        hot.pinDigest[b] = (uint8_t)strtol(byteString, NULL, 16);
+      }
+      hot.nfcUidLen = parseUid(old.nfcId, hot.nfcUid);
+      if (hot.nfcUidLen == 0 && old.nfcId[0] != '\0') {
+        Serial.printf("[STORE] User %u: card ID %s is not a UID, dropped\n", slot + 1, old.nfcId);
+      }
+      hot.setFlags(old.authType, old.isActive, hasPin);
+      
+      // A V2 page always falls inside a single cold page
+      if (loadColdPage(slot / RECORDS_PER_PAGE)) {
+        UserColdRecord& cold = coldPage[slot % RECORDS_PER_PAGE];
+        memcpy(cold.name, old.name, sizeof(cold.name));
+        cold.lastUsed = old.lastUsed;
+        cold.failedAttempts = old.failedAttempts;
+      }
+      migrated++;
+    }
+    saveColdPage();
+  }
+  free(v2Page);
+  
+  for (uint16_t pageNo = 0; pageNo < pageCount(); pageNo++) {
+    saveHotPage(pageNo);
+  }
+  prefs.putUChar("schema", SCHEMA_VERSION);
+  removeV2Pages();
+  
+  Serial.printf("[STORE] Migrated %u users to schema %d\n", migrated, SCHEMA_VERSION);
+  return true;
+}
+
+void UserStore::removeV2Pages() {
+  char key[16];
+  for (uint16_t v2PageNo = 0; v2PageNo * V2_PER_PAGE < slots; v2PageNo++) {
+    snprintf(key, sizeof(key), "pg_%u", v2PageNo);
+    if (prefs.isKey(key)) prefs.remove(key);
+  }
+}
+
+void UserStore::clear() {
+  prefs.clear();
+  prefs.putUChar("schema", SCHEMA_VERSION);
+  memset(slotMap, 0, mapBytes());
+  memset(hotTable, 0, (size_t)pageCount() * RECORDS_PER_PAGE * sizeof(UserHotRecord));
+  saveSlotMap();
+  used = 0;
+  cachedColdPage = -1;
+  coldDirty = false;
+}
+
+uint16_t UserStore::findFreeSlot() const {
+  // Word-at-a-time scan: at most capacity/32 compares
+  uint16_t words = (slots + 31) / 32;
+  for (uint16_t w = 0; w < words; w++) {
+    if (slotMap[w] == 0xFFFFFFFF) continue;
+    uint16_t slot = w * 32 + __builtin_ctz(~slotMap[w]);
+    return slot < slots ? slot : NO_SLOT;
+  }
+  return NO_SLOT;
+}
+
+bool UserStore::isUsed(uint16_t slot) const {
+  return slot < slots && (slotMap[slot / 32] & (1UL << (slot % 32)));
+}
+
+void UserStore::setUsed(uint16_t slot, bool inUse) {
+  if (inUse) {
+    slotMap[slot / 32] |= (1UL << (slot % 32));
+  } else {
+    slotMap[slot / 32] &= ~(1UL << (slot % 32));
+  }
+}
+
+void UserStore::saveSlotMap() {
+  if (batching) {
+    slotMapDirty = true;
+    return;
+  }
+  prefs.putBytes("slot_map", slotMap, mapBytes());
+}
+
+bool UserStore::saveHotPage(uint16_t pageNo) {
+  if (batching) {
+    dirtyHotPages[pageNo / 32] |= 1UL << (pageNo % 32);
+    return true;
+  }
+  
+  // The RAM table is laid out page by page, so a page is a plain slice
+  char key[16];
+  snprintf(key, sizeof(key), "h_%u", pageNo);
+  size_t size = RECORDS_PER_PAGE * sizeof(UserHotRecord);
+  return prefs.putBytes(key, &hotTable[pageNo * RECORDS_PER_PAGE], size) == size;
+}
+
+bool UserStore::loadColdPage(uint16_t pageNo) {
+  if (cachedColdPage == pageNo) return true;
+  if (!commitCold()) return false;
+
+  char key[16];
+  snprintf(key, sizeof(key), "c_%u", pageNo);
+  memset(coldPage, 0, sizeof(coldPage));
+  if (prefs.isKey(key)) {
+    prefs.getBytes(key, coldPage, sizeof(coldPage));
+  }
+  cachedColdPage = pageNo;
+  return true;
+}
+
+bool UserStore::saveColdPage() {
+  if (cachedColdPage < 0) return false;
+
+  char key[16];
+  snprintf(key, sizeof(key), "c_%u", (unsigned)cachedColdPage);
+  coldDirty = false;
+  if (prefs.putBytes(key, coldPage, sizeof(coldPage)) != sizeof(coldPage)) {
+    cachedColdPage = -1;
+    return false;
+  }
+  return true;
+}
+
+bool UserStore::commitCold() {
+  return !coldDirty || saveColdPage();
+}
+
+bool UserStore::commitBatch() {
+  batching = false;
+  bool ok = commitCold();
+  
+  for (uint16_t pageNo = 0; pageNo < pageCount(); pageNo++) {
+    uint32_t bit = 1UL << (pageNo % 32);
+    if (dirtyHotPages[pageNo / 32] & bit) {
+      dirtyHotPages[pageNo / 32] &= ~bit;
+      ok = saveHotPage(pageNo) && ok;
+    }
+  }
+  
+  // The bitmap goes last, so a cut mid-commit never marks a slot used
+  // whose records were not written
+  if (slotMapDirty) {
+    slotMapDirty = false;
+    saveSlotMap();
+  }
+  return ok;
+}
+
+bool UserStore::add(uint16_t slot, const UserHotRecord& hot, const UserColdRecord& cold) {
+  if (slot >= slots) return false;
+  
+  if (!writeCold(slot, cold) || !writeHot(slot, hot)) {
+    return false;
+  }
+  
+  if (!isUsed(slot)) {
+    setUsed(slot, true);
+    used++;
+    saveSlotMap();
+  }
+  return true;
+}
+
+bool UserStore::writeHot(uint16_t slot, const UserHotRecord& hot) {
+  if (slot >= slots) return false;
+  
+  hotTable[slot] = hot;
+  return saveHotPage(slot / RECORDS_PER_PAGE);
+}
+
+bool UserStore::readCold(uint16_t slot, UserColdRecord& cold) {
+  if (!isUsed(slot) || !loadColdPage(slot / RECORDS_PER_PAGE)) return false;
+  
+  cold = coldPage[slot % RECORDS_PER_PAGE];
+  return true;
+}
+
+bool UserStore::writeCold(uint16_t slot, const UserColdRecord& cold, bool commit) {
+  if (slot >= slots || !loadColdPage(slot / RECORDS_PER_PAGE)) return false;
+
+  coldPage[slot % RECORDS_PER_PAGE] = cold;
+  coldDirty = true;
+  return !commit || batching || saveColdPage();
+}
+
+bool UserStore::erase(uint16_t slot) {
+  if (!isUsed(slot)) return false;
+  
+  setUsed(slot, false);
+  used--;
+  saveSlotMap();
+  
+  // Scrub the records so the PIN digest does not linger in flash
+  UserHotRecord emptyHot;
+  memset(&emptyHot, 0, sizeof(UserHotRecord));
+  writeHot(slot, emptyHot);
+  if (loadColdPage(slot / RECORDS_PER_PAGE)) {
+    memset(&coldPage[slot % RECORDS_PER_PAGE], 0, sizeof(UserColdRecord));
+    coldDirty = true;
+    if (!batching) saveColdPage();
+  }
+  return true;
+}
+
+uint8_t UserStore::parseUid(const char* nfcId, uint8_t* uid) {
+  // UIDs arrive from the Arduino as hex; compare them as raw bytes so case
+  // does not matter. Anything else, or a UID longer than MAX_UID_LEN, is
+  // rejected with 0 rather than truncated into another card's UID.
+  size_t length = strlen(nfcId);
+  if (length == 0 || length % 2 != 0 || length / 2 > UserHotRecord::MAX_UID_LEN) {
+    return 0;
+  }
+  for (size_t i = 0; i < length; i++) {
+    if (!isxdigit((unsigned char)nfcId[i])) return 0;
+  }
+  
+  for (size_t i = 0; i < length; i += 2) {
+    char byteString[3] = {nfcId[i], nfcId[i + 1], '\0'};
+    uid[i / 2] = (uint8_t)strtol(byteString, NULL, 16);
+  }
+  return length / 2;
+}
+
+void UserStore::formatUid(const uint8_t* uid, uint8_t length, char* out) {
+  static const char digits[] = "0123456789ABCDEF";
+  for (uint8_t i = 0; i < length; i++) {
+    out[i * 2] = digits[uid[i] >> 4];
+    out[i * 2 + 1] = digits[uid[i] & 0x0F];
+  }
+  out[length * 2] = '\0';
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <Arduino.h>
+#include <Preferences.h>
+
+// Authentication types
+enum AuthType {
+  AUTH_PIN = 1,
+  AUTH_NFC = 2,
+  AUTH_COMBINED = 3  // PIN + NFC required
+};
+
+// User structure returned to callers; assembled from the hot and cold records
+struct OfflineUser {
+  uint16_t id;
+  char name[32];
+  char nfcId[21];    // NFC UID as hex string
+  AuthType authType;
+  bool isActive;
+  uint32_t lastUsed;
+  uint8_t failedAttempts;
+};
+
+// Matching data for one user (44 bytes). The whole hot table is kept in RAM
+// so authentication compares raw digests and UIDs without touching flash.
+struct __attribute__((packed)) UserHotRecord {
+  static const uint8_t MAX_UID_LEN = 10;  // ISO 14443 UIDs are 4, 7 or 10 bytes
+  
+  uint8_t pinDigest[32];  // raw SHA-256 of the PIN
+  uint8_t nfcUidLen;
+  uint8_t nfcUid[MAX_UID_LEN];
+  uint8_t flags;          // bits 0-1 authType, bit 2 active, bit 3 has PIN, bit 4 from a sync
+  
+  AuthType authType() const { return (AuthType)(flags & 0x03); }
+  bool isActive() const { return flags & 0x04; }
+  bool hasPin() const { return flags & 0x08; }
+  bool isSynced() const { return flags & 0x10; }
+  // Keeps the sync bit
+  void setFlags(AuthType type, bool active, bool pin) {
+    flags = (flags & 0x10) | (type & 0x03) | (active ? 0x04 : 0) | (pin ? 0x08 : 0);
+  }
+  void setSynced(bool synced) { flags = synced ? flags | 0x10 : flags & ~0x10; }
+};
+
+// Display and bookkeeping data (40 bytes), only read after a match, for
+// the LCD welcome message and the admin listing.
+struct __attribute__((packed)) UserColdRecord {
+  char name[32];
+  uint32_t lastUsed;
+  uint8_t failedAttempts;
+  uint8_t reserved[3];
+};
+
+// Paged user record store. Hot and cold records are packed
+// RECORDS_PER_PAGE to an NVS blob ("h_<n>" / "c_<n>"), and a persisted
+// bitmap tracks which slots are in use, so add/remove/update touch one page
+// and the bitmap regardless of how many users are enrolled. Uses the
+// dedicated "authdb" NVS partition when the partition table has one.
+class UserStore {
+public:
+  static const uint16_t NO_SLOT = 0xFFFF;
+  static const uint8_t RECORDS_PER_PAGE = 32;
+  static const uint8_t SCHEMA_VERSION = 3;
+  
+  UserStore();
+  ~UserStore();
+  
+  // Loads the hot table into RAM and migrates older schemas
+  bool begin(uint16_t capacity);
+  void clear();
+  
+  // Finds a free slot in the bitmap; the slot is claimed by add()
+  uint16_t findFreeSlot() const;
+  bool add(uint16_t slot, const UserHotRecord& hot, const UserColdRecord& cold);
+  bool erase(uint16_t slot);
+  
+  const UserHotRecord& hot(uint16_t slot) const { return hotTable[slot]; }
+  bool writeHot(uint16_t slot, const UserHotRecord& hot);
+  bool readCold(uint16_t slot, UserColdRecord& cold);
+  // With commit = false the change stays in the cached cold page until
+  // commitCold() or until another page is loaded, batching page writes
+  bool writeCold(uint16_t slot, const UserColdRecord& cold, bool commit = true);
+  bool commitCold();
+  
+  // Between beginBatch() and commitBatch() page and bitmap writes only mark
+  // them dirty; commitBatch() then writes each touched page once
+  void beginBatch() { batching = true; }
+  bool commitBatch();
+  
+  bool isUsed(uint16_t slot) const;
+  uint16_t count() const { return used; }
+  uint16_t capacity() const { return slots; }
+  // Free entries left in the store's NVS partition
+  size_t freeEntries() { return prefs.freeEntries(); }
+  
+  // Parses a hex UID string from the Arduino into bytes; 0 when it is not
+  // hex or does not fit in MAX_UID_LEN
+  static uint8_t parseUid(const char* nfcId, uint8_t* uid);
+  static void formatUid(const uint8_t* uid, uint8_t length, char* out);
+
+private:
+  static const char* NAMESPACE;
+  static const char* PARTITION;
+  
+  Preferences prefs;
+  uint32_t* slotMap;
+  UserHotRecord* hotTable;
+  uint16_t slots;
+  uint16_t used;
+  
+  // One cold page is cached so listing and bookkeeping hit RAM
+  UserColdRecord coldPage[RECORDS_PER_PAGE];
+  int32_t cachedColdPage;
+  bool coldDirty;
+  
+  // Batch state: one bit per hot page, plus the slot bitmap
+  bool batching;
+  uint32_t* dirtyHotPages;
+  bool slotMapDirty;
+  
+  bool loadColdPage(uint16_t pageNo);
+  bool saveHotPage(uint16_t pageNo);
+  bool saveColdPage();
+  void setUsed(uint16_t slot, bool inUse);
+  void saveSlotMap();
+  uint16_t pageCount() const { return (slots + RECORDS_PER_PAGE - 1) / RECORDS_PER_PAGE; }
+  size_t mapBytes() const { return ((slots + 31) / 32) * sizeof(uint32_t); }
+  bool migrateFromV2();
+  void removeV2Pages();
+};
@@ -0,0 +1,159 @@
+#include "user_sync.h"
+
+enum SyncField : uint8_t {
+  FIELD_NONE,
+  FIELD_REVISION,  // top-level keys
+  FIELD_FULL,
+  FIELD_USERS,
+  FIELD_REMOVED,
+  FIELD_NAME,      // keys inside an entry
+  FIELD_PIN,
+  FIELD_NFC,
+  FIELD_AUTH_TYPE
+};
+
+// Levels inside {"users":[{...}]}
+static const uint8_t TOP_DEPTH = 1;
+static const uint8_t USERS_DEPTH = 2;
+static const uint8_t USER_DEPTH = 3;
+
+UserSyncStream::UserSyncStream(UserHandler handler)
+  : parser(onToken, this), handler(handler) {
+  begin();
+}
+
+void UserSyncStream::begin() {
+  parser.reset();
+  listOp = SYNC_UPSERT;
+  inList = false;
+  inUser = false;
+  field = FIELD_NONE;
+  memset(&report, 0, sizeof(report));
+  startedAt = millis();
+  startFreeHeap = ESP.getFreeHeap();
+  minFreeHeap = startFreeHeap;
+}
+
+SyncReport UserSyncStream::finish() {
+  sampleHeap();
+  report.bytes = parser.bytesParsed();
+  report.elapsedMs = millis() - startedAt;
+  report.peakHeapUse = startFreeHeap - minFreeHeap;
+  report.parsed = parser.complete();
+  return report;
+}
+
+size_t UserSyncStream::write(uint8_t c) {
+  return parser.feed((char)c) ? 1 : 0;
+}
+
+size_t UserSyncStream::write(const uint8_t* buffer, size_t size) {
+  // Called once per network chunk, a cheap point to watch the heap
+  sampleHeap();
+  return parser.feed(buffer, size) ? size : 0;
+}
+
+void UserSyncStream::sampleHeap() {
+  uint32_t freeHeap = ESP.getFreeHeap();
+  if (freeHeap < minFreeHeap) {
+    minFreeHeap = freeHeap;
+  }
+}
+
+void UserSyncStream::onToken(void* context, JsonStreamParser::Event event, const char* text, uint8_t depth) {
+  static_cast<UserSyncStream*>(context)->handleToken(event, text, depth);
+}
+
+static void copyField(char* dest, size_t size, const char* text) {
+  strncpy(dest, text, size - 1);
+  dest[size - 1] = '\0';
+}
+
+void UserSyncStream::handleToken(JsonStreamParser::Event event, const char* text, uint8_t depth) {
+  if (!inList) {
+    if (depth != TOP_DEPTH && depth != USERS_DEPTH) return;
+    
+    switch (event) {
+      case JsonStreamParser::JSON_KEY:
+        if (depth != TOP_DEPTH) break;
+        if (strcmp(text, "revision") == 0) field = FIELD_REVISION;
+        else if (strcmp(text, "full") == 0) field = FIELD_FULL;
+        else if (strcmp(text, "users") == 0) field = FIELD_USERS;
+        else if (strcmp(text, "removed") == 0) field = FIELD_REMOVED;
+        else field = FIELD_NONE;
+        break;
+      
+      case JsonStreamParser::JSON_NUMBER:
+        if (depth == TOP_DEPTH && field == FIELD_REVISION) {
+          report.revision = strtoul(text, nullptr, 10);
+        }
+        break;
+      
+      case JsonStreamParser::JSON_LITERAL:
+        if (depth == TOP_DEPTH && field == FIELD_FULL) {
+          report.full = strcmp(text, "true") == 0;
+        }
+        break;
+      
+      case JsonStreamParser::JSON_ARRAY_START:
+        if (depth == USERS_DEPTH && (field == FIELD_USERS || field == FIELD_REMOVED)) {
+          listOp = field == FIELD_USERS ? SYNC_UPSERT : SYNC_REMOVE;
+          inList = true;
+        }
+        break;
+      
+      default:
+        break;
+    }
+    return;
+  }
+  
+  if (!inUser) {
+    if (event == JsonStreamParser::JSON_OBJECT_START && depth == USER_DEPTH) {
+      memset(&current, 0, sizeof(current));
+      current.op = listOp;
+      inUser = true;
+      field = FIELD_NONE;
+    } else if (event == JsonStreamParser::JSON_ARRAY_END && depth == USERS_DEPTH) {
+      inList = false;
+      field = FIELD_NONE;
+    }
+    return;
+  }
+  
+  // Anything nested deeper inside a user is skipped
+  if (depth != USER_DEPTH) return;
+  
+  switch (event) {
+    case JsonStreamParser::JSON_KEY:
+      if (strcmp(text, "name") == 0) field = FIELD_NAME;
+      else if (strcmp(text, "pin") == 0) field = FIELD_PIN;
+      else if (strcmp(text, "nfc") == 0) field = FIELD_NFC;
+      else if (strcmp(text, "authType") == 0) field = FIELD_AUTH_TYPE;
+      else field = FIELD_NONE;
+      break;
+    
+    case JsonStreamParser::JSON_STRING:
+    case JsonStreamParser::JSON_NUMBER:
+      switch (field) {
+        case FIELD_NAME: copyField(current.name, sizeof(current.name), text); break;
+        case FIELD_PIN: copyField(current.pin, sizeof(current.pin), text); break;
+        case FIELD_NFC: copyField(current.nfc, sizeof(current.nfc), text); break;
+        case FIELD_AUTH_TYPE: current.authType = atoi(text); break;
+        default: break;
+      }
+      field = FIELD_NONE;
+      break;
+    
+    case JsonStreamParser::JSON_OBJECT_END:
+      inUser = false;
+      report.users++;
+      handler(current);
+      break;
+    
+    default:
+      // null and booleans leave the field empty
+      field = FIELD_NONE;
+      break;
+  }
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <Arduino.h>
+#include "json_stream.h"
+
+enum SyncOp : uint8_t {
+  SYNC_UPSERT,  // added or changed on the server
+  SYNC_REMOVE,  // deleted on the server; pin/nfc identify the user
+  SYNC_COMMIT   // end of a complete download; revision is the new cursor
+};
+
+// One change from /api/users/changes
+struct SyncUser {
+  SyncOp op;
+  char name[32];
+  char pin[9];
+  char nfc[21];
+  uint8_t authType;
+  uint32_t revision;
+  bool full;  // SYNC_COMMIT: the download was the whole roster
+};
+
+// Parse statistics for one download
+struct SyncReport {
+  uint32_t users;        // upserts and removals
+  uint32_t bytes;
+  uint32_t elapsedMs;
+  uint32_t peakHeapUse;  // largest drop in free heap while streaming
+  uint32_t revision;     // server revision the download brings us to
+  bool full;             // the server sent every user, not a delta
+  bool parsed;           // the whole document was valid JSON
+};
+
+// Stream sink for the /api/users/changes body,
+// {"revision":42,"full":false,
+//  "removed":[{"pin":"1234","nfc":""},...],
+//  "users":[{"name":"John","pin":"1234","nfc":"abc123","authType":1},...]}.
+// The HTTP client writes the body into it chunk by chunk and every
+// complete entry is handed to the callback straight away, so the roster is
+// never held in RAM.
+class UserSyncStream : public Stream {
+public:
+  typedef void (*UserHandler)(const SyncUser& user);
+  
+  explicit UserSyncStream(UserHandler handler);
+  
+  void begin();
+  SyncReport finish();
+  
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t* buffer, size_t size) override;
+  
+  // Write-only
+  int available() override { return 0; }
+  int read() override { return -1; }
+  int peek() override { return -1; }
+
+private:
+  JsonStreamParser parser;
+  UserHandler handler;
+  
+  SyncUser current;
+  SyncOp listOp;
+  bool inList;
+  bool inUser;
+  uint8_t field;
+  SyncReport report;
+  uint32_t startedAt;
+  uint32_t startFreeHeap;
+  uint32_t minFreeHeap;
+  
+  static void onToken(void* context, JsonStreamParser::Event event, const char* text, uint8_t depth);
+  void handleToken(JsonStreamParser::Event event, const char* text, uint8_t depth);
+  void sampleHeap();
+};
@@ -0,0 +1,100 @@
+#include "verdict_cache.h"
+
+VerdictCache verdictCache;
+
+VerdictCache::VerdictCache() {
+  grantTtl = VERDICT_CACHE_GRANT_TTL_MS;
+  denyTtl = VERDICT_CACHE_DENY_TTL_MS;
+  memset(&cacheStats, 0, sizeof(cacheStats));
+  clear();
+}
+
+void VerdictCache::setTtl(uint32_t grantMs, uint32_t denyMs) {
+  grantTtl = grantMs;
+  denyTtl = denyMs;
+}
+
+bool VerdictCache::lookup(uint8_t kind, const uint8_t* digest, bool& granted) {
+  int index = find(kind, digest);
+  if (index < 0) {
+    cacheStats.misses++;
+    return false;
+  }
+  
+  Entry& entry = entries[index];
+  uint32_t now = millis();
+  if (isExpired(entry, now)) {
+    entry.used = false;
+    cacheStats.expired++;
+    cacheStats.misses++;
+    return false;
+  }
+  
+  entry.lastHit = now;
+  granted = entry.granted;
+  cacheStats.hits++;
+  return true;
+}
+
+void VerdictCache::store(uint8_t kind, const uint8_t* digest, bool granted, uint32_t ttlMs) {
+  uint32_t now = millis();
+  int index = find(kind, digest);
+  
+  if (index < 0) {
+    // Free or expired slot first, otherwise the least recently used one
+    uint8_t victim = 0;
+    bool victimLive = true;
+    for (uint8_t i = 0; i < CAPACITY; i++) {
+      const Entry& entry = entries[i];
+      if (!entry.used || isExpired(entry, now)) {
+        victim = i;
+        victimLive = false;
+        break;
+      }
+      if (now - entry.lastHit > now - entries[victim].lastHit) {
+        victim = i;
+      }
+    }
+    if (victimLive) cacheStats.evictions++;
+    index = victim;
+  }
+  
+  Entry& entry = entries[index];
+  memcpy(entry.digest, digest, DIGEST_LEN);
+  entry.kind = kind;
+  entry.used = true;
+  entry.granted = granted;
+  entry.storedAt = now;
+  entry.lastHit = now;
+  uint32_t limit = granted ? grantTtl : denyTtl;
+  entry.ttl = ttlMs < limit ? ttlMs : limit;
+}
+
+void VerdictCache::clear() {
+  for (uint8_t i = 0; i < CAPACITY; i++) {
+    entries[i].used = false;
+  }
+}
+
+uint8_t VerdictCache::size() const {
+  uint32_t now = millis();
+  uint8_t count = 0;
+  for (uint8_t i = 0; i < CAPACITY; i++) {
+    if (entries[i].used && !isExpired(entries[i], now)) count++;
+  }
+  return count;
+}
+
+int VerdictCache::find(uint8_t kind, const uint8_t* digest) const {
+  for (uint8_t i = 0; i < CAPACITY; i++) {
+    const Entry& entry = entries[i];
+    if (entry.used && entry.kind == kind && memcmp(entry.digest, digest, DIGEST_LEN) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+bool VerdictCache::isExpired(const Entry& entry, uint32_t now) const {
+  return now - entry.storedAt >= entry.ttl;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Number of online verdicts remembered
+#ifndef VERDICT_CACHE_SIZE
+#define VERDICT_CACHE_SIZE 16
+#endif
+
+// Longest a server grant / denial is trusted without asking again; the
+// backend may allow less, or no caching at all
+#ifndef VERDICT_CACHE_GRANT_TTL_MS
+#define VERDICT_CACHE_GRANT_TTL_MS 600000
+#endif
+#ifndef VERDICT_CACHE_DENY_TTL_MS
+#define VERDICT_CACHE_DENY_TTL_MS 60000
+#endif
+
+struct VerdictCacheStats {
+  uint32_t hits;
+  uint32_t misses;
+  uint32_t expired;    // entries found but past their TTL
+  uint32_t evictions;  // live entries pushed out by a newer verdict
+};
+
+// Small RAM cache of verdicts from /api/unlock for credentials the local
+// store does not know (guest codes, unknown cards). Entries are keyed by
+// credential kind and SHA-256 digest, expire after a per-verdict TTL and
+// are evicted least recently used first. Nothing is persisted: a reboot or
+// an admin change to the users starts from empty.
+class VerdictCache {
+public:
+  static const uint8_t DIGEST_LEN = 32;
+  
+  VerdictCache();
+  
+  void setTtl(uint32_t grantMs, uint32_t denyMs);
+  
+  // Returns true on a live entry and sets granted
+  bool lookup(uint8_t kind, const uint8_t* digest, bool& granted);
+  // Kept for ttlMs, at most the grant or deny TTL
+  void store(uint8_t kind, const uint8_t* digest, bool granted, uint32_t ttlMs);
+  void clear();
+  
+  uint8_t size() const;
+  const VerdictCacheStats& stats() const { return cacheStats; }
+
+private:
+  static const uint8_t CAPACITY = VERDICT_CACHE_SIZE;
+  
+  struct Entry {
+    uint8_t digest[DIGEST_LEN];
+    uint8_t kind;
+    bool used;
+    bool granted;
+    uint32_t storedAt;
+    uint32_t lastHit;
+    uint32_t ttl;
+  };
+  
+  Entry entries[CAPACITY];
+  uint32_t grantTtl;
+  uint32_t denyTtl;
+  VerdictCacheStats cacheStats;
+  
+  int find(uint8_t kind, const uint8_t* digest) const;
+  bool isExpired(const Entry& entry, uint32_t now) const;
+};
+
+extern VerdictCache verdictCache;
@@ -0,0 +1,351 @@
+// Microbenchmarks for OfflineAuth on the host build. Each operation is run
+// against stores of 10, 100, 1k and 10k users and reported as ns/op, heap
+// allocations/op and simulated NVS reads/writes per op.
+//
+//   bench_offline_auth [--sizes 10,100,1000,10000] [--min-ms 200]
+//                      [--nvs-read-ns N] [--nvs-write-ns N] [--csv] [--quick]
+//
+// --nvs-*-ns charge every simulated flash operation that much time, so
+// changes that trade RAM work for flash traffic show up in ns/op too.
+// --quick is the smoke run used by ctest. Any lookup that should succeed
+// and does not fails the run, as does an authentication that allocates.
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+#include "host_counters.h"
+#include "credential_index.h"
+#include "offline_auth.h"
+
+struct BenchResult {
+  std::string name;
+  uint32_t users;
+  uint64_t ops;
+  double nsPerOp;
+  double allocsPerOp;
+  double readsPerOp;
+  double writesPerOp;
+};
+
+struct BenchUser {
+  String name;
+  String pin;
+  String nfc;
+  AuthType type;
+  uint8_t uid[UserHotRecord::MAX_UID_LEN];
+  uint8_t uidLen;
+};
+
+static uint32_t minTimeMs = 200;
+static bool failed = false;
+static std::vector<BenchResult> results;
+
+static uint64_t nowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void record(const char* name, uint32_t users, uint64_t ops, uint64_t elapsedNs, const HostCounterSnapshot& used) {
+  BenchResult result;
+  result.name = name;
+  result.users = users;
+  result.ops = ops;
+  result.nsPerOp = (double)elapsedNs / ops;
+  result.allocsPerOp = (double)used.allocations / ops;
+  result.readsPerOp = (double)used.flashReads / ops;
+  result.writesPerOp = (double)(used.flashWrites + used.flashErases) / ops;
+  results.push_back(result);
+}
+
+// Runs op(i) until both minOps calls and the minimum time are done
+static void measure(const char* name, uint32_t users, uint64_t minOps, const std::function<void(uint64_t)>& op) {
+  op(0);  // warm up caches and lazily loaded pages
+  
+  HostCounterSnapshot start = snapshotHostCounters();
+  uint64_t startNs = nowNs();
+  uint64_t deadline = startNs + (uint64_t)minTimeMs * 1000000;
+  uint64_t ops = 0;
+  uint64_t now = startNs;
+  while (ops < minOps || now < deadline) {
+    op(ops++);
+    if ((ops & 15) == 0) now = nowNs();
+  }
+  now = nowNs();
+  record(name, users, ops, now - startNs, snapshotHostCounters() - start);
+}
+
+static void expect(bool condition, const char* what, uint32_t users) {
+  if (!condition && !failed) {
+    fprintf(stderr, "FAILED: %s at %u users\n", what, users);
+    failed = true;
+  }
+}
+
+// The door authenticates for weeks on end; any heap use there fragments
+static void expectNoAllocations(uint32_t users) {
+  const BenchResult& last = results.back();
+  if (hostAllocationsCounted()) {
+    expect(last.allocsPerOp == 0, last.name.c_str(), users);
+  }
+}
+
+// Unique credentials for user i; types rotate PIN, NFC, PIN+NFC
+static BenchUser makeUser(uint32_t i) {
+  BenchUser user;
+  char buffer[24];
+  snprintf(buffer, sizeof(buffer), "user%u", i);
+  user.name = buffer;
+  user.type = (AuthType)(AUTH_PIN + i % 3);
+  if (user.type != AUTH_NFC) {
+    snprintf(buffer, sizeof(buffer), "%u", 100000 + i);
+    user.pin = buffer;
+  }
+  if (user.type != AUTH_PIN) {
+    // Multiplying by an odd constant is a bijection, so UIDs are unique
+    snprintf(buffer, sizeof(buffer), "%08X", (unsigned)(i * 2654435761u));
+    user.nfc = buffer;
+  }
+  user.uidLen = UserStore::parseUid(user.nfc.c_str(), user.uid);
+  return user;
+}
+
+static void runSize(uint32_t size) {
+  Preferences::eraseAll();
+  OfflineAuth* auth = new OfflineAuth();
+  auth->begin();
+  
+  std::vector<BenchUser> users;
+  std::vector<uint32_t> pinUsers;
+  std::vector<uint32_t> nfcUsers;
+  std::vector<uint32_t> combinedUsers;
+  for (uint32_t i = 0; i < size; i++) {
+    users.push_back(makeUser(i));
+    expect(auth->addUser(users[i].name, users[i].pin, users[i].nfc, users[i].type), "populate", size);
+    if (users[i].type == AUTH_PIN) pinUsers.push_back(i);
+    if (users[i].type == AUTH_NFC) nfcUsers.push_back(i);
+    if (users[i].type == AUTH_COMBINED) combinedUsers.push_back(i);
+  }
+  auth->flush();
+  
+  // Lookups cycle through the users so every index bucket gets visited
+  uint64_t lookups = size * 2 > 1000 ? size * 2 : 1000;
+  
+  measure("authenticatePin", size, lookups, [&](uint64_t i) {
+    const BenchUser& user = users[pinUsers[i % pinUsers.size()]];
+    expect(auth->authenticatePin(user.pin).success, "authenticatePin", size);
+  });
+  expectNoAllocations(size);
+  
+  measure("authenticatePin (raw)", size, lookups, [&](uint64_t i) {
+    const BenchUser& user = users[pinUsers[i % pinUsers.size()]];
+    expect(auth->authenticatePin(user.pin.c_str(), user.pin.length()).success, "authenticatePin raw", size);
+  });
+  expectNoAllocations(size);
+  
+  const String unknownPin("99999999");
+  measure("authenticatePin (miss)", size, lookups, [&](uint64_t) {
+    expect(!auth->authenticatePin(unknownPin).success, "authenticatePin miss", size);
+  });
+  expectNoAllocations(size);
+  
+  measure("authenticateNfc", size, lookups, [&](uint64_t i) {
+    const BenchUser& user = users[nfcUsers[i % nfcUsers.size()]];
+    expect(auth->authenticateNfc(user.nfc).success, "authenticateNfc", size);
+  });
+  expectNoAllocations(size);
+  
+  measure("authenticateNfc (raw)", size, lookups, [&](uint64_t i) {
+    const BenchUser& user = users[nfcUsers[i % nfcUsers.size()]];
+    expect(auth->authenticateNfc(user.uid, user.uidLen).success, "authenticateNfc raw", size);
+  });
+  expectNoAllocations(size);
+  
+  const uint8_t unknownUid[4] = {0xDE, 0xAD, 0xBE, 0xEF};
+  measure("authenticateNfc (miss)", size, lookups, [&](uint64_t) {
+    expect(!auth->authenticateNfc(unknownUid, sizeof(unknownUid)).success, "authenticateNfc miss", size);
+  });
+  expectNoAllocations(size);
+  
+  measure("authenticateCombined", size, lookups, [&](uint64_t i) {
+    const BenchUser& user = users[combinedUsers[i % combinedUsers.size()]];
+    expect(auth->authenticateCombined(user.pin, user.nfc).success, "authenticateCombined", size);
+  });
+  expectNoAllocations(size);
+  
+  measure("authenticateCombined (raw)", size, lookups, [&](uint64_t i) {
+    const BenchUser& user = users[combinedUsers[i % combinedUsers.size()]];
+    expect(auth->authenticateCombined(user.pin.c_str(), user.pin.length(), user.uid, user.uidLen).success,
+           "authenticateCombined raw", size);
+  });
+  expectNoAllocations(size);
+  
+  measure("getUser", size, lookups, [&](uint64_t i) {
+    OfflineUser user;
+    expect(auth->getUser(1 + i % size, user), "getUser", size);
+  });
+  
+  measure("isNfcCardEnrolled", size, lookups, [&](uint64_t i) {
+    const BenchUser& user = users[nfcUsers[i % nfcUsers.size()]];
+    expect(auth->isNfcCardEnrolled(user.nfc), "isNfcCardEnrolled", size);
+  });
+  
+  // The admin listing pages 20 users at a time
+  measure("getUsers (page of 20)", size, 100, [&](uint64_t i) {
+    uint16_t first = 1 + (i * 20) % (size + 1);
+    auth->getUsers(first, 20);
+  });
+  
+  measure("getUsers (all)", size, 3, [&](uint64_t) {
+    expect(auth->getUsers().size() == size + 1, "getUsers", size);
+  });
+  
+  // Adds on top of the populated store, then removes them again untimed
+  uint32_t extra = 100;
+  std::vector<BenchUser> added;
+  for (uint32_t i = 0; i < extra; i++) {
+    added.push_back(makeUser(size + i));
+  }
+  HostCounterSnapshot start = snapshotHostCounters();
+  uint64_t startNs = nowNs();
+  for (const BenchUser& user : added) {
+    expect(auth->addUser(user.name, user.pin, user.nfc, user.type), "addUser", size);
+  }
+  uint64_t elapsed = nowNs() - startNs;
+  record("addUser", size, extra, elapsed, snapshotHostCounters() - start);
+  for (uint32_t i = 0; i < extra; i++) {
+    auth->removeUser(size + 2 + i);
+  }
+  
+  // Enough adds and removes to fill the indexes with tombstones several
+  // times over; each user must be found right after it is added, and the
+  // populated users must all still be found at the end
+  uint32_t churn = auth->getMaxUsers() * 2;
+  for (uint32_t i = 0; i < churn; i++) {
+    const BenchUser& user = added[i % extra];
+    expect(auth->addUser(user.name, user.pin, user.nfc, user.type), "churn addUser", size);
+    if (user.type == AUTH_PIN) {
+      expect(auth->authenticatePin(user.pin).success, "churn authenticatePin", size);
+    } else if (user.type == AUTH_NFC) {
+      expect(auth->authenticateNfc(user.nfc).success, "churn authenticateNfc", size);
+    }
+    auth->removeUser(size + 2);
+  }
+  for (uint32_t i = 0; i < size; i++) {
+    const BenchUser& user = users[i];
+    bool found = user.type == AUTH_NFC ? auth->authenticateNfc(user.nfc).success
+                                       : auth->authenticatePin(user.pin).success;
+    expect(found, "authenticate after churn", size);
+  }
+  
+  // Card IDs that are not hex, or longer than a UID, are refused rather
+  // than truncated into some other card's UID
+  expect(!auth->addUser("Bad", "", "ZZ", AUTH_NFC), "reject non-hex UID", size);
+  expect(!auth->addUser("Bad", "", "00112233445566778899AA", AUTH_NFC), "reject long UID", size);
+  expect(!auth->enrollNfcCard("ABC", 1), "reject odd UID", size);
+  expect(!auth->authenticateNfc("5A5A").success, "no raw UID match", size);
+  
+  delete auth;
+}
+
+// Random inserts and removes on a small index whose keys all crowd into
+// eight home buckets, checked against a plain set after every step. Runs
+// through many compactions, and a slot they lose shows up at once.
+static void checkIndexChurn() {
+  CredentialIndex index;
+  index.begin(64);
+  bool live[48] = {};
+  uint32_t count = 0;
+  uint32_t seed = 1;
+  auto hashOf = [](uint16_t slot) { return (uint32_t)((slot % 8) | (slot / 8) << 6) << 16; };
+  
+  for (uint32_t step = 0; step < 20000; step++) {
+    seed = seed * 1103515245 + 12345;
+    uint16_t slot = (seed >> 16) % 48;
+    if (live[slot]) {
+      expect(index.remove(hashOf(slot), slot), "index remove", 0);
+      live[slot] = false;
+      count--;
+    } else if (count < 40) {
+      expect(index.insert(hashOf(slot), slot), "index insert", 0);
+      live[slot] = true;
+      count++;
+    }
+    for (uint16_t other = 0; other < 48; other++) {
+      uint16_t found = index.find(hashOf(other), [&](uint16_t candidate) { return candidate == other; });
+      expect((found == other) == live[other], "index find", 0);
+    }
+  }
+  expect(index.size() == count, "index size", 0);
+}
+
+static std::vector<uint32_t> parseSizes(const char* list) {
+  std::vector<uint32_t> sizes;
+  const char* at = list;
+  while (*at) {
+    sizes.push_back(strtoul(at, (char**)&at, 10));
+    if (*at == ',') at++;
+    else if (*at) break;
+  }
+  return sizes;
+}
+
+int main(int argc, char** argv) {
+  std::vector<uint32_t> sizes = {10, 100, 1000, 10000};
+  NvsLatency latency = {0, 0, 0};
+  bool csv = false;
+  
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (arg == "--sizes" && hasValue) sizes = parseSizes(argv[++i]);
+    else if (arg == "--min-ms" && hasValue) minTimeMs = atoi(argv[++i]);
+    else if (arg == "--nvs-read-ns" && hasValue) latency.readNs = atoi(argv[++i]);
+    else if (arg == "--nvs-write-ns" && hasValue) latency.writeNs = latency.eraseNs = atoi(argv[++i]);
+    else if (arg == "--csv") csv = true;
+    else if (arg == "--quick") {
+      sizes = {10, 100};
+      minTimeMs = 5;
+    } else {
+      fprintf(stderr, "usage: %s [--sizes 10,100,1000,10000] [--min-ms 200] "
+                      "[--nvs-read-ns N] [--nvs-write-ns N] [--csv] [--quick]\n", argv[0]);
+      return 2;
+    }
+  }
+  
+  for (uint32_t size : sizes) {
+    if (size < 3 || size + 101 > OFFLINE_AUTH_MAX_USERS) {
+      fprintf(stderr, "Size %u outside 3..%u\n", size, OFFLINE_AUTH_MAX_USERS - 101);
+      return 2;
+    }
+  }
+  
+  Serial.setMuted(true);
+  checkIndexChurn();
+  Preferences::setLatency(latency);
+  for (uint32_t size : sizes) {
+    runSize(size);
+  }
+  
+  if (csv) {
+    printf("operation,users,ops,ns_per_op,allocs_per_op,flash_reads_per_op,flash_writes_per_op\n");
+    for (const BenchResult& r : results) {
+      printf("%s,%u,%llu,%.1f,%.2f,%.3f,%.3f\n", r.name.c_str(), r.users, (unsigned long long)r.ops,
+             r.nsPerOp, r.allocsPerOp, r.readsPerOp, r.writesPerOp);
+    }
+  } else {
+    printf("%-28s %7s %10s %12s %10s %10s %10s\n", "operation", "users", "ops", "ns/op", "allocs/op", "flash rd", "flash wr");
+    for (const BenchResult& r : results) {
+      printf("%-28s %7u %10llu %12.1f %10.2f %10.3f %10.3f\n", r.name.c_str(), r.users, (unsigned long long)r.ops,
+             r.nsPerOp, r.allocsPerOp, r.readsPerOp, r.writesPerOp);
+    }
+    if (!hostAllocationsCounted()) {
+      printf("(allocations are not counted with this C library)\n");
+    }
+  }
+  
+  fflush(stdout);
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,657 @@
+// Load generator for the door firmware running in DoorSim. A queue of
+// people walks up one after another: each types a PIN (a synced user's, a
+// wrong one, or a one-off code only the server knows) or taps a card, and
+// the next one steps up a moment after the door has answered. Admin MQTT
+// traffic arrives in the background. The report gives time from the
+// final input (the '#' press, the card tap) to SERVO:90 or to the denied
+// screen, events the door lost, and how long passes of loop() took.
+//
+//   door_load [--people 1000] [--users 500] [--mix 55,30,10,5] [--seed 1]
+//             [--key-ms 150] [--hold-ms 80] [--gap-ms 400] [--timeout-ms 5000]
+//             [--mqtt-per-min 6] [--rtt-ms 40] [--loop-us 50]
+//             [--nvs-read-us 20] [--nvs-write-us 1000] [--stall-ms 20]
+//             [--link-corrupt N] [--text-link] [--arduino-stall START,MS]
+//             [--outage-s START,LENGTH] [--remove N] [--log FILE] [--record FILE] [--check] [--quick]
+//
+// --link-corrupt N spoils every Nth frame the door sends the Arduino, so
+// commands only get through by retransmission; --text-link plays an old
+// Arduino that never agrees to frames. --arduino-stall makes the Arduino
+// deaf for MS milliseconds from the first frame the door sends START
+// seconds into the load; the door has to get it back on frames without
+// dropping to a rate the Arduino is not on. --outage-s takes WiFi away START
+// seconds into the load for LENGTH seconds; online codes tried around then
+// may get either answer. --remove N deletes users on the backend before
+// the load: N reach the door as tombstones in a delta sync, then N more are
+// left out of a full sync after the server's history is reset, and the door
+// has to drop them itself. People holding their PINs and cards are then
+// expected to be denied. Now and then someone types an online code that
+// was already used, which the backend must refuse.
+// --record saves the firmware's input trace of the run (from the end of the
+// initial sync) for door_replay.
+// --mix is the percentage of synced PINs, cards, wrong PINs and online
+// codes. --check fails the run if anyone got no answer or the wrong one,
+// if the audit log has not all reached the backend once the load is over,
+// if the PIN and card events published do not match the people served, if
+// either end of Serial2 sent at a rate the other was not on, if
+// a removed user is still on the door after its sync, if
+// the backend was asked to open the door for anyone but the online codes
+// (local grants are only verified), or if a key pressed while the door was at the low clock took more than 20 ms
+// to reach the LCD. With --gap-ms of several seconds the door drops its
+// clock between people; the Power line estimates the current from the time
+// spent running, waiting and at the low clock. The Memory line counts heap
+// allocations per person by subsystem, as tagged by MemoryScope.
+// Everything runs on the virtual clock, so a seed always gives the same run.
+
+#include <Arduino.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include "arduino_link.h"
+#include "audit_log.h"
+#include "door_sim.h"
+#include "fake_backend.h"
+#include "histogram.h"
+#include "input_trace.h"
+#include "keypad_scanner.h"
+#include "latency_trace.h"
+#include "lcd_frame.h"
+#include "memory_telemetry.h"
+#include "mqtt_outbox.h"
+#include "power_manager.h"
+#include "offline_auth.h"
+#include "roster.h"
+#include "trace_file.h"
+
+enum PersonKind : uint8_t {
+  PERSON_PIN,
+  PERSON_CARD,
+  PERSON_WRONG_PIN,
+  PERSON_ONLINE,
+  PERSON_KINDS
+};
+
+static const char* KIND_NAMES[PERSON_KINDS] = {"PIN", "card", "wrong PIN", "online code"};
+
+struct LoadOptions {
+  uint32_t people = 1000;
+  uint32_t users = 500;
+  uint32_t codes = 20;
+  uint32_t mix[PERSON_KINDS] = {55, 30, 10, 5};
+  uint32_t seed = 1;
+  uint32_t keyMs = 150;
+  uint32_t holdMs = 80;
+  uint32_t gapMs = 400;
+  uint32_t timeoutMs = 5000;
+  double mqttPerMin = 6;
+  uint32_t outageStartS = 0;
+  uint32_t outageS = 0;
+  uint32_t arduinoStallStartS = 0;
+  uint32_t arduinoStallMs = 0;
+  uint32_t remove = 0;
+  bool check = false;
+};
+
+struct Person {
+  PersonKind kind;
+  bool expectGrant;
+  bool eitherVerdict;  // an online code tried around an outage
+  uint32_t code;       // online code typed
+  bool freshCode;      // not tried before
+  uint64_t startUs;
+  uint64_t submitUs;  // the '#' press or the card tap
+  bool fromLow;       // the door was at the low clock when the first key went down
+  bool shown;         // the first key has reached the screen
+};
+
+// Whole-chip current with WiFi associated in modem sleep, from the ESP32
+// datasheet's modem-sleep ranges; an estimate until measured on the board
+static const double RUNNING_MA = 50;      // 240 MHz, the door task running
+static const double WAITING_MA = 30;      // 240 MHz, the door task blocked
+static const double LOW_CLOCK_MA = 20;    // 80 MHz, the door task blocked
+// A key pressed at the low clock to its '*' on the LCD
+static const uint64_t WAKE_BUDGET_US = 20000;
+
+struct KindStats {
+  Histogram answered;
+  uint32_t granted = 0;
+  uint32_t denied = 0;
+  uint32_t wrong = 0;
+  uint32_t unanswered = 0;
+};
+
+static bool parseMix(const char* text, uint32_t* mix) {
+  uint32_t total = 0;
+  for (uint8_t i = 0; i < PERSON_KINDS; i++) {
+    char* end;
+    mix[i] = strtoul(text, &end, 10);
+    total += mix[i];
+    if (i + 1 < PERSON_KINDS && *end != ',') return false;
+    text = end + 1;
+  }
+  return total > 0;
+}
+
+class LoadRun {
+public:
+  LoadRun(DoorSim& sim, FakeBackend& backend, const LoadOptions& options)
+    : sim(sim), backend(backend), options(options), random(options.seed) {}
+  
+  bool waitForSync(uint64_t limitUs);
+  // Deletes 2 * options.remove users on the backend and syncs them away,
+  // by tombstones and then by a full roster
+  void removeUsers(uint64_t limitUs);
+  void run();
+  // Runs on until the audit log and the MQTT outbox are empty or limitUs
+  // passes
+  void drain(uint64_t limitUs);
+  void report(double hostSeconds);
+  bool passed() const;
+
+private:
+  DoorSim& sim;
+  FakeBackend& backend;
+  const LoadOptions& options;
+  std::mt19937 random;
+  std::vector<DoorOutput> outputs;
+  
+  bool active = false;
+  Person person;
+  uint32_t started = 0;
+  uint64_t nextPersonUs = 0;
+  uint64_t nextMqttUs = 0;
+  uint64_t syncedAtUs = 0;
+  uint64_t loadStartUs = 0;
+  uint32_t strayOpens = 0;
+  uint32_t published = 0;
+  uint32_t eventLines = 0;  // PINs and card UIDs in mytopic/pin and mytopic/rfid
+  uint32_t removed = 0;       // roster users below this index are gone
+  uint32_t removedByDelta = 0;
+  bool removalsSynced = true;
+  uint32_t nextCode = 0;
+  std::vector<uint32_t> usedCodes;  // granted once, so the backend has used them up
+  bool wifiDown = false;
+  uint64_t auditDrainedUs = 0;
+  uint64_t waitedAtStartUs = 0;
+  PowerStats powerAtStart;
+  uint32_t allocsAtStart[MEM_SUBSYSTEMS];
+  Histogram firstKey;  // a key pressed at the low clock to its '*' on the LCD
+  KindStats stats[PERSON_KINDS];
+  
+  bool doorHasRemoved() const;
+  PersonKind pickKind();
+  void startPerson(uint64_t atUs);
+  void typePin(uint64_t atUs, const std::string& pin);
+  void scheduleMqtt();
+  void handleOutputs();
+  void finishPerson(bool granted, uint64_t atUs);
+  uint64_t outageStartUs() const { return loadStartUs + (uint64_t)options.outageStartS * 1000000; }
+  uint64_t outageEndUs() const { return outageStartUs() + (uint64_t)options.outageS * 1000000; }
+  void updateWifi(uint64_t now);
+};
+
+bool LoadRun::waitForSync(uint64_t limitUs) {
+  while (sim.nowUs() < limitUs) {
+    sim.step();
+    sim.takeOutputs(outputs);
+    if (offlineAuth.getSyncRevision() == backend.revision() && !offlineAuth.isSyncing()) {
+      if (syncedAtUs == 0) syncedAtUs = sim.nowUs();
+      return true;
+    }
+  }
+  return false;
+}
+
+// Whether the door still lists a roster user that was removed
+bool LoadRun::doorHasRemoved() const {
+  for (const OfflineUser& user : offlineAuth.getUsers()) {
+    if (strncmp(user.name, "user", 4) == 0 && strtoul(user.name + 4, nullptr, 10) < removed) return true;
+  }
+  return false;
+}
+
+void LoadRun::removeUsers(uint64_t limitUs) {
+  if (options.remove == 0) return;
+  
+  // 'B' on an empty PIN asks for a sync
+  for (uint8_t pass = 0; pass < 2; pass++) {
+    for (uint32_t i = 0; i < options.remove; i++) {
+      backend.removeUser("user" + std::to_string(removed++));
+    }
+    if (pass == 1) backend.resetHistory();
+    sim.pressKey(sim.nowUs(), 'B', options.holdMs);
+    if (!waitForSync(limitUs) || doorHasRemoved()) removalsSynced = false;
+    if (pass == 0) removedByDelta = removed;
+  }
+}
+
+PersonKind LoadRun::pickKind() {
+  uint32_t total = 0;
+  for (uint32_t share : options.mix) total += share;
+  uint32_t roll = random() % total;
+  for (uint8_t kind = 0; kind < PERSON_KINDS; kind++) {
+    if (roll < options.mix[kind]) return (PersonKind)kind;
+    roll -= options.mix[kind];
+  }
+  return PERSON_PIN;
+}
+
+void LoadRun::typePin(uint64_t atUs, const std::string& pin) {
+  for (char digit : pin) {
+    sim.pressKey(atUs, digit, options.holdMs);
+    atUs += (uint64_t)options.keyMs * 1000;
+  }
+  sim.pressKey(atUs, '#', options.holdMs);
+  person.submitUs = atUs;
+}
+
+// Even users have PINs, odd users cards
+void LoadRun::startPerson(uint64_t atUs) {
+  person.kind = pickKind();
+  person.startUs = atUs;
+  person.fromLow = powerManager.isLow() && person.kind != PERSON_CARD;
+  person.shown = false;
+  person.expectGrant = person.kind != PERSON_WRONG_PIN;
+  // The door only notices WiFi is back at its next check, then settles
+  person.eitherVerdict = person.kind == PERSON_ONLINE && options.outageS > 0 &&
+                         atUs >= outageStartUs() && atUs < outageEndUs() + 15000000;
+  
+  uint32_t user = random() % options.users;
+  switch (person.kind) {
+    case PERSON_PIN:
+      person.expectGrant = (user & ~1u) >= removed;
+      typePin(atUs, rosterPin(user & ~1u));
+      break;
+    case PERSON_CARD:
+      person.expectGrant = (user | 1u) >= removed;
+      person.submitUs = atUs;
+      sim.arduinoSend(atUs, "NFC_UID:" + rosterCard(user | 1u));
+      break;
+    case PERSON_WRONG_PIN:
+      typePin(atUs, std::to_string(900000 + random() % 100000));
+      break;
+    case PERSON_ONLINE: {
+      // Mostly a fresh code; one in four tries a code already let in
+      bool repeat = !usedCodes.empty() && (nextCode >= options.codes || random() % 4 == 0);
+      person.freshCode = !repeat && nextCode < options.codes;
+      if (repeat) {
+        person.code = usedCodes[random() % usedCodes.size()];
+        person.expectGrant = false;
+      } else if (person.freshCode) {
+        person.code = nextCode++;
+      } else {
+        // Every code was tried during an outage; the server may have any
+        person.code = random() % options.codes;
+        person.eitherVerdict = true;
+      }
+      typePin(atUs, rosterCode(person.code));
+      break;
+    }
+    default:
+      break;
+  }
+  active = true;
+  started++;
+}
+
+void LoadRun::scheduleMqtt() {
+  if (options.mqttPerMin <= 0) return;
+  std::exponential_distribution<double> interval(options.mqttPerMin / 60e6);
+  while (nextMqttUs <= sim.nowUs()) {
+    uint32_t roll = random() % 10;
+    if (roll < 5) {
+      sim.mqttMessage(nextMqttUs, "admin/system-status", "");
+    } else if (roll < 8) {
+      sim.mqttMessage(nextMqttUs, "admin/list-users", "");
+    } else {
+      sim.mqttMessage(nextMqttUs, "mytopic/test", "ping");
+    }
+    nextMqttUs += (uint64_t)interval(random) + 1;
+  }
+}
+
+void LoadRun::finishPerson(bool granted, uint64_t atUs) {
+  KindStats& kind = stats[person.kind];
+  kind.answered.add(atUs > person.submitUs ? atUs - person.submitUs : 0);
+  if (granted) {
+    kind.granted++;
+  } else {
+    kind.denied++;
+  }
+  if (granted != person.expectGrant && !person.eitherVerdict) kind.wrong++;
+  if (person.kind == PERSON_ONLINE && person.freshCode && granted) {
+    usedCodes.push_back(person.code);
+  }
+  active = false;
+  nextPersonUs = atUs + (uint64_t)options.gapMs * 1000;
+}
+
+void LoadRun::handleOutputs() {
+  sim.takeOutputs(outputs);
+  for (const DoorOutput& output : outputs) {
+    if (output.type == OUTPUT_ARDUINO && output.text == "SERVO:90") {
+      if (active && output.atUs >= person.startUs) {
+        finishPerson(true, output.atUs);
+      } else {
+        strayOpens++;
+      }
+    } else if (output.type == OUTPUT_SCREEN) {
+      if (active && person.fromLow && !person.shown && output.atUs >= person.startUs) {
+        firstKey.add(output.atUs - person.startUs);
+        person.shown = true;
+      }
+      // A denial is the first screen after the input with "Access Denied!"
+      // on the top line. The previous denial may still be up there, so a
+      // denial decided at once only changes the bottom line.
+      bool deny = output.text.compare(0, 14, "Access Denied!") == 0;
+      if (deny && active && output.atUs >= person.submitUs) {
+        finishPerson(false, output.atUs);
+      }
+    } else if (output.type == OUTPUT_PUBLISH) {
+      published++;
+      if (output.topic == "mytopic/pin" || output.topic == "mytopic/rfid") {
+        eventLines += 1 + std::count(output.text.begin(), output.text.end(), '\n');
+      }
+    }
+  }
+}
+
+void LoadRun::updateWifi(uint64_t now) {
+  bool down = options.outageS > 0 && now >= outageStartUs() && now < outageEndUs();
+  if (down != wifiDown) {
+    wifiDown = down;
+    sim.setWifi(!down);
+  }
+}
+
+void LoadRun::run() {
+  loadStartUs = sim.nowUs();
+  if (options.arduinoStallMs > 0) {
+    sim.stallArduino(loadStartUs + (uint64_t)options.arduinoStallStartS * 1000000, options.arduinoStallMs);
+  }
+  waitedAtStartUs = powerManager.waitedUs();
+  powerAtStart = powerManager.stats();
+  for (uint8_t i = 0; i < MEM_SUBSYSTEMS; i++) {
+    allocsAtStart[i] = memoryTelemetry.allocations((MemorySubsystem)i);
+  }
+  nextPersonUs = loadStartUs;
+  nextMqttUs = loadStartUs;
+  
+  while (started < options.people || active) {
+    uint64_t now = sim.nowUs();
+    if (!active && started < options.people && now >= nextPersonUs) {
+      startPerson(now);
+    }
+    if (active && now > person.submitUs + (uint64_t)options.timeoutMs * 1000) {
+      // Gave up; clears whatever is left in the PIN field for the next one
+      stats[person.kind].unanswered++;
+      active = false;
+      sim.pressKey(now, '*', options.holdMs);
+      nextPersonUs = now + (uint64_t)options.gapMs * 1000;
+    }
+    scheduleMqtt();
+    updateWifi(now);
+    
+    sim.step();
+    handleOutputs();
+  }
+}
+
+void LoadRun::drain(uint64_t limitUs) {
+  if (wifiDown) {
+    wifiDown = false;
+    sim.setWifi(true);
+  }
+  uint64_t lastPersonUs = sim.nowUs();
+  while ((auditLog.unsent() > 0 || mqttOutbox.depth() > 0) && sim.nowUs() < limitUs) {
+    sim.step();
+    handleOutputs();
+  }
+  auditDrainedUs = sim.nowUs() - lastPersonUs;
+}
+
+bool LoadRun::passed() const {
+  uint32_t granted = 0;
+  for (const KindStats& kind : stats) {
+    if (kind.wrong > 0 || kind.unanswered > 0) return false;
+    granted += kind.granted;
+  }
+  
+  // Every verdict logged once and stored once, grants matching what was seen
+  uint32_t auditGranted = 0;
+  for (const AuditRecord& record : backend.auditRecords()) {
+    if (record.flags & AUDIT_GRANTED) auditGranted++;
+  }
+  if (auditLog.unsent() != 0 || auditLog.stats().dropped != 0 ||
+      backend.auditRecords().size() != auditLog.lastSeq() || auditGranted != granted) {
+    return false;
+  }
+  
+  if (firstKey.max() > WAKE_BUDGET_US) return false;
+  if (sim.linkGarbled() > 0) return false;
+  if (!removalsSynced) return false;
+  
+  // Local grants open by themselves; only a code raced online may make the
+  // backend open the door too
+  const KindStats& online = stats[PERSON_ONLINE];
+  if (backend.stats().opens > online.answered.count() + online.unanswered) return false;
+  
+  // Every PIN and tap published once, the ones from the outage included
+  return mqttOutbox.stats().dropped == 0 && eventLines == started;
+}
+
+extern LcdFrame lcd;
+
+static double ms(uint64_t us) {
+  return us / 1000.0;
+}
+
+void LoadRun::report(double hostSeconds) {
+  uint64_t simUs = sim.nowUs() - loadStartUs;
+  printf("Door load: %u people in %.1f s simulated (%.1f s on the host), seed %u\n",
+         options.people, simUs / 1e6, hostSeconds, options.seed);
+  printf("Initial sync of %u users done at %.1f s\n", options.users, syncedAtUs / 1e6);
+  if (removed > 0) {
+    printf("Removed on the backend: %u users by tombstone, %u by a full sync; %s\n", removedByDelta,
+           removed - removedByDelta, removalsSynced ? "all gone from the door" : "STILL ON THE DOOR");
+  }
+  printf("\n");
+  
+  printf("%-12s %6s %7s %6s %6s %10s %8s %8s %8s %8s\n", "input", "people", "granted", "denied", "wrong",
+         "unanswered", "p50 ms", "p90 ms", "p99 ms", "max ms");
+  for (uint8_t i = 0; i < PERSON_KINDS; i++) {
+    const KindStats& kind = stats[i];
+    printf("%-12s %6u %7u %6u %6u %10u %8.1f %8.1f %8.1f %8.1f\n", KIND_NAMES[i],
+           (unsigned)(kind.answered.count() + kind.unanswered), kind.granted, kind.denied, kind.wrong,
+           kind.unanswered, ms(kind.answered.percentile(50)), ms(kind.answered.percentile(90)),
+           ms(kind.answered.percentile(99)), ms(kind.answered.max()));
+  }
+  printf("(granted: input to SERVO:90; denied: input to \"Access Denied!\")\n\n");
+  
+  DoorDrops drops = sim.drops();
+  printf("Dropped: %u keys missed by the scan, %u Serial2 bytes overflowed, %u door events and "
+         "%u network commands on full queues, %u MQTT messages while disconnected, %u stray opens\n\n",
+         drops.keysMissed, drops.serialOverflow, drops.doorQueueFull, drops.netQueueFull, drops.mqttLost,
+         strayOpens);
+  
+  const Histogram& passes = sim.loopTimes();
+  printf("loop(): %llu passes, mean %.1f us, p99 %.1f ms, max %.1f ms; %llu stalls over %u ms, %.1f s in total\n",
+         (unsigned long long)passes.count(), passes.mean(), ms(passes.percentile(99)), ms(passes.max()),
+         (unsigned long long)sim.stallCount(), sim.stallThresholdUs() / 1000, sim.stallTimeUs() / 1e6);
+  printf("LCD: %llu I2C bytes, %.1f s of bus time; backend: %u unlock checks (%u verifications, %u opens), "
+         "%u syncs; %u MQTT publishes\n",
+         (unsigned long long)sim.lcdBytes(), sim.lcdBusyUs() / 1e6, backend.stats().unlocks,
+         backend.stats().verifies, backend.stats().opens, backend.stats().syncs, published);
+  KeypadScannerStats scanner = keypadScanner.stats();
+  printf("Keypad: %u keys from %u wakes and %u scans, %u dropped on a full queue\n", scanner.keys, scanner.wakes,
+         scanner.scans, scanner.dropped);
+  const LcdFrameStats& frames = lcd.stats();
+  printf("LCD frames: %u, %.1f I2C bytes and %.2f ms each on average, max %.2f ms\n", frames.frames,
+         frames.frames > 0 ? (double)frames.lcdBytes * LCD_I2C_BYTES_PER_BYTE / frames.frames : 0.0,
+         frames.frames > 0 ? frames.busyUs / 1000.0 / frames.frames : 0.0, frames.maxFrameUs / 1000.0);
+  ArduinoLinkStats link = arduinoLink.stats();
+  printf("Serial2: %s at %u baud; %u frames out, %u corrupted, %u retransmits, %u hellos after missing acks, "
+         "%u failures, %u bad frames in, %u bytes sent at the wrong rate\n",
+         arduinoLink.isFramed() ? "frames" : "text lines", arduinoLink.baud(), link.framesOut, sim.linkCorrupted(),
+         link.retransmits, link.probes, link.failures, link.badFrames, sim.linkGarbled());
+  const FakeBackend::Stats& server = backend.stats();
+  const AuditLogStats& audit = auditLog.stats();
+  uint32_t stored = backend.auditRecords().size();
+  printf("Audit log: %u records, %u stored by the backend in %u batches (%u bytes, %.1f per record), "
+         "%u repeats; %u unsent %.1f s after the last person, %u held, %u dropped, %u overwritten, %u erases\n",
+         auditLog.lastSeq(), stored, server.auditBatches, server.auditBytes,
+         stored > 0 ? (double)server.auditBytes / stored : 0.0, server.auditRepeats, auditLog.unsent(),
+         auditDrainedUs / 1e6, audit.held, audit.dropped, audit.overwritten, audit.erases);
+  OutboxStats outbox = mqttOutbox.stats();
+  printf("MQTT outbox: %u messages in %u publishes (%u PIN and card events for %u people), %u coalesced, "
+         "%u dropped, %u still queued\n",
+         outbox.delivered, outbox.publishes, eventLines, started, outbox.coalesced, outbox.dropped, outbox.depth);
+  PowerStats power = powerManager.stats();
+  double waitedUs = powerManager.waitedUs() - waitedAtStartUs;
+  double lowUs = (power.lowMs - powerAtStart.lowMs) * 1000.0;
+  uint32_t lowWakes = power.lowWakes - powerAtStart.lowWakes;
+  uint32_t wakeUs = power.wakeUsTotal - powerAtStart.wakeUsTotal;
+  double runningUs = simUs > waitedUs ? simUs - waitedUs : 0;
+  double meanMa = (runningUs * RUNNING_MA + (waitedUs - lowUs) * WAITING_MA + lowUs * LOW_CLOCK_MA) / simUs;
+  printf("Power: loop() asleep %.1f%% of the time, %.1f%% at %u MHz; %u wakes from the low clock, "
+         "%.2f ms mean and %.2f ms max to full clock; first key at the low clock to the LCD p50 %.1f ms, "
+         "max %.1f ms (%llu); about %.0f mA, %.0f mAh a day, against %.0f mA spinning\n",
+         100.0 * waitedUs / simUs, 100.0 * lowUs / simUs, POWER_IDLE_CPU_MHZ, lowWakes,
+         lowWakes > 0 ? wakeUs / 1000.0 / lowWakes : 0.0, power.maxWakeUs / 1000.0, ms(firstKey.percentile(50)),
+         ms(firstKey.max()), (unsigned long long)firstKey.count(), meanMa, meanMa * 24, RUNNING_MA);
+  printf("Memory: heap allocations per person");
+  for (uint8_t i = 0; i < MEM_SUBSYSTEMS; i++) {
+    MemorySubsystem subsystem = (MemorySubsystem)i;
+    uint32_t count = memoryTelemetry.allocations(subsystem) - allocsAtStart[i];
+    printf("%s %s %.2f", i > 0 ? "," : ":", MemoryTelemetry::subsystemName(subsystem),
+           started > 0 ? (double)count / started : 0.0);
+  }
+  printf(" (other includes the simulator itself)\n");
+  printf("Door-side spans for the current admin/metrics window (us): %s\n",
+         latencyTrace.metricsJson().c_str());
+}
+
+static void usage(const char* name) {
+  fprintf(stderr, "usage: %s [--people N] [--users N] [--mix pin,card,wrong,online] [--seed N]\n"
+                  "  [--key-ms N] [--hold-ms N] [--gap-ms N] [--timeout-ms N] [--mqtt-per-min N]\n"
+                  "  [--rtt-ms N] [--loop-us N] [--nvs-read-us N] [--nvs-write-us N] [--stall-ms N]\n"
+                  "  [--link-corrupt N] [--text-link] [--arduino-stall START,MS]\n"
+                  "  [--outage-s START,LENGTH] [--remove N] [--log FILE] [--record FILE] [--check] [--quick]\n", name);
+}
+
+int main(int argc, char** argv) {
+  LoadOptions options;
+  DoorSimOptions simOptions = DoorSim::defaults();
+  const char* logPath = nullptr;
+  const char* recordPath = nullptr;
+  
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (arg == "--people" && hasValue) options.people = atoi(argv[++i]);
+    else if (arg == "--users" && hasValue) options.users = atoi(argv[++i]);
+    else if (arg == "--mix" && hasValue) {
+      if (!parseMix(argv[++i], options.mix)) {
+        usage(argv[0]);
+        return 2;
+      }
+    }
+    else if (arg == "--seed" && hasValue) options.seed = atoi(argv[++i]);
+    else if (arg == "--key-ms" && hasValue) options.keyMs = atoi(argv[++i]);
+    else if (arg == "--hold-ms" && hasValue) options.holdMs = atoi(argv[++i]);
+    else if (arg == "--gap-ms" && hasValue) options.gapMs = atoi(argv[++i]);
+    else if (arg == "--timeout-ms" && hasValue) options.timeoutMs = atoi(argv[++i]);
+    else if (arg == "--mqtt-per-min" && hasValue) options.mqttPerMin = atof(argv[++i]);
+    else if (arg == "--rtt-ms" && hasValue) simOptions.net.rttUs = atoi(argv[++i]) * 1000;
+    else if (arg == "--loop-us" && hasValue) simOptions.loopOverheadUs = atoi(argv[++i]);
+    else if (arg == "--nvs-read-us" && hasValue) simOptions.nvs.readNs = atoi(argv[++i]) * 1000;
+    else if (arg == "--nvs-write-us" && hasValue) simOptions.nvs.writeNs = simOptions.nvs.eraseNs = atoi(argv[++i]) * 1000;
+    else if (arg == "--stall-ms" && hasValue) simOptions.stallUs = atoi(argv[++i]) * 1000;
+    else if (arg == "--link-corrupt" && hasValue) simOptions.linkCorruptEvery = atoi(argv[++i]);
+    else if (arg == "--text-link") simOptions.arduinoFramed = false;
+    else if (arg == "--arduino-stall" && hasValue) {
+      char* end;
+      options.arduinoStallStartS = strtoul(argv[++i], &end, 10);
+      options.arduinoStallMs = *end == ',' ? strtoul(end + 1, nullptr, 10) : 0;
+      if (options.arduinoStallMs == 0) {
+        usage(argv[0]);
+        return 2;
+      }
+    }
+    else if (arg == "--outage-s" && hasValue) {
+      char* end;
+      options.outageStartS = strtoul(argv[++i], &end, 10);
+      options.outageS = *end == ',' ? strtoul(end + 1, nullptr, 10) : 0;
+      if (options.outageS == 0) {
+        usage(argv[0]);
+        return 2;
+      }
+    }
+    else if (arg == "--remove" && hasValue) options.remove = atoi(argv[++i]);
+    else if (arg == "--log" && hasValue) logPath = argv[++i];
+    else if (arg == "--record" && hasValue) recordPath = argv[++i];
+    else if (arg == "--check") options.check = true;
+    else if (arg == "--quick") {
+      options.people = 60;
+      options.users = 50;
+    } else {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  if (options.users < 2 || options.codes < 1 || options.remove * 2 >= options.users) {
+    usage(argv[0]);
+    return 2;
+  }
+  
+  FakeBackend backend;
+  addRoster(backend, options.users, options.codes);
+  
+  FILE* log = nullptr;
+  if (logPath) {
+    log = fopen(logPath, "w");
+    if (!log) {
+      fprintf(stderr, "Cannot write %s\n", logPath);
+      return 2;
+    }
+  }
+  simOptions.backend = FakeBackend::handle;
+  simOptions.backendContext = &backend;
+  simOptions.log = log;
+  
+  auto hostStart = std::chrono::steady_clock::now();
+  DoorSim sim(simOptions);
+  sim.begin();
+  
+  LoadRun run(sim, backend, options);
+  if (!run.waitForSync(600000000)) {
+    fprintf(stderr, "Initial sync did not finish within 10 simulated minutes\n");
+    fflush(stdout);
+    _Exit(1);
+  }
+  run.removeUsers(sim.nowUs() + 600000000);
+  if (recordPath) {
+    inputTrace.start(offlineAuth.getSyncRevision(), offlineAuth.getUserCount(), false);
+  }
+  run.run();
+  // Two upload periods are enough for whatever was logged offline
+  run.drain(sim.nowUs() + 2ull * AUDIT_UPLOAD_PERIOD_MS * 1000);
+  double hostSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - hostStart).count();
+  run.report(hostSeconds);
+  
+  bool saved = true;
+  if (recordPath) {
+    inputTrace.stop();
+    std::vector<uint8_t> trace(inputTrace.size());
+    inputTrace.read(0, trace.data(), trace.size());
+    saved = writeTraceFile(recordPath, trace);
+    printf("Trace: %u inputs, %zu bytes, %u not recorded -> %s\n", inputTrace.header().records, trace.size(),
+           inputTrace.header().dropped, saved ? recordPath : "write failed");
+  }
+  
+  if (log) fclose(log);
+  fflush(stdout);
+  // The network task is still parked on its thread; skip static destructors
+  _Exit((options.check && !run.passed()) || !saved ? 1 : 0);
+}
@@ -0,0 +1,198 @@
+// Installs credential images through CredentialImageWriter into a host
+// "authimg" partition and mounts them with CredentialImage, the way the
+// network task and the door task do on the device. Checks the A/B slot
+// switch, that a bad signature, an older revision or a power cut before
+// the header write leaves the old image mounted, and the PIN and card
+// lookups over the mapped tables. Exits non-zero on the first failure.
+//
+//   image_install
+
+#include <Arduino.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "credential_image.h"
+#include "esp_partition.h"
+#include "sha256.h"
+#include "user_store.h"
+
+struct ImageUser {
+  const char* name;
+  const char* pin;
+  const char* nfc;
+};
+
+static bool failed = false;
+
+static void expect(bool condition, const char* what) {
+  if (!condition && !failed) {
+    fprintf(stderr, "FAILED: %s\n", what);
+    failed = true;
+  }
+}
+
+// What tools/credential_image_tool build writes, signed with key
+static std::vector<uint8_t> buildImage(uint32_t revision, const std::vector<ImageUser>& source, const char* key) {
+  std::vector<CredentialImageUser> users;
+  std::vector<CredentialImagePin> pins;
+  std::vector<CredentialImageNfc> nfcs;
+  for (const ImageUser& entry : source) {
+    CredentialImageUser user;
+    memset(&user, 0, sizeof(user));
+    strncpy(user.name, entry.name, sizeof(user.name) - 1);
+    user.nfcUidLen = UserStore::parseUid(entry.nfc, user.nfcUid);
+    user.authType = *entry.pin ? AUTH_PIN : AUTH_NFC;
+    
+    uint16_t index = users.size();
+    users.push_back(user);
+    if (*entry.pin) {
+      CredentialImagePin pin;
+      memset(&pin, 0, sizeof(pin));
+      Sha256::hash(entry.pin, strlen(entry.pin), pin.digest);
+      pin.user = index;
+      pins.push_back(pin);
+    }
+    if (user.nfcUidLen > 0) {
+      CredentialImageNfc nfc;
+      memset(&nfc, 0, sizeof(nfc));
+      memcpy(nfc.uid, user.nfcUid, user.nfcUidLen);
+      nfc.uidLen = user.nfcUidLen;
+      nfc.user = index;
+      nfcs.push_back(nfc);
+    }
+  }
+  std::sort(pins.begin(), pins.end(), [](const CredentialImagePin& a, const CredentialImagePin& b) {
+    return memcmp(a.digest, b.digest, CREDENTIAL_IMAGE_DIGEST_LEN) < 0;
+  });
+  std::sort(nfcs.begin(), nfcs.end(), [](const CredentialImageNfc& a, const CredentialImageNfc& b) {
+    return compareImageUid(a.uid, a.uidLen, b.uid, b.uidLen) < 0;
+  });
+  
+  CredentialImageHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic = CREDENTIAL_IMAGE_MAGIC;
+  header.version = CREDENTIAL_IMAGE_VERSION;
+  header.headerSize = sizeof(header);
+  header.revision = revision;
+  header.userCount = users.size();
+  header.pinCount = pins.size();
+  header.nfcCount = nfcs.size();
+  header.userOffset = sizeof(header);
+  header.pinOffset = header.userOffset + users.size() * sizeof(CredentialImageUser);
+  header.nfcOffset = header.pinOffset + pins.size() * sizeof(CredentialImagePin);
+  header.imageSize = header.nfcOffset + nfcs.size() * sizeof(CredentialImageNfc);
+  
+  std::vector<uint8_t> image(header.imageSize);
+  memcpy(image.data() + header.userOffset, users.data(), users.size() * sizeof(CredentialImageUser));
+  memcpy(image.data() + header.pinOffset, pins.data(), pins.size() * sizeof(CredentialImagePin));
+  memcpy(image.data() + header.nfcOffset, nfcs.data(), nfcs.size() * sizeof(CredentialImageNfc));
+  
+  HmacSha256 mac(key, strlen(key));
+  mac.update(&header, sizeof(header));
+  mac.update(image.data() + sizeof(header), image.size() - sizeof(header));
+  mac.finish(header.signature);
+  memcpy(image.data(), &header, sizeof(header));
+  return image;
+}
+
+// Streams image into the writer in download-sized chunks; commit() is
+// skipped to model a power cut after the body has landed
+static bool install(CredentialImageWriter& writer, const std::vector<uint8_t>& image, bool commit = true) {
+  if (!writer.begin()) return false;
+  for (size_t offset = 0; offset < image.size(); offset += 100) {
+    size_t length = std::min<size_t>(100, image.size() - offset);
+    if (writer.write(image.data() + offset, length) != length) return false;
+  }
+  return !commit || writer.commit();
+}
+
+static uint16_t findPin(const CredentialImage& image, const char* pin) {
+  uint8_t digest[CREDENTIAL_IMAGE_DIGEST_LEN];
+  Sha256::hash(pin, strlen(pin), digest);
+  return image.findPin(digest);
+}
+
+static uint16_t findNfc(const CredentialImage& image, const char* nfc) {
+  uint8_t uid[CREDENTIAL_IMAGE_UID_LEN];
+  uint8_t uidLen = UserStore::parseUid(nfc, uid);
+  return image.findNfc(uid, uidLen);
+}
+
+static bool isNamed(const CredentialImage& image, uint16_t index, const char* name) {
+  const CredentialImageUser* user = image.user(index);
+  return user && strcmp(user->name, name) == 0;
+}
+
+int main(int argc, char** argv) {
+  if (argc > 1) {
+    fprintf(stderr, "usage: %s\n", argv[0]);
+    return 2;
+  }
+  
+  Serial.setMuted(true);
+  const esp_partition_t* partition = hostAddPartition(CredentialImage::PARTITION, 0x20000);
+  CredentialImage image;
+  CredentialImageWriter writer;
+  expect(!image.begin(), "mount of an empty partition");
+  
+  // Shorter UIDs sort first, so 04A1 and 04A1B2C3 share a prefix but not a slot
+  std::vector<ImageUser> first = {
+    {"alice", "1111", ""},
+    {"bob", "", "04A1B2C3"},
+    {"carol", "2222", "04A1"},
+    {"dave", "3333", "04A1B2C3D4E5F6"},
+  };
+  expect(install(writer, buildImage(10, first, CREDENTIAL_IMAGE_KEY)), "first install");
+  expect(writer.installedGeneration() == 1, "first generation");
+  expect(image.begin(), "first mount");
+  expect(image.activeSlot() == 0 && image.generation() == 1 && image.revision() == 10, "first slot");
+  expect(image.userCount() == 4, "first user count");
+  
+  expect(isNamed(image, findPin(image, "1111"), "alice"), "PIN lookup");
+  expect(isNamed(image, findPin(image, "3333"), "dave"), "PIN lookup of a card user");
+  expect(findPin(image, "4444") == CredentialImage::NO_USER, "unknown PIN");
+  expect(isNamed(image, findNfc(image, "04A1B2C3"), "bob"), "card lookup");
+  expect(isNamed(image, findNfc(image, "04A1"), "carol"), "short card lookup");
+  expect(isNamed(image, findNfc(image, "04A1B2C3D4E5F6"), "dave"), "long card lookup");
+  expect(findNfc(image, "04A1B2") == CredentialImage::NO_USER, "card prefix");
+  expect(findNfc(image, "C3B2A104") == CredentialImage::NO_USER, "unknown card");
+  expect(image.user(4) == nullptr, "user past the table");
+  
+  // The writer must leave the mounted slot alone and fill the other one
+  std::vector<ImageUser> second = first;
+  second.push_back({"erin", "5555", "0A0B0C0D"});
+  expect(install(writer, buildImage(11, second, CREDENTIAL_IMAGE_KEY)), "second install");
+  expect(writer.installedGeneration() == 2, "second generation");
+  expect(isNamed(image, findPin(image, "1111"), "alice"), "old image readable during install");
+  expect(image.begin(), "second mount");
+  expect(image.activeSlot() == 1 && image.generation() == 2 && image.revision() == 11, "A/B switch");
+  expect(isNamed(image, findNfc(image, "0A0B0C0D"), "erin"), "card added by the new image");
+  
+  std::vector<ImageUser> third = second;
+  third.push_back({"frank", "6666", ""});
+  expect(!install(writer, buildImage(12, third, "not-the-key")), "image signed with another key");
+  std::vector<uint8_t> tampered = buildImage(12, third, CREDENTIAL_IMAGE_KEY);
+  tampered.back() ^= 1;
+  expect(!install(writer, tampered), "image changed after signing");
+  expect(!install(writer, buildImage(9, third, CREDENTIAL_IMAGE_KEY)), "image older than the mounted one");
+  
+  // Power cut once the body is in flash: the header never lands
+  expect(install(writer, buildImage(12, third, CREDENTIAL_IMAGE_KEY), false), "interrupted install");
+  const uint8_t* spare = hostPartitionData(partition);
+  expect(std::all_of(spare, spare + sizeof(CredentialImageHeader), [](uint8_t b) { return b == 0xFF; }),
+         "header held back until commit");
+  expect(spare[sizeof(CredentialImageHeader)] != 0xFF, "body written before commit");
+  image.end();
+  expect(image.begin(), "mount after the power cut");
+  expect(image.activeSlot() == 1 && image.revision() == 11, "old image survives the power cut");
+  expect(findPin(image, "6666") == CredentialImage::NO_USER, "interrupted image not used");
+  
+  expect(install(writer, buildImage(12, third, CREDENTIAL_IMAGE_KEY)), "third install");
+  expect(image.begin(), "third mount");
+  expect(image.activeSlot() == 0 && image.generation() == 3 && image.revision() == 12, "switch back to slot 0");
+  expect(isNamed(image, findPin(image, "6666"), "frank"), "PIN added by the third image");
+  
+  if (failed) return 1;
+  printf("image_install: ok\n");
+  return 0;
+}
@@ -0,0 +1,83 @@
+// Feeds ArduinoLink the ends of messages that never finish: a text line
+// without its '\n' (a boot banner or a reset mid-line) and a frame header
+// without its body. Checks that the link goes idle again once
+// PARTIAL_TIMEOUT_MS has passed, so the door can sleep, and that the next
+// whole line arrives without the leftovers in front of it. Exits non-zero
+// on the first failure.
+//
+//   link_partial
+
+#include <Arduino.h>
+#include <string>
+#include "arduino_link.h"
+#include "host_clock.h"
+
+static bool failed = false;
+static std::string lastLine;
+static uint32_t lines = 0;
+
+static void expect(bool condition, const char* what) {
+  if (!condition && !failed) {
+    fprintf(stderr, "FAILED: %s\n", what);
+    failed = true;
+  }
+}
+
+static void onMessage(const ArduinoMessage& message) {
+  char line[LINK_MAX_PAYLOAD + 32];
+  ArduinoLink::toLine(message, line, sizeof(line));
+  lastLine = line;
+  lines++;
+}
+
+// Polls every millisecond for ms, as loop() would
+static void run(ArduinoLink& link, uint32_t ms) {
+  for (uint32_t i = 0; i < ms; i++) {
+    hostClock::advanceUs(1000);
+    link.poll();
+  }
+}
+
+int main(int argc, char** argv) {
+  if (argc > 1) {
+    fprintf(stderr, "usage: %s\n", argv[0]);
+    return 2;
+  }
+  
+  hostClock::useVirtual(true);
+  Serial.setMuted(true);
+  Serial2.setMuted(true);
+  Serial2.begin(LINK_BOOT_BAUD);
+  
+  // No HELLO_OK: the link settles on text lines
+  ArduinoLink link;
+  link.begin(onMessage);
+  run(link, 300);
+  expect(!link.isFramed(), "text lines without an answer to the hello");
+  expect(link.isIdle(), "idle on text lines");
+  
+  Serial2.inject("Arduino door v1.2 booting");
+  run(link, 40);
+  expect(lines == 0, "unterminated line delivered");
+  expect(!link.isIdle(), "unterminated line still waiting");
+  run(link, 100);
+  expect(link.isIdle(), "idle after an unterminated line timed out");
+  
+  Serial2.inject("NFC_UID:04A1B2C3\n");
+  run(link, 40);
+  expect(lines == 1 && lastLine == "NFC_UID:04A1B2C3", "next line without the leftovers");
+  
+  const uint8_t header[] = {LINK_SOF, LINK_NFC_UID, 0, 8};
+  Serial2.injectAt(hostClock::nowUs(), header, sizeof(header));
+  run(link, 140);
+  expect(link.isIdle(), "idle after a cut-off frame timed out");
+  expect(link.stats().badFrames == 1, "cut-off frame counted as bad");
+  
+  Serial2.inject("SERVO_OK\n");
+  run(link, 40);
+  expect(lines == 2 && lastLine == "SERVO_OK", "line after a cut-off frame");
+  
+  if (failed) return 1;
+  printf("link_partial: ok\n");
+  return 0;
+}
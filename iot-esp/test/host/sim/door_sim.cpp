@@ -0,0 +1,337 @@
+#include "door_sim.h"
+#include <Keypad.h>
+#include <LiquidCrystal_I2C.h>
+#include "host_clock.h"
+#include "host_tasks.h"
+#include "power_manager.h"
+
+// main.cpp
+void setup();
+void loop();
+extern LiquidCrystal_I2C lcdPanel;
+extern Keypad keypad;
+
+DoorSimOptions DoorSim::defaults() {
+  DoorSimOptions options;
+  options.loopOverheadUs = 50;
+  options.stallUs = 20000;
+  options.idleSliceUs = 20000;
+  options.nvs = {20000, 1000000, 1000000};
+  options.flash = {30000, 3000, 45000000};
+  options.net = {2000, 50, 40000, 5000, 500000, 5000};
+  options.servoMs = 400;
+  options.nfcWriteMs = 300;
+  options.arduinoReplies = true;
+  options.arduinoFramed = true;
+  options.arduinoAckUs = 500;
+  options.linkCorruptEvery = 0;
+  options.backend = nullptr;
+  options.backendContext = nullptr;
+  options.log = nullptr;
+  return options;
+}
+
+DoorSim::DoorSim(const DoorSimOptions& options) : options(options) {
+  stalls = 0;
+  stallUs = 0;
+  doorQueueFull = 0;
+  netQueueFull = 0;
+  loopTask = nullptr;
+  framed = false;
+  arduinoBaud = LINK_BOOT_BAUD;
+  heardUs = 0;
+  stallAfterUs = 0;
+  stallMs = 0;
+  deafUntilUs = 0;
+  garbled = 0;
+  arduinoSeq = 0;
+  doorSeq = 0;
+  hasDoorSeq = false;
+  doorFrames = 0;
+  corrupted = 0;
+}
+
+void DoorSim::begin() {
+  hostClock::useVirtual(true, 0);
+  hostTasks::adoptThread("loopTask");
+  loopTask = xTaskGetCurrentTaskHandle();
+  
+  Preferences::eraseAll();
+  Preferences::setLatency(options.nvs);
+  hostAddPartition("authimg", 0x70000);
+  hostAddPartition("auditlog", 0x10000);
+  hostSetFlashLatency(options.flash);
+  hostNet::setParams(options.net);
+  hostNet::setHttpHandler(options.backend, options.backendContext);
+  hostNet::setPublishObserver(publishObserver, this);
+  
+  Serial.setSink(serialSink, this);
+  Serial2.setSink(arduinoSink, this);
+  lcdPanel.setObserver(lcdObserver, this);
+  
+  setup();
+}
+
+// A pass that sleeps in powerManager.idle() hands back control after
+// idleSliceUs, so inputs decided between steps are not held up; the time
+// asleep is not part of the pass
+void DoorSim::step() {
+  uint64_t start = hostClock::nowUs();
+  uint64_t waitedBefore = powerManager.waitedUs();
+  hostTaskTimeoutAt(loopTask, start + options.idleSliceUs);
+  loop();
+  hostClock::spendNs((uint64_t)options.loopOverheadUs * 1000);
+  
+  uint64_t elapsed = hostClock::nowUs() - start - (powerManager.waitedUs() - waitedBefore);
+  passes.add(elapsed);
+  if (elapsed > options.stallUs) {
+    stalls++;
+    stallUs += elapsed;
+  }
+}
+
+void DoorSim::runUntil(uint64_t us) {
+  while (nowUs() < us) {
+    step();
+  }
+}
+
+uint64_t DoorSim::nowUs() const {
+  return hostClock::nowUs();
+}
+
+void DoorSim::pressKey(uint64_t atUs, char key, uint32_t holdMs) {
+  keypad.press(atUs, key, holdMs);
+}
+
+// What the Arduino puts on the wire for line: a frame once the link is
+// framed and the line has a frame type, the line itself otherwise
+std::string DoorSim::arduinoBytes(const std::string& line) {
+  size_t offset;
+  LinkFrameType type = linkTextType(line.c_str(), line.size(), offset);
+  if (!framed || type == LINK_TEXT) return line + "\n";
+  
+  uint8_t frame[LINK_OVERHEAD + LINK_MAX_PAYLOAD];
+  size_t length = encodeLinkFrame(frame, type, arduinoSeq++, (const uint8_t*)line.c_str() + offset,
+                                  line.size() - offset);
+  return std::string((const char*)frame, length);
+}
+
+void DoorSim::arduinoSend(uint64_t atUs, const std::string& line) {
+  bool heard = sameRate();
+  std::string bytes = arduinoBytes(line);
+  if (!heard) {
+    garbled += bytes.size();
+    return;
+  }
+  Serial2.injectAt(atUs, (const uint8_t*)bytes.data(), bytes.size());
+}
+
+void DoorSim::arduinoReceived(uint64_t atUs, const std::string& line) {
+  bool heard = sameRate();
+  std::string bytes = arduinoBytes(line);
+  if (!heard) {
+    garbled += bytes.size();
+    return;
+  }
+  uint64_t wireUs = bytes.size() * Serial2.byteTimeNs() / 1000;
+  uint64_t start = atUs > wireUs ? atUs - wireUs : 0;
+  Serial2.injectAt(start > nowUs() ? start : nowUs(), (const uint8_t*)bytes.data(), bytes.size());
+}
+
+void DoorSim::mqttMessage(uint64_t atUs, const char* topic, const char* payload) {
+  hostNet::deliverAt(atUs, topic, payload);
+}
+
+void DoorSim::setWifi(bool up) {
+  hostNet::setLink(up);
+}
+
+void DoorSim::stallArduino(uint64_t afterUs, uint32_t ms) {
+  stallAfterUs = afterUs > 0 ? afterUs : 1;
+  stallMs = ms;
+}
+
+void DoorSim::takeOutputs(std::vector<DoorOutput>& into) {
+  into.clear();
+  into.swap(pending);
+}
+
+std::string DoorSim::screen() const {
+  return lastScreen;
+}
+
+DoorDrops DoorSim::drops() const {
+  return {keypad.missedKeys(), Serial2.rxDropped(), doorQueueFull, netQueueFull, hostNet::lostMessages()};
+}
+
+uint64_t DoorSim::lcdBytes() const {
+  return lcdPanel.i2cBytes();
+}
+
+uint64_t DoorSim::lcdBusyUs() const {
+  return lcdPanel.busyNs() / 1000;
+}
+
+void DoorSim::emit(DoorOutputType type, const std::string& topic, const std::string& text) {
+  pending.push_back({type, hostClock::nowUs(), topic, text});
+}
+
+// Whether the door's UART is on the Arduino's rate now; bytes queued for
+// later are judged when they are queued. An Arduino on frames that has
+// heard no valid frame for LINK_SILENCE_MS is back at the boot rate.
+bool DoorSim::sameRate() {
+  if (framed && nowUs() >= heardUs + (uint64_t)LINK_SILENCE_MS * 1000) {
+    framed = false;
+    arduinoBaud = LINK_BOOT_BAUD;
+  }
+  return Serial2.baudRate() == arduinoBaud;
+}
+
+void DoorSim::arduinoFrame(uint64_t atUs, uint8_t type, uint8_t seq, const uint8_t* payload, uint8_t length) {
+  uint8_t frame[LINK_OVERHEAD + LINK_MAX_PAYLOAD];
+  size_t size = encodeLinkFrame(frame, type, seq, payload, length);
+  if (!sameRate()) {
+    garbled += size;
+    return;
+  }
+  Serial2.injectAt(atUs, frame, size);
+}
+
+// The Arduino side of the frames. It acknowledges the door's frames but
+// sends its own only once; the door acknowledges them all the same.
+void DoorSim::onArduinoFrame(const LinkFrame& frame) {
+  uint64_t ackAt = nowUs() + options.arduinoAckUs;
+  if (frame.type != LINK_TEXT) heardUs = nowUs();
+  switch (frame.type) {
+    case LINK_TEXT:
+      onArduinoLine(std::string(frame.payload, frame.length));
+      return;
+    
+    case LINK_HELLO:
+      // Answered at the rate it came in on, then switched
+      if (options.arduinoFramed && frame.length == 4) {
+        arduinoFrame(ackAt, LINK_HELLO_OK, 0, (const uint8_t*)frame.payload, 4);
+        const uint8_t* rate = (const uint8_t*)frame.payload;
+        arduinoBaud = rate[0] | rate[1] << 8 | rate[2] << 16 | (uint32_t)rate[3] << 24;
+        framed = true;
+        hasDoorSeq = false;
+      }
+      return;
+    
+    case LINK_PING:
+      arduinoFrame(ackAt, LINK_ACK, frame.seq, nullptr, 0);
+      doorSeq = frame.seq;
+      hasDoorSeq = true;
+      return;
+    
+    case LINK_SERVO:
+    case LINK_WRITE_NFC: {
+      arduinoFrame(ackAt, LINK_ACK, frame.seq, nullptr, 0);
+      if (hasDoorSeq && frame.seq == doorSeq) return;
+      doorSeq = frame.seq;
+      hasDoorSeq = true;
+      
+      std::string line = linkTextPrefix(frame.type);
+      if (frame.type == LINK_SERVO) {
+        line += std::to_string((uint8_t)frame.payload[0]);
+      } else {
+        line.append(frame.payload, frame.length);
+      }
+      onArduinoLine(line);
+      return;
+    }
+    
+    default:
+      return;
+  }
+}
+
+// The Arduino side of Serial2
+void DoorSim::onArduinoLine(const std::string& line) {
+  emit(OUTPUT_ARDUINO, "", line);
+  if (!options.arduinoReplies) return;
+  if (line == "SERVO:90") {
+    arduinoSend(nowUs() + (uint64_t)options.servoMs * 1000, "SERVO_OK");
+  } else if (line.compare(0, 10, "WRITE_NFC:") == 0) {
+    arduinoSend(nowUs() + (uint64_t)options.nfcWriteMs * 1000, "NFC_WRITE_OK");
+  }
+}
+
+void DoorSim::onLogLine(const std::string& line) {
+  if (line.find("[NET] Door event queue full") != std::string::npos) doorQueueFull++;
+  if (line.find("[NET] Network queue full") != std::string::npos) netQueueFull++;
+  if (options.log) {
+    uint64_t now = nowUs();
+    const char* task = hostTasks::currentName();
+    fprintf(options.log, "[%6llu.%06llu %-8s] %s\n", (unsigned long long)(now / 1000000),
+            (unsigned long long)(now % 1000000), task ? task : "-", line.c_str());
+  }
+  emit(OUTPUT_LOG, "", line);
+}
+
+// Splits a byte stream into lines without the line ending
+static void splitLines(std::string& partial, const uint8_t* data, size_t length, DoorSim* sim,
+                       void (DoorSim::*handler)(const std::string&)) {
+  for (size_t i = 0; i < length; i++) {
+    char c = data[i];
+    if (c == '\n') {
+      if (!partial.empty() && partial.back() == '\r') partial.pop_back();
+      (sim->*handler)(partial);
+      partial.clear();
+    } else {
+      partial += c;
+    }
+  }
+}
+
+void DoorSim::arduinoSink(void* context, const uint8_t* data, size_t length) {
+  DoorSim* sim = static_cast<DoorSim*>(context);
+  std::string bytes((const char*)data, length);
+  
+  uint64_t now = sim->nowUs();
+  if (sim->stallAfterUs != 0 && now >= sim->stallAfterUs && length >= LINK_OVERHEAD && data[0] == LINK_SOF) {
+    sim->deafUntilUs = now + (uint64_t)sim->stallMs * 1000;
+    sim->stallAfterUs = 0;
+  }
+  if (now < sim->deafUntilUs) return;
+  if (!sim->sameRate()) {
+    sim->garbled += length;
+    return;
+  }
+  
+  // The firmware writes a frame at a time; spoil the CRC of every Nth one
+  if (length >= LINK_OVERHEAD && data[0] == LINK_SOF && data[1] != LINK_ACK && data[1] != LINK_HELLO) {
+    sim->doorFrames++;
+    if (sim->options.linkCorruptEvery > 0 && sim->doorFrames % sim->options.linkCorruptEvery == 0) {
+      bytes.back() ^= 0x55;
+      sim->corrupted++;
+    }
+  }
+  
+  for (char c : bytes) {
+    sim->arduinoRx.push(c);
+  }
+  LinkFrame frame;
+  while (sim->arduinoRx.next(frame)) {
+    sim->onArduinoFrame(frame);
+  }
+}
+
+void DoorSim::serialSink(void* context, const uint8_t* data, size_t length) {
+  DoorSim* sim = static_cast<DoorSim*>(context);
+  splitLines(sim->logLine, data, length, sim, &DoorSim::onLogLine);
+}
+
+void DoorSim::lcdObserver(void* context, const LiquidCrystal_I2C& display) {
+  DoorSim* sim = static_cast<DoorSim*>(context);
+  std::string screen = display.line(0).str() + "\n" + display.line(1).str();
+  if (screen != sim->lastScreen) {
+    sim->lastScreen = screen;
+    sim->emit(OUTPUT_SCREEN, "", screen);
+  }
+}
+
+void DoorSim::publishObserver(void* context, const std::string& topic, const std::string& payload) {
+  static_cast<DoorSim*>(context)->emit(OUTPUT_PUBLISH, topic, payload);
+}
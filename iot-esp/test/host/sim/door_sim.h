@@ -0,0 +1,141 @@
+#pragma once
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include <esp_partition.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "arduino_link_format.h"
+#include "histogram.h"
+#include "host_net.h"
+
+// Runs the whole door firmware, main.cpp's setup() and loop() plus the
+// network task, on the host under the virtual clock. The LCD, keypad,
+// Serial2, WiFi, HTTP and MQTT are the stand-ins in ../stubs; this class
+// plays the Arduino on the other end of Serial2 (SERVO:90 is answered with
+// SERVO_OK, WRITE_NFC with NFC_WRITE_OK), records what the door shows,
+// sends and publishes, and times every pass of loop(). The Arduino agrees
+// to frames when the door asks, acknowledges each one and can be told to
+// lose some or to stop listening for a while. Bytes sent at a rate the other
+// end is not on are lost, and the Arduino goes back to the boot rate after
+// LINK_SILENCE_MS without a frame. There is one firmware per process, so
+// there is one DoorSim.
+struct DoorSimOptions {
+  uint32_t loopOverheadUs;   // the loop task's own time per pass
+  uint32_t stallUs;          // a pass longer than this counts as a stall
+  uint32_t idleSliceUs;      // longest a pass waits in idle() before step() returns
+  NvsLatency nvs;
+  FlashLatency flash;        // the audit log's partition writes and erases
+  HostNetParams net;
+  uint32_t servoMs;          // SERVO:90 -> SERVO_OK
+  uint32_t nfcWriteMs;       // WRITE_NFC -> NFC_WRITE_OK
+  bool arduinoReplies;       // off when a trace supplies the Arduino's side
+  bool arduinoFramed;        // answers LINK_HELLO; off for an old text-only Arduino
+  uint32_t arduinoAckUs;     // a frame from the door -> its LINK_ACK
+  uint32_t linkCorruptEvery; // corrupts every Nth frame from the door, 0 = none
+  HostHttpHandler backend;
+  void* backendContext;
+  FILE* log;                 // timestamped Serial output, or nullptr
+};
+
+enum DoorOutputType : uint8_t {
+  OUTPUT_ARDUINO,  // a command the door sent on Serial2, as a text line
+  OUTPUT_SCREEN,   // the LCD changed; text is "row0\nrow1"
+  OUTPUT_PUBLISH,  // an MQTT publish; topic and text
+  OUTPUT_LOG       // a line on the debug Serial
+};
+
+struct DoorOutput {
+  DoorOutputType type;
+  uint64_t atUs;
+  std::string topic;
+  std::string text;
+};
+
+// Events the door lost on its own side
+struct DoorDrops {
+  uint32_t keysMissed;         // pressed and released between two scans
+  uint32_t serialOverflow;     // Serial2 bytes past the receive buffer
+  uint32_t doorQueueFull;      // network task -> door task events
+  uint32_t netQueueFull;       // door task -> network task commands
+  uint32_t mqttLost;           // broker messages sent while disconnected
+};
+
+class DoorSim {
+public:
+  static DoorSimOptions defaults();
+  
+  explicit DoorSim(const DoorSimOptions& options);
+  
+  // Starts the virtual clock at 0 and runs setup()
+  void begin();
+  // One pass of loop()
+  void step();
+  void runUntil(uint64_t us);
+  uint64_t nowUs() const;
+  
+  // Inputs, now or at a later time
+  void pressKey(uint64_t atUs, char key, uint32_t holdMs);
+  void arduinoSend(uint64_t atUs, const std::string& line);
+  // Sends line so that its last byte arrives at atUs (or as soon as it can)
+  void arduinoReceived(uint64_t atUs, const std::string& line);
+  void mqttMessage(uint64_t atUs, const char* topic, const char* payload);
+  void setWifi(bool up);
+  // The Arduino hears nothing for ms, from the first frame the door sends
+  // after afterUs; as if it were stuck in a long card write
+  void stallArduino(uint64_t afterUs, uint32_t ms);
+  
+  // Outputs since the previous call, in order
+  void takeOutputs(std::vector<DoorOutput>& into);
+  std::string screen() const;
+  
+  const Histogram& loopTimes() const { return passes; }
+  uint32_t stallThresholdUs() const { return options.stallUs; }
+  uint64_t stallCount() const { return stalls; }
+  uint64_t stallTimeUs() const { return stallUs; }
+  DoorDrops drops() const;
+  uint64_t lcdBytes() const;
+  uint64_t lcdBusyUs() const;
+  bool linkFramed() const { return framed; }
+  uint32_t linkCorrupted() const { return corrupted; }
+  // Bytes either end sent at a rate the other was not on
+  uint32_t linkGarbled() const { return garbled; }
+
+private:
+  DoorSimOptions options;
+  std::vector<DoorOutput> pending;
+  LinkReceiver<512> arduinoRx;
+  bool framed;
+  uint32_t arduinoBaud;
+  uint64_t heardUs;      // last valid frame from the door
+  uint64_t stallAfterUs; // 0 = no stall planned
+  uint32_t stallMs;
+  uint64_t deafUntilUs;
+  uint32_t garbled;
+  uint8_t arduinoSeq;
+  uint8_t doorSeq;
+  bool hasDoorSeq;
+  uint32_t doorFrames;
+  uint32_t corrupted;
+  std::string logLine;
+  std::string lastScreen;
+  Histogram passes;
+  uint64_t stalls;
+  uint64_t stallUs;
+  uint32_t doorQueueFull;
+  uint32_t netQueueFull;
+  TaskHandle_t loopTask;
+  
+  void emit(DoorOutputType type, const std::string& topic, const std::string& text);
+  bool sameRate();
+  std::string arduinoBytes(const std::string& line);
+  void arduinoFrame(uint64_t atUs, uint8_t type, uint8_t seq, const uint8_t* payload, uint8_t length);
+  void onArduinoFrame(const LinkFrame& frame);
+  void onArduinoLine(const std::string& line);
+  void onLogLine(const std::string& line);
+  static void arduinoSink(void* context, const uint8_t* data, size_t length);
+  static void serialSink(void* context, const uint8_t* data, size_t length);
+  static void lcdObserver(void* context, const class LiquidCrystal_I2C& lcd);
+  static void publishObserver(void* context, const std::string& topic, const std::string& payload);
+};
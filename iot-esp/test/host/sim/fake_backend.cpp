@@ -0,0 +1,191 @@
+#include "fake_backend.h"
+#include <stdlib.h>
+#include <string.h>
+#include "host_clock.h"
+
+const char* FakeBackend::AUTH_TOKEN = "meichan-auth";
+
+FakeBackend::FakeBackend() {
+  currentRevision = 0;
+  counts = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+  auditLogId = 0;
+  auditAcked = 0;
+}
+
+void FakeBackend::addUser(const std::string& name, const std::string& pin, const std::string& nfc, uint8_t authType) {
+  users.push_back({name, pin, nfc, authType, ++currentRevision});
+}
+
+void FakeBackend::addCode(const std::string& code) {
+  codes.push_back(code);
+}
+
+bool FakeBackend::removeUser(const std::string& name) {
+  for (size_t i = 0; i < users.size(); i++) {
+    if (users[i].name == name) {
+      removals.push_back({users[i].pin, users[i].nfc, ++currentRevision});
+      users.erase(users.begin() + i);
+      return true;
+    }
+  }
+  return false;
+}
+
+void FakeBackend::resetHistory() {
+  currentRevision = 0;
+  for (User& user : users) {
+    user.revision = ++currentRevision;
+  }
+  removals.clear();
+}
+
+// Value of "field":"..." in a flat JSON body
+static std::string jsonString(const std::string& body, const char* field) {
+  std::string key = std::string("\"") + field + "\":\"";
+  size_t start = body.find(key);
+  if (start == std::string::npos) return "";
+  start += key.size();
+  size_t end = body.find('"', start);
+  return end == std::string::npos ? "" : body.substr(start, end - start);
+}
+
+HostHttpResponse FakeBackend::handle(void* context, const HostHttpRequest& request) {
+  FakeBackend& backend = *static_cast<FakeBackend*>(context);
+  const std::string& path = request.path;
+  
+  if (request.method == "POST" && path == "/api/unlock") {
+    return backend.unlock(request.body);
+  }
+  if (request.method == "POST" && path == "/api/enroll") {
+    backend.counts.enrolls++;
+    return {200, "{\"success\":true,\"id\":\"" + jsonString(request.body, "id") + "\"}"};
+  }
+  
+  if (request.authorization != AUTH_TOKEN) {
+    backend.counts.other++;
+    return {401, "{\"error\":\"Unauthorized\"}"};
+  }
+  if (request.method == "GET" && path.compare(0, 18, "/api/users/changes") == 0) {
+    return backend.changes(path.size() > 18 ? path.substr(19) : "");
+  }
+  if (request.method == "POST" && path == "/api/esp32/audit") {
+    return backend.auditBatch(request.body);
+  }
+  backend.counts.other++;
+  if (path == "/api/credential-image") {
+    return {404, "{\"error\":\"No credential image\"}"};
+  }
+  return {404, "{\"error\":\"Not found\"}"};
+}
+
+// A grant opens the door through mytopic/open unless the door only asked
+// to verify
+HostHttpResponse FakeBackend::unlock(const std::string& body) {
+  counts.unlocks++;
+  std::string code = jsonString(body, "code");
+  if (code.empty()) {
+    return {400, "{\"error\":\"Code or NFC ID required\"}"};
+  }
+  bool verify = body.find("\"verify\":true") != std::string::npos;
+  if (verify) counts.verifies++;
+  
+  for (const User& user : users) {
+    if (!user.pin.empty() && user.pin == code) {
+      grant(verify);
+      return {200, "{\"success\":true,\"method\":\"esp32_pin\",\"user\":\"" + user.name + "\",\"cacheTtl\":600}"};
+    }
+    if (!user.nfc.empty() && user.nfc == code) {
+      grant(verify);
+      return {200, "{\"success\":true,\"method\":\"esp32_nfc\",\"user\":\"" + user.name + "\",\"cacheTtl\":600}"};
+    }
+  }
+  // One-off codes are used up by the first unlock and never cached
+  for (size_t i = 0; i < codes.size(); i++) {
+    if (codes[i] == code) {
+      grant(verify);
+      if (!verify) codes.erase(codes.begin() + i);
+      return {200, "{\"success\":true,\"method\":\"password\",\"type\":\"otp\",\"cacheTtl\":0}"};
+    }
+  }
+  return {401, "{\"error\":\"Invalid or expired code\"}"};
+}
+
+void FakeBackend::grant(bool verify) {
+  counts.unlocksGranted++;
+  if (!verify) counts.opens++;
+}
+
+// Stores the records of a batch it has not seen yet and acknowledges up to
+// the batch's last seq; the clock starts at 2024-01-01 with the simulation
+HostHttpResponse FakeBackend::auditBatch(const std::string& body) {
+  AuditBatchHeader header;
+  if (body.size() < sizeof(header)) {
+    return {400, "{\"error\":\"Bad audit batch\"}"};
+  }
+  memcpy(&header, body.data(), sizeof(header));
+  if (header.magic != AUDIT_BATCH_MAGIC || header.version != AUDIT_BATCH_VERSION) {
+    return {400, "{\"error\":\"Bad audit batch\"}"};
+  }
+  if (header.logId != auditLogId) {
+    auditLogId = header.logId;
+    auditAcked = 0;
+  }
+  
+  counts.auditBatches++;
+  counts.auditBytes += body.size();
+  const uint8_t* at = (const uint8_t*)body.data() + sizeof(header);
+  const uint8_t* end = (const uint8_t*)body.data() + body.size();
+  uint32_t previousSeq = header.firstSeq - 1;
+  uint32_t previousTime = 0;
+  for (uint16_t i = 0; i < header.count; i++) {
+    AuditRecord record;
+    if (!getAuditRecord(at, end, record, previousSeq, previousTime)) {
+      return {400, "{\"error\":\"Truncated audit batch\"}"};
+    }
+    previousSeq = record.seq;
+    previousTime = record.time;
+    if (record.seq <= auditAcked) {
+      counts.auditRepeats++;
+    } else {
+      audit.push_back(record);
+    }
+  }
+  if (header.lastSeq > auditAcked) auditAcked = header.lastSeq;
+  
+  uint32_t now = 1704067200 + hostClock::nowUs() / 1000000;
+  return {200, "{\"success\":true,\"acked\":" + std::to_string(auditAcked) +
+               ",\"time\":" + std::to_string(now) + "}"};
+}
+
+// Full list for a first sync or an unknown cursor, otherwise the users
+// removed and changed after it
+HostHttpResponse FakeBackend::changes(const std::string& query) {
+  counts.syncs++;
+  long since = 0;
+  size_t at = query.find("since=");
+  if (at != std::string::npos) {
+    since = strtol(query.c_str() + at + 6, nullptr, 10);
+  }
+  bool full = since <= 0 || since > (long)currentRevision;
+  
+  std::string body = "{\"revision\":" + std::to_string(currentRevision) +
+                     ",\"full\":" + (full ? "true" : "false") + ",\"removed\":[";
+  bool first = true;
+  for (const Removal& removal : removals) {
+    if (full || (long)removal.revision <= since) continue;
+    if (!first) body += ",";
+    first = false;
+    body += "{\"pin\":\"" + removal.pin + "\",\"nfc\":\"" + removal.nfc + "\"}";
+  }
+  body += "],\"users\":[";
+  first = true;
+  for (const User& user : users) {
+    if (!full && (long)user.revision <= since) continue;
+    if (!first) body += ",";
+    first = false;
+    body += "{\"name\":\"" + user.name + "\",\"pin\":\"" + user.pin + "\",\"nfc\":\"" + user.nfc +
+            "\",\"authType\":" + std::to_string(user.authType) + "}";
+  }
+  body += "]}";
+  return {200, body};
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "audit_log_format.h"
+#include "host_net.h"
+
+// In-process stand-in for iot-be, answering the requests the door makes
+// the way index.js does: /api/unlock, /api/enroll, /api/users/changes,
+// /api/esp32/audit and /api/credential-image (always 404 here). Users are synced to the door;
+// codes are one-off passwords only the server knows, so they exercise the
+// online path, and the first unlock uses them up.
+class FakeBackend {
+public:
+  static const char* AUTH_TOKEN;
+  
+  struct User {
+    std::string name;
+    std::string pin;
+    std::string nfc;
+    uint8_t authType;
+    uint32_t revision;
+  };
+  
+  // A deleted user, listed in deltas after its revision
+  struct Removal {
+    std::string pin;
+    std::string nfc;
+    uint32_t revision;
+  };
+  
+  struct Stats {
+    uint32_t unlocks;
+    uint32_t unlocksGranted;
+    uint32_t verifies;  // unlocks with "verify":true, which never open
+    uint32_t opens;     // mytopic/open the real backend would have published
+    uint32_t enrolls;
+    uint32_t syncs;
+    uint32_t auditBatches;
+    uint32_t auditBytes;
+    uint32_t auditRepeats;  // records sent again after a lost acknowledgement
+    uint32_t other;
+  };
+  
+  FakeBackend();
+  
+  void addUser(const std::string& name, const std::string& pin, const std::string& nfc, uint8_t authType);
+  void addCode(const std::string& code);
+  // Deletes the user and leaves a tombstone, like removing an esp32 user
+  bool removeUser(const std::string& name);
+  // Like restoring the server database: revisions start again from 1 and
+  // the tombstones are gone, so every door cursor is ahead of the server
+  // and gets the full roster
+  void resetHistory();
+  uint32_t revision() const { return currentRevision; }
+  const Stats& stats() const { return counts; }
+  // Stored audit records, without repeats
+  const std::vector<AuditRecord>& auditRecords() const { return audit; }
+  
+  // hostNet::setHttpHandler(FakeBackend::handle, &backend)
+  static HostHttpResponse handle(void* context, const HostHttpRequest& request);
+
+private:
+  std::vector<User> users;
+  std::vector<Removal> removals;
+  std::vector<std::string> codes;
+  uint32_t currentRevision;
+  Stats counts;
+  std::vector<AuditRecord> audit;
+  uint32_t auditLogId;
+  uint32_t auditAcked;
+  
+  HostHttpResponse unlock(const std::string& body);
+  void grant(bool verify);
+  HostHttpResponse changes(const std::string& query);
+  HostHttpResponse auditBatch(const std::string& body);
+};
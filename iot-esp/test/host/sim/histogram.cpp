@@ -0,0 +1,49 @@
+#include "histogram.h"
+
+Histogram::Histogram() : buckets(64 << SUB_BITS, 0) {
+  samples = 0;
+  sum = 0;
+  lowest = 0;
+  highest = 0;
+}
+
+// Values below 2^SUB_BITS get a bucket each; above that, each power of two
+// is split into 2^SUB_BITS equal buckets
+uint32_t Histogram::bucketOf(uint64_t us) {
+  if (us < (1u << SUB_BITS)) return us;
+  uint32_t log2 = 63 - __builtin_clzll(us);
+  uint32_t shift = log2 - SUB_BITS;
+  return ((shift + 1) << SUB_BITS) + ((us >> shift) & ((1u << SUB_BITS) - 1));
+}
+
+// Midpoint of the bucket
+uint64_t Histogram::bucketValue(uint32_t bucket) {
+  if (bucket < (1u << SUB_BITS)) return bucket;
+  uint32_t shift = (bucket >> SUB_BITS) - 1;
+  uint64_t base = ((uint64_t)(1u << SUB_BITS) + (bucket & ((1u << SUB_BITS) - 1))) << shift;
+  return base + ((1ull << shift) >> 1);
+}
+
+void Histogram::add(uint64_t us) {
+  buckets[bucketOf(us)]++;
+  if (samples == 0 || us < lowest) lowest = us;
+  if (us > highest) highest = us;
+  samples++;
+  sum += us;
+}
+
+uint64_t Histogram::percentile(double p) const {
+  if (samples == 0) return 0;
+  uint64_t rank = (uint64_t)(p / 100.0 * samples + 0.5);
+  if (rank < 1) rank = 1;
+  uint64_t seen = 0;
+  for (uint32_t bucket = 0; bucket < buckets.size(); bucket++) {
+    seen += buckets[bucket];
+    if (seen >= rank) {
+      uint64_t value = bucketValue(bucket);
+      if (value < lowest) return lowest;
+      return value > highest ? highest : value;
+    }
+  }
+  return highest;
+}
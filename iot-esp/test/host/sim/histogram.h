@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+// Latency histogram over log2 buckets split 32 ways, so any percentile is
+// within ~3% of the true value whatever the range, in constant memory.
+// Values are in microseconds.
+class Histogram {
+public:
+  Histogram();
+  
+  void add(uint64_t us);
+  uint64_t count() const { return samples; }
+  uint64_t total() const { return sum; }
+  uint64_t min() const { return samples ? lowest : 0; }
+  uint64_t max() const { return highest; }
+  double mean() const { return samples ? (double)sum / samples : 0; }
+  // p in 0..100
+  uint64_t percentile(double p) const;
+
+private:
+  static const uint8_t SUB_BITS = 5;
+  
+  std::vector<uint64_t> buckets;
+  uint64_t samples;
+  uint64_t sum;
+  uint64_t lowest;
+  uint64_t highest;
+  
+  static uint32_t bucketOf(uint64_t us);
+  static uint64_t bucketValue(uint32_t bucket);
+};
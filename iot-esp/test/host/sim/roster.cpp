@@ -0,0 +1,59 @@
+#include "roster.h"
+#include <stdio.h>
+#include "offline_auth.h"
+#include "user_sync.h"
+
+std::string rosterPin(uint32_t user) {
+  return std::to_string(100000 + user);
+}
+
+std::string rosterCard(uint32_t user) {
+  char uid[9];
+  snprintf(uid, sizeof(uid), "%08X", (unsigned)(user * 2654435761u));
+  return uid;
+}
+
+std::string rosterCode(uint32_t code) {
+  return std::to_string(500000 + code);
+}
+
+void addRoster(FakeBackend& backend, uint32_t users, uint32_t codes) {
+  for (uint32_t i = 0; i < users; i++) {
+    std::string name = "user" + std::to_string(i);
+    if (i % 2 == 0) {
+      backend.addUser(name, rosterPin(i), "", AUTH_PIN);
+    } else {
+      backend.addUser(name, "", rosterCard(i), AUTH_NFC);
+    }
+  }
+  for (uint32_t i = 0; i < codes; i++) {
+    backend.addCode(rosterCode(i));
+  }
+}
+
+// UserSyncStream takes a plain function, so the target is a global
+static FakeBackend* loadingInto = nullptr;
+
+static void addSyncedUser(const SyncUser& user) {
+  if (user.op == SYNC_UPSERT) {
+    loadingInto->addUser(user.name, user.pin, user.nfc, user.authType);
+  }
+}
+
+bool loadUsersJson(FakeBackend& backend, const char* path) {
+  FILE* file = fopen(path, "rb");
+  if (!file) return false;
+  
+  loadingInto = &backend;
+  UserSyncStream stream(addSyncedUser);
+  stream.begin();
+  uint8_t chunk[4096];
+  size_t length;
+  while ((length = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+    stream.write(chunk, length);
+  }
+  fclose(file);
+  SyncReport report = stream.finish();
+  loadingInto = nullptr;
+  return report.parsed;
+}
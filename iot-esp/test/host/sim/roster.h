@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include "fake_backend.h"
+
+// Users for the fake backend. The synthetic roster is the one door_load
+// runs against: even users have PIN 100000+i, odd users a card, and codes
+// are online-only PINs from 500000. door_replay builds the same roster, so
+// a trace door_load recorded replays against the users it was made with.
+std::string rosterPin(uint32_t user);
+std::string rosterCard(uint32_t user);
+std::string rosterCode(uint32_t code);
+void addRoster(FakeBackend& backend, uint32_t users, uint32_t codes);
+
+// Loads an export of the real roster, the body of
+// GET /api/users/changes?since=0, through the firmware's own sync parser
+bool loadUsersJson(FakeBackend& backend, const char* path);
@@ -0,0 +1,175 @@
+#include "trace_file.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+static bool readAll(const char* path, std::vector<uint8_t>& data) {
+  FILE* file = fopen(path, "rb");
+  if (!file) return false;
+  uint8_t chunk[4096];
+  size_t length;
+  while ((length = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+    data.insert(data.end(), chunk, chunk + length);
+  }
+  fclose(file);
+  return true;
+}
+
+static int hexValue(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+// Puts the "<offset>:<hex>" chunks of a saved dump back together
+static bool decodeDump(const std::vector<uint8_t>& text, std::vector<uint8_t>& data, std::string& error) {
+  std::string all(text.begin(), text.end());
+  size_t expected = 0;
+  bool ended = false;
+  size_t lineStart = 0;
+  while (lineStart < all.size()) {
+    size_t lineEnd = all.find('\n', lineStart);
+    if (lineEnd == std::string::npos) lineEnd = all.size();
+    std::string line = all.substr(lineStart, lineEnd - lineStart);
+    lineStart = lineEnd + 1;
+    
+    // mosquitto_sub -v puts the topic first
+    size_t space = line.rfind(' ');
+    if (space != std::string::npos) line = line.substr(space + 1);
+    while (!line.empty() && (line.back() == '\r' || line.back() == ' ')) line.pop_back();
+    size_t colon = line.find(':');
+    if (colon == std::string::npos) continue;
+    
+    if (line.compare(0, colon, "end") == 0) {
+      expected = strtoul(line.c_str() + colon + 1, nullptr, 10);
+      ended = true;
+      continue;
+    }
+    size_t offset = strtoul(line.c_str(), nullptr, 10);
+    size_t length = (line.size() - colon - 1) / 2;
+    if (data.size() < offset + length) data.resize(offset + length);
+    for (size_t i = 0; i < length; i++) {
+      int high = hexValue(line[colon + 1 + 2 * i]);
+      int low = hexValue(line[colon + 2 + 2 * i]);
+      if (high < 0 || low < 0) {
+        error = "bad hex at offset " + std::to_string(offset + i);
+        return false;
+      }
+      data[offset + i] = (uint8_t)(high << 4 | low);
+    }
+  }
+  if (!ended || data.size() != expected) {
+    error = "incomplete dump";
+    return false;
+  }
+  return true;
+}
+
+static bool parseRecords(const uint8_t* at, const uint8_t* end, TraceFile& trace, std::string& error) {
+  uint64_t now = 0;
+  while (at < end) {
+    TraceEvent event;
+    event.type = (InputTraceRecord)*at++;
+    event.key = 0;
+    event.wifiStatus = 0;
+    uint64_t delta;
+    if (!getTraceVarint(at, end, delta)) break;
+    now += delta;
+    event.atUs = now;
+    
+    bool complete = false;
+    switch (event.type) {
+      case TRACE_KEY:
+      case TRACE_WIFI:
+        if (at < end) {
+          if (event.type == TRACE_KEY) event.key = (char)*at;
+          else event.wifiStatus = *at;
+          at++;
+          complete = true;
+        }
+        break;
+      
+      case TRACE_ARDUINO:
+        if (at < end && *at <= end - at - 1) {
+          uint8_t length = *at++;
+          event.text.assign((const char*)at, length);
+          at += length;
+          complete = true;
+        }
+        break;
+      
+      case TRACE_MQTT: {
+        if (at >= end) break;
+        uint8_t index = *at++;
+        if (index == TRACE_TOPIC_INLINE) {
+          if (at >= end || *at > end - at - 1) break;
+          uint8_t length = *at++;
+          event.topic.assign((const char*)at, length);
+          at += length;
+        } else if (index < INPUT_TRACE_TOPIC_COUNT) {
+          event.topic = INPUT_TRACE_TOPICS[index];
+        } else {
+          break;
+        }
+        uint64_t length;
+        if (!getTraceVarint(at, end, length) || length > (uint64_t)(end - at)) break;
+        event.text.assign((const char*)at, length);
+        at += length;
+        complete = true;
+        break;
+      }
+      
+      default:
+        break;
+    }
+    if (!complete) {
+      error = "bad record " + std::to_string(trace.events.size());
+      return false;
+    }
+    trace.events.push_back(event);
+  }
+  if (trace.events.size() != trace.header.records) {
+    error = "expected " + std::to_string(trace.header.records) + " records, found " +
+            std::to_string(trace.events.size());
+    return false;
+  }
+  return true;
+}
+
+bool readTraceFile(const char* path, TraceFile& trace, std::string& error) {
+  std::vector<uint8_t> raw;
+  if (!readAll(path, raw)) {
+    error = "cannot read file";
+    return false;
+  }
+  
+  std::vector<uint8_t> data;
+  uint32_t magic = INPUT_TRACE_MAGIC;
+  if (raw.size() >= sizeof(magic) && memcmp(raw.data(), &magic, sizeof(magic)) == 0) {
+    data.swap(raw);
+  } else if (!decodeDump(raw, data, error)) {
+    return false;
+  }
+  
+  if (data.size() < sizeof(InputTraceHeader)) {
+    error = "too short";
+    return false;
+  }
+  memcpy(&trace.header, data.data(), sizeof(InputTraceHeader));
+  const InputTraceHeader& header = trace.header;
+  if (header.magic != INPUT_TRACE_MAGIC || header.version != INPUT_TRACE_VERSION ||
+      header.headerSize != sizeof(InputTraceHeader) ||
+      data.size() != (size_t)header.headerSize + header.recordBytes) {
+    error = "not an input trace, or truncated";
+    return false;
+  }
+  trace.events.clear();
+  return parseRecords(data.data() + header.headerSize, data.data() + data.size(), trace, error);
+}
+
+bool writeTraceFile(const char* path, const std::vector<uint8_t>& data) {
+  FILE* file = fopen(path, "wb");
+  if (!file) return false;
+  bool written = fwrite(data.data(), 1, data.size(), file) == data.size();
+  return fclose(file) == 0 && written;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "input_trace_format.h"
+
+// One input from a trace, with its time from the start of the recording
+struct TraceEvent {
+  InputTraceRecord type;
+  uint64_t atUs;
+  char key;             // TRACE_KEY
+  uint8_t wifiStatus;   // TRACE_WIFI
+  std::string topic;    // TRACE_MQTT
+  std::string text;     // Serial2 line or MQTT payload
+};
+
+struct TraceFile {
+  InputTraceHeader header;
+  std::vector<TraceEvent> events;
+};
+
+// Reads a trace written by InputTrace. path is either the raw trace or the
+// admin/trace-data messages of a dump saved one per line ("<offset>:<hex>",
+// optionally after the topic as mosquitto_sub -v prints it). Returns false
+// with a reason in error if the file is not a complete, valid trace.
+bool readTraceFile(const char* path, TraceFile& trace, std::string& error);
+// Writes a raw trace
+bool writeTraceFile(const char* path, const std::vector<uint8_t>& data);
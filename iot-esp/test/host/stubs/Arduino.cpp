@@ -0,0 +1,300 @@
+#include "Arduino.h"
+#include "host_clock.h"
+#include "host_counters.h"
+#include "host_gpio.h"
+
+HardwareSerial Serial("Serial");
+HardwareSerial Serial2("Serial2");
+EspClass ESP;
+
+unsigned long millis() {
+  return hostClock::nowUs() / 1000;
+}
+
+unsigned long micros() {
+  return hostClock::nowUs();
+}
+
+void delay(unsigned long ms) {
+  hostClock::sleepUs((uint64_t)ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us) {
+  hostClock::spendNs((uint64_t)us * 1000);
+}
+
+void yield() {
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+  hostGpio::setMode(pin, mode);
+}
+
+void digitalWrite(uint8_t pin, uint8_t level) {
+  hostGpio::write(pin, level);
+}
+
+int digitalRead(uint8_t pin) {
+  return hostGpio::read(pin);
+}
+
+void attachInterrupt(uint8_t pin, void (*handler)(), int mode) {
+  hostGpio::attach(pin, handler, mode);
+}
+
+void detachInterrupt(uint8_t pin) {
+  hostGpio::detach(pin);
+}
+
+static uint32_t cpuMhz = 240;
+
+bool setCpuFrequencyMhz(uint32_t mhz) {
+  cpuMhz = mhz;
+  return true;
+}
+
+uint32_t getCpuFrequencyMhz() {
+  return cpuMhz;
+}
+
+uint32_t esp_random() {
+  static uint32_t state = 0x2545F491;
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+String String::substring(unsigned int begin, unsigned int end) const {
+  if (end > text.size()) end = text.size();
+  if (begin >= end) return String();
+  return String(text.substr(begin, end - begin));
+}
+
+bool String::endsWith(const String& suffix) const {
+  return text.size() >= suffix.text.size() &&
+         text.compare(text.size() - suffix.text.size(), suffix.text.size(), suffix.text) == 0;
+}
+
+void String::trim() {
+  size_t begin = text.find_first_not_of(" \t\r\n");
+  if (begin == std::string::npos) {
+    text.clear();
+    return;
+  }
+  size_t end = text.find_last_not_of(" \t\r\n");
+  text = text.substr(begin, end - begin + 1);
+}
+
+void String::replace(const String& find, const String& with) {
+  if (find.text.empty()) return;
+  size_t at = 0;
+  while ((at = text.find(find.text, at)) != std::string::npos) {
+    text.replace(at, find.text.size(), with.text);
+    at += with.text.size();
+  }
+}
+
+void String::fromSigned(long long value, unsigned char base) {
+  if (value < 0 && base == DEC) {
+    fromUnsigned(-(unsigned long long)value, base);
+    text.insert(text.begin(), '-');
+  } else {
+    fromUnsigned((unsigned long long)value, base);
+  }
+}
+
+void String::fromUnsigned(unsigned long long value, unsigned char base) {
+  static const char digits[] = "0123456789ABCDEF";
+  char buffer[66];
+  int at = sizeof(buffer);
+  buffer[--at] = '\0';
+  do {
+    buffer[--at] = digits[value % base];
+    value /= base;
+  } while (value > 0);
+  text = buffer + at;
+}
+
+void String::fromDouble(double value, unsigned int decimals) {
+  char buffer[64];
+  snprintf(buffer, sizeof(buffer), "%.*f", decimals, value);
+  text = buffer;
+}
+
+size_t Print::write(const uint8_t* buffer, size_t size) {
+  size_t written = 0;
+  while (written < size && write(buffer[written])) {
+    written++;
+  }
+  return written;
+}
+
+size_t Print::printf(const char* format, ...) {
+  char buffer[256];
+  va_list args;
+  va_start(args, format);
+  int length = vsnprintf(buffer, sizeof(buffer), format, args);
+  va_end(args);
+  if (length < 0) return 0;
+  if ((size_t)length < sizeof(buffer)) {
+    return write((const uint8_t*)buffer, length);
+  }
+  
+  std::string large(length + 1, '\0');
+  va_start(args, format);
+  vsnprintf(&large[0], large.size(), format, args);
+  va_end(args);
+  return write((const uint8_t*)large.data(), length);
+}
+
+size_t Stream::readBytes(uint8_t* buffer, size_t length) {
+  size_t count = 0;
+  while (count < length && available()) {
+    buffer[count++] = read();
+  }
+  return count;
+}
+
+String Stream::readString() {
+  std::string text;
+  while (available()) {
+    text += (char)read();
+  }
+  return String(text);
+}
+
+String Stream::readStringUntil(char terminator) {
+  std::string text;
+  while (available()) {
+    int c = read();
+    if (c == terminator) break;
+    text += (char)c;
+  }
+  return String(text);
+}
+
+void HardwareSerial::begin(unsigned long baud, uint32_t, int8_t, int8_t) {
+  updateBaudRate(baud);
+}
+
+void HardwareSerial::updateBaudRate(unsigned long baud) {
+  this->baud = baud;
+  // 8N1: ten bit times per character
+  byteNs = baud > 0 ? 10000000000ULL / baud : 0;
+}
+
+void HardwareSerial::flush() {
+  uint64_t now = hostClock::nowNs();
+  if (txIdleNs > now) {
+    hostClock::spendNs(txIdleNs - now);
+  }
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+  return write(&c, 1);
+}
+
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size) {
+  if (sink) {
+    sink(sinkContext, buffer, size);
+  } else if (!muted) {
+    fwrite(buffer, 1, size, stdout);
+  }
+  
+  if (byteNs > 0) {
+    // Returns once what is still on the wire fits the FIFO
+    uint64_t now = hostClock::nowNs();
+    txIdleNs = (txIdleNs > now ? txIdleNs : now) + size * byteNs;
+    uint64_t fifoNs = TX_FIFO_SIZE * byteNs;
+    if (txIdleNs > now + fifoNs) {
+      hostClock::spendNs(txIdleNs - fifoNs - now);
+    }
+  }
+  return size;
+}
+
+void HardwareSerial::receive() {
+  uint64_t now = hostClock::nowNs();
+  while (!wire.empty() && wire.front().arrivesNs <= now) {
+    if (rx.size() - rxPos < rxBufferSize) {
+      rx += wire.front().c;
+    } else {
+      droppedBytes++;
+    }
+    wire.pop_front();
+  }
+}
+
+int HardwareSerial::available() {
+  receive();
+  return rx.size() - rxPos;
+}
+
+int HardwareSerial::read() {
+  receive();
+  if (rxPos >= rx.size()) return -1;
+  int c = (uint8_t)rx[rxPos++];
+  if (rxPos == rx.size()) {
+    rx.clear();
+    rxPos = 0;
+  }
+  return c;
+}
+
+int HardwareSerial::peek() {
+  receive();
+  return rxPos < rx.size() ? (uint8_t)rx[rxPos] : -1;
+}
+
+void HardwareSerial::pollReceive() {
+  Serial.pollOne();
+  Serial2.pollOne();
+}
+
+void HardwareSerial::pollOne() {
+  if (!receiveCallback) return;
+  receive();
+  size_t unread = rx.size() - rxPos;
+  if (unread > signalled) receiveCallback();
+  signalled = unread;
+}
+
+void HardwareSerial::inject(const char* text) {
+  injectAt(hostClock::nowUs(), text);
+}
+
+void HardwareSerial::injectAt(uint64_t atUs, const char* text) {
+  injectAt(atUs, (const uint8_t*)text, strlen(text));
+}
+
+void HardwareSerial::injectAt(uint64_t atUs, const uint8_t* data, size_t length) {
+  uint64_t at = atUs * 1000;
+  if (at < lastArrivalNs) at = lastArrivalNs;
+  for (size_t i = 0; i < length; i++) {
+    at += byteNs;
+    wire.push_back({at, (char)data[i]});
+  }
+  lastArrivalNs = at;
+}
+
+static uint64_t heapBaseline = 0;
+static uint32_t minFreeHeap = EspClass::HEAP_SIZE;
+
+uint32_t EspClass::getFreeHeap() {
+  static bool started = false;
+  uint64_t live = hostCounters.liveBytes.load();
+  if (!started) {
+    heapBaseline = live;
+    started = true;
+  }
+  uint64_t used = live > heapBaseline ? live - heapBaseline : 0;
+  uint32_t free = used < HEAP_SIZE ? HEAP_SIZE - used : 0;
+  if (free < minFreeHeap) minFreeHeap = free;
+  return free;
+}
+
+uint32_t EspClass::getMinFreeHeap() {
+  getFreeHeap();
+  return minFreeHeap;
+}
@@ -0,0 +1,270 @@
+#pragma once
+
+// Host stand-in for the parts of the Arduino-ESP32 core the firmware uses.
+// String keeps Arduino's API on top of std::string; time comes from the
+// host clock (see host_clock.h for the virtual clock used by simulations).
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <deque>
+#include <functional>
+#include <string>
+#include <type_traits>
+#include "freertos/FreeRTOS.h"
+
+#define HEX 16
+#define DEC 10
+
+#define LOW 0x0
+#define HIGH 0x1
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+#define IRAM_ATTR
+#define digitalPinToInterrupt(pin) (pin)
+
+typedef uint8_t byte;
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+// GPIO as host_gpio.h simulates it
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t level);
+int digitalRead(uint8_t pin);
+void attachInterrupt(uint8_t pin, void (*handler)(), int mode);
+void detachInterrupt(uint8_t pin);
+// Deterministic on the host, so simulated runs repeat
+uint32_t esp_random();
+// Recorded only; simulated costs do not scale with the clock
+bool setCpuFrequencyMhz(uint32_t mhz);
+uint32_t getCpuFrequencyMhz();
+
+class String {
+public:
+  String() {}
+  String(const char* text) : text(text ? text : "") {}
+  String(const std::string& text) : text(text) {}
+  explicit String(char c) : text(1, c) {}
+  explicit String(int value, unsigned char base = DEC) { fromSigned(value, base); }
+  explicit String(long value, unsigned char base = DEC) { fromSigned(value, base); }
+  explicit String(unsigned int value, unsigned char base = DEC) { fromUnsigned(value, base); }
+  explicit String(unsigned long value, unsigned char base = DEC) { fromUnsigned(value, base); }
+  explicit String(unsigned char value, unsigned char base = DEC) { fromUnsigned(value, base); }
+  explicit String(long long value, unsigned char base = DEC) { fromSigned(value, base); }
+  explicit String(unsigned long long value, unsigned char base = DEC) { fromUnsigned(value, base); }
+  explicit String(float value, unsigned int decimals = 2) { fromDouble(value, decimals); }
+  explicit String(double value, unsigned int decimals = 2) { fromDouble(value, decimals); }
+  
+  const char* c_str() const { return text.c_str(); }
+  unsigned int length() const { return text.size(); }
+  bool isEmpty() const { return text.empty(); }
+  bool reserve(unsigned int size) { text.reserve(size); return true; }
+  
+  char operator[](unsigned int index) const { return index < text.size() ? text[index] : 0; }
+  char& operator[](unsigned int index) { return text[index]; }
+  char charAt(unsigned int index) const { return (*this)[index]; }
+  
+  String& operator+=(const String& other) { text += other.text; return *this; }
+  String& operator+=(const char* other) { text += other ? other : ""; return *this; }
+  String& operator+=(char c) { text += c; return *this; }
+  template <typename T, typename std::enable_if<std::is_arithmetic<T>::value && !std::is_same<T, char>::value, int>::type = 0>
+  String& operator+=(T value) { return *this += String(value); }
+  bool concat(const String& other) { text += other.text; return true; }
+  bool concat(const char* other) { text += other ? other : ""; return true; }
+  bool concat(char c) { text += c; return true; }
+  
+  bool operator==(const String& other) const { return text == other.text; }
+  bool operator==(const char* other) const { return text == (other ? other : ""); }
+  bool operator!=(const String& other) const { return !(*this == other); }
+  bool operator!=(const char* other) const { return !(*this == other); }
+  bool operator<(const String& other) const { return text < other.text; }
+  bool equals(const String& other) const { return text == other.text; }
+  
+  int indexOf(char c, unsigned int from = 0) const { return position(text.find(c, from)); }
+  int indexOf(const String& other, unsigned int from = 0) const { return position(text.find(other.text, from)); }
+  int lastIndexOf(char c) const { return position(text.rfind(c)); }
+  int lastIndexOf(const String& other) const { return position(text.rfind(other.text)); }
+  String substring(unsigned int begin) const { return begin >= text.size() ? String() : String(text.substr(begin)); }
+  String substring(unsigned int begin, unsigned int end) const;
+  bool startsWith(const String& prefix) const { return text.compare(0, prefix.text.size(), prefix.text) == 0; }
+  bool endsWith(const String& suffix) const;
+  
+  long toInt() const { return atol(text.c_str()); }
+  float toFloat() const { return atof(text.c_str()); }
+  void trim();
+  void toLowerCase() { for (char& c : text) c = tolower((unsigned char)c); }
+  void toUpperCase() { for (char& c : text) c = toupper((unsigned char)c); }
+  void replace(const String& find, const String& with);
+  void remove(unsigned int index) { if (index < text.size()) text.erase(index); }
+  void remove(unsigned int index, unsigned int count) { if (index < text.size()) text.erase(index, count); }
+  
+  const std::string& str() const { return text; }
+
+private:
+  std::string text;
+  
+  static int position(size_t found) { return found == std::string::npos ? -1 : (int)found; }
+  void fromSigned(long long value, unsigned char base);
+  void fromUnsigned(unsigned long long value, unsigned char base);
+  void fromDouble(double value, unsigned int decimals);
+};
+
+inline String operator+(const String& a, const String& b) { String sum(a); sum += b; return sum; }
+inline String operator+(const String& a, const char* b) { String sum(a); sum += b; return sum; }
+inline String operator+(const char* a, const String& b) { String sum(a); sum += b; return sum; }
+inline String operator+(const String& a, char b) { String sum(a); sum += b; return sum; }
+template <typename T, typename std::enable_if<std::is_arithmetic<T>::value && !std::is_same<T, char>::value, int>::type = 0>
+inline String operator+(const String& a, T b) { String sum(a); sum += String(b); return sum; }
+
+class Print;
+
+class Printable {
+public:
+  virtual ~Printable() {}
+  virtual size_t printTo(Print& p) const = 0;
+};
+
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t* buffer, size_t size);
+  size_t write(const char* text) { return write((const uint8_t*)text, strlen(text)); }
+  
+  size_t print(const String& text) { return write((const uint8_t*)text.c_str(), text.length()); }
+  size_t print(const char* text) { return write(text); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(int value, int base = DEC) { return print(String(value, base)); }
+  size_t print(unsigned int value, int base = DEC) { return print(String(value, base)); }
+  size_t print(long value, int base = DEC) { return print(String(value, base)); }
+  size_t print(unsigned long value, int base = DEC) { return print(String(value, base)); }
+  size_t print(unsigned char value, int base = DEC) { return print(String(value, base)); }
+  size_t print(double value, int decimals = 2) { return print(String(value, decimals)); }
+  size_t print(const Printable& value) { return value.printTo(*this); }
+  
+  size_t println() { return write("\r\n"); }
+  template <typename T> size_t println(const T& value) { return print(value) + println(); }
+  template <typename T> size_t println(const T& value, int format) { return print(value, format) + println(); }
+  
+  size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+};
+
+class Stream : public Print {
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+  virtual void flush() {}
+  
+  void setTimeout(unsigned long ms) { timeout = ms; }
+  size_t readBytes(uint8_t* buffer, size_t length);
+  String readString();
+  String readStringUntil(char terminator);
+
+protected:
+  unsigned long timeout = 1000;
+};
+
+// Serial ports. Output goes to stdout (or nowhere when muted); input is
+// whatever a test injected, so simulators can play the other side of a link.
+// Once begin() has set a baud rate the port also keeps UART time: injected
+// bytes arrive one character time apart into a 256-byte receive buffer
+// (overflow is dropped and counted), and a write that does not fit the
+// 128-byte transmit FIFO blocks the writer until it drains.
+class HardwareSerial : public Stream {
+public:
+  static const size_t TX_FIFO_SIZE = 128;
+  
+  explicit HardwareSerial(const char* name) : name(name) {}
+  
+  void begin(unsigned long baud, uint32_t config = 0, int8_t rxPin = -1, int8_t txPin = -1);
+  void end() {}
+  void updateBaudRate(unsigned long baud);
+  // The driver's receive buffer; 256 bytes unless set before begin()
+  void setRxBufferSize(size_t size) { rxBufferSize = size; }
+  operator bool() const { return true; }
+  
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t* buffer, size_t size) override;
+  using Print::write;
+  int available() override;
+  int read() override;
+  int peek() override;
+  // Waits until everything written has left the wire
+  void flush() override;
+  // Called from a waiting ulTaskNotifyTake() once bytes have arrived, as
+  // the UART driver's event task would
+  void onReceive(std::function<void()> callback, bool = false) { receiveCallback = callback; }
+  static void pollReceive();
+  
+  // Host side of the port. inject() starts sending now, injectAt() at a
+  // later time; either way bytes queue behind those still on the wire.
+  void inject(const char* text);
+  void injectAt(uint64_t atUs, const char* text);
+  void injectAt(uint64_t atUs, const uint8_t* data, size_t length);
+  uint32_t rxDropped() const { return droppedBytes; }
+  uint64_t byteTimeNs() const { return byteNs; }
+  unsigned long baudRate() const { return baud; }
+  void setMuted(bool muted) { this->muted = muted; }
+  // Receives everything the firmware writes to the port, instead of stdout
+  void setSink(void (*sink)(void* context, const uint8_t* data, size_t length), void* context) {
+    this->sink = sink;
+    sinkContext = context;
+  }
+
+private:
+  struct Incoming {
+    uint64_t arrivesNs;
+    char c;
+  };
+  
+  const char* name;
+  unsigned long baud = 0;
+  uint64_t byteNs = 0;  // one character time, 0 until begin()
+  size_t rxBufferSize = 256;
+  std::deque<Incoming> wire;
+  std::string rx;
+  size_t rxPos = 0;
+  uint64_t lastArrivalNs = 0;
+  uint64_t txIdleNs = 0;
+  uint32_t droppedBytes = 0;
+  bool muted = false;
+  void (*sink)(void* context, const uint8_t* data, size_t length) = nullptr;
+  void* sinkContext = nullptr;
+  std::function<void()> receiveCallback;
+  size_t signalled = 0;  // rx bytes the callback has been told about
+  
+  void receive();
+  void pollOne();
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial2;
+
+#define SERIAL_8N1 0x800001c
+
+// Heap figures for the firmware's diagnostics. The host heap is modelled as
+// a fixed budget minus whatever has been allocated and not freed since the
+// first call (see hostCounters.liveBytes).
+class EspClass {
+public:
+  static const uint32_t HEAP_SIZE = 300000;
+  
+  uint32_t getHeapSize() { return HEAP_SIZE; }
+  uint32_t getFreeHeap();
+  uint32_t getMinFreeHeap();
+  uint32_t getMaxAllocHeap() { return getFreeHeap(); }
+};
+
+extern EspClass ESP;
@@ -0,0 +1,84 @@
+#include "EspMQTTClient.h"
+#include "WiFi.h"
+#include "host_clock.h"
+#include "host_net.h"
+
+EspMQTTClient::EspMQTTClient(const char*, const char*, const char*, const char*, const char*, const char*, uint16_t) {
+  connected = false;
+  connectAtUs = 0;
+  epoch = 0;
+}
+
+// QoS 0: whatever the broker sends while we are away is gone
+void EspMQTTClient::dropDueMessages() {
+  std::string topic;
+  std::string payload;
+  while (hostNet::takeDue(hostClock::nowUs(), topic, payload)) {
+    hostNet::countLost();
+  }
+}
+
+void EspMQTTClient::loop() {
+  if (connected && (WiFi.status() != WL_CONNECTED || epoch != hostNet::linkEpoch())) {
+    connected = false;
+    connectAtUs = 0;
+  }
+  
+  if (!connected) {
+    if (WiFi.status() == WL_CONNECTED) {
+      if (connectAtUs == 0) {
+        connectAtUs = hostClock::nowUs() + (uint64_t)hostNet::params().mqttConnectMs * 1000;
+      } else if (hostClock::nowUs() >= connectAtUs) {
+        connected = true;
+        connectAtUs = 0;
+        epoch = hostNet::linkEpoch();
+        subscriptions.clear();
+        onConnectionEstablished();
+      }
+    }
+    if (!connected) {
+      dropDueMessages();
+      return;
+    }
+  }
+  
+  std::string topic;
+  std::string payload;
+  while (hostNet::takeDue(hostClock::nowUs(), topic, payload)) {
+    hostClock::spendNs(MESSAGE_NS);
+    for (const Subscription& subscription : subscriptions) {
+      if (subscription.topic == topic.c_str()) {
+        subscription.callback(String(payload));
+      }
+    }
+  }
+}
+
+bool EspMQTTClient::publish(const String& topic, const String& payload, bool) {
+  // A write on a link that has gone fails before loop() notices
+  if (!connected || WiFi.status() != WL_CONNECTED || epoch != hostNet::linkEpoch()) return false;
+  hostClock::spendNs(MESSAGE_NS);
+  hostNet::published(topic.str(), payload.str());
+  return true;
+}
+
+bool EspMQTTClient::subscribe(const String& topic, MessageReceivedCallback callback, uint8_t) {
+  for (Subscription& subscription : subscriptions) {
+    if (subscription.topic == topic) {
+      subscription.callback = callback;
+      return true;
+    }
+  }
+  subscriptions.push_back({topic, callback});
+  return true;
+}
+
+bool EspMQTTClient::unsubscribe(const String& topic) {
+  for (size_t i = 0; i < subscriptions.size(); i++) {
+    if (subscriptions[i].topic == topic) {
+      subscriptions.erase(subscriptions.begin() + i);
+      return true;
+    }
+  }
+  return false;
+}
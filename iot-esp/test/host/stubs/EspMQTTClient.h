@@ -0,0 +1,42 @@
+#pragma once
+
+#include "Arduino.h"
+#include <functional>
+#include <vector>
+
+typedef std::function<void(const String& message)> MessageReceivedCallback;
+
+// Defined by the firmware; called every time the broker connection is made
+void onConnectionEstablished();
+
+// MQTT client on top of the simulated broker in host_net.h. loop()
+// connects once WiFi is up (mqttConnectMs later), calls
+// onConnectionEstablished() and then hands due messages to the callbacks
+// subscribed to their topic. Subscriptions do not survive a reconnect.
+class EspMQTTClient {
+public:
+  static const uint32_t MESSAGE_NS = 100000;  // TCP read/write per packet
+  
+  EspMQTTClient(const char* wifiSsid, const char* wifiPassword, const char* mqttServerIp,
+                const char* mqttUsername, const char* mqttPassword, const char* mqttClientName = "ESP32",
+                uint16_t mqttServerPort = 1883);
+  
+  void loop();
+  bool isConnected() const { return connected; }
+  bool publish(const String& topic, const String& payload, bool retain = false);
+  bool subscribe(const String& topic, MessageReceivedCallback callback, uint8_t qos = 0);
+  bool unsubscribe(const String& topic);
+
+private:
+  struct Subscription {
+    String topic;
+    MessageReceivedCallback callback;
+  };
+  
+  bool connected;
+  uint64_t connectAtUs;
+  uint32_t epoch;
+  std::vector<Subscription> subscriptions;
+  
+  void dropDueMessages();
+};
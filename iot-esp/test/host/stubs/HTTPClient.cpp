@@ -0,0 +1,92 @@
+#include "HTTPClient.h"
+#include "host_clock.h"
+#include "host_net.h"
+
+bool HTTPClient::begin(WiFiClient& client, const char* host, uint16_t port, const char* uri) {
+  this->client = &client;
+  this->host = host;
+  this->port = port;
+  this->uri = uri;
+  authorization.clear();
+  response.status = 0;
+  response.body.clear();
+  return true;
+}
+
+void HTTPClient::end() {
+  if (!client) return;
+  if (reuse) {
+    client->touch();
+  } else {
+    client->stop();
+  }
+}
+
+void HTTPClient::addHeader(const String& name, const String& value) {
+  if (name == "Authorization") {
+    authorization = value.str();
+  }
+}
+
+int HTTPClient::GET() {
+  return sendRequest("GET", "");
+}
+
+int HTTPClient::POST(const String& body) {
+  return sendRequest("POST", body.str());
+}
+
+int HTTPClient::POST(uint8_t* payload, size_t size) {
+  return sendRequest("POST", std::string((const char*)payload, size));
+}
+
+int HTTPClient::sendRequest(const char* method, const std::string& body) {
+  if (!client->connected() && !client->connect(host.c_str(), port, connectTimeout)) {
+    return HTTPC_ERROR_CONNECTION_REFUSED;
+  }
+  
+  const HostNetParams& params = hostNet::params();
+  uint64_t latencyUs = (uint64_t)params.rttUs + params.serverUs;
+  if (!hostNet::serverUp() || latencyUs > (uint64_t)responseTimeout * 1000) {
+    hostClock::sleepUs((uint64_t)responseTimeout * 1000);
+    client->stop();
+    return HTTPC_ERROR_READ_TIMEOUT;
+  }
+  
+  uint32_t epoch = hostNet::linkEpoch();
+  HostHttpRequest request = {method, uri, body, authorization};
+  HostHttpResponse answer = hostNet::handleHttp(request);
+  hostClock::sleepUs(latencyUs);
+  if (hostNet::linkEpoch() != epoch) {
+    client->stop();
+    return HTTPC_ERROR_CONNECTION_LOST;
+  }
+  
+  response.status = answer.status;
+  response.body = answer.body;
+  return response.status;
+}
+
+void HTTPClient::spendTransfer(size_t bytes) {
+  uint32_t rate = hostNet::params().bytesPerSec;
+  if (rate > 0) {
+    hostClock::sleepUs((uint64_t)bytes * 1000000 / rate);
+  }
+}
+
+String HTTPClient::getString() {
+  spendTransfer(response.body.size());
+  return String(response.body);
+}
+
+int HTTPClient::writeToStream(Stream* stream) {
+  const std::string& body = response.body;
+  for (size_t offset = 0; offset < body.size(); offset += SEGMENT_SIZE) {
+    size_t length = body.size() - offset < SEGMENT_SIZE ? body.size() - offset : SEGMENT_SIZE;
+    spendTransfer(length);
+    if (stream->write((const uint8_t*)body.data() + offset, length) != length) {
+      return HTTPC_ERROR_STREAM_WRITE;
+    }
+  }
+  return body.size();
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "Arduino.h"
+#include "WiFi.h"
+
+#define HTTP_CODE_OK 200
+#define HTTPC_ERROR_CONNECTION_REFUSED (-1)
+#define HTTPC_ERROR_CONNECTION_LOST (-5)
+#define HTTPC_ERROR_STREAM_WRITE (-10)
+#define HTTPC_ERROR_READ_TIMEOUT (-11)
+
+// HTTP/1.1 client over a WiFiClient, answered by the handler installed
+// with hostNet::setHttpHandler(). A request costs a connect round trip when
+// the socket is closed, then one round trip plus the server's processing
+// time; bodies take their size over bytesPerSec to arrive.
+class HTTPClient {
+public:
+  bool begin(WiFiClient& client, const char* host, uint16_t port, const char* uri);
+  void end();
+  void setReuse(bool reuse) { this->reuse = reuse; }
+  void setConnectTimeout(int32_t ms) { connectTimeout = ms; }
+  void setTimeout(uint16_t ms) { responseTimeout = ms; }
+  void addHeader(const String& name, const String& value);
+  
+  int GET();
+  int POST(const String& body);
+  int POST(uint8_t* payload, size_t size);
+  String getString();
+  int writeToStream(Stream* stream);
+  int getSize() { return response.body.size(); }
+
+private:
+  static const size_t SEGMENT_SIZE = 1436;
+  
+  WiFiClient* client = nullptr;
+  std::string host;
+  uint16_t port = 0;
+  std::string uri;
+  std::string authorization;
+  bool reuse = true;
+  int32_t connectTimeout = 5000;
+  uint16_t responseTimeout = 5000;
+  struct {
+    int status;
+    std::string body;
+  } response = {0, ""};
+  
+  int sendRequest(const char* method, const std::string& body);
+  void spendTransfer(size_t bytes);
+};
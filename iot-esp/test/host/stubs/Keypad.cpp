@@ -0,0 +1,82 @@
+#include "Keypad.h"
+#include "host_clock.h"
+#include "host_gpio.h"
+
+Keypad::Keypad(char* keymap, byte* rowPins, byte* colPins, byte rows, byte cols)
+  : keymap(keymap), rows(rows < 4 ? rows : 4), cols(cols < 4 ? cols : 4) {
+  memcpy(this->rowPins, rowPins, this->rows);
+  memcpy(this->colPins, colPins, this->cols);
+  hostGpio::setDevice({level, nextChangeUs, this});
+  lastScan = 0;
+  debounceMs = 10;
+  missed = 0;
+}
+
+char Keypad::getKey() {
+  if (millis() - lastScan <= debounceMs) return NO_KEY;
+  
+  hostClock::spendNs(SCAN_NS);
+  lastScan = millis();
+  
+  uint64_t now = hostClock::nowUs();
+  while (!pending.empty()) {
+    const Press& press = pending.front();
+    if (press.atUs > now) return NO_KEY;
+    if (press.releaseUs < now) {
+      // Pressed and released between two scans
+      missed++;
+      pending.pop_front();
+      continue;
+    }
+    char key = press.key;
+    reported.push_back(press);
+    pending.pop_front();
+    return key;
+  }
+  return NO_KEY;
+}
+
+bool Keypad::held(const Press& press, uint64_t nowUs, byte row) const {
+  if (press.atUs > nowUs || press.releaseUs <= nowUs) return false;
+  for (byte column = 0; column < cols; column++) {
+    if (keymap[row * cols + column] == press.key && hostGpio::driven(colPins[column]) == LOW) return true;
+  }
+  return false;
+}
+
+// A row reads LOW through any held key whose column is driven LOW; left to
+// its pull-up otherwise
+int Keypad::level(void* context, uint8_t pin) {
+  Keypad* keypad = static_cast<Keypad*>(context);
+  uint64_t now = hostClock::nowUs();
+  while (!keypad->reported.empty() && keypad->reported.front().releaseUs <= now) {
+    keypad->reported.pop_front();
+  }
+  for (byte row = 0; row < keypad->rows; row++) {
+    if (keypad->rowPins[row] != pin) continue;
+    for (const Press& press : keypad->reported) {
+      if (keypad->held(press, now, row)) return LOW;
+    }
+    for (const Press& press : keypad->pending) {
+      if (press.atUs > now) break;
+      if (keypad->held(press, now, row)) return LOW;
+    }
+  }
+  return -1;
+}
+
+uint64_t Keypad::nextChangeUs(void* context, uint64_t nowUs) {
+  Keypad* keypad = static_cast<Keypad*>(context);
+  uint64_t next = UINT64_MAX;
+  for (const std::deque<Press>* presses : {&keypad->reported, &keypad->pending}) {
+    for (const Press& press : *presses) {
+      if (press.atUs > nowUs && press.atUs < next) next = press.atUs;
+      if (press.releaseUs > nowUs && press.releaseUs < next) next = press.releaseUs;
+    }
+  }
+  return next;
+}
+
+void Keypad::press(uint64_t atUs, char key, uint32_t holdMs) {
+  pending.push_back({atUs, atUs + (uint64_t)holdMs * 1000, key});
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "Arduino.h"
+
+#define makeKeymap(x) ((char*)x)
+#define NO_KEY '\0'
+
+// 4x4 matrix keypad as the Keypad library reads it: getKey() scans the
+// matrix only when more than the debounce time has passed since the last
+// scan, and reports a key on the scan that first sees it down. Presses come
+// from the host with a hold time; one that no scan sees while it is held
+// is lost, just as on the real door when loop() is busy.
+//
+// The matrix is also wired to the host GPIO (host_gpio.h): while a key is
+// held, its row pin reads LOW if the firmware drives its column LOW, so
+// row interrupts fire as they would on the board.
+class Keypad {
+public:
+  static const uint32_t SCAN_NS = 30000;  // 4 column drives, 16 pin reads
+  
+  Keypad(char* keymap, byte* rowPins, byte* colPins, byte rows, byte cols);
+  
+  char getKey();
+  void setDebounceTime(unsigned int ms) { debounceMs = ms; }
+  
+  // Host side
+  void press(uint64_t atUs, char key, uint32_t holdMs);
+  void clearPresses() {
+    pending.clear();
+    reported.clear();
+  }
+  uint32_t missedKeys() const { return missed; }
+  size_t pendingKeys() const { return pending.size(); }
+
+private:
+  struct Press {
+    uint64_t atUs;
+    uint64_t releaseUs;
+    char key;
+  };
+  
+  std::deque<Press> pending;
+  std::deque<Press> reported;  // seen by a scan, maybe still held
+  const char* keymap;
+  byte rowPins[4];
+  byte colPins[4];
+  byte rows;
+  byte cols;
+  unsigned long lastScan;
+  unsigned int debounceMs;
+  uint32_t missed;
+  
+  bool held(const Press& press, uint64_t nowUs, byte row) const;
+  static int level(void* context, uint8_t pin);
+  static uint64_t nextChangeUs(void* context, uint64_t nowUs);
+};
@@ -0,0 +1,96 @@
+#include "LiquidCrystal_I2C.h"
+#include "Wire.h"
+#include "host_clock.h"
+
+TwoWire Wire;
+
+LiquidCrystal_I2C::LiquidCrystal_I2C(uint8_t, uint8_t columns, uint8_t rows)
+  : columns(columns < MAX_COLUMNS ? columns : MAX_COLUMNS), rows(rows < MAX_ROWS ? rows : MAX_ROWS) {
+  memset(text, ' ', sizeof(text));
+  cursorColumn = 0;
+  cursorRow = 0;
+  busBytes = 0;
+  busNs = 0;
+  observer = nullptr;
+  observerContext = nullptr;
+}
+
+// Two nibbles, each an expander write plus an enable pulse of two more
+void LiquidCrystal_I2C::send(uint32_t extraNs) {
+  uint64_t ns = 2 * (3 * EXPANDER_WRITE_NS + PULSE_DELAY_NS) + extraNs;
+  busBytes += 2 * 3 * 2;
+  busNs += ns;
+  hostClock::spendNs(ns);
+}
+
+void LiquidCrystal_I2C::init() {
+  // Power-up wait and the 4-bit initialisation sequence
+  hostClock::spendNs(50000000);
+  for (uint8_t i = 0; i < 8; i++) {
+    send(SLOW_COMMAND_NS / 2);
+  }
+  clear();
+}
+
+void LiquidCrystal_I2C::clear() {
+  command(SLOW_COMMAND_NS);
+  memset(text, ' ', sizeof(text));
+  cursorColumn = 0;
+  cursorRow = 0;
+  notify();
+}
+
+void LiquidCrystal_I2C::home() {
+  command(SLOW_COMMAND_NS);
+  cursorColumn = 0;
+  cursorRow = 0;
+}
+
+void LiquidCrystal_I2C::setCursor(uint8_t column, uint8_t row) {
+  command();
+  cursorColumn = column;
+  cursorRow = row < rows ? row : rows - 1;
+}
+
+void LiquidCrystal_I2C::backlight() {
+  busBytes += 2;
+  busNs += EXPANDER_WRITE_NS;
+  hostClock::spendNs(EXPANDER_WRITE_NS);
+}
+
+void LiquidCrystal_I2C::noBacklight() {
+  backlight();
+}
+
+// The controller's line buffer is 40 characters; only the first
+// `columns` of them are visible
+void LiquidCrystal_I2C::putChar(uint8_t c) {
+  send();
+  if (cursorColumn < columns) {
+    text[cursorRow][cursorColumn] = c;
+  }
+  if (cursorColumn < 39) cursorColumn++;
+}
+
+size_t LiquidCrystal_I2C::write(uint8_t c) {
+  putChar(c);
+  notify();
+  return 1;
+}
+
+size_t LiquidCrystal_I2C::write(const uint8_t* buffer, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    putChar(buffer[i]);
+  }
+  notify();
+  return size;
+}
+
+String LiquidCrystal_I2C::line(uint8_t row) const {
+  if (row >= rows) return String();
+  return String(std::string(text[row], columns));
+}
+
+void LiquidCrystal_I2C::notify() {
+  if (observer) observer(observerContext, *this);
+}
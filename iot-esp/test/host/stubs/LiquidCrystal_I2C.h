@@ -0,0 +1,61 @@
+#pragma once
+
+#include "Arduino.h"
+
+// HD44780 character LCD behind a PCF8574 I2C expander, as driven by the
+// LiquidCrystal_I2C library. Text lands in a shadow of the visible
+// characters, and every call is charged the bus time the library spends:
+// each byte to the display is two 4-bit nibbles, each nibble three
+// expander writes of two I2C bytes at 100 kHz plus the enable pulse
+// delays, and clear()/home() add the controller's 2 ms.
+class LiquidCrystal_I2C : public Print {
+public:
+  static const uint32_t EXPANDER_WRITE_NS = 200000;  // start, 2 bytes + acks, stop
+  static const uint32_t PULSE_DELAY_NS = 51000;
+  static const uint32_t SLOW_COMMAND_NS = 2000000;
+  
+  LiquidCrystal_I2C(uint8_t address, uint8_t columns, uint8_t rows);
+  
+  void init();
+  void begin() { init(); }
+  void clear();
+  void home();
+  void setCursor(uint8_t column, uint8_t row);
+  void backlight();
+  void noBacklight();
+  void display() { command(); }
+  void noDisplay() { command(); }
+  
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t* buffer, size_t size) override;
+  using Print::write;
+  
+  // Host side
+  String line(uint8_t row) const;
+  uint64_t i2cBytes() const { return busBytes; }
+  uint64_t busyNs() const { return busNs; }
+  // Called after every call that changed what is on the screen
+  void setObserver(void (*observer)(void* context, const LiquidCrystal_I2C& lcd), void* context) {
+    this->observer = observer;
+    observerContext = context;
+  }
+
+private:
+  static const uint8_t MAX_COLUMNS = 20;
+  static const uint8_t MAX_ROWS = 4;
+  
+  uint8_t columns;
+  uint8_t rows;
+  char text[MAX_ROWS][MAX_COLUMNS];
+  uint8_t cursorColumn;
+  uint8_t cursorRow;
+  uint64_t busBytes;
+  uint64_t busNs;
+  void (*observer)(void* context, const LiquidCrystal_I2C& lcd);
+  void* observerContext;
+  
+  void send(uint32_t extraNs = 0);
+  void command(uint32_t extraNs = 0) { send(extraNs); }
+  void putChar(uint8_t c);
+  void notify();
+};
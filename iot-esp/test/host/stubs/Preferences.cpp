@@ -0,0 +1,171 @@
+#include "Preferences.h"
+#include "host_clock.h"
+#include "host_counters.h"
+#include <map>
+#include <mutex>
+#include <vector>
+
+typedef std::map<std::string, std::vector<uint8_t>> Namespace;
+
+static std::map<std::string, Namespace>& spaces() {
+  // Leaked on purpose: the firmware's globals still use it during exit
+  static std::map<std::string, Namespace>* all = new std::map<std::string, Namespace>();
+  return *all;
+}
+
+static std::mutex& lock() {
+  static std::mutex* mutex = new std::mutex();
+  return *mutex;
+}
+
+static NvsLatency latency = {0, 0, 0};
+
+static void countRead() {
+  hostCounters.flashReads.fetch_add(1, std::memory_order_relaxed);
+  hostClock::spendNs(latency.readNs);
+}
+
+static void countWrite() {
+  hostCounters.flashWrites.fetch_add(1, std::memory_order_relaxed);
+  hostClock::spendNs(latency.writeNs);
+}
+
+static void countErase() {
+  hostCounters.flashErases.fetch_add(1, std::memory_order_relaxed);
+  hostClock::spendNs(latency.eraseNs);
+}
+
+bool Preferences::begin(const char* name, bool readOnly, const char* partitionLabel) {
+  space = std::string(partitionLabel ? partitionLabel : "nvs") + "/" + name;
+  opened = true;
+  this->readOnly = readOnly;
+  return true;
+}
+
+void Preferences::end() {
+  opened = false;
+}
+
+bool Preferences::clear() {
+  if (!opened || readOnly) return false;
+  std::lock_guard<std::mutex> guard(lock());
+  countErase();
+  spaces()[space].clear();
+  return true;
+}
+
+bool Preferences::remove(const char* key) {
+  if (!opened || readOnly) return false;
+  std::lock_guard<std::mutex> guard(lock());
+  countErase();
+  return spaces()[space].erase(key) > 0;
+}
+
+bool Preferences::isKey(const char* key) {
+  if (!opened) return false;
+  std::lock_guard<std::mutex> guard(lock());
+  // NVS keeps a hash list of its entries in RAM; no flash access
+  return spaces()[space].count(key) > 0;
+}
+
+size_t Preferences::putBytes(const char* key, const void* value, size_t length) {
+  if (!opened || readOnly || !key) return 0;
+  std::lock_guard<std::mutex> guard(lock());
+  countWrite();
+  const uint8_t* bytes = (const uint8_t*)value;
+  spaces()[space][key].assign(bytes, bytes + length);
+  return length;
+}
+
+size_t Preferences::getBytes(const char* key, void* buffer, size_t maxLength) {
+  if (!opened) return 0;
+  std::lock_guard<std::mutex> guard(lock());
+  Namespace& entries = spaces()[space];
+  auto entry = entries.find(key);
+  if (entry == entries.end()) return 0;
+  // Like nvs_get_blob, a buffer that is too small gets nothing
+  if (buffer && entry->second.size() > maxLength) return 0;
+  countRead();
+  if (buffer) memcpy(buffer, entry->second.data(), entry->second.size());
+  return entry->second.size();
+}
+
+size_t Preferences::getBytesLength(const char* key) {
+  if (!opened) return 0;
+  std::lock_guard<std::mutex> guard(lock());
+  Namespace& entries = spaces()[space];
+  auto entry = entries.find(key);
+  return entry == entries.end() ? 0 : entry->second.size();
+}
+
+String Preferences::getString(const char* key, const String& defaultValue) {
+  size_t length = getBytesLength(key);
+  if (length == 0) return defaultValue;
+  std::string text(length, '\0');
+  getBytes(key, &text[0], length);
+  return String(text.c_str());
+}
+
+void Preferences::setLatency(const NvsLatency& value) {
+  latency = value;
+}
+
+void Preferences::eraseAll() {
+  std::lock_guard<std::mutex> guard(lock());
+  spaces().clear();
+}
+
+size_t Preferences::usedBytes() {
+  std::lock_guard<std::mutex> guard(lock());
+  size_t total = 0;
+  for (const auto& ns : spaces()) {
+    for (const auto& entry : ns.second) {
+      total += entry.first.size() + entry.second.size();
+    }
+  }
+  return total;
+}
+
+// File format: repeated [u16 space length][space][u16 key length][key][u32 value length][value]
+bool Preferences::saveFile(const char* path) {
+  FILE* file = fopen(path, "wb");
+  if (!file) return false;
+  std::lock_guard<std::mutex> guard(lock());
+  for (const auto& ns : spaces()) {
+    for (const auto& entry : ns.second) {
+      uint16_t spaceLength = ns.first.size();
+      uint16_t keyLength = entry.first.size();
+      uint32_t valueLength = entry.second.size();
+      fwrite(&spaceLength, sizeof(spaceLength), 1, file);
+      fwrite(ns.first.data(), 1, spaceLength, file);
+      fwrite(&keyLength, sizeof(keyLength), 1, file);
+      fwrite(entry.first.data(), 1, keyLength, file);
+      fwrite(&valueLength, sizeof(valueLength), 1, file);
+      fwrite(entry.second.data(), 1, valueLength, file);
+    }
+  }
+  return fclose(file) == 0;
+}
+
+bool Preferences::loadFile(const char* path) {
+  FILE* file = fopen(path, "rb");
+  if (!file) return false;
+  std::lock_guard<std::mutex> guard(lock());
+  spaces().clear();
+  uint16_t spaceLength;
+  while (fread(&spaceLength, sizeof(spaceLength), 1, file) == 1) {
+    std::string name(spaceLength, '\0');
+    uint16_t keyLength;
+    uint32_t valueLength;
+    if (fread(&name[0], 1, spaceLength, file) != spaceLength ||
+        fread(&keyLength, sizeof(keyLength), 1, file) != 1) break;
+    std::string key(keyLength, '\0');
+    if (fread(&key[0], 1, keyLength, file) != keyLength ||
+        fread(&valueLength, sizeof(valueLength), 1, file) != 1) break;
+    std::vector<uint8_t> value(valueLength);
+    if (fread(value.data(), 1, valueLength, file) != valueLength) break;
+    spaces()[name][key] = value;
+  }
+  fclose(file);
+  return true;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "Arduino.h"
+
+// Cost of one simulated NVS operation, spent on every call (busy wait on
+// the real clock, an advance of the virtual one)
+struct NvsLatency {
+  uint32_t readNs;
+  uint32_t writeNs;
+  uint32_t eraseNs;
+};
+
+// In-memory stand-in for the ESP32 Preferences (NVS) library. Every
+// namespace of every partition lives in one process-wide map, so separate
+// Preferences objects see each other's keys as on the device. Reads,
+// writes and erases are counted in hostCounters.
+class Preferences {
+public:
+  bool begin(const char* name, bool readOnly = false, const char* partitionLabel = nullptr);
+  void end();
+  
+  bool clear();
+  bool remove(const char* key);
+  bool isKey(const char* key);
+  
+  size_t putBytes(const char* key, const void* value, size_t length);
+  size_t getBytes(const char* key, void* buffer, size_t maxLength);
+  size_t getBytesLength(const char* key);
+  
+  size_t putBool(const char* key, bool value) { return putValue(key, (uint8_t)value); }
+  bool getBool(const char* key, bool defaultValue = false) { return getValue(key, (uint8_t)defaultValue) != 0; }
+  size_t putUChar(const char* key, uint8_t value) { return putValue(key, value); }
+  uint8_t getUChar(const char* key, uint8_t defaultValue = 0) { return getValue(key, defaultValue); }
+  size_t putUShort(const char* key, uint16_t value) { return putValue(key, value); }
+  uint16_t getUShort(const char* key, uint16_t defaultValue = 0) { return getValue(key, defaultValue); }
+  size_t putUInt(const char* key, uint32_t value) { return putValue(key, value); }
+  uint32_t getUInt(const char* key, uint32_t defaultValue = 0) { return getValue(key, defaultValue); }
+  size_t putULong(const char* key, uint32_t value) { return putValue(key, value); }
+  uint32_t getULong(const char* key, uint32_t defaultValue = 0) { return getValue(key, defaultValue); }
+  size_t putString(const char* key, const String& value) { return putBytes(key, value.c_str(), value.length() + 1); }
+  String getString(const char* key, const String& defaultValue = String());
+  
+  size_t freeEntries() { return 1000; }
+  
+  // Host controls
+  static void setLatency(const NvsLatency& latency);
+  static void eraseAll();
+  // Stored bytes across every namespace, for footprint reports
+  static size_t usedBytes();
+  // Persists every namespace to a file and back, for runs that restart
+  static bool saveFile(const char* path);
+  static bool loadFile(const char* path);
+
+private:
+  std::string space;
+  bool opened = false;
+  bool readOnly = false;
+  
+  template <typename T> size_t putValue(const char* key, T value) { return putBytes(key, &value, sizeof(value)); }
+  template <typename T> T getValue(const char* key, T defaultValue) {
+    T value = defaultValue;
+    if (getBytesLength(key) == sizeof(T)) getBytes(key, &value, sizeof(value));
+    return value;
+  }
+};
@@ -0,0 +1,75 @@
+#include "WiFi.h"
+#include "host_clock.h"
+#include "host_net.h"
+
+WiFiClass WiFi;
+
+String IPAddress::toString() const {
+  char text[16];
+  snprintf(text, sizeof(text), "%u.%u.%u.%u", octets[0], octets[1], octets[2], octets[3]);
+  return String(text);
+}
+
+wl_status_t WiFiClass::begin(const char*, const char*) {
+  started = true;
+  beganUs = hostClock::nowUs();
+  return status();
+}
+
+bool WiFiClass::disconnect(bool) {
+  started = false;
+  return true;
+}
+
+wl_status_t WiFiClass::status() {
+  if (!started) return WL_DISCONNECTED;
+  if (!hostNet::linkUp()) {
+    return everConnected ? WL_CONNECTION_LOST : WL_NO_SSID_AVAIL;
+  }
+  
+  // Associating starts at begin(), or when the link came back
+  uint64_t from = beganUs;
+  if (hostNet::linkChangedUs() > from && (autoReconnect || !everConnected)) {
+    from = hostNet::linkChangedUs();
+  }
+  if (hostClock::nowUs() < from + (uint64_t)hostNet::params().wifiConnectMs * 1000) {
+    return WL_DISCONNECTED;
+  }
+  everConnected = true;
+  return WL_CONNECTED;
+}
+
+int WiFiClient::connect(const char*, uint16_t, int32_t timeoutMs) {
+  open = false;
+  // No route fails at once; a dead server only after the timeout
+  if (WiFi.status() != WL_CONNECTED) return 0;
+  if (!hostNet::serverUp()) {
+    hostClock::sleepUs((uint64_t)timeoutMs * 1000);
+    return 0;
+  }
+  
+  uint32_t rtt = hostNet::params().rttUs;
+  if (rtt > (uint64_t)timeoutMs * 1000) {
+    hostClock::sleepUs((uint64_t)timeoutMs * 1000);
+    return 0;
+  }
+  hostClock::sleepUs(rtt);
+  open = true;
+  epoch = hostNet::linkEpoch();
+  lastUseUs = hostClock::nowUs();
+  return 1;
+}
+
+uint8_t WiFiClient::connected() {
+  if (!open) return 0;
+  // A link drop or the server's keep-alive timeout closes the socket
+  if (epoch != hostNet::linkEpoch() || !hostNet::linkUp() ||
+      hostClock::nowUs() - lastUseUs >= (uint64_t)hostNet::params().keepAliveMs * 1000) {
+    open = false;
+  }
+  return open;
+}
+
+void WiFiClient::touch() {
+  lastUseUs = hostClock::nowUs();
+}
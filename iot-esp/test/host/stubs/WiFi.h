@@ -0,0 +1,74 @@
+#pragma once
+
+#include "Arduino.h"
+
+// Station-mode WiFi and TCP client on top of the simulated link in
+// host_net.h. Association takes wifiConnectMs once begin() has been called
+// and the access point is in range; with auto-reconnect (the default) a
+// link that comes back re-associates by itself.
+
+typedef enum {
+  WL_IDLE_STATUS = 0,
+  WL_NO_SSID_AVAIL = 1,
+  WL_SCAN_COMPLETED = 2,
+  WL_CONNECTED = 3,
+  WL_CONNECT_FAILED = 4,
+  WL_CONNECTION_LOST = 5,
+  WL_DISCONNECTED = 6
+} wl_status_t;
+
+typedef enum {
+  WIFI_OFF = 0,
+  WIFI_STA = 1,
+  WIFI_AP = 2,
+  WIFI_AP_STA = 3
+} wifi_mode_t;
+
+class IPAddress : public Printable {
+public:
+  IPAddress(uint8_t a = 0, uint8_t b = 0, uint8_t c = 0, uint8_t d = 0) : octets{a, b, c, d} {}
+  
+  String toString() const;
+  size_t printTo(Print& p) const override { return p.print(toString()); }
+
+private:
+  uint8_t octets[4];
+};
+
+class WiFiClass {
+public:
+  bool mode(wifi_mode_t) { return true; }
+  bool setAutoReconnect(bool enabled) { autoReconnect = enabled; return true; }
+  void persistent(bool) {}
+  bool setSleep(bool) { return true; }
+  
+  wl_status_t begin(const char* ssid, const char* password = nullptr);
+  bool disconnect(bool wifiOff = false);
+  wl_status_t status();
+  bool isConnected() { return status() == WL_CONNECTED; }
+  int8_t RSSI() { return status() == WL_CONNECTED ? -58 : 0; }
+  IPAddress localIP() { return status() == WL_CONNECTED ? IPAddress(192, 168, 1, 50) : IPAddress(); }
+
+private:
+  bool started = false;
+  bool autoReconnect = true;
+  bool everConnected = false;
+  uint64_t beganUs = 0;
+};
+
+extern WiFiClass WiFi;
+
+class WiFiClient {
+public:
+  int connect(const char* host, uint16_t port, int32_t timeoutMs = 3000);
+  uint8_t connected();
+  void stop() { open = false; }
+  
+  // Host side, used by HTTPClient: marks the connection as just used
+  void touch();
+
+private:
+  bool open = false;
+  uint32_t epoch = 0;
+  uint64_t lastUseUs = 0;
+};
@@ -0,0 +1,14 @@
+#pragma once
+
+// Host stand-in for the ESP-IDF heap API, as if built with
+// CONFIG_HEAP_USE_HOOKS (ESP-IDF 5.1+): the allocator in host_counters.cpp
+// calls the allocation hook when the firmware defines one. Heap sizes come
+// from ESP in Arduino.h.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CONFIG_HEAP_USE_HOOKS 1
+#define MALLOC_CAP_8BIT (1 << 2)
+
+extern "C" __attribute__((weak)) void esp_heap_trace_alloc_hook(void* pointer, size_t size, uint32_t caps);
@@ -0,0 +1,5 @@
+#pragma once
+
+// The host stand-ins follow the ESP-IDF 4.4 API of Arduino-ESP32 2.x
+#define ESP_IDF_VERSION_MAJOR 4
+#define ESP_IDF_VERSION_MINOR 4
@@ -0,0 +1,91 @@
+#include "esp_partition.h"
+#include "host_clock.h"
+#include "host_counters.h"
+#include <string.h>
+#include <map>
+#include <string>
+#include <vector>
+
+struct HostPartition {
+  esp_partition_t info;
+  std::vector<uint8_t> data;
+};
+
+static std::map<std::string, HostPartition>& partitions() {
+  static std::map<std::string, HostPartition>* all = new std::map<std::string, HostPartition>();
+  return *all;
+}
+
+static FlashLatency latency = {0, 0, 0};
+
+void hostSetFlashLatency(const FlashLatency& value) {
+  latency = value;
+}
+
+static HostPartition* lookup(const esp_partition_t* partition) {
+  auto found = partitions().find(partition->label);
+  return found == partitions().end() ? nullptr : &found->second;
+}
+
+esp_partition_t* hostAddPartition(const char* label, uint32_t size) {
+  HostPartition& partition = partitions()[label];
+  memset(&partition.info, 0, sizeof(partition.info));
+  partition.info.type = ESP_PARTITION_TYPE_DATA;
+  partition.info.subtype = 0x40;
+  partition.info.size = size;
+  strncpy(partition.info.label, label, sizeof(partition.info.label) - 1);
+  partition.data.assign(size, 0xFF);
+  return &partition.info;
+}
+
+uint8_t* hostPartitionData(const esp_partition_t* partition) {
+  HostPartition* host = lookup(partition);
+  return host ? host->data.data() : nullptr;
+}
+
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t, const char* label) {
+  auto found = label ? partitions().find(label) : partitions().end();
+  return found == partitions().end() || found->second.info.type != type ? nullptr : &found->second.info;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t* partition, size_t offset, void* dst, size_t size) {
+  HostPartition* host = lookup(partition);
+  if (!host || offset + size > host->data.size()) return ESP_ERR_INVALID_SIZE;
+  hostCounters.flashReads.fetch_add(1, std::memory_order_relaxed);
+  memcpy(dst, host->data.data() + offset, size);
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t* partition, size_t offset, const void* src, size_t size) {
+  HostPartition* host = lookup(partition);
+  if (!host || offset + size > host->data.size()) return ESP_ERR_INVALID_SIZE;
+  hostCounters.flashWrites.fetch_add(1, std::memory_order_relaxed);
+  hostClock::spendNs(latency.writeNs + (uint64_t)latency.writeByteNs * size);
+  const uint8_t* bytes = (const uint8_t*)src;
+  for (size_t i = 0; i < size; i++) {
+    host->data[offset + i] &= bytes[i];
+  }
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t* partition, size_t offset, size_t size) {
+  HostPartition* host = lookup(partition);
+  if (!host || offset % SPI_FLASH_SEC_SIZE || size % SPI_FLASH_SEC_SIZE) return ESP_ERR_INVALID_ARG;
+  if (offset + size > host->data.size()) return ESP_ERR_INVALID_SIZE;
+  hostCounters.flashErases.fetch_add(size / SPI_FLASH_SEC_SIZE, std::memory_order_relaxed);
+  hostClock::spendNs((uint64_t)latency.eraseNs * (size / SPI_FLASH_SEC_SIZE));
+  memset(host->data.data() + offset, 0xFF, size);
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_mmap(const esp_partition_t* partition, size_t offset, size_t size,
+                             spi_flash_mmap_memory_t, const void** out_ptr, spi_flash_mmap_handle_t* out_handle) {
+  HostPartition* host = lookup(partition);
+  if (!host || offset + size > host->data.size()) return ESP_ERR_INVALID_SIZE;
+  *out_ptr = host->data.data() + offset;
+  *out_handle = 1;
+  return ESP_OK;
+}
+
+void spi_flash_munmap(spi_flash_mmap_handle_t) {
+}
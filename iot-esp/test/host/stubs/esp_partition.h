@@ -0,0 +1,56 @@
+#pragma once
+
+// Host stand-in for the ESP-IDF partition API. Partitions are RAM buffers
+// created by the test with hostAddPartition(); writes only clear bits, as
+// on NOR flash, and an erase sets them again. Writes and erases cost the
+// time set with hostSetFlashLatency() (none by default).
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#define SPI_FLASH_SEC_SIZE 4096
+
+typedef enum {
+  ESP_PARTITION_TYPE_APP = 0x00,
+  ESP_PARTITION_TYPE_DATA = 0x01
+} esp_partition_type_t;
+
+typedef enum {
+  ESP_PARTITION_SUBTYPE_ANY = 0xff
+} esp_partition_subtype_t;
+
+typedef struct {
+  esp_partition_type_t type;
+  uint8_t subtype;
+  uint32_t address;
+  uint32_t size;
+  char label[17];
+  bool encrypted;
+} esp_partition_t;
+
+typedef uint32_t spi_flash_mmap_handle_t;
+typedef enum {
+  SPI_FLASH_MMAP_DATA,
+  SPI_FLASH_MMAP_INST
+} spi_flash_mmap_memory_t;
+
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char* label);
+esp_err_t esp_partition_read(const esp_partition_t* partition, size_t offset, void* dst, size_t size);
+esp_err_t esp_partition_write(const esp_partition_t* partition, size_t offset, const void* src, size_t size);
+esp_err_t esp_partition_erase_range(const esp_partition_t* partition, size_t offset, size_t size);
+esp_err_t esp_partition_mmap(const esp_partition_t* partition, size_t offset, size_t size,
+                             spi_flash_mmap_memory_t memory, const void** out_ptr, spi_flash_mmap_handle_t* out_handle);
+void spi_flash_munmap(spi_flash_mmap_handle_t handle);
+
+// Host controls
+esp_partition_t* hostAddPartition(const char* label, uint32_t size);
+uint8_t* hostPartitionData(const esp_partition_t* partition);
+
+struct FlashLatency {
+  uint32_t writeNs;      // per write call
+  uint32_t writeByteNs;  // per byte written
+  uint32_t eraseNs;      // per sector erased
+};
+
+void hostSetFlashLatency(const FlashLatency& latency);
@@ -0,0 +1,30 @@
+#include "esp_pm.h"
+
+struct HostPmLock {
+  esp_pm_lock_type_t type;
+  int held;
+};
+
+esp_err_t esp_pm_configure(const void* config) {
+  const esp_pm_config_esp32_t* pm = static_cast<const esp_pm_config_esp32_t*>(config);
+  if (!pm || pm->min_freq_mhz > pm->max_freq_mhz) return ESP_ERR_INVALID_ARG;
+  return pm->light_sleep_enable ? ESP_ERR_NOT_SUPPORTED : ESP_OK;
+}
+
+esp_err_t esp_pm_lock_create(esp_pm_lock_type_t type, int, const char*, esp_pm_lock_handle_t* handle) {
+  if (!handle) return ESP_ERR_INVALID_ARG;
+  *handle = new HostPmLock{type, 0};
+  return ESP_OK;
+}
+
+esp_err_t esp_pm_lock_acquire(esp_pm_lock_handle_t handle) {
+  if (!handle) return ESP_ERR_INVALID_ARG;
+  handle->held++;
+  return ESP_OK;
+}
+
+esp_err_t esp_pm_lock_release(esp_pm_lock_handle_t handle) {
+  if (!handle || handle->held == 0) return ESP_ERR_INVALID_ARG;
+  handle->held--;
+  return ESP_OK;
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stdint.h>
+#include "host_clock.h"
+
+// Microseconds since boot, from the host clock
+inline int64_t esp_timer_get_time() {
+  return (int64_t)hostClock::nowUs();
+}
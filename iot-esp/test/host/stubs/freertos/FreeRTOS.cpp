@@ -0,0 +1,102 @@
+#include "FreeRTOS.h"
+#include "Arduino.h"
+#include "host_clock.h"
+#include "host_tasks.h"
+#include "host_gpio.h"
+#include <atomic>
+
+// What a TaskHandle_t points to
+struct HostTaskState {
+  std::atomic<uint32_t> notifications{0};
+  uint64_t timeoutAtUs = UINT64_MAX;
+  uint32_t stackDepth = 8192;
+};
+
+struct HostTaskStart {
+  TaskFunction_t body;
+  void* arg;
+  HostTaskState* state;
+};
+
+static thread_local HostTaskState* currentTask = nullptr;
+
+static void startTask(void* context) {
+  HostTaskStart start = *static_cast<HostTaskStart*>(context);
+  delete static_cast<HostTaskStart*>(context);
+  currentTask = start.state;
+  start.body(start.arg);
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t body, const char* name, uint32_t stackDepth, void* arg,
+                                   UBaseType_t, TaskHandle_t* handle, BaseType_t) {
+  // Never freed: handles outlive their tasks in the firmware's globals
+  HostTaskState* state = new HostTaskState();
+  state->stackDepth = stackDepth;
+  if (handle) *handle = state;
+  return hostTasks::create(startTask, new HostTaskStart{body, arg, state}, name) ? pdPASS : pdFAIL;
+}
+
+void vTaskDelay(TickType_t ticks) {
+  hostClock::sleepUs((uint64_t)ticks * 1000);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle() {
+  // The adopted loop task was not made by xTaskCreatePinnedToCore()
+  if (!currentTask) currentTask = new HostTaskState();
+  return currentTask;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) {
+  HostTaskState* state = static_cast<HostTaskState*>(task ? task : xTaskGetCurrentTaskHandle());
+  return state->stackDepth;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearCountOnExit, TickType_t ticks) {
+  HostTaskState* task = static_cast<HostTaskState*>(xTaskGetCurrentTaskHandle());
+  uint64_t deadlineUs = ticks == portMAX_DELAY ? UINT64_MAX : hostClock::nowUs() + (uint64_t)ticks * 1000;
+  if (task->timeoutAtUs < deadlineUs) deadlineUs = task->timeoutAtUs;
+  for (;;) {
+    hostGpio::poll();
+    HardwareSerial::pollReceive();
+    uint32_t count = task->notifications.load();
+    if (count > 0) {
+      if (clearCountOnExit) {
+        task->notifications -= count;
+      } else {
+        task->notifications--;
+      }
+      return count;
+    }
+    
+    uint64_t nowUs = hostClock::nowUs();
+    if (nowUs >= deadlineUs) return 0;
+    uint64_t wakeUs = nowUs + 1000;
+    uint64_t edgeUs = hostGpio::nextChangeUs();
+    if (edgeUs < wakeUs) wakeUs = edgeUs > nowUs ? edgeUs : nowUs + 1;
+    if (deadlineUs < wakeUs) wakeUs = deadlineUs;
+    hostClock::sleepUs(wakeUs - nowUs);
+  }
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+  static_cast<HostTaskState*>(task)->notifications++;
+  return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t* higherPriorityTaskWoken) {
+  static_cast<HostTaskState*>(task)->notifications++;
+  if (higherPriorityTaskWoken) *higherPriorityTaskWoken = pdFALSE;
+}
+
+void hostTaskTimeoutAt(TaskHandle_t task, uint64_t atUs) {
+  static_cast<HostTaskState*>(task)->timeoutAtUs = atUs;
+}
+
+void vPortEnterCritical(portMUX_TYPE* mux) {
+  while (__atomic_exchange_n(&mux->locked, 1, __ATOMIC_ACQUIRE)) {
+  }
+}
+
+void vPortExitCritical(portMUX_TYPE* mux) {
+  __atomic_store_n(&mux->locked, 0, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+// The slice of the FreeRTOS task API the firmware uses, on top of
+// hostTasks. One tick is one millisecond, as in the Arduino-ESP32 build.
+
+#include <stdint.h>
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+typedef void (*TaskFunction_t)(void*);
+typedef void* TaskHandle_t;
+
+#define pdPASS 1
+#define pdFAIL 0
+#define pdTRUE 1
+#define pdFALSE 0
+#define portMAX_DELAY 0xFFFFFFFF
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t body, const char* name, uint32_t stackDepth, void* arg,
+                                   UBaseType_t priority, TaskHandle_t* handle, BaseType_t core);
+void vTaskDelay(TickType_t ticks);
+TaskHandle_t xTaskGetCurrentTaskHandle();
+// Host tasks run on thread stacks, so nothing is ever used: the depth the
+// task was created with (the Arduino loop stack for the adopted loop task)
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task);
+
+// Direct-to-task notifications as a counting semaphore. A task waiting in
+// ulTaskNotifyTake() also runs due GPIO interrupts (host_gpio.h), which is
+// how a handler gets to notify it; a notify from another task is seen within
+// a millisecond, as are bytes arriving on a port with an onReceive()
+// callback.
+uint32_t ulTaskNotifyTake(BaseType_t clearCountOnExit, TickType_t ticks);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t* higherPriorityTaskWoken);
+#define portYIELD_FROM_ISR(...) do {} while (0)
+// Host side: a wait of task in ulTaskNotifyTake() times out by atUs at the
+// latest, so a simulation gets control back while the firmware sleeps
+void hostTaskTimeoutAt(TaskHandle_t task, uint64_t atUs);
+
+// Spinlock critical sections. Simulated tasks never switch inside one, but
+// benchmarks run tasks as real threads, so the lock is real.
+typedef struct {
+  volatile int locked;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED {0}
+
+void vPortEnterCritical(portMUX_TYPE* mux);
+void vPortExitCritical(portMUX_TYPE* mux);
+#define portENTER_CRITICAL(mux) vPortEnterCritical(mux)
+#define portEXIT_CRITICAL(mux) vPortExitCritical(mux)
@@ -0,0 +1,67 @@
+#include "host_clock.h"
+#include "host_tasks.h"
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+static const std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+static std::atomic<bool> virtualMode(false);
+static std::atomic<uint64_t> virtualNs(0);
+
+static uint64_t realNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - started).count();
+}
+
+// A simulated task hands the clock to whichever task is due next; anything
+// else just moves it
+static void waitVirtual(uint64_t ns) {
+  if (!hostTasks::waitNs(ns)) {
+    virtualNs.fetch_add(ns);
+  }
+}
+
+uint64_t hostClock::nowUs() {
+  return nowNs() / 1000;
+}
+
+uint64_t hostClock::nowNs() {
+  return virtualMode.load() ? virtualNs.load() : realNs();
+}
+
+void hostClock::sleepUs(uint64_t us) {
+  if (virtualMode.load()) {
+    waitVirtual(us * 1000);
+  } else {
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+  }
+}
+
+void hostClock::spendNs(uint64_t ns) {
+  if (ns == 0) return;
+  if (virtualMode.load()) {
+    waitVirtual(ns);
+    return;
+  }
+  uint64_t until = realNs() + ns;
+  while (realNs() < until) {
+  }
+}
+
+void hostClock::useVirtual(bool enabled, uint64_t startUs) {
+  virtualNs.store(startUs * 1000);
+  virtualMode.store(enabled);
+}
+
+bool hostClock::isVirtual() {
+  return virtualMode.load();
+}
+
+void hostClock::advanceUs(uint64_t us) {
+  virtualNs.fetch_add(us * 1000);
+}
+
+void hostClock::advanceToNs(uint64_t ns) {
+  uint64_t now = virtualNs.load();
+  while (now < ns && !virtualNs.compare_exchange_weak(now, ns)) {
+  }
+}
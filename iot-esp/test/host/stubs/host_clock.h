@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdint.h>
+
+// Time source behind millis()/micros()/delay() on the host. By default it
+// follows the monotonic host clock; in virtual mode time only moves when a
+// driver advances it or a simulated task waits (see host_tasks.h), so
+// simulations and replays are deterministic.
+namespace hostClock {
+  uint64_t nowUs();
+  uint64_t nowNs();
+  void sleepUs(uint64_t us);
+  // Simulated hardware cost: spins in real mode, advances in virtual mode
+  void spendNs(uint64_t ns);
+  
+  void useVirtual(bool enabled, uint64_t startUs = 0);
+  bool isVirtual();
+  void advanceUs(uint64_t us);
+  // Moves virtual time forward to ns; never backwards
+  void advanceToNs(uint64_t ns);
+}
@@ -0,0 +1,88 @@
+#include "host_counters.h"
+#include "esp_heap_caps.h"
+#include <stddef.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+HostCounters hostCounters = {};
+
+HostCounterSnapshot snapshotHostCounters() {
+  return {hostCounters.allocations.load(), hostCounters.allocatedBytes.load(), hostCounters.frees.load(),
+          hostCounters.flashReads.load(), hostCounters.flashWrites.load(), hostCounters.flashErases.load()};
+}
+
+#ifdef __GLIBC__
+// Interpose the allocator; glibc exports its own implementation under the
+// __libc_ names, and operator new ends up here as well
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* pointer, size_t size);
+void __libc_free(void* pointer);
+
+static void callHook(void* pointer, size_t size) {
+  if (pointer && esp_heap_trace_alloc_hook) {
+    esp_heap_trace_alloc_hook(pointer, size, MALLOC_CAP_8BIT);
+  }
+}
+
+static void countLive(void* pointer, bool allocated) {
+  if (!pointer) return;
+  size_t size = malloc_usable_size(pointer);
+  if (allocated) {
+    hostCounters.liveBytes.fetch_add(size, std::memory_order_relaxed);
+  } else {
+    hostCounters.liveBytes.fetch_sub(size, std::memory_order_relaxed);
+  }
+}
+
+void* malloc(size_t size) {
+  hostCounters.allocations.fetch_add(1, std::memory_order_relaxed);
+  hostCounters.allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+  void* pointer = __libc_malloc(size);
+  countLive(pointer, true);
+  callHook(pointer, size);
+  return pointer;
+}
+
+void* calloc(size_t count, size_t size) {
+  hostCounters.allocations.fetch_add(1, std::memory_order_relaxed);
+  hostCounters.allocatedBytes.fetch_add(count * size, std::memory_order_relaxed);
+  void* pointer = __libc_calloc(count, size);
+  countLive(pointer, true);
+  callHook(pointer, count * size);
+  return pointer;
+}
+
+void* realloc(void* pointer, size_t size) {
+  hostCounters.allocations.fetch_add(1, std::memory_order_relaxed);
+  hostCounters.allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+  countLive(pointer, false);
+  void* moved = __libc_realloc(pointer, size);
+  if (moved) {
+    countLive(moved, true);
+    callHook(moved, size);
+  } else if (size > 0) {
+    countLive(pointer, true);  // failed, the old block is still live
+  }
+  return moved;
+}
+
+void free(void* pointer) {
+  if (pointer) {
+    hostCounters.frees.fetch_add(1, std::memory_order_relaxed);
+  }
+  countLive(pointer, false);
+  __libc_free(pointer);
+}
+}
+
+bool hostAllocationsCounted() {
+  return true;
+}
+#else
+bool hostAllocationsCounted() {
+  return false;
+}
+#endif
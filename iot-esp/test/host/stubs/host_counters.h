@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+// Process-wide counters the benchmarks and simulators read: heap
+// allocations (every malloc/calloc/realloc, which includes operator new)
+// and the simulated flash operations of the Preferences stand-in.
+struct HostCounters {
+  std::atomic<uint64_t> allocations;
+  std::atomic<uint64_t> allocatedBytes;
+  std::atomic<uint64_t> frees;
+  std::atomic<uint64_t> liveBytes;  // allocated and not yet freed
+  std::atomic<uint64_t> flashReads;
+  std::atomic<uint64_t> flashWrites;
+  std::atomic<uint64_t> flashErases;
+};
+
+struct HostCounterSnapshot {
+  uint64_t allocations;
+  uint64_t allocatedBytes;
+  uint64_t frees;
+  uint64_t flashReads;
+  uint64_t flashWrites;
+  uint64_t flashErases;
+  
+  HostCounterSnapshot operator-(const HostCounterSnapshot& start) const {
+    return {allocations - start.allocations, allocatedBytes - start.allocatedBytes, frees - start.frees,
+            flashReads - start.flashReads, flashWrites - start.flashWrites, flashErases - start.flashErases};
+  }
+};
+
+extern HostCounters hostCounters;
+
+HostCounterSnapshot snapshotHostCounters();
+// False when the C library could not be interposed (allocations read 0)
+bool hostAllocationsCounted();
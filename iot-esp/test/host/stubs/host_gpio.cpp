@@ -0,0 +1,69 @@
+#include "host_gpio.h"
+#include "Arduino.h"
+#include "host_clock.h"
+
+struct HostPin {
+  uint8_t mode;
+  uint8_t level;
+  void (*handler)();
+  int edge;
+  int lastLevel;
+};
+
+static HostPin pins[hostGpio::PINS];
+static hostGpio::Device device = {nullptr, nullptr, nullptr};
+
+void hostGpio::setDevice(const Device& wired) {
+  device = wired;
+}
+
+void hostGpio::setMode(uint8_t pin, uint8_t mode) {
+  if (pin < PINS) pins[pin].mode = mode;
+}
+
+void hostGpio::write(uint8_t pin, uint8_t level) {
+  if (pin < PINS) pins[pin].level = level ? HIGH : LOW;
+}
+
+int hostGpio::driven(uint8_t pin) {
+  if (pin >= PINS || pins[pin].mode != OUTPUT) return -1;
+  return pins[pin].level;
+}
+
+int hostGpio::read(uint8_t pin) {
+  if (pin >= PINS) return LOW;
+  if (device.level) {
+    int level = device.level(device.context, pin);
+    if (level >= 0) return level;
+  }
+  if (pins[pin].mode == OUTPUT) return pins[pin].level;
+  return pins[pin].mode == INPUT_PULLUP ? HIGH : LOW;
+}
+
+void hostGpio::attach(uint8_t pin, void (*handler)(), int mode) {
+  if (pin >= PINS) return;
+  pins[pin].handler = handler;
+  pins[pin].edge = mode;
+  pins[pin].lastLevel = read(pin);
+}
+
+void hostGpio::detach(uint8_t pin) {
+  if (pin < PINS) pins[pin].handler = nullptr;
+}
+
+void hostGpio::poll() {
+  for (uint8_t pin = 0; pin < PINS; pin++) {
+    HostPin& state = pins[pin];
+    if (!state.handler) continue;
+    int level = read(pin);
+    if (level == state.lastLevel) continue;
+    state.lastLevel = level;
+    if (state.edge == CHANGE || (state.edge == FALLING && level == LOW) || (state.edge == RISING && level == HIGH)) {
+      state.handler();
+    }
+  }
+}
+
+uint64_t hostGpio::nextChangeUs() {
+  return device.nextChangeUs ? device.nextChangeUs(device.context, hostClock::nowUs()) : UINT64_MAX;
+}
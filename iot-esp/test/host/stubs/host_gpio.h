@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+
+// GPIO on the host: pin modes and output levels as the firmware set them,
+// input levels from a simulated device, and the interrupts attached with
+// attachInterrupt(). Nothing runs on its own; waits that can be woken by an
+// interrupt (ulTaskNotifyTake) call poll() to run the handlers of edges
+// that are due, and sleep no further than nextChangeUs().
+namespace hostGpio {
+  static const uint8_t PINS = 40;
+  
+  // The device wired to the inputs: the level it puts on pin (given what the
+  // firmware drives), or -1 for a pin it does not touch, and the next time
+  // any of its levels can change
+  struct Device {
+    int (*level)(void* context, uint8_t pin);
+    uint64_t (*nextChangeUs)(void* context, uint64_t nowUs);
+    void* context;
+  };
+  void setDevice(const Device& device);
+  
+  void setMode(uint8_t pin, uint8_t mode);
+  void write(uint8_t pin, uint8_t level);
+  int read(uint8_t pin);
+  // What the firmware drives on pin: 0 or 1 for an output, -1 for an input
+  int driven(uint8_t pin);
+  
+  void attach(uint8_t pin, void (*handler)(), int mode);
+  void detach(uint8_t pin);
+  
+  // Runs the handlers of edges on attached pins since the last poll
+  void poll();
+  uint64_t nextChangeUs();
+}
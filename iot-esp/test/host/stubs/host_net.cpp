@@ -0,0 +1,98 @@
+#include "host_net.h"
+#include "host_clock.h"
+
+struct PendingMessage {
+  uint64_t atUs;
+  std::string topic;
+  std::string payload;
+};
+
+static HostNetParams netParams = {2000, 50, 40000, 5000, 500000, 5000};
+static bool link = true;
+static uint32_t epoch = 0;
+static uint64_t changedUs = 0;
+static HostHttpHandler httpHandler = nullptr;
+static void* httpContext = nullptr;
+static bool server = true;
+static std::deque<PendingMessage> inbound;
+static HostPublishObserver publishObserver = nullptr;
+static void* publishContext = nullptr;
+static uint32_t lost = 0;
+
+void hostNet::setParams(const HostNetParams& params) {
+  netParams = params;
+}
+
+const HostNetParams& hostNet::params() {
+  return netParams;
+}
+
+void hostNet::setLink(bool up) {
+  if (up == link) return;
+  link = up;
+  changedUs = hostClock::nowUs();
+  if (!up) epoch++;
+}
+
+bool hostNet::linkUp() {
+  return link;
+}
+
+uint32_t hostNet::linkEpoch() {
+  return epoch;
+}
+
+uint64_t hostNet::linkChangedUs() {
+  return changedUs;
+}
+
+void hostNet::setHttpHandler(HostHttpHandler handler, void* context) {
+  httpHandler = handler;
+  httpContext = context;
+}
+
+void hostNet::setServerUp(bool up) {
+  server = up;
+}
+
+bool hostNet::serverUp() {
+  return server && httpHandler;
+}
+
+HostHttpResponse hostNet::handleHttp(const HostHttpRequest& request) {
+  return httpHandler(httpContext, request);
+}
+
+void hostNet::deliverAt(uint64_t atUs, const char* topic, const char* payload) {
+  // Kept in time order; equal times keep the order they were sent in
+  auto at = inbound.end();
+  while (at != inbound.begin() && (at - 1)->atUs > atUs) {
+    --at;
+  }
+  inbound.insert(at, {atUs, topic, payload});
+}
+
+bool hostNet::takeDue(uint64_t nowUs, std::string& topic, std::string& payload) {
+  if (inbound.empty() || inbound.front().atUs > nowUs) return false;
+  topic = inbound.front().topic;
+  payload = inbound.front().payload;
+  inbound.pop_front();
+  return true;
+}
+
+void hostNet::setPublishObserver(HostPublishObserver observer, void* context) {
+  publishObserver = observer;
+  publishContext = context;
+}
+
+void hostNet::published(const std::string& topic, const std::string& payload) {
+  if (publishObserver) publishObserver(publishContext, topic, payload);
+}
+
+uint32_t hostNet::lostMessages() {
+  return lost;
+}
+
+void hostNet::countLost() {
+  lost++;
+}
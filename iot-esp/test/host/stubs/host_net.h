@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+#include <deque>
+#include <string>
+
+// Host side of the simulated network behind the WiFi, HTTPClient and
+// EspMQTTClient stand-ins: the WiFi link, the latency of the path to the
+// server, an HTTP handler playing the backend and a queue of messages the
+// broker will deliver. Everything is in simulated time (see host_clock.h).
+struct HostNetParams {
+  uint32_t wifiConnectMs;    // association plus DHCP after WiFi.begin()
+  uint32_t mqttConnectMs;    // broker CONNECT/CONNACK once WiFi is up
+  uint32_t rttUs;            // one round trip to the server
+  uint32_t serverUs;         // backend processing per request
+  uint32_t bytesPerSec;      // response body throughput
+  uint32_t keepAliveMs;      // server closes idle connections after this
+};
+
+struct HostHttpRequest {
+  std::string method;
+  std::string path;
+  std::string body;
+  std::string authorization;
+};
+
+struct HostHttpResponse {
+  int status;
+  std::string body;
+};
+
+typedef HostHttpResponse (*HostHttpHandler)(void* context, const HostHttpRequest& request);
+typedef void (*HostPublishObserver)(void* context, const std::string& topic, const std::string& payload);
+
+namespace hostNet {
+  void setParams(const HostNetParams& params);
+  const HostNetParams& params();
+  
+  // WiFi access point in range. Dropping it breaks every open connection.
+  void setLink(bool up);
+  bool linkUp();
+  uint32_t linkEpoch();
+  uint64_t linkChangedUs();
+  
+  // The backend; without a handler (or while it is down) connects time out
+  void setHttpHandler(HostHttpHandler handler, void* context);
+  void setServerUp(bool up);
+  bool serverUp();
+  HostHttpResponse handleHttp(const HostHttpRequest& request);
+  
+  // Broker side. Messages are delivered by the client's loop() once their
+  // time has come; a client that is not connected then never sees them.
+  void deliverAt(uint64_t atUs, const char* topic, const char* payload);
+  bool takeDue(uint64_t nowUs, std::string& topic, std::string& payload);
+  void setPublishObserver(HostPublishObserver observer, void* context);
+  void published(const std::string& topic, const std::string& payload);
+  uint32_t lostMessages();
+  void countLost();
+}
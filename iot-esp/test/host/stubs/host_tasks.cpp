@@ -0,0 +1,101 @@
+#include "host_tasks.h"
+#include "host_clock.h"
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct SimTask {
+  std::string name;
+  uint64_t wakeNs;
+  uint64_t order;  // ties on wakeNs go to whoever has waited longest
+  std::condition_variable turn;
+};
+
+// Leaked on purpose: blocked task threads still use them while the process
+// exits
+static std::mutex& kernelLock = *new std::mutex();
+static std::vector<SimTask*>& tasks = *new std::vector<SimTask*>();
+static SimTask* running = nullptr;
+static uint64_t nextOrder = 0;
+static thread_local SimTask* self = nullptr;
+
+static SimTask* dueTask() {
+  SimTask* due = nullptr;
+  for (SimTask* task : tasks) {
+    if (!due || task->wakeNs < due->wakeNs || (task->wakeNs == due->wakeNs && task->order < due->order)) {
+      due = task;
+    }
+  }
+  return due;
+}
+
+// Caller holds kernelLock and is the running task
+static void handOver(std::unique_lock<std::mutex>& guard) {
+  SimTask* next = dueTask();
+  hostClock::advanceToNs(next->wakeNs);
+  if (next == self) return;
+  
+  running = next;
+  next->turn.notify_one();
+  self->turn.wait(guard, [] { return running == self; });
+}
+
+void hostTasks::adoptThread(const char* name) {
+  std::lock_guard<std::mutex> guard(kernelLock);
+  self = new SimTask();
+  self->name = name;
+  self->wakeNs = hostClock::nowNs();
+  self->order = nextOrder++;
+  tasks.push_back(self);
+  running = self;
+}
+
+bool hostTasks::create(void (*body)(void*), void* arg, const char* name) {
+  if (!hostClock::isVirtual() || !self) {
+    std::thread(body, arg).detach();
+    return true;
+  }
+  
+  SimTask* task = new SimTask();
+  task->name = name;
+  {
+    std::lock_guard<std::mutex> guard(kernelLock);
+    task->wakeNs = hostClock::nowNs();
+    task->order = nextOrder++;
+    tasks.push_back(task);
+  }
+  
+  // The new task first runs when the creator next waits
+  std::thread([task, body, arg] {
+    {
+      std::unique_lock<std::mutex> guard(kernelLock);
+      self = task;
+      task->turn.wait(guard, [task] { return running == task; });
+    }
+    body(arg);
+    
+    std::unique_lock<std::mutex> guard(kernelLock);
+    tasks.erase(std::find(tasks.begin(), tasks.end(), task));
+    running = dueTask();
+    hostClock::advanceToNs(running->wakeNs);
+    running->turn.notify_one();
+  }).detach();
+  return true;
+}
+
+bool hostTasks::waitNs(uint64_t ns) {
+  if (!self || !hostClock::isVirtual()) return false;
+  
+  std::unique_lock<std::mutex> guard(kernelLock);
+  self->wakeNs = hostClock::nowNs() + ns;
+  self->order = nextOrder++;
+  handOver(guard);
+  return true;
+}
+
+const char* hostTasks::currentName() {
+  return self ? self->name.c_str() : nullptr;
+}
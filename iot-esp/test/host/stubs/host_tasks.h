@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdint.h>
+
+// FreeRTOS tasks on the host. In real-time mode every task is a plain
+// thread. Under the virtual clock the tasks take turns: exactly one runs at
+// a time, code between two waits takes no virtual time, and a task that
+// waits (delay, vTaskDelay or a simulated hardware cost) hands over to the
+// task that is due soonest. Each task behaves as if it had a core to
+// itself, and a run is the same every time.
+namespace hostTasks {
+  // Makes the calling thread a task; the simulator's main thread calls this
+  // before setup() so it plays the Arduino loop task
+  void adoptThread(const char* name);
+  bool create(void (*body)(void*), void* arg, const char* name);
+  
+  // Blocks the calling task for ns of virtual time while the others run.
+  // False when the caller is not a task or the clock is real.
+  bool waitNs(uint64_t ns);
+  // Name of the calling task, or nullptr
+  const char* currentName();
+}
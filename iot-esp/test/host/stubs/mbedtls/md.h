@@ -0,0 +1,37 @@
+#pragma once
+
+// Host stand-in for the HMAC part of the mbedtls message digest API
+#include <sha256.h>  // tools/sha256.h
+
+typedef enum {
+  MBEDTLS_MD_SHA256 = 6
+} mbedtls_md_type_t;
+
+typedef struct {
+  mbedtls_md_type_t type;
+} mbedtls_md_info_t;
+
+typedef struct {
+  HmacSha256* hmac;
+} mbedtls_md_context_t;
+
+inline const mbedtls_md_info_t* mbedtls_md_info_from_type(mbedtls_md_type_t type) {
+  static const mbedtls_md_info_t sha256 = {MBEDTLS_MD_SHA256};
+  return type == MBEDTLS_MD_SHA256 ? &sha256 : nullptr;
+}
+inline void mbedtls_md_init(mbedtls_md_context_t* ctx) { ctx->hmac = nullptr; }
+inline void mbedtls_md_free(mbedtls_md_context_t* ctx) { delete ctx->hmac; ctx->hmac = nullptr; }
+inline int mbedtls_md_setup(mbedtls_md_context_t*, const mbedtls_md_info_t* info, int) { return info ? 0 : -1; }
+inline int mbedtls_md_hmac_starts(mbedtls_md_context_t* ctx, const unsigned char* key, size_t length) {
+  delete ctx->hmac;
+  ctx->hmac = new HmacSha256(key, length);
+  return 0;
+}
+inline int mbedtls_md_hmac_update(mbedtls_md_context_t* ctx, const unsigned char* input, size_t length) {
+  ctx->hmac->update(input, length);
+  return 0;
+}
+inline int mbedtls_md_hmac_finish(mbedtls_md_context_t* ctx, unsigned char* output) {
+  ctx->hmac->finish(output);
+  return 0;
+}
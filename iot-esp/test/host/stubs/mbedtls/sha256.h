@@ -0,0 +1,26 @@
+#pragma once
+
+// Host stand-in for the mbedtls SHA-256 API, backed by the portable
+// implementation in tools/sha256.cpp
+#include <sha256.h>  // tools/sha256.h
+
+typedef struct {
+  Sha256 sha;
+} mbedtls_sha256_context;
+
+inline void mbedtls_sha256_init(mbedtls_sha256_context* ctx) { ctx->sha = Sha256(); }
+inline void mbedtls_sha256_free(mbedtls_sha256_context*) {}
+inline void mbedtls_sha256_clone(mbedtls_sha256_context* dst, const mbedtls_sha256_context* src) { *dst = *src; }
+inline int mbedtls_sha256_starts(mbedtls_sha256_context* ctx, int) { ctx->sha = Sha256(); return 0; }
+inline int mbedtls_sha256_update(mbedtls_sha256_context* ctx, const unsigned char* input, size_t length) {
+  ctx->sha.update(input, length);
+  return 0;
+}
+inline int mbedtls_sha256_finish(mbedtls_sha256_context* ctx, unsigned char output[32]) {
+  ctx->sha.finish(output);
+  return 0;
+}
+inline int mbedtls_sha256(const unsigned char* input, size_t length, unsigned char output[32], int) {
+  Sha256::hash(input, length, output);
+  return 0;
+}
@@ -0,0 +1,325 @@
+// Builds a signed credential image for the "authimg" partition from a user
+// export, and prints the header of an existing image.
+//
+//   credential_image_tool build [--key KEY] users.json credential.img
+//   credential_image_tool info [--key KEY] credential.img
+//
+// users.json is what the ESP32 sync downloads, i.e. the body of
+// GET /api/users/changes?since=0 (or /api/users):
+//   {"revision":42,"users":[{"name":"John","pin":"1234","nfc":"04A1B2C3","authType":1},...]}
+// KEY defaults to the CREDENTIAL_IMAGE_KEY the tool was built with and
+// must match the firmware's.
+//
+// Build on the host (from iot-esp/tools), with the firmware's key:
+//   g++ -std=c++17 -O2 -I../src -DCREDENTIAL_IMAGE_KEY='"..."' -o credential_image_tool \
+//       credential_image_tool.cpp sha256.cpp ../src/json_stream.cpp
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "credential_image_format.h"
+#include "json_stream.h"
+#include "sha256.h"
+
+#ifndef CREDENTIAL_IMAGE_KEY
+#error "CREDENTIAL_IMAGE_KEY is not set; build with the firmware's -DCREDENTIAL_IMAGE_KEY"
+#endif
+
+// AuthType in user_store.h
+static const uint8_t AUTH_PIN = 1;
+static const uint8_t AUTH_NFC = 2;
+static const uint8_t AUTH_COMBINED = 3;
+
+struct ExportUser {
+  std::string name;
+  std::string pin;
+  std::string nfc;
+  uint8_t authType;
+};
+
+// Collects {"revision":N,"users":[{...},...]} from the tokenizer
+struct ExportReader {
+  enum Field { NONE, REVISION, USERS, NAME, PIN, NFC, AUTH_TYPE };
+  
+  std::vector<ExportUser> users;
+  uint32_t revision = 0;
+  bool inUsers = false;
+  bool inUser = false;
+  Field field = NONE;
+  ExportUser current;
+  
+  static void onToken(void* context, JsonStreamParser::Event event, const char* text, uint8_t depth) {
+    static_cast<ExportReader*>(context)->handle(event, text, depth);
+  }
+  
+  void handle(JsonStreamParser::Event event, const char* text, uint8_t depth) {
+    if (!inUsers) {
+      if (depth != 1 && depth != 2) return;
+      if (event == JsonStreamParser::JSON_KEY && depth == 1) {
+        field = strcmp(text, "revision") == 0 ? REVISION : strcmp(text, "users") == 0 ? USERS : NONE;
+      } else if (event == JsonStreamParser::JSON_NUMBER && depth == 1 && field == REVISION) {
+        revision = strtoul(text, nullptr, 10);
+      } else if (event == JsonStreamParser::JSON_ARRAY_START && depth == 2 && field == USERS) {
+        inUsers = true;
+      }
+      return;
+    }
+    
+    if (!inUser) {
+      if (event == JsonStreamParser::JSON_OBJECT_START && depth == 3) {
+        current = ExportUser();
+        current.authType = 0;
+        inUser = true;
+        field = NONE;
+      } else if (event == JsonStreamParser::JSON_ARRAY_END && depth == 2) {
+        inUsers = false;
+        field = NONE;
+      }
+      return;
+    }
+    
+    if (depth != 3) return;
+    switch (event) {
+      case JsonStreamParser::JSON_KEY:
+        if (strcmp(text, "name") == 0) field = NAME;
+        else if (strcmp(text, "pin") == 0) field = PIN;
+        else if (strcmp(text, "nfc") == 0) field = NFC;
+        else if (strcmp(text, "authType") == 0) field = AUTH_TYPE;
+        else field = NONE;
+        break;
+      
+      case JsonStreamParser::JSON_STRING:
+      case JsonStreamParser::JSON_NUMBER:
+        if (field == NAME) current.name = text;
+        else if (field == PIN) current.pin = text;
+        else if (field == NFC) current.nfc = text;
+        else if (field == AUTH_TYPE) current.authType = atoi(text);
+        field = NONE;
+        break;
+      
+      case JsonStreamParser::JSON_OBJECT_END:
+        inUser = false;
+        users.push_back(current);
+        break;
+      
+      default:
+        field = NONE;
+        break;
+    }
+  }
+};
+
+// Same rules as UserStore::parseUid, so the device finds what it stores
+static uint8_t parseUid(const std::string& nfcId, uint8_t* uid) {
+  size_t length = nfcId.size();
+  if (length == 0 || length % 2 != 0 || length / 2 > CREDENTIAL_IMAGE_UID_LEN) {
+    return 0;
+  }
+  for (size_t i = 0; i < length; i++) {
+    if (!isxdigit((unsigned char)nfcId[i])) return 0;
+  }
+  
+  for (size_t i = 0; i < length; i += 2) {
+    char byteString[3] = {nfcId[i], nfcId[i + 1], '\0'};
+    uid[i / 2] = (uint8_t)strtol(byteString, NULL, 16);
+  }
+  return length / 2;
+}
+
+static bool readFile(const char* path, std::vector<uint8_t>& data) {
+  FILE* file = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+  if (!file) return false;
+  uint8_t chunk[4096];
+  size_t length;
+  while ((length = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+    data.insert(data.end(), chunk, chunk + length);
+  }
+  if (file != stdin) fclose(file);
+  return true;
+}
+
+static void sign(std::vector<uint8_t>& image, const std::string& key) {
+  CredentialImageHeader header;
+  memcpy(&header, image.data(), sizeof(header));
+  header.generation = 0;
+  memset(header.signature, 0, sizeof(header.signature));
+  
+  HmacSha256 mac(key.data(), key.size());
+  mac.update(&header, sizeof(header));
+  mac.update(image.data() + sizeof(header), image.size() - sizeof(header));
+  mac.finish(header.signature);
+  memcpy(image.data(), &header, sizeof(header));
+}
+
+static bool verify(const std::vector<uint8_t>& image, const std::string& key) {
+  std::vector<uint8_t> copy = image;
+  sign(copy, key);
+  return memcmp(copy.data() + offsetof(CredentialImageHeader, signature),
+                image.data() + offsetof(CredentialImageHeader, signature), CREDENTIAL_IMAGE_DIGEST_LEN) == 0;
+}
+
+static int build(const char* inputPath, const char* outputPath, const std::string& key) {
+  std::vector<uint8_t> input;
+  if (!readFile(inputPath, input)) {
+    fprintf(stderr, "Cannot read %s\n", inputPath);
+    return 1;
+  }
+  
+  ExportReader reader;
+  JsonStreamParser parser(ExportReader::onToken, &reader);
+  if (!parser.feed(input.data(), input.size()) || !parser.complete()) {
+    fprintf(stderr, "%s: malformed JSON at byte %u\n", inputPath, parser.bytesParsed());
+    return 1;
+  }
+  
+  std::vector<CredentialImageUser> users;
+  std::vector<CredentialImagePin> pins;
+  std::vector<CredentialImageNfc> nfcs;
+  for (const ExportUser& source : reader.users) {
+    CredentialImageUser user;
+    memset(&user, 0, sizeof(user));
+    strncpy(user.name, source.name.c_str(), sizeof(user.name) - 1);
+    user.nfcUidLen = parseUid(source.nfc, user.nfcUid);
+    if (!source.nfc.empty() && user.nfcUidLen == 0) {
+      fprintf(stderr, "%s: card ID \"%s\" is not a hex UID of up to %d bytes\n", user.name, source.nfc.c_str(), CREDENTIAL_IMAGE_UID_LEN);
+      return 1;
+    }
+    user.authType = source.authType;
+    if (user.authType < AUTH_PIN || user.authType > AUTH_COMBINED) {
+      user.authType = source.pin.empty() ? AUTH_NFC : AUTH_PIN;
+    }
+    if (source.pin.empty() && user.nfcUidLen == 0) {
+      fprintf(stderr, "Skipping %s: no credentials\n", user.name);
+      continue;
+    }
+    
+    uint16_t index = users.size();
+    users.push_back(user);
+    if (!source.pin.empty()) {
+      CredentialImagePin pin;
+      memset(&pin, 0, sizeof(pin));
+      Sha256::hash(source.pin.data(), source.pin.size(), pin.digest);
+      pin.user = index;
+      pins.push_back(pin);
+    }
+    if (user.nfcUidLen > 0) {
+      CredentialImageNfc nfc;
+      memset(&nfc, 0, sizeof(nfc));
+      memcpy(nfc.uid, user.nfcUid, user.nfcUidLen);
+      nfc.uidLen = user.nfcUidLen;
+      nfc.user = index;
+      nfcs.push_back(nfc);
+    }
+  }
+  if (users.size() > 0x7FFF) {
+    fprintf(stderr, "Too many users: %zu\n", users.size());
+    return 1;
+  }
+  
+  // Stable sorts keep the first user of a duplicate, which is then the only
+  // one kept: a binary search could not tell the two apart
+  std::stable_sort(pins.begin(), pins.end(), [](const CredentialImagePin& a, const CredentialImagePin& b) {
+    return memcmp(a.digest, b.digest, CREDENTIAL_IMAGE_DIGEST_LEN) < 0;
+  });
+  std::stable_sort(nfcs.begin(), nfcs.end(), [](const CredentialImageNfc& a, const CredentialImageNfc& b) {
+    return compareImageUid(a.uid, a.uidLen, b.uid, b.uidLen) < 0;
+  });
+  auto samePin = [&](const CredentialImagePin& a, const CredentialImagePin& b) {
+    if (memcmp(a.digest, b.digest, CREDENTIAL_IMAGE_DIGEST_LEN) != 0) return false;
+    fprintf(stderr, "Duplicate PIN: %s ignored, kept %s\n", users[b.user].name, users[a.user].name);
+    return true;
+  };
+  auto sameCard = [&](const CredentialImageNfc& a, const CredentialImageNfc& b) {
+    if (compareImageUid(a.uid, a.uidLen, b.uid, b.uidLen) != 0) return false;
+    fprintf(stderr, "Duplicate card: %s ignored, kept %s\n", users[b.user].name, users[a.user].name);
+    return true;
+  };
+  pins.erase(std::unique(pins.begin(), pins.end(), samePin), pins.end());
+  nfcs.erase(std::unique(nfcs.begin(), nfcs.end(), sameCard), nfcs.end());
+  
+  CredentialImageHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic = CREDENTIAL_IMAGE_MAGIC;
+  header.version = CREDENTIAL_IMAGE_VERSION;
+  header.headerSize = sizeof(header);
+  header.revision = reader.revision;
+  header.userCount = users.size();
+  header.pinCount = pins.size();
+  header.nfcCount = nfcs.size();
+  header.userOffset = sizeof(header);
+  header.pinOffset = header.userOffset + users.size() * sizeof(CredentialImageUser);
+  header.nfcOffset = header.pinOffset + pins.size() * sizeof(CredentialImagePin);
+  header.imageSize = header.nfcOffset + nfcs.size() * sizeof(CredentialImageNfc);
+  
+  std::vector<uint8_t> image(header.imageSize);
+  memcpy(image.data(), &header, sizeof(header));
+  memcpy(image.data() + header.userOffset, users.data(), users.size() * sizeof(CredentialImageUser));
+  memcpy(image.data() + header.pinOffset, pins.data(), pins.size() * sizeof(CredentialImagePin));
+  memcpy(image.data() + header.nfcOffset, nfcs.data(), nfcs.size() * sizeof(CredentialImageNfc));
+  sign(image, key);
+  
+  FILE* output = fopen(outputPath, "wb");
+  if (!output || fwrite(image.data(), 1, image.size(), output) != image.size()) {
+    fprintf(stderr, "Cannot write %s\n", outputPath);
+    if (output) fclose(output);
+    return 1;
+  }
+  fclose(output);
+  
+  printf("%s: revision %u, %zu users, %zu PINs, %zu cards, %zu bytes\n",
+         outputPath, reader.revision, users.size(), pins.size(), nfcs.size(), image.size());
+  return 0;
+}
+
+static int info(const char* path, const std::string& key) {
+  std::vector<uint8_t> image;
+  if (!readFile(path, image) || image.size() < sizeof(CredentialImageHeader)) {
+    fprintf(stderr, "Cannot read %s\n", path);
+    return 1;
+  }
+  
+  CredentialImageHeader header;
+  memcpy(&header, image.data(), sizeof(header));
+  if (!isImageLayoutValid(header, image.size()) || header.imageSize != image.size()) {
+    fprintf(stderr, "%s: not a credential image\n", path);
+    return 1;
+  }
+  
+  bool valid = verify(image, key);
+  printf("%s: version %u, revision %u, generation %u, %u users, %u PINs, %u cards, %u bytes, signature %s\n",
+         path, header.version, header.revision, header.generation, header.userCount,
+         header.pinCount, header.nfcCount, header.imageSize, valid ? "ok" : "INVALID");
+  return valid ? 0 : 1;
+}
+
+static int usage() {
+  fprintf(stderr, "usage: credential_image_tool build [--key KEY] users.json credential.img\n"
+                  "       credential_image_tool info [--key KEY] credential.img\n");
+  return 2;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2) return usage();
+  
+  std::string key = CREDENTIAL_IMAGE_KEY;
+  std::vector<const char*> paths;
+  for (int i = 2; i < argc; i++) {
+    if (strcmp(argv[i], "--key") == 0 && i + 1 < argc) {
+      key = argv[++i];
+    } else {
+      paths.push_back(argv[i]);
+    }
+  }
+  
+  if (strcmp(argv[1], "build") == 0 && paths.size() == 2) {
+    return build(paths[0], paths[1], key);
+  }
+  if (strcmp(argv[1], "info") == 0 && paths.size() == 1) {
+    return info(paths[0], key);
+  }
+  return usage();
+}
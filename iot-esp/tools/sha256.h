@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Small portable SHA-256 and HMAC-SHA256 for the host tools, matching what
+// the firmware computes with mbedtls
+class Sha256 {
+public:
+  static const size_t DIGEST_LEN = 32;
+  
+  Sha256();
+  void update(const void* data, size_t length);
+  void finish(uint8_t* digest);
+  
+  static void hash(const void* data, size_t length, uint8_t* digest);
+
+private:
+  uint32_t state[8];
+  uint64_t total;
+  uint8_t buffer[64];
+  
+  void block(const uint8_t* data);
+};
+
+class HmacSha256 {
+public:
+  HmacSha256(const void* key, size_t keyLength);
+  void update(const void* data, size_t length);
+  void finish(uint8_t* mac);
+
+private:
+  Sha256 inner;
+  uint8_t outerPad[64];
+};